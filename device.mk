@@ -44,7 +44,8 @@ PRODUCT_COPY_FILES += \
 # Audio
 PRODUCT_PACKAGES += \
     libtinyalsa \
-    audio.primary.fugu
+    audio.primary.fugu \
+    libatvpreprocessproxy
 
 USE_CUSTOM_AUDIO_POLICY := 1
 
@@ -52,6 +53,10 @@ USE_CUSTOM_AUDIO_POLICY := 1
 PRODUCT_COPY_FILES += \
     device/asus/fugu/audio_policy.conf:system/etc/audio_policy.conf
 
+# AGC/NS run in the audio HAL; these map the effects onto pass-through proxies
+PRODUCT_COPY_FILES += \
+    device/asus/fugu/audio_effects.conf:system/vendor/etc/audio_effects.conf
+
 # Hdmi CEC: Fugu works as a playback device (4).
 PRODUCT_PROPERTY_OVERRIDES += ro.hdmi.device_type=4
 
@@ -199,6 +204,9 @@ PRODUCT_PACKAGES += \
 PRODUCT_PACKAGES += \
     power.fugu
 
+PRODUCT_COPY_FILES += \
+    device/asus/fugu/power/power_profiles.conf:system/etc/power_profiles.conf
+
 # Debug rc files
 ifneq (,$(filter userdebug eng, $(TARGET_BUILD_VARIANT)))
 PRODUCT_COPY_FILES += \
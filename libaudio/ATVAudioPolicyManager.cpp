@@ -25,10 +25,7 @@
 
 #include "AudioHardwareOutput.h"
 #include "ATVAudioPolicyManager.h"
-
-#ifdef REMOTE_CONTROL_INTERFACE
-#include <IRemoteControlService.h>
-#endif
+#include "RemoteControlState.h"
 
 
 namespace android {
@@ -56,6 +53,9 @@ ATVAudioPolicyManager::ATVAudioPolicyManager(
         AudioPolicyClientInterface *clientInterface)
     : AudioPolicyManager(clientInterface), mForceSubmixInputSelection(false)
 {
+    // Connect to the RemoteControl service now if it is already up, rather
+    // than on the first voice search.
+    RemoteControlState::getInstance()->onConnectionChanged();
 }
 
 float ATVAudioPolicyManager::computeVolume(audio_stream_type_t stream,
@@ -91,6 +91,10 @@ status_t ATVAudioPolicyManager::setDeviceConnectionState(audio_devices_t device,
         }
     }
 
+    // Output routing is changed in one transaction per event.  The expected
+    // device set goes in first, so the HAL can get ready for it (HDMI caps)
+    // before the base class looks at the outputs; the streams are only
+    // retargeted at commit, against whatever the base class settled on.
     if (audio_is_output_device(device)) {
       switch (state) {
           case AUDIO_POLICY_DEVICE_STATE_AVAILABLE:
@@ -105,8 +109,13 @@ status_t ATVAudioPolicyManager::setDeviceConnectionState(audio_devices_t device,
               return BAD_VALUE;
       }
 
-      gAudioHardwareOutput.updateRouting(tmp);
+      gAudioHardwareOutput.beginRouting();
+      gAudioHardwareOutput.setRoutingDevices(tmp);
       tmp = mAvailableOutputDevices.types();
+
+      // The base class queries the sink's formats, channel masks and rates
+      // straight away; they have to be the new sink's, not an empty table.
+      gAudioHardwareOutput.waitForHDMICaps();
     }
 
     status_t ret = 0;
@@ -115,9 +124,17 @@ status_t ATVAudioPolicyManager::setDeviceConnectionState(audio_devices_t device,
                     device, state, device_address);
     }
 
+    // The remote's mic coming or going is the only notice we get that the
+    // remote itself has; pick up its new state while we are off the
+    // routing path.
+    if (device == AUDIO_DEVICE_IN_WIRED_HEADSET) {
+      RemoteControlState::getInstance()->onConnectionChanged();
+    }
+
     if (audio_is_output_device(device)) {
       if (tmp != mAvailableOutputDevices.types())
-          gAudioHardwareOutput.updateRouting(mAvailableOutputDevices.types());
+          gAudioHardwareOutput.setRoutingDevices(mAvailableOutputDevices.types());
+      gAudioHardwareOutput.commitRouting();
     }
 
     return ret;
@@ -130,12 +147,9 @@ audio_devices_t ATVAudioPolicyManager::getDeviceForInputSource(audio_source_t in
 
     if (inputSource == AUDIO_SOURCE_VOICE_RECOGNITION) {
 #ifdef REMOTE_CONTROL_INTERFACE
-      // Check if remote is actually connected or we should move on
-      sp<IRemoteControlService> service = IRemoteControlService::getInstance();
-      if (service == NULL) {
-          ALOGV("getDeviceForInputSource No RemoteControl service detected, ignoring");
-          usePhysRemote = false;
-      } else if (!service->hasActiveRemote()) {
+      // Check if remote is actually connected or we should move on.  This
+      // is the cached state; no binder call is made here.
+      if (!RemoteControlState::getInstance()->hasActiveRemote()) {
           ALOGV("getDeviceForInputSource No active connected device, passing onto submix");
           usePhysRemote = false;
       }
@@ -0,0 +1,300 @@
+/*
+**
+** Copyright 2014, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#define LOG_TAG "AudioHAL:AVSyncEstimator"
+
+#include <utils/Log.h>
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <drm/drm.h>
+#include <linux/psb_drm.h>
+
+#include "AVSyncEstimator.h"
+
+namespace android {
+
+/*
+ * PSB DRM vsync source
+ */
+
+// Created by ueventd; see ueventd.fugu.rc.
+const char* PSBVsyncSource::kDRMDevicePath = "/dev/dri/card0";
+
+PSBVsyncSource::PSBVsyncSource(int pipe)
+    : mPipe(pipe)
+    , mEnabled(false)
+{
+    mFD = open(kDRMDevicePath, O_RDWR);
+    if (mFD < 0)
+        ALOGE("%s: failed to open %s (%s)", __func__, kDRMDevicePath, strerror(errno));
+}
+
+PSBVsyncSource::~PSBVsyncSource()
+{
+    if (mFD >= 0) {
+        if (mEnabled)
+            vsyncOp(VSYNC_DISABLE, NULL);
+        close(mFD);
+    }
+}
+
+status_t PSBVsyncSource::vsyncOp(uint32_t op, nsecs_t* timestamp)
+{
+    struct drm_psb_vsync_set_arg arg;
+
+    memset(&arg, 0, sizeof(arg));
+    arg.vsync_operation_mask = op;
+    arg.vsync.pipe = mPipe;
+
+    if (ioctl(mFD, DRM_IOWR(DRM_COMMAND_BASE + DRM_PSB_VSYNC_SET,
+                            struct drm_psb_vsync_set_arg), &arg) < 0)
+        return -errno;
+
+    if (timestamp != NULL)
+        *timestamp = static_cast<nsecs_t>(arg.vsync.timestamp);
+    return OK;
+}
+
+status_t PSBVsyncSource::initCheck()
+{
+    return (mFD >= 0) ? OK : NO_INIT;
+}
+
+status_t PSBVsyncSource::waitForVsync(nsecs_t* timestamp)
+{
+    if (mFD < 0)
+        return NO_INIT;
+
+    // The driver only delivers vsync interrupts for pipes they have been
+    // enabled on; without this VSYNC_WAIT just times out.  Retried on every
+    // wait until it works, since the pipe may be off when we start.
+    if (!mEnabled) {
+        status_t res = vsyncOp(VSYNC_ENABLE, NULL);
+        if (res != OK) {
+            ALOGW("%s: unable to enable vsync on pipe %d (%d)", __func__,
+                  mPipe, res);
+            return res;
+        }
+        mEnabled = true;
+    }
+
+    return vsyncOp(VSYNC_WAIT, timestamp);
+}
+
+/*
+ * Estimator
+ */
+
+const uint32_t AVSyncEstimator::kMinVsyncs = 16;
+const uint32_t AVSyncEstimator::kMinAudioSamples = 8;
+const int      AVSyncEstimator::kPeriodShift = 4;
+const int      AVSyncEstimator::kWaitShift = 4;
+const nsecs_t  AVSyncEstimator::kMinPeriod = 8333333;   // 120Hz
+const nsecs_t  AVSyncEstimator::kMaxPeriod = 41708333;  // 23.976Hz
+const nsecs_t  AVSyncEstimator::kStaleTimeout = 500000000;
+
+AVSyncEstimator::AVSyncEstimator()
+    : mLastVsync(0)
+    , mPeriod(0)
+    , mAvgWait(0)
+    , mVsyncCount(0)
+    , mAudioCount(0)
+    , mMissedVsyncs(0)
+    , mPipelineDepth(0)
+{
+}
+
+AVSyncEstimator::~AVSyncEstimator()
+{
+    stop();
+}
+
+status_t AVSyncEstimator::start(const sp<VsyncSource>& source)
+{
+    Mutex::Autolock _l(mLock);
+
+    if (mThread != NULL)
+        return OK;
+
+    if ((source == NULL) || (source->initCheck() != OK))
+        return NO_INIT;
+
+    mThread = new VsyncThread(*this, source);
+    status_t res = mThread->run("ATVVsyncEst", PRIORITY_AUDIO);
+    if (res != OK)
+        mThread.clear();
+
+    return res;
+}
+
+void AVSyncEstimator::stop()
+{
+    sp<VsyncThread> thread;
+
+    {
+        Mutex::Autolock _l(mLock);
+        thread = mThread;
+        mThread.clear();
+        mVsyncCount = 0;
+        mAudioCount = 0;
+    }
+
+    // The thread may be blocked in the vsync wait for up to a frame.
+    if (thread != NULL)
+        thread->requestExitAndWait();
+}
+
+void AVSyncEstimator::setPipelineDepth(uint32_t frames)
+{
+    Mutex::Autolock _l(mLock);
+    mPipelineDepth = frames;
+}
+
+void AVSyncEstimator::onVsync(nsecs_t timestamp)
+{
+    Mutex::Autolock _l(mLock);
+
+    if (mVsyncCount && (timestamp > mLastVsync)) {
+        nsecs_t interval = timestamp - mLastVsync;
+
+        // If we slept through one or more vsyncs, divide the interval back
+        // down to a single period before folding it into the estimate.
+        if (mPeriod && (interval > (mPeriod + (mPeriod >> 1)))) {
+            nsecs_t n = (interval + (mPeriod >> 1)) / mPeriod;
+            mMissedVsyncs += static_cast<uint32_t>(n - 1);
+            interval /= n;
+        }
+
+        if ((interval >= kMinPeriod) && (interval <= kMaxPeriod)) {
+            if (!mPeriod)
+                mPeriod = interval;
+            else
+                mPeriod += (interval - mPeriod) >> kPeriodShift;
+        }
+    }
+
+    mLastVsync = timestamp;
+    mVsyncCount++;
+}
+
+void AVSyncEstimator::onAudioPresented(const struct timespec& timestamp)
+{
+    nsecs_t t = (static_cast<nsecs_t>(timestamp.tv_sec) * 1000000000LL) +
+                timestamp.tv_nsec;
+    Mutex::Autolock _l(mLock);
+
+    if ((mVsyncCount < kMinVsyncs) || !mPeriod)
+        return;
+
+    // How long would a video frame released at this point on the audio
+    // timeline wait for the next vsync?
+    nsecs_t phase = (t - mLastVsync) % mPeriod;
+    if (phase < 0)
+        phase += mPeriod;
+    nsecs_t wait = mPeriod - phase;
+
+    if (!mAudioCount) {
+        mAvgWait = wait;
+    } else {
+        // The wait is a phase, so average it as one: take the shorter way
+        // round the vsync period to the new sample and keep the result in
+        // (0, period].  Otherwise audio jittering across the vsync would
+        // average waits of ~0 and ~period out to half a period.
+        nsecs_t delta = wait - mAvgWait;
+        if (delta > (mPeriod >> 1))
+            delta -= mPeriod;
+        else if (delta < -(mPeriod >> 1))
+            delta += mPeriod;
+
+        mAvgWait += delta >> kWaitShift;
+        if (mAvgWait <= 0)
+            mAvgWait += mPeriod;
+        else if (mAvgWait > mPeriod)
+            mAvgWait -= mPeriod;
+    }
+
+    mAudioCount++;
+}
+
+bool AVSyncEstimator::getVideoDelayUsec(uint32_t* delayUsec)
+{
+    Mutex::Autolock _l(mLock);
+
+    if ((mVsyncCount < kMinVsyncs) || (mAudioCount < kMinAudioSamples))
+        return false;
+
+    // Don't trust an estimate based on a vsync stream which has stopped (eg.
+    // the display was turned off or the source failed).
+    if ((systemTime() - mLastVsync) > kStaleTimeout)
+        return false;
+
+    nsecs_t delay = mAvgWait + (mPeriod * mPipelineDepth);
+    *delayUsec = static_cast<uint32_t>(ns2us(delay));
+    return true;
+}
+
+void AVSyncEstimator::dump(String8& result)
+{
+    uint32_t delay = 0;
+    bool valid = getVideoDelayUsec(&delay);
+    Mutex::Autolock _l(mLock);
+
+    result.appendFormat("\tAV Sync Estimator\n");
+    result.appendFormat("\t\tRunning           : %s\n",
+                        (mThread != NULL) ? "true" : "false");
+    result.appendFormat("\t\tVsync Period      : %lld uSec\n",
+                        static_cast<long long>(ns2us(mPeriod)));
+    result.appendFormat("\t\tVsyncs Observed   : %u (%u missed)\n",
+                        mVsyncCount, mMissedVsyncs);
+    result.appendFormat("\t\tAudio Samples     : %u\n", mAudioCount);
+    result.appendFormat("\t\tAvg Vsync Wait    : %lld uSec\n",
+                        static_cast<long long>(ns2us(mAvgWait)));
+    result.appendFormat("\t\tPipeline Depth    : %u frames\n", mPipelineDepth);
+    if (valid)
+        result.appendFormat("\t\tVideo Delay Est   : %u uSec\n", delay);
+    else
+        result.appendFormat("\t\tVideo Delay Est   : (not valid)\n");
+}
+
+bool AVSyncEstimator::VsyncThread::threadLoop()
+{
+    static const uint32_t kMaxErrors = 10;
+    nsecs_t timestamp;
+
+    if (mSource->waitForVsync(&timestamp) == OK) {
+        mErrorCount = 0;
+        mOwner.onVsync(timestamp);
+        return true;
+    }
+
+    // Back off and retry on error (the display pipe may be off); give up for
+    // good if the source keeps failing.
+    if (++mErrorCount >= kMaxErrors) {
+        ALOGW("%s: vsync source failed %u times in a row, giving up",
+              __func__, mErrorCount);
+        return false;
+    }
+
+    usleep(100000);
+    return true;
+}
+
+}  // namespace android
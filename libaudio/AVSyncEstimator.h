@@ -0,0 +1,131 @@
+/*
+**
+** Copyright 2014, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#ifndef ANDROID_AV_SYNC_ESTIMATOR_H
+#define ANDROID_AV_SYNC_ESTIMATOR_H
+
+#include <stdint.h>
+#include <time.h>
+
+#include <utils/Errors.h>
+#include <utils/RefBase.h>
+#include <utils/String8.h>
+#include <utils/threads.h>
+#include <utils/Timers.h>
+
+namespace android {
+
+// Source of display vsync events.  Timestamps are CLOCK_MONOTONIC, the same
+// clock used for audio presentation timestamps (see PCM_MONOTONIC in
+// AudioOutput::openPCMDevice).
+class VsyncSource : public RefBase {
+  public:
+    virtual ~VsyncSource() {}
+    virtual status_t initCheck() = 0;
+    // Block until the next vsync and report when it happened.
+    virtual status_t waitForVsync(nsecs_t* timestamp) = 0;
+};
+
+// Vsync source backed by the PSB DRM driver's DRM_PSB_VSYNC_SET ioctl.
+// Vsync interrupts are enabled on the pipe for as long as the source is
+// waiting on them, and disabled again when it is destroyed.
+class PSBVsyncSource : public VsyncSource {
+  public:
+    explicit PSBVsyncSource(int pipe);
+    virtual ~PSBVsyncSource();
+    virtual status_t initCheck();
+    virtual status_t waitForVsync(nsecs_t* timestamp);
+
+  private:
+    static const char* kDRMDevicePath;
+    status_t vsyncOp(uint32_t op, nsecs_t* timestamp);
+    int mFD;
+    int mPipe;
+    bool mEnabled;
+};
+
+// Estimates how late video reaches the display relative to the audio
+// presentation timeline.
+//
+// A video frame which AV sync releases for a given audio presentation time is
+// not displayed until the next vsync (plus whatever the composition pipeline
+// adds).  The estimator tracks the actual vsync period and phase, and the
+// phase of the audio presentation timeline against it, and produces the
+// expected video delay which the HAL would otherwise assume to be a constant
+// (see Settings::videoDelayCompUsec).
+//
+// Vsync events may either come from a VsyncSource (start() spins up a thread
+// to pump it) or be pushed directly through onVsync(), which allows the
+// estimator to be driven by a simulated source.
+class AVSyncEstimator : public RefBase {
+  public:
+    AVSyncEstimator();
+    virtual ~AVSyncEstimator();
+
+    status_t start(const sp<VsyncSource>& source);
+    void     stop();
+
+    void     onVsync(nsecs_t timestamp);
+    void     onAudioPresented(const struct timespec& timestamp);
+
+    // Number of display frames the composition pipeline is expected to add
+    // on top of the wait for the next vsync.
+    void     setPipelineDepth(uint32_t frames);
+
+    // Returns true and the estimated video delay if the estimate is usable.
+    bool     getVideoDelayUsec(uint32_t* delayUsec);
+    void     dump(String8& result);
+
+  private:
+    class VsyncThread : public Thread {
+      public:
+        VsyncThread(AVSyncEstimator& owner, const sp<VsyncSource>& source)
+            : Thread(false), mOwner(owner), mSource(source), mErrorCount(0) {}
+      private:
+        virtual bool threadLoop();
+        AVSyncEstimator&  mOwner;
+        sp<VsyncSource>   mSource;
+        uint32_t          mErrorCount;
+    };
+
+    // Number of vsyncs and audio observations required before the estimate
+    // is considered valid.
+    static const uint32_t kMinVsyncs;
+    static const uint32_t kMinAudioSamples;
+    // Smoothing factors, expressed as a shift (alpha = 1 / (1 << shift)).
+    static const int      kPeriodShift;
+    static const int      kWaitShift;
+    // Vsync periods outside of this range (24Hz - 120Hz) are ignored.
+    static const nsecs_t  kMinPeriod;
+    static const nsecs_t  kMaxPeriod;
+    // Estimates older than this are considered stale.
+    static const nsecs_t  kStaleTimeout;
+
+    Mutex             mLock;
+    sp<VsyncThread>   mThread;
+
+    nsecs_t           mLastVsync;
+    nsecs_t           mPeriod;
+    nsecs_t           mAvgWait;
+    uint32_t          mVsyncCount;
+    uint32_t          mAudioCount;
+    uint32_t          mMissedVsyncs;
+    uint32_t          mPipelineDepth;
+};
+
+}  // namespace android
+#endif  // ANDROID_AV_SYNC_ESTIMATOR_H
@@ -20,17 +20,30 @@ LOCAL_PATH := $(call my-dir)
 include $(CLEAR_VARS)
 
 LOCAL_SRC_FILES := \
+    alsa_caps_mixer.cpp \
     alsa_utils.cpp \
+    edid_parser.cpp \
     AudioHardwareOutput.cpp \
     AudioOutput.cpp \
     AudioStreamOut.cpp \
     HDMIAudioOutput.cpp \
     AudioHardwareInput.cpp \
     AudioStreamIn.cpp \
-    AudioHotplugThread.cpp
+    AudioHotplugThread.cpp \
+    AVSyncEstimator.cpp \
+    CaptureDSP.cpp \
+    CaptureEngine.cpp \
+    CaptureRing.cpp \
+    HALStateWriter.cpp \
+    RemoteControlState.cpp \
+    SilenceClock.cpp \
+    SoundUevent.cpp
 
 LOCAL_C_INCLUDES := \
     external/tinyalsa/include \
+    external/libdrm/include/drm \
+    $(LOCAL_PATH)/../kernel-headers \
+    $(call include-path-for, audio-effects) \
     $(call include-path-for, audio-utils)
 
 LOCAL_SHARED_LIBRARIES := \
@@ -125,3 +138,26 @@ LOCAL_MODULE := libaudiopolicymanager
 LOCAL_MODULE_TAGS := optional
 
 include $(BUILD_SHARED_LIBRARY)
+
+##################################
+# Pre-processing effect proxies
+##################################
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := \
+    atv_preprocess_proxy.c
+
+LOCAL_C_INCLUDES := \
+    $(call include-path-for, audio-effects)
+
+LOCAL_SHARED_LIBRARIES := \
+    libcutils \
+    liblog
+
+LOCAL_MODULE := libatvpreprocessproxy
+LOCAL_MODULE_RELATIVE_PATH := soundfx
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_SHARED_LIBRARY)
+
+include $(call all-makefiles-under,$(LOCAL_PATH))
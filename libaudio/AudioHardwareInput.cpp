@@ -29,6 +29,8 @@
 #include "AudioHardwareInput.h"
 #include "AudioHotplugThread.h"
 #include "AudioStreamIn.h"
+#include "HALStateWriter.h"
+#include "RemoteControlState.h"
 
 namespace android {
 
@@ -37,6 +39,7 @@ AudioHardwareInput gAudioHardwareInput;
 
 AudioHardwareInput::AudioHardwareInput()
     : mMicMute(false)
+    , mDevices(new DeviceSet())
 {
     mHotplugThread = new AudioHotplugThread(*this);
     if (mHotplugThread == NULL) {
@@ -47,10 +50,6 @@ AudioHardwareInput::AudioHardwareInput()
               "Pluggable audio input devices will not function.");
         mHotplugThread.clear();
     }
-
-    for (int i=0; i<kMaxDevices; i++) {
-        mDeviceInfos[i].valid = false;
-    }
 }
 
 AudioHardwareInput::~AudioHardwareInput()
@@ -63,6 +62,18 @@ AudioHardwareInput::~AudioHardwareInput()
     closeAllInputStreams();
 }
 
+void AudioHardwareInput::addHotplugCallback(AudioHotplugThread::Callback* callback)
+{
+    if (mHotplugThread != NULL)
+        mHotplugThread->addCallback(callback);
+}
+
+void AudioHardwareInput::removeHotplugCallback(AudioHotplugThread::Callback* callback)
+{
+    if (mHotplugThread != NULL)
+        mHotplugThread->removeCallback(callback);
+}
+
 status_t AudioHardwareInput::setMicMute(bool mute)
 {
     mMicMute = mute;
@@ -100,6 +111,7 @@ status_t AudioHardwareInput::getInputBufferSize(const audio_config* config)
 }
 
 AudioStreamIn* AudioHardwareInput::openInputStream(uint32_t devices,
+        audio_source_t source,
         audio_format_t* format, uint32_t* channelMask, uint32_t* sampleRate,
         status_t* status)
 {
@@ -122,6 +134,7 @@ AudioStreamIn* AudioHardwareInput::openInputStream(uint32_t devices,
     }
 
     mInputStreams.add(in);
+    in->requestPrearm(source);
 
     return in;
 }
@@ -133,7 +146,7 @@ void AudioHardwareInput::closeInputStream(AudioStreamIn* in)
     for (size_t i = 0; i < mInputStreams.size(); i++) {
         if (in == mInputStreams[i]) {
             mInputStreams.removeAt(i);
-            in->standby();
+            in->forceStandby();
             delete in;
             break;
         }
@@ -145,7 +158,7 @@ void AudioHardwareInput::closeAllInputStreams()
     while (mInputStreams.size() != 0) {
         AudioStreamIn* in = mInputStreams[0];
         mInputStreams.removeAt(0);
-        in->standby();
+        in->forceStandby();
         delete in;
     }
 }
@@ -153,12 +166,22 @@ void AudioHardwareInput::closeAllInputStreams()
 void AudioHardwareInput::standbyAllInputStreams(const AudioHotplugThread::DeviceInfo* deviceInfo)
 {
     for (size_t i = 0; i < mInputStreams.size(); i++) {
-        if (deviceInfo == NULL || deviceInfo == mInputStreams[i]->getDeviceInfo()) {
-            mInputStreams[i]->standby();
+        if (deviceInfo == NULL) {
+            mInputStreams[i]->forceStandby();
+        } else {
+            mInputStreams[i]->forceStandbyIfUsing(deviceInfo->pcmCard,
+                                                  deviceInfo->pcmDevice);
         }
     }
 }
 
+void AudioHardwareInput::reevaluateInputStreams()
+{
+    for (size_t i = 0; i < mInputStreams.size(); i++) {
+        mInputStreams[i]->reevaluateDevice();
+    }
+}
+
 #define DUMP(a...) \
     snprintf(buffer, SIZE, a); \
     buffer[SIZE - 1] = 0; \
@@ -173,12 +196,26 @@ status_t AudioHardwareInput::dump(int fd)
 
     DUMP("\nAudioHardwareInput::dump\n");
 
-    for (int i=0; i<kMaxDevices; i++) {
-        if (mDeviceInfos[i].valid) {
-            DUMP("device[%d] is valid\n", i);
-            DUMP("\tcapture card: %d\n", mDeviceInfos[i].pcmCard);
-            DUMP("\tcapture device: %d\n", mDeviceInfos[i].pcmDevice);
+    sp<const DeviceSet> devices = getDevices();
+    for (size_t i = 0; i < devices->devices.size(); i++) {
+        const AudioHotplugThread::DeviceInfo& info = devices->devices.valueAt(i).info;
+        DUMP("device[%zu]%s\n", i, info.forVoiceRecognition ? " (voice recognition)" : "");
+        DUMP("\tcapture card: %d\n", info.pcmCard);
+        DUMP("\tcapture device: %d\n", info.pcmDevice);
+        DUMP("\tformats: 0x%llx\n",
+             static_cast<unsigned long long>(info.formatMask));
+        DUMP("\trates:");
+        for (size_t r = 0; r < AudioHotplugThread::kNumStandardRates; r++) {
+            if (info.rateMask & (1u << r)) {
+                DUMP(" %u", AudioHotplugThread::kStandardRates[r]);
+            }
         }
+        DUMP(" (%u - %u)\n", info.minSampleRate, info.maxSampleRate);
+        DUMP("\tperiods: %u - %u of %u - %u frames\n",
+             info.minPeriodCount, info.maxPeriodCount,
+             info.minPeriodSize, info.maxPeriodSize);
+        DUMP("\tadded: %lld mSec ago\n", static_cast<long long>(
+                ns2ms(systemTime() - devices->devices.valueAt(i).added)));
     }
 
     ::write(fd, result.string(), result.size());
@@ -190,48 +227,114 @@ status_t AudioHardwareInput::dump(int fd)
         }
     }
 
+    {
+        Mutex::Autolock _l(mEngineLock);
+        result.clear();
+        for (size_t i = 0; i < mCaptureEngines.size(); i++) {
+            mCaptureEngines[i].engine->dump(result);
+        }
+        ::write(fd, result.string(), result.size());
+    }
+
+    result.clear();
+    RemoteControlState::getInstance()->dump(result);
+    ::write(fd, result.string(), result.size());
+
     return NO_ERROR;
 }
 
 #undef DUMP
 #undef B2STR
 
+void AudioHardwareInput::exportState(HALStateWriter& w)
+{
+    Mutex::Autolock _l(mLock);
+
+    w.beginObject("input");
+    w.addBool("micMute", mMicMute);
+
+    w.beginArray("devices");
+    sp<const DeviceSet> devices = getDevices();
+    for (size_t i = 0; i < devices->devices.size(); i++) {
+        const AudioHotplugThread::DeviceInfo& info = devices->devices.valueAt(i).info;
+
+        w.beginObject(NULL);
+        w.addInt("card", info.pcmCard);
+        w.addInt("device", info.pcmDevice);
+        w.addInt("minRate", info.minSampleRate);
+        w.addInt("maxRate", info.maxSampleRate);
+        w.addInt("minChannels", info.minChannelCount);
+        w.addInt("maxChannels", info.maxChannelCount);
+        w.addInt("formatMask", static_cast<int64_t>(info.formatMask));
+        w.addInt("rateMask", info.rateMask);
+        w.addInt("minPeriodSize", info.minPeriodSize);
+        w.addInt("maxPeriodSize", info.maxPeriodSize);
+        w.addBool("voiceRecognition", info.forVoiceRecognition);
+        w.endObject();
+    }
+    w.endArray();
+
+    w.beginArray("streams");
+    for (size_t i = 0; i < mInputStreams.size(); i++) {
+        mInputStreams[i]->exportState(w);
+    }
+    w.endArray();
+
+    {
+        Mutex::Autolock _l(mEngineLock);
+        w.addInt("captureEngines", mCaptureEngines.size());
+    }
+
+    RemoteControlState::getInstance()->exportState(w);
+
+    w.endObject();
+}
+
+sp<const AudioHardwareInput::DeviceSet> AudioHardwareInput::getDevices()
+{
+    Mutex::Autolock _l(mDevicesLock);
+    return mDevices;
+}
+
+void AudioHardwareInput::publishDevices(const sp<const DeviceSet>& devices)
+{
+    Mutex::Autolock _l(mDevicesLock);
+    mDevices = devices;
+}
+
 // called on the audio hotplug thread
 void AudioHardwareInput::onDeviceFound(
         const AudioHotplugThread::DeviceInfo& devInfo)
 {
-    bool foundSlot = false;
     Mutex::Autolock _l(mLock);
 
     ALOGD("AudioHardwareInput::onDeviceFound pcmCard = %d", devInfo.pcmCard);
 
-    for (int i=0; i<kMaxDevices; i++) {
-        if (mDeviceInfos[i].valid) {
-            if ((mDeviceInfos[i].pcmCard == devInfo.pcmCard)
-                && (mDeviceInfos[i].pcmDevice == devInfo.pcmDevice)) {
-                ALOGW("AudioHardwareInput::onDeviceFound already has  %d:%d",
-                    devInfo.pcmCard, devInfo.pcmDevice);
-                return; // Got it already so no action needed.
-            }
-        }
-    }
-
-    // New device so find an empty slot and save it.
-    for (int i=0; i<kMaxDevices; i++) {
-        if (!mDeviceInfos[i].valid) {
-            ALOGD("AudioHardwareInput::onDeviceFound saving as device #%d", i);
-            mDeviceInfos[i] = devInfo;
-            mDeviceInfos[i].valid = true;
-            foundSlot = true;
-            /* Restart any currently running streams. */
-            standbyAllInputStreams(NULL);
-            break;
-        }
+    // Only the hotplug thread publishes, and it does so under mLock, so the
+    // current set cannot change underneath us.
+    sp<const DeviceSet> current = getDevices();
+    uint32_t key = deviceKey(devInfo.pcmCard, devInfo.pcmDevice);
+    if (current->devices.indexOfKey(key) >= 0) {
+        ALOGW("AudioHardwareInput::onDeviceFound already has  %d:%d",
+            devInfo.pcmCard, devInfo.pcmDevice);
+        return; // Got it already so no action needed.
     }
 
-    if (!foundSlot) {
-        ALOGW("AudioHardwareInput::onDeviceFound found more devices than expected! Dropped");
-    }
+    sp<DeviceSet> next = new DeviceSet();
+    next->devices = current->devices;
+    DeviceSet::Entry entry;
+    entry.info = devInfo;
+    entry.info.valid = true;
+    entry.added = systemTime();
+    next->devices.add(key, entry);
+    publishDevices(next);
+
+    ALOGD("AudioHardwareInput::onDeviceFound now has %zu devices",
+          next->devices.size());
+
+    /* Move any running stream which the new device suits better over to it.
+     * Streams whose choice of device is unchanged are left alone. */
+    reevaluateInputStreams();
 }
 
 // called on the audio hotplug thread
@@ -240,25 +343,67 @@ void AudioHardwareInput::onDeviceRemoved(unsigned int pcmCard, unsigned int pcmD
     Mutex::Autolock _l(mLock);
 
     ALOGD("AudioHardwareInput::onDeviceRemoved pcmCard = %d", pcmCard);
-    // Find matching DeviceInfo.
-    for (int i=0; i<kMaxDevices; i++) {
-        if (mDeviceInfos[i].valid) {
-            if ((mDeviceInfos[i].pcmCard == pcmCard) && (mDeviceInfos[i].pcmDevice == pcmDevice)) {
-                ALOGD("AudioHardwareInput::onDeviceRemoved matches #%d", i);
-                mDeviceInfos[i].valid = false;
-                /* If currently active stream is using this device then restart. */
-                standbyAllInputStreams(&mDeviceInfos[i]);
-                break;
-            }
+
+    sp<const DeviceSet> current = getDevices();
+    ssize_t ndx = current->devices.indexOfKey(deviceKey(pcmCard, pcmDevice));
+    if (ndx < 0) {
+        return;
+    }
+
+    AudioHotplugThread::DeviceInfo removed = current->devices.valueAt(ndx).info;
+    sp<DeviceSet> next = new DeviceSet();
+    next->devices = current->devices;
+    next->devices.removeItemsAt(ndx);
+    publishDevices(next);
+
+    /* If currently active stream is using this device then restart. */
+    standbyAllInputStreams(&removed);
+}
+
+// Lower is better; negative means the device can not serve the request.
+int AudioHardwareInput::deviceCost(const AudioHotplugThread::DeviceInfo& info,
+                                   uint32_t sampleRate, uint32_t channelCount)
+{
+    int cost = 0;
+
+    // We only capture 16 bit PCM.
+    if (!info.supportsS16LE())
+        return -1;
+
+    // Resampling: free if the device runs at the client's rate, cheap for a
+    // straight decimation, otherwise a full rational conversion.
+    unsigned int rate = info.bestRateFor(sampleRate);
+    if (rate != sampleRate) {
+        cost += (rate && !(rate % sampleRate)) ? 40 : 100;
+    }
+
+    // Channel conversion.
+    if ((channelCount < info.minChannelCount) ||
+        (channelCount > info.maxChannelCount)) {
+        cost += 20;
+    }
+
+    // Latency: each millisecond of the smallest period the device allows
+    // beyond our own period size.
+    if (info.minPeriodSize && rate) {
+        uint32_t periodMs = (info.minPeriodSize * 1000) / rate;
+        if (periodMs > kPeriodMsec) {
+            uint32_t extra = periodMs - kPeriodMsec;
+            cost += (extra > 50) ? 50 : extra;
         }
     }
+
+    return cost;
 }
 
-const AudioHotplugThread::DeviceInfo* AudioHardwareInput::getBestDevice(int inputSource)
+bool AudioHardwareInput::getBestDevice(int inputSource, uint32_t sampleRate,
+                                       uint32_t channelCount,
+                                       AudioHotplugThread::DeviceInfo* devInfo)
 {
     bool doVoiceRecognition = (inputSource == AUDIO_SOURCE_VOICE_RECOGNITION);
-    int chosenDeviceIndex = -1;
-    Mutex::Autolock _l(mLock);
+    sp<const DeviceSet> devices = getDevices();
+    const DeviceSet::Entry* chosen = NULL;
+    int chosenCost = 0;
 
     ALOGD("AudioHardwareInput::getBestDevice inputSource = %d, doVoiceRecognition = %d",
         inputSource, (doVoiceRecognition ? 1 : 0));
@@ -266,22 +411,114 @@ const AudioHotplugThread::DeviceInfo* AudioHardwareInput::getBestDevice(int inpu
     // and no other devices are used for voice recognition.
     // Currently the RemoteControl is the only device marked with forVoiceRecognition=true.
     // A connected USB mic could be used for anything but voice recognition.
-    for (int i=0; i<kMaxDevices; i++) {
-        if (mDeviceInfos[i].valid) {
-            if (mDeviceInfos[i].forVoiceRecognition == doVoiceRecognition) {
-                chosenDeviceIndex = i;
-                break;
-            }
+    // Among the rest, take the cheapest, and on a tie the one plugged in
+    // most recently.
+    for (size_t i = 0; i < devices->devices.size(); i++) {
+        const DeviceSet::Entry& entry = devices->devices.valueAt(i);
+        if (entry.info.forVoiceRecognition != doVoiceRecognition) {
+            continue;
+        }
+
+        int cost = deviceCost(entry.info, sampleRate, channelCount);
+        if (cost < 0) {
+            continue;
+        }
+
+        if ((chosen == NULL) || (cost < chosenCost) ||
+            ((cost == chosenCost) && (entry.added > chosen->added))) {
+            chosen = &entry;
+            chosenCost = cost;
         }
     }
 
-    if (chosenDeviceIndex < 0) {
+    if (chosen == NULL) {
         ALOGE("ERROR AudioHardwareInput::getBestDevice, none for source %d", inputSource);
-    } else {
-        ALOGD("AudioHardwareInput::getBestDevice chose #%d", chosenDeviceIndex);
+        return false;
+    }
+
+    ALOGD("AudioHardwareInput::getBestDevice chose %d:%d, cost %d",
+          chosen->info.pcmCard, chosen->info.pcmDevice, chosenCost);
+    *devInfo = chosen->info;
+    return true;
+}
+
+status_t AudioHardwareInput::acquireCaptureEngine(
+        const AudioHotplugThread::DeviceInfo* devInfo,
+        const struct pcm_config& config,
+        sp<CaptureEngine>* engine,
+        sp<CaptureEngine::Client>* client)
+{
+    Mutex::Autolock _l(mEngineLock);
+
+    for (size_t i = 0; i < mCaptureEngines.size(); i++) {
+        const sp<CaptureEngine>& e = mCaptureEngines[i].engine;
+        if ((e->card() == devInfo->pcmCard) && (e->device() == devInfo->pcmDevice)) {
+            ALOGD("AudioHardwareInput::acquireCaptureEngine sharing %d:%d",
+                  devInfo->pcmCard, devInfo->pcmDevice);
+            *engine = e;
+            *client = e->attach();
+            return NO_ERROR;
+        }
+    }
+
+    // Turn on RemoteControl MIC if we are recording from it.
+    if (devInfo->forVoiceRecognition) {
+        setRemoteControlMicEnabled(true);
+    }
+
+    // Attach before starting the engine so the first period is not missed.
+    sp<CaptureEngine> e = new CaptureEngine(devInfo->pcmCard, devInfo->pcmDevice,
+                                            config);
+    sp<CaptureEngine::Client> c = e->attach();
+    status_t res = e->open();
+    if (res != NO_ERROR) {
+        if (devInfo->forVoiceRecognition) {
+            setRemoteControlMicEnabled(false);
+        }
+        return res;
+    }
+
+    SharedCapture sc;
+    sc.engine = e;
+    sc.remoteMic = devInfo->forVoiceRecognition;
+    mCaptureEngines.add(sc);
+
+    *engine = e;
+    *client = c;
+    return NO_ERROR;
+}
+
+void AudioHardwareInput::releaseCaptureEngine(const sp<CaptureEngine>& engine,
+                                              const sp<CaptureEngine::Client>& client)
+{
+    Mutex::Autolock _l(mEngineLock);
+
+    engine->detach(client);
+    if (engine->clientCount() != 0) {
+        return;
+    }
+
+    for (size_t i = 0; i < mCaptureEngines.size(); i++) {
+        if (mCaptureEngines[i].engine == engine) {
+            bool remoteMic = mCaptureEngines[i].remoteMic;
+            mCaptureEngines.removeAt(i);
+
+            ALOGD("AudioHardwareInput::releaseCaptureEngine closing %d:%d",
+                  engine->card(), engine->device());
+            engine->close();
+
+            // Turn OFF Remote MIC now that nobody is recording from it.
+            if (remoteMic) {
+                setRemoteControlMicEnabled(false);
+            }
+            break;
+        }
     }
+}
 
-    return (chosenDeviceIndex >= 0) ? &mDeviceInfos[chosenDeviceIndex] : NULL;
+void AudioHardwareInput::setRemoteControlMicEnabled(bool flag)
+{
+    RemoteControlState::getInstance()->setMicEnabled(flag);
 }
 
 }; // namespace android
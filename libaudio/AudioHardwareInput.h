@@ -21,14 +21,19 @@
 #include <hardware/audio.h>
 #include <system/audio.h>
 #include <utils/Errors.h>
+#include <utils/KeyedVector.h>
+#include <utils/RefBase.h>
 #include <utils/threads.h>
+#include <utils/Timers.h>
 #include <utils/Vector.h>
 
 #include "AudioHotplugThread.h"
+#include "CaptureEngine.h"
 
 namespace android {
 
 class AudioStreamIn;
+class HALStateWriter;
 
 class AudioHardwareInput : public AudioHotplugThread::Callback {
   public:
@@ -40,6 +45,7 @@ class AudioHardwareInput : public AudioHotplugThread::Callback {
     status_t    getInputBufferSize(const audio_config* config);
 
     AudioStreamIn* openInputStream(uint32_t devices,
+                                   audio_source_t source,
                                    audio_format_t* format,
                                    uint32_t* channelMask,
                                    uint32_t* sampleRate,
@@ -47,6 +53,7 @@ class AudioHardwareInput : public AudioHotplugThread::Callback {
     void           closeInputStream(AudioStreamIn* in);
 
     status_t       dump(int fd);
+    void           exportState(HALStateWriter& w);
 
     // AudioHotplugThread callbacks
     virtual void onDeviceFound(const AudioHotplugThread::DeviceInfo& devInfo);
@@ -59,23 +66,87 @@ class AudioHardwareInput : public AudioHotplugThread::Callback {
     static const uint32_t kPeriodMsec;
 
     /**
-     * Decide which device to use for the given input.
+     * Decide which device to use for the given input, and copy its info to
+     * devInfo.  Devices are ranked by deviceCost(); returns false if none is
+     * usable for the source.  Never blocks on the hotplug thread.
      */
-    const AudioHotplugThread::DeviceInfo* getBestDevice(int inputSource);
+    bool getBestDevice(int inputSource, uint32_t sampleRate,
+                       uint32_t channelCount,
+                       AudioHotplugThread::DeviceInfo* devInfo);
+
+    /**
+     * Attach to the capture engine for a device, opening it with config if
+     * nobody is capturing from the device yet.  An engine which is already
+     * running keeps its own config; callers must use engine->config().
+     */
+    status_t acquireCaptureEngine(const AudioHotplugThread::DeviceInfo* devInfo,
+                                  const struct pcm_config& config,
+                                  sp<CaptureEngine>* engine,
+                                  sp<CaptureEngine::Client>* client);
+    /**
+     * Detach from an engine, closing it once the last client has gone.
+     */
+    void     releaseCaptureEngine(const sp<CaptureEngine>& engine,
+                                  const sp<CaptureEngine::Client>& client);
+
+    static void setRemoteControlMicEnabled(bool flag);
+
+    /**
+     * Share the hotplug thread, which this object owns, with other parts of
+     * the HAL (see AudioHotplugThread::addCallback).  A no-op if the thread
+     * could not be started.
+     */
+    void     addHotplugCallback(AudioHotplugThread::Callback* callback);
+    void     removeHotplugCallback(AudioHotplugThread::Callback* callback);
 
   private:
-    static const int    kMaxDevices = 8; // TODO review strategy for adding more devices
+    // The attached capture devices, indexed by deviceKey().  A set is never
+    // modified once published: the hotplug thread builds a new one and swaps
+    // it in, so readers only need mDevicesLock long enough to take a
+    // reference.
+    class DeviceSet : public RefBase {
+      public:
+        struct Entry {
+            AudioHotplugThread::DeviceInfo info;
+            nsecs_t                        added;
+        };
+        KeyedVector<uint32_t, Entry> devices;
+    };
+
+    static uint32_t     deviceKey(unsigned int pcmCard, unsigned int pcmDevice) {
+        return (pcmCard << 16) | pcmDevice;
+    }
+    static int          deviceCost(const AudioHotplugThread::DeviceInfo& info,
+                                   uint32_t sampleRate, uint32_t channelCount);
+
+    sp<const DeviceSet> getDevices();
+    void                publishDevices(const sp<const DeviceSet>& devices);
+
     void                closeAllInputStreams();
     // Place all input streams using the specified device into standby. If deviceInfo is NULL,
     // all input streams are placed into standby.
     void                standbyAllInputStreams(const AudioHotplugThread::DeviceInfo* deviceInfo);
+    // Have each input stream move to the best device for it, if that is no
+    // longer the one it is capturing from.
+    void                reevaluateInputStreams();
     Mutex               mLock;
     bool                mMicMute;
     Vector<AudioStreamIn*> mInputStreams;
 
     sp<AudioHotplugThread> mHotplugThread;
 
-    AudioHotplugThread::DeviceInfo mDeviceInfos[kMaxDevices];
+    Mutex               mDevicesLock;
+    sp<const DeviceSet> mDevices;
+
+    // One engine per open capture device, shared by every stream reading
+    // from it.  mEngineLock is taken with stream locks held, so it must
+    // never be held while calling into a stream.
+    struct SharedCapture {
+        sp<CaptureEngine> engine;
+        bool              remoteMic;
+    };
+    Mutex                  mEngineLock;
+    Vector<SharedCapture>  mCaptureEngines;
 };
 
 }; // namespace android
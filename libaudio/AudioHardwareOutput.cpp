@@ -26,12 +26,16 @@
 #include <common_time/local_clock.h>
 #include <cutils/properties.h>
 
+#include "AudioHardwareInput.h"
 #include "AudioHardwareOutput.h"
 #include "AudioStreamOut.h"
+#include "HALStateWriter.h"
 #include "HDMIAudioOutput.h"
 
 namespace android {
 
+extern AudioHardwareInput gAudioHardwareInput;
+
 // Global singleton.
 AudioHardwareOutput gAudioHardwareOutput;
 
@@ -48,6 +52,28 @@ const String8 AudioHardwareOutput::kFixedHDMIOutputLevelParamKey(
 // Video delay comp hack options (not exposed to user level)
 const String8 AudioHardwareOutput::kVideoDelayCompParamKey(
         "atv.video.delay_comp");
+const String8 AudioHardwareOutput::kVideoDelayCompAutoParamKey(
+        "atv.video.delay_comp_auto");
+const String8 AudioHardwareOutput::kVideoDelayCompPipelineParamKey(
+        "atv.video.delay_comp_pipeline");
+
+// Machine readable state export (read only).  The first key returns JSON, the
+// second returns the compact binary form, base64 encoded.
+const String8 AudioHardwareOutput::kHALStateParamKey(
+        "atv.hal_state");
+const String8 AudioHardwareOutput::kHALStateBinParamKey(
+        "atv.hal_state_bin");
+
+// How long an HDMI disconnect has to stand before it is acted on.  AVRs
+// switching inputs commonly drop hotplug for a moment and raise it again;
+// within this window that costs nothing.  0 applies disconnects at once.
+static const char* kRoutingDebounceProp = "audio.atv.routing_debounce_ms";
+static const int32_t kDefaultRoutingDebounceMs = 300;
+
+// Upper bound on how long a routing change waits for HDMI caps.  Loads from
+// the ELD take a few mSec; walking the mixer's mode table can take a few
+// hundred.
+static const nsecs_t kHDMICapsWaitTimeout = ms2ns(1000);
 
 // Defaults for settings.
 void AudioHardwareOutput::OutputSettings::setDefaults()
@@ -80,6 +106,13 @@ void AudioHardwareOutput::Settings::setDefaults() {
     // which will be subtracted from the latency estimate and defaulting it to
     // a reasonable middle gound (12mSec in this case).
     videoDelayCompUsec = 12000;
+
+    // Optionally, the fixed compensation above can be replaced with one
+    // derived from the display's actual vsync timing (see AVSyncEstimator).
+    // This is off by default; when it is on but the estimate is not (yet)
+    // usable, the fixed value is still used.
+    videoDelayCompAuto = false;
+    videoDelayCompPipeline = 0;
 }
 
 AudioHardwareOutput::AudioHardwareOutput()
@@ -87,18 +120,58 @@ AudioHardwareOutput::AudioHardwareOutput()
   , mMCOutput(NULL)
   , mHDMIConnected(false)
   , mMaxDelayCompUsec(0)
+  , mHotplugSubscribed(false)
+  , mHDMIPlugged(false)
+  , mHDMICapsRequested(false)
+  , mHDMICapsReady(false)
+  , mHDMICapsReloading(false)
+  , mRoutingDepth(0)
+  , mRoutingDevMask(0)
+  , mRoutedDevMask(0)
+  , mHDMIDisconnectAt(0)
+  , mRoutingCommits(0)
+  , mRoutingCoalesced(0)
 {
     mSettings.setDefaults();
+    mAVSyncEstimator = new AVSyncEstimator();
     mHDMICardID = find_alsa_card_by_name(kHDMI_ALSADeviceName);
+    mHDMIAudioCaps.setCallback(this);
+
+    int32_t debounceMs = property_get_int32(kRoutingDebounceProp,
+                                            kDefaultRoutingDebounceMs);
+    mRoutingDebounce = (debounceMs > 0) ? ms2ns(debounceMs) : 0;
 }
 
 AudioHardwareOutput::~AudioHardwareOutput()
 {
+    if (mHotplugSubscribed)
+        gAudioHardwareInput.removeHotplugCallback(this);
+
+    sp<RoutingThread> thread;
+    {
+        Mutex::Autolock _l(mStreamLock);
+        thread = mRoutingThread;
+        mRoutingThread.clear();
+        if (thread != NULL) {
+            thread->requestExit();
+            mRoutingCond.signal();
+        }
+    }
+    if (thread != NULL)
+        thread->requestExitAndWait();
+    mHDMIAudioCaps.setCallback(NULL);
     closeOutputStream(mMainOutput);
     closeOutputStream(mMCOutput);
+    mAVSyncEstimator->stop();
 }
 
 status_t AudioHardwareOutput::initCheck() {
+    // Not from the constructor; gAudioHardwareInput may not be constructed
+    // yet at that point.
+    if (!mHotplugSubscribed) {
+        mHotplugSubscribed = true;
+        gAudioHardwareInput.addHotplugCallback(this);
+    }
     return NO_ERROR;
 }
 
@@ -268,6 +341,17 @@ status_t AudioHardwareOutput::setParameters(const char* kvpairs) {
         param.remove(kVideoDelayCompParamKey);
     }
 
+    if (param.getInt(kVideoDelayCompAutoParamKey, intVal) == NO_ERROR) {
+        s.videoDelayCompAuto = (intVal != 0);
+        param.remove(kVideoDelayCompAutoParamKey);
+    }
+
+    if ((param.getInt(kVideoDelayCompPipelineParamKey, intVal) == NO_ERROR) &&
+        (intVal >= 0) && (intVal <= 4)) {
+        s.videoDelayCompPipeline = static_cast<uint32_t>(intVal);
+        param.remove(kVideoDelayCompPipelineParamKey);
+    }
+
     if (param.size())
         status = BAD_VALUE;
 
@@ -285,6 +369,10 @@ status_t AudioHardwareOutput::setParameters(const char* kvpairs) {
         if (initial.videoDelayCompUsec != s.videoDelayCompUsec)
             mSettings.videoDelayCompUsec = s.videoDelayCompUsec;
 
+        if ((initial.videoDelayCompAuto != s.videoDelayCompAuto) ||
+            (initial.videoDelayCompPipeline != s.videoDelayCompPipeline))
+            applyVideoDelayCompAuto_l(s);
+
         uint32_t tmp = 0;
         if (mSettings.hdmi.allowed && (tmp < mSettings.hdmi.delayCompUsec))
             tmp = mSettings.hdmi.delayCompUsec;
@@ -300,6 +388,88 @@ status_t AudioHardwareOutput::setParameters(const char* kvpairs) {
     return status;
 }
 
+void AudioHardwareOutput::applyVideoDelayCompAuto_l(const Settings& s)
+{
+    // ASSERT(holding mSettingsLock)
+    mSettings.videoDelayCompAuto = s.videoDelayCompAuto;
+    mSettings.videoDelayCompPipeline = s.videoDelayCompPipeline;
+    mAVSyncEstimator->setPipelineDepth(s.videoDelayCompPipeline);
+
+    if (!s.videoDelayCompAuto) {
+        mAVSyncEstimator->stop();
+        return;
+    }
+
+    // The HDMI output is driven from the secondary display pipe.
+    static const int kHDMIPipe = 1;
+    status_t res = mAVSyncEstimator->start(new PSBVsyncSource(kHDMIPipe));
+    if (res != OK)
+        ALOGW("%s: failed to start vsync estimator (res %d), falling back to"
+              " fixed video delay compensation", __func__, res);
+}
+
+bool AudioHardwareOutput::getVideoDelayEstimateUsec(uint32_t* delayUsec) const
+{
+    bool autoComp;
+
+    // Explicit scope for auto-lock pattern.
+    {
+        Mutex::Autolock _l(mSettingsLock);
+        autoComp = mSettings.videoDelayCompAuto;
+    }
+
+    if (!autoComp || !mAVSyncEstimator->getVideoDelayUsec(delayUsec))
+        return false;
+
+    *delayUsec += getSinkAVSyncDelayUsec();
+    return true;
+}
+
+uint32_t AudioHardwareOutput::getVideoDelayCompUsec() const
+{
+    uint32_t est;
+    uint32_t fixed;
+
+    if (getVideoDelayEstimateUsec(&est))
+        return est;
+
+    // Explicit scope for auto-lock pattern.
+    {
+        Mutex::Autolock _l(mSettingsLock);
+        fixed = mSettings.videoDelayCompUsec;
+    }
+
+    return fixed + getSinkAVSyncDelayUsec();
+}
+
+// The sink's own video processing delay beyond its audio latency, as
+// advertised in its ELD/EDID.  Neither the vsync estimate nor the fixed
+// setting can see past the HDMI link, so this is added on top of either.
+// The caps are reset when HDMI goes away, so there is nothing to add unless
+// a sink which reported a delay is connected.  A sink which delays audio
+// more than video would need video held back, which is not ours to do.
+uint32_t AudioHardwareOutput::getSinkAVSyncDelayUsec() const
+{
+    int delayMs = mHDMIAudioCaps.sinkAVSyncDelayMs();
+
+    return (delayMs > 0) ? static_cast<uint32_t>(delayMs) * 1000 : 0;
+}
+
+void AudioHardwareOutput::onPresentationTimestamp(
+        const struct timespec& timestamp)
+{
+    bool autoComp;
+
+    // Explicit scope for auto-lock pattern.
+    {
+        Mutex::Autolock _l(mSettingsLock);
+        autoComp = mSettings.videoDelayCompAuto;
+    }
+
+    if (autoComp)
+        mAVSyncEstimator->onAudioPresented(timestamp);
+}
+
 bool AudioHardwareOutput::applyOutputSettings_l(
         const AudioHardwareOutput::OutputSettings& initial,
         const AudioHardwareOutput::OutputSettings& current,
@@ -386,23 +556,223 @@ char* AudioHardwareOutput::getParameters(const char* keys) {
         param.addFloat(kVideoDelayCompParamKey,
                        static_cast<float>(s.videoDelayCompUsec) / 1000.0);
 
+    if (param.get(kVideoDelayCompAutoParamKey, tmp) == NO_ERROR)
+        param.addInt(kVideoDelayCompAutoParamKey, s.videoDelayCompAuto ? 1 : 0);
+
+    if (param.get(kVideoDelayCompPipelineParamKey, tmp) == NO_ERROR)
+        param.addInt(kVideoDelayCompPipelineParamKey,
+                     s.videoDelayCompPipeline);
+
+    /***************************************************************
+     *                        State Export                         *
+     ***************************************************************/
+    if (param.get(kHALStateParamKey, tmp) == NO_ERROR) {
+        HALStateWriter w(HALStateWriter::kFormatJSON);
+        w.beginObject(NULL);
+        exportState(w);
+        gAudioHardwareInput.exportState(w);
+        w.endObject();
+        param.add(kHALStateParamKey, w.result());
+    }
+
+    if (param.get(kHALStateBinParamKey, tmp) == NO_ERROR) {
+        HALStateWriter w(HALStateWriter::kFormatBinary);
+        w.beginObject(NULL);
+        exportState(w);
+        gAudioHardwareInput.exportState(w);
+        w.endObject();
+        param.add(kHALStateBinParamKey, w.result());
+    }
+
     return strdup(param.toString().string());
 }
 
 void AudioHardwareOutput::updateRouting(uint32_t devMask) {
+    beginRouting();
+    setRoutingDevices(devMask);
+    commitRouting();
+}
+
+void AudioHardwareOutput::beginRouting() {
     Mutex::Autolock _l(mStreamLock);
 
-    bool hasHDMI = 0 != (devMask & HDMIAudioOutput::classDevMask());
-    ALOGI("%s: hasHDMI = %d, mHDMIConnected = %d", __func__, hasHDMI, mHDMIConnected);
-    if (mHDMIConnected != hasHDMI) {
-        mHDMIConnected = hasHDMI;
+    if (mRoutingDepth++ == 0)
+        mRoutingDevMask = mRoutedDevMask;
+}
+
+void AudioHardwareOutput::setRoutingDevices(uint32_t devMask) {
+    Mutex::Autolock _l(mStreamLock);
 
-        if (mHDMIConnected)
-            mHDMIAudioCaps.loadCaps(mHDMICardID);
-        else
-            mHDMIAudioCaps.reset();
+    if (!mRoutingDepth) {
+        ALOGW("%s: no routing transaction open", __func__);
+        return;
+    }
+    mRoutingDevMask = devMask;
+
+    // Loading the sink's caps involves a fair amount of mixer I/O, so it
+    // happens in the background, and is started as soon as we hear of the
+    // sink rather than at commit.  HDMI is only added to the streams'
+    // targets once the caps are in (see onCapsLoaded); until then, opening
+    // the HDMI output would just fail the format check.
+    if (!(devMask & HDMIAudioOutput::classDevMask()))
+        return;
 
+    if (mHDMIDisconnectAt && !mHDMICapsReloading) {
+        // Back before a pending disconnect took effect.  The streams never
+        // stopped targeting HDMI, but a different sink may now be on the
+        // other end of the cable; refresh the caps now, while the policy
+        // manager can still wait for them.
+        mHDMICapsReloading = true;
+        mHDMIAudioCaps.loadCapsAsync(mHDMICardID);
+    }
+    requestHDMICaps_l();
+}
+
+void AudioHardwareOutput::commitRouting() {
+    Mutex::Autolock _l(mStreamLock);
+
+    if (!mRoutingDepth) {
+        ALOGW("%s: no routing transaction open", __func__);
+        return;
+    }
+    if (--mRoutingDepth)
+        return;
+
+    mRoutedDevMask = mRoutingDevMask;
+    mRoutingCommits++;
+
+    bool hasHDMI = 0 != (mRoutedDevMask & HDMIAudioOutput::classDevMask());
+    ALOGI("%s: hasHDMI = %d, mHDMIConnected = %d%s", __func__, hasHDMI,
+          mHDMIConnected, mHDMIDisconnectAt ? " (disconnect pending)" : "");
+
+    // Whatever reload the transaction started has been waited for by now.
+    mHDMICapsReloading = false;
+
+    if (hasHDMI) {
+        if (mHDMIDisconnectAt) {
+            // Back before the disconnect took effect; nothing to undo.  The
+            // caps were refreshed by setRoutingDevices.
+            mHDMIDisconnectAt = 0;
+            mRoutingCoalesced++;
+        } else if (!mHDMIConnected) {
+            mHDMIConnected = true;
+            // Otherwise onCapsLoaded does this.
+            if (mHDMICapsReady)
+                updateTgtDevices_l();
+        }
+    } else if (mHDMIConnected && !mHDMIDisconnectAt) {
+        if (!mRoutingDebounce || !ensureRoutingThread_l()) {
+            disconnectHDMI_l();
+        } else {
+            mHDMIDisconnectAt = systemTime() + mRoutingDebounce;
+            mRoutingCond.signal();
+        }
+    }
+}
+
+void AudioHardwareOutput::waitForHDMICaps() {
+    // onCapsLoaded needs mStreamLock, so it must not be held here.
+    if (!mHDMIAudioCaps.waitForLoad(kHDMICapsWaitTimeout))
+        ALOGW("%s: proceeding without the new HDMI caps", __func__);
+}
+
+void AudioHardwareOutput::requestHDMICaps_l() {
+    if (mHDMICapsRequested)
+        return;
+
+    mHDMICapsRequested = true;
+    mHDMIAudioCaps.loadCapsAsync(mHDMICardID);
+}
+
+void AudioHardwareOutput::dropHDMICaps_l() {
+    mHDMICapsRequested = false;
+    mHDMICapsReady = false;
+    mHDMIAudioCaps.reset();
+}
+
+void AudioHardwareOutput::disconnectHDMI_l() {
+    mHDMIDisconnectAt = 0;
+    mHDMIConnected = false;
+    dropHDMICaps_l();
+    updateTgtDevices_l();
+}
+
+bool AudioHardwareOutput::ensureRoutingThread_l() {
+    if (mRoutingThread != NULL)
+        return true;
+
+    mRoutingThread = new RoutingThread(*this);
+    if (mRoutingThread->run("ATVRoutingDebounce") != NO_ERROR) {
+        ALOGE("%s: unable to start routing thread", __func__);
+        mRoutingThread.clear();
+        return false;
+    }
+
+    return true;
+}
+
+// Applies an HDMI disconnect once it has stood for the debounce period.
+bool AudioHardwareOutput::RoutingThread::threadLoop() {
+    Mutex::Autolock _l(mOwner.mStreamLock);
+
+    if (exitPending())
+        return false;
+
+    nsecs_t deadline = mOwner.mHDMIDisconnectAt;
+    nsecs_t now = systemTime();
+
+    if (!deadline) {
+        mOwner.mRoutingCond.wait(mOwner.mStreamLock);
+    } else if (now >= deadline) {
+        ALOGI("%s: HDMI disconnect stood for %lld mSec, applying", __func__,
+              static_cast<long long>(ns2ms(mOwner.mRoutingDebounce)));
+        mOwner.disconnectHDMI_l();
+    } else {
+        mOwner.mRoutingCond.waitRelative(mOwner.mStreamLock, deadline - now);
+    }
+
+    return true;
+}
+
+void AudioHardwareOutput::onCapsLoaded(bool basicAudioSupported) {
+    Mutex::Autolock _l(mStreamLock);
+
+    ALOGI("%s: basicAudioSupported = %d, mHDMIConnected = %d", __func__,
+          basicAudioSupported, mHDMIConnected);
+    if (mHDMICapsRequested)
+        mHDMICapsReady = true;
+    if (mHDMIConnected)
         updateTgtDevices_l();
+}
+
+// called on the audio hotplug thread
+void AudioHardwareOutput::onPlaybackDeviceFound(
+        const AudioHotplugThread::DeviceInfo& devInfo) {
+    if (!devInfo.isHDMI)
+        return;
+
+    Mutex::Autolock _l(mStreamLock);
+    if (mHDMICardID != static_cast<int>(devInfo.pcmCard)) {
+        ALOGI("%s: HDMI audio is card %u", __func__, devInfo.pcmCard);
+        mHDMICardID = devInfo.pcmCard;
+    }
+}
+
+// called on the audio hotplug thread
+void AudioHardwareOutput::onHDMIStateChanged(bool connected) {
+    Mutex::Autolock _l(mStreamLock);
+
+    ALOGI("%s: connected = %d, mHDMIConnected = %d", __func__, connected,
+          mHDMIConnected);
+    mHDMIPlugged = connected;
+
+    // Routing itself still follows the framework; only the caps are
+    // fetched early.  A sink which goes away again before the framework
+    // noticed it drops the caps it brought.
+    if (connected && (mHDMICardID >= 0)) {
+        requestHDMICaps_l();
+    } else if (!connected && !mHDMIConnected && !mRoutingDepth && mHDMICapsRequested) {
+        dropHDMICaps_l();
     }
 }
 
@@ -566,6 +936,17 @@ status_t AudioHardwareOutput::dump(int fd)
     DUMP("\tHDMI Output Fixed      : %s\n", B2STR(s.hdmi.isFixed));
     DUMP("\tHDMI Fixed Level       : %.1f dB\n", s.hdmi.fixedLvl);
     DUMP("\tVideo Delay Comp       : %u uSec\n", s.videoDelayCompUsec);
+    DUMP("\tVideo Delay Comp Auto  : %s (pipeline %u, in use %u uSec)\n",
+         B2STR(s.videoDelayCompAuto), s.videoDelayCompPipeline,
+         getVideoDelayCompUsec());
+    DUMP("\tSink A/V Sync Delay    : %u uSec\n", getSinkAVSyncDelayUsec());
+    if (s.videoDelayCompAuto)
+        mAVSyncEstimator->dump(result);
+    DUMP("\tHDMI Plugged (kernel)  : %s\n", B2STR(mHDMIPlugged));
+    DUMP("\tRouting                : 0x%08x, %u commits, %u flaps coalesced%s\n",
+         mRoutedDevMask, mRoutingCommits, mRoutingCoalesced,
+         mHDMIDisconnectAt ? ", HDMI disconnect pending" : "");
+    mHDMIAudioCaps.dump(result);
 
     ::write(fd, result.string(), result.size());
 
@@ -585,4 +966,54 @@ status_t AudioHardwareOutput::dump(int fd)
 #undef B2STR
 #undef DUMP
 
+void AudioHardwareOutput::exportState(HALStateWriter& w)
+{
+    Settings s;
+
+    // Explicit scope for auto-lock pattern.
+    {
+        Mutex::Autolock _l(mSettingsLock);
+        s = mSettings;
+    }
+
+    w.beginObject("output");
+
+    w.beginObject("settings");
+    w.addFloat("masterVolume", s.masterVolume);
+    w.addBool("masterMute", s.masterMute);
+    w.addBool("hdmiAllowed", s.hdmi.allowed);
+    w.addInt("hdmiDelayCompUsec", s.hdmi.delayCompUsec);
+    w.addBool("hdmiFixed", s.hdmi.isFixed);
+    w.addFloat("hdmiFixedLevel", s.hdmi.fixedLvl);
+    w.addInt("videoDelayCompUsec", s.videoDelayCompUsec);
+    w.addBool("videoDelayCompAuto", s.videoDelayCompAuto);
+    w.addInt("videoDelayCompPipeline", s.videoDelayCompPipeline);
+    w.endObject();
+
+    w.addInt("videoDelayCompInUseUsec", getVideoDelayCompUsec());
+    w.addInt("sinkAVSyncDelayUsec", getSinkAVSyncDelayUsec());
+
+    w.addBool("hdmiConnected", mHDMIConnected);
+    w.addBool("hdmiPlugged", mHDMIPlugged);
+    w.addBool("hdmiDisconnectPending", mHDMIDisconnectAt != 0);
+    w.addInt("routedDevices", mRoutedDevMask);
+    w.addInt("routingCommits", mRoutingCommits);
+    w.addInt("routingCoalesced", mRoutingCoalesced);
+    mHDMIAudioCaps.exportState(w);
+
+    // Explicit scope for auto-lock pattern.
+    {
+        Mutex::Autolock _l(mOutputLock);
+        w.beginArray("streams");
+        if (mMainOutput)
+            mMainOutput->exportState(w);
+
+        if (mMCOutput)
+            mMCOutput->exportState(w);
+        w.endArray();
+    }
+
+    w.endObject();
+}
+
 }; // namespace android
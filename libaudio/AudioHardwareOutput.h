@@ -26,14 +26,18 @@
 #include <utils/threads.h>
 
 #include "alsa_utils.h"
+#include "AudioHotplugThread.h"
+#include "AVSyncEstimator.h"
 #include "AudioOutput.h"
 
 namespace android {
 
 class AudioStreamOut;
 class AudioOutput;
+class HALStateWriter;
 
-class AudioHardwareOutput {
+class AudioHardwareOutput : private HDMIAudioCaps::Callback,
+                            private AudioHotplugThread::Callback {
   public:
                 AudioHardwareOutput();
     virtual    ~AudioHardwareOutput();
@@ -45,11 +49,26 @@ class AudioHardwareOutput {
     status_t    setParameters(const char* kvpairs);
     char*       getParameters(const char* keys);
     status_t    dump(int fd);
+    void        exportState(HALStateWriter& w);
+    // Routing changes are made in transactions: begin, set the new output
+    // device mask (as often as needed), commit.  Caps for a newly seen HDMI
+    // sink start loading as soon as the mask names it, but the streams are
+    // retargeted at most once, at the outermost commit.  HDMI disconnects
+    // are held back for a debounce period, and a reconnect inside it
+    // cancels the disconnect.  updateRouting is a transaction of one.
     void        updateRouting(uint32_t devMask);
+    void        beginRouting();
+    void        setRoutingDevices(uint32_t devMask);
+    void        commitRouting();
+    // Block (for a bounded time) until any HDMI caps load started by the
+    // open transaction has been published, so that the policy manager
+    // reads the sink's real caps rather than the ones being replaced.
+    // Called without any HAL locks held.
+    void        waitForHDMICaps();
     uint32_t    getMaxDelayCompUsec() const { return mMaxDelayCompUsec; }
-    uint32_t    getVideoDelayCompUsec() const {
-        return mSettings.videoDelayCompUsec;
-    }
+    uint32_t    getVideoDelayCompUsec() const;
+    bool        getVideoDelayEstimateUsec(uint32_t* delayUsec) const;
+    void        onPresentationTimestamp(const struct timespec& timestamp);
     HDMIAudioCaps& getHDMIAudioCaps() { return mHDMIAudioCaps; }
 
     // Interface to allow streams to obtain and release various physical
@@ -73,6 +92,22 @@ class AudioHardwareOutput {
     void           standbyStatusUpdate(bool isInStandby, bool isMCStream);
 
   private:
+    class RoutingThread : public Thread {
+      public:
+        explicit RoutingThread(AudioHardwareOutput& owner)
+            : Thread(false), mOwner(owner) {}
+      private:
+        virtual bool threadLoop();
+        AudioHardwareOutput& mOwner;
+    };
+
+    // HDMIAudioCaps::Callback
+    virtual void onCapsLoaded(bool basicAudioSupported);
+
+    // AudioHotplugThread::Callback
+    virtual void onPlaybackDeviceFound(const AudioHotplugThread::DeviceInfo& devInfo);
+    virtual void onHDMIStateChanged(bool connected);
+
     struct OutputSettings {
         bool        allowed;
         uint32_t    delayCompUsec;
@@ -84,12 +119,20 @@ class AudioHardwareOutput {
     struct Settings {
         OutputSettings hdmi;
         uint32_t       videoDelayCompUsec;
+        bool           videoDelayCompAuto;
+        uint32_t       videoDelayCompPipeline;
         float          masterVolume;
         bool           masterMute;
         void           setDefaults();
     };
 
     void     updateTgtDevices_l();
+    void     requestHDMICaps_l();
+    void     dropHDMICaps_l();
+    void     disconnectHDMI_l();
+    bool     ensureRoutingThread_l();
+    void     applyVideoDelayCompAuto_l(const Settings& s);
+    uint32_t getSinkAVSyncDelayUsec() const;
     bool     applyOutputSettings_l(const OutputSettings& initial,
                                    const OutputSettings& current,
                                    OutputSettings& updateMe,
@@ -132,18 +175,55 @@ class AudioHardwareOutput {
     Mutex            mOutputLock;
     AudioOutputList  mPhysOutputs;
 
-    Mutex            mSettingsLock;
+    mutable Mutex    mSettingsLock;
     Settings         mSettings;
     uint32_t         mMaxDelayCompUsec;
 
+    // Vsync based estimate of the video delay, used in place of
+    // Settings::videoDelayCompUsec when videoDelayCompAuto is set.
+    sp<AVSyncEstimator> mAVSyncEstimator;
+
     HDMIAudioCaps    mHDMIAudioCaps;
     int              mHDMICardID;
+    bool             mHotplugSubscribed;
+
+    // The kernel usually sees HDMI come and go well before the framework
+    // gets round to updateRouting.  mHDMIPlugged is the kernel's view.  When
+    // it sees a sink first, the caps load is started straight away
+    // (mHDMICapsRequested), so that by the time the policy manager calls
+    // waitForHDMICaps the load has usually finished (mHDMICapsReady).
+    // mHDMICapsReloading is set when a reconnect inside the debounce window
+    // has started a fresh load for the open transaction.  All four are
+    // protected by mStreamLock.
+    bool             mHDMIPlugged;
+    bool             mHDMICapsRequested;
+    bool             mHDMICapsReady;
+    bool             mHDMICapsReloading;
+
+    // Routing transactions, also under mStreamLock.  mRoutingDevMask is the
+    // mask being built by the open transaction(s), mRoutedDevMask the last
+    // one committed.  mHDMIDisconnectAt is when a debounced HDMI disconnect
+    // takes effect (0 if none is pending); mRoutingThread applies it, waiting
+    // on mRoutingCond.
+    uint32_t         mRoutingDepth;
+    uint32_t         mRoutingDevMask;
+    uint32_t         mRoutedDevMask;
+    nsecs_t          mHDMIDisconnectAt;
+    nsecs_t          mRoutingDebounce;
+    sp<RoutingThread> mRoutingThread;
+    Condition        mRoutingCond;
+    uint32_t         mRoutingCommits;
+    uint32_t         mRoutingCoalesced;
 
     static const String8 kHDMIAllowedParamKey;
     static const String8 kHDMIDelayCompParamKey;
     static const String8 kFixedHDMIOutputParamKey;
     static const String8 kFixedHDMIOutputLevelParamKey;
     static const String8 kVideoDelayCompParamKey;
+    static const String8 kVideoDelayCompAutoParamKey;
+    static const String8 kVideoDelayCompPipelineParamKey;
+    static const String8 kHALStateParamKey;
+    static const String8 kHALStateBinParamKey;
     static const float   kDefaultMasterVol;
 
 };
@@ -20,10 +20,12 @@
 
 #include <assert.h>
 #include <dirent.h>
+#include <limits.h>
 #include <poll.h>
 #include <sys/eventfd.h>
 #include <sys/inotify.h>
 #include <sys/ioctl.h>
+#include <sys/socket.h>
 
 // Bionic's copy of asound.h contains references to these kernel macros.
 // They need to be removed in order to include the file from userland.
@@ -35,10 +37,13 @@
 #undef __bitwise
 #undef __user
 
+#include <cutils/uevent.h>
 #include <utils/misc.h>
 #include <utils/String8.h>
 
 #include "AudioHotplugThread.h"
+#include "SoundUevent.h"
+#include "alsa_utils.h"
 
 // This name is used to recognize the AndroidTV Remote mic so we can
 // use it for voice recognition.
@@ -121,13 +126,25 @@ const char* AudioHotplugThread::kThreadName = "ATVRemoteAudioHotplug";
 // directory where ALSA device nodes appear
 const char* AudioHotplugThread::kAlsaDeviceDir = "/dev/snd";
 
-// filename suffix for ALSA nodes representing capture devices
+// control device of a card, through which its PCMs can be queried without
+// opening them
+const char* AudioHotplugThread::kAlsaControlFmt = "/dev/snd/controlC%u";
+
+// filename suffixes for ALSA nodes representing capture and playback devices
 const char  AudioHotplugThread::kDeviceTypeCapture = 'c';
+const char  AudioHotplugThread::kDeviceTypePlayback = 'p';
+
+// Some devices can not be opened immediately after their node appears.  A
+// card with a node which fails to probe is retried after kRetryTime, doubling
+// each time.
+const nsecs_t AudioHotplugThread::kRetryTime = 10000000;
+const int     AudioHotplugThread::kMaxProbeAttempts = 5;
 
 AudioHotplugThread::AudioHotplugThread(Callback& callback)
-    : mCallback(callback)
-    , mShutdownEventFD(-1)
+    : mShutdownEventFD(-1)
+    , mHDMIConnected(false)
 {
+    mCallbacks.add(&callback);
 }
 
 AudioHotplugThread::~AudioHotplugThread()
@@ -155,13 +172,107 @@ void AudioHotplugThread::shutdown()
     join();
 }
 
-bool AudioHotplugThread::parseCaptureDeviceName(const char* name,
-                                                unsigned int* card,
-                                                unsigned int* device)
+void AudioHotplugThread::addCallback(Callback* callback)
+{
+    Mutex::Autolock _l(mLock);
+
+    for (size_t i = 0; i < mCallbacks.size(); i++) {
+        if (mCallbacks[i] == callback)
+            return;
+    }
+    mCallbacks.add(callback);
+
+    // Catch the newcomer up.  The cache holds exactly the nodes we have
+    // probed on cards which are still present.
+    for (size_t i = 0; i < mCapsCache.size(); i++) {
+        const DeviceInfo& info = mCapsCache.valueAt(i);
+        if (info.forPlayback)
+            callback->onPlaybackDeviceFound(info);
+        else
+            callback->onDeviceFound(info);
+    }
+    if (mHDMIConnected)
+        callback->onHDMIStateChanged(true);
+}
+
+void AudioHotplugThread::removeCallback(Callback* callback)
 {
-    char deviceType;
-    int ret = sscanf(name, "pcmC%uD%u%c", card, device, &deviceType);
-    return (ret == 3 && deviceType == kDeviceTypeCapture);
+    Mutex::Autolock _l(mLock);
+
+    for (size_t i = 0; i < mCallbacks.size(); i++) {
+        if (mCallbacks[i] == callback) {
+            mCallbacks.removeAt(i);
+            return;
+        }
+    }
+}
+
+void AudioHotplugThread::notifyDeviceFound(const DeviceInfo& info)
+{
+    Mutex::Autolock _l(mLock);
+
+    for (size_t i = 0; i < mCallbacks.size(); i++) {
+        if (info.forPlayback)
+            mCallbacks[i]->onPlaybackDeviceFound(info);
+        else
+            mCallbacks[i]->onDeviceFound(info);
+    }
+}
+
+void AudioHotplugThread::notifyDeviceRemoved(unsigned int pcmCard,
+                                             unsigned int pcmDevice,
+                                             bool playback)
+{
+    Mutex::Autolock _l(mLock);
+
+    for (size_t i = 0; i < mCallbacks.size(); i++) {
+        if (playback)
+            mCallbacks[i]->onPlaybackDeviceRemoved(pcmCard, pcmDevice);
+        else
+            mCallbacks[i]->onDeviceRemoved(pcmCard, pcmDevice);
+    }
+}
+
+// Re-read the HDMI connector state and pass on any change.  The connector is
+// looked up every time; its DRM name depends on the card and port numbering.
+void AudioHotplugThread::updateHDMIState()
+{
+    char path[PATH_MAX];
+    char status[32];
+    if (find_hdmi_connector_attr(kDRM_ClassDir, "status", path, sizeof(path)))
+        return;
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return;
+
+    int amt = read(fd, status, sizeof(status) - 1);
+    close(fd);
+    if (amt <= 0)
+        return;
+    status[amt] = 0;
+
+    bool connected = !strncmp(status, "connected", 9);
+
+    Mutex::Autolock _l(mLock);
+    if (connected == mHDMIConnected)
+        return;
+
+    ALOGI("AudioHotplugThread: HDMI %s", connected ? "connected" : "disconnected");
+    mHDMIConnected = connected;
+    for (size_t i = 0; i < mCallbacks.size(); i++)
+        mCallbacks[i]->onHDMIStateChanged(connected);
+}
+
+bool AudioHotplugThread::parseDeviceName(const char* name,
+                                         unsigned int* card,
+                                         unsigned int* device,
+                                         bool* playback)
+{
+    bool control;
+
+    return SoundUevent::parseNodeName(name, card, device, playback, &control) &&
+           !control;
 }
 
 static inline void getAlsaParamInterval(const struct snd_pcm_hw_params& params,
@@ -174,6 +285,95 @@ static inline void getAlsaParamInterval(const struct snd_pcm_hw_params& params,
     *max = interval->max;
 }
 
+const unsigned int AudioHotplugThread::kStandardRates[] = {
+    8000, 11025, 16000, 22050, 24000, 32000, 44100, 48000, 88200, 96000,
+};
+const size_t AudioHotplugThread::kNumStandardRates = NELEM(kStandardRates);
+
+bool AudioHotplugThread::DeviceInfo::supportsRate(unsigned int rate) const
+{
+    for (size_t i = 0; i < kNumStandardRates; i++) {
+        if (kStandardRates[i] == rate)
+            return (rateMask & (1u << i)) != 0;
+    }
+
+    // Not one we probed; all we know is the interval.
+    return (rate >= minSampleRate) && (rate <= maxSampleRate);
+}
+
+bool AudioHotplugThread::DeviceInfo::supportsS16LE() const
+{
+    return !formatMask || (formatMask & (1ULL << SNDRV_PCM_FORMAT_S16_LE));
+}
+
+// An integer multiple (a pure decimation) beats the nearest rate above, which
+// beats the nearest rate below.
+unsigned int AudioHotplugThread::DeviceInfo::bestRateFor(unsigned int rate) const
+{
+    unsigned int multiple = 0;
+    unsigned int above = 0;
+    unsigned int below = 0;
+
+    if (supportsRate(rate))
+        return rate;
+
+    // kStandardRates is in ascending order.
+    for (size_t i = 0; i < kNumStandardRates; i++) {
+        unsigned int r = kStandardRates[i];
+        if (!(rateMask & (1u << i)))
+            continue;
+
+        if (r > rate) {
+            if (!multiple && rate && !(r % rate))
+                multiple = r;
+            if (!above)
+                above = r;
+        } else {
+            below = r;
+        }
+    }
+
+    if (multiple)
+        return multiple;
+    if (above)
+        return above;
+    if (below)
+        return below;
+
+    // No discrete rates known; clip to min/max available from driver.
+    if (rate < minSampleRate)
+        return minSampleRate;
+    if (rate > maxSampleRate)
+        return maxSampleRate;
+    return rate;
+}
+
+// Refine the configuration space with the rate pinned to each standard rate
+// in turn, and note which ones the driver accepts.
+uint32_t AudioHotplugThread::probeRates(int alsaFD, unsigned int minRate,
+                                        unsigned int maxRate)
+{
+    uint32_t mask = 0;
+
+    for (size_t i = 0; i < kNumStandardRates; i++) {
+        unsigned int rate = kStandardRates[i];
+        if ((rate < minRate) || (rate > maxRate))
+            continue;
+
+        struct snd_pcm_hw_params params;
+        param_init(&params);
+        struct snd_interval* interval = param_to_interval(&params,
+                SNDRV_PCM_HW_PARAM_RATE);
+        interval->min = interval->max = rate;
+        interval->integer = 1;
+
+        if (ioctl(alsaFD, SNDRV_PCM_IOCTL_HW_REFINE, &params) == 0)
+            mask |= 1u << i;
+    }
+
+    return mask;
+}
+
 // This was hacked out of "alsa_utils.cpp".
 static int s_get_alsa_card_name(char *name, size_t len, int card_id)
 {
@@ -194,13 +394,43 @@ static int s_get_alsa_card_name(char *name, size_t len, int card_id)
 
 bool AudioHotplugThread::getDeviceInfo(unsigned int pcmCard,
                                        unsigned int pcmDevice,
+                                       bool playback,
                                        DeviceInfo* info)
 {
-    bool result = false;
-    int ret;
     int len;
     char cardName[64] = "";
 
+    if (playback ? !getPlaybackNodeInfo(pcmCard, pcmDevice, info)
+                 : !getCaptureNodeInfo(pcmCard, pcmDevice, info))
+        return false;
+
+    info->pcmCard = pcmCard;
+    info->pcmDevice = pcmDevice;
+    info->forPlayback = playback;
+
+    // Ugly hack to recognize Remote mic and mark it for voice recognition
+    info->forVoiceRecognition = false;
+    info->isHDMI = false;
+    len = s_get_alsa_card_name(cardName, sizeof(cardName), pcmCard);
+    ALOGD("AudioHotplugThread get_alsa_card_name returned %d, %s", len, cardName);
+    if (len > 0) {
+        info->isHDMI = (strcmp(kHDMI_ALSADeviceName, cardName) == 0);
+        if (!playback && (strcmp(ANDROID_TV_REMOTE_AUDIO_DEVICE_NAME, cardName) == 0)) {
+            ALOGD("AudioHotplugThread found Android TV remote mic on Card %d, for VOICE_RECOGNITION", pcmCard);
+            info->forVoiceRecognition = true;
+        }
+    }
+
+    return true;
+}
+
+bool AudioHotplugThread::getCaptureNodeInfo(unsigned int pcmCard,
+                                            unsigned int pcmDevice,
+                                            DeviceInfo* info)
+{
+    bool result = false;
+    int ret;
+
     String8 devicePath = String8::format("%s/pcmC%dD%d%c",
             kAlsaDeviceDir, pcmCard, pcmDevice, kDeviceTypeCapture);
 
@@ -220,25 +450,31 @@ bool AudioHotplugThread::getDeviceInfo(unsigned int pcmCard,
         goto done;
     }
 
-    info->pcmCard = pcmCard;
-    info->pcmDevice = pcmDevice;
     getAlsaParamInterval(params, SNDRV_PCM_HW_PARAM_SAMPLE_BITS,
                          &info->minSampleBits, &info->maxSampleBits);
     getAlsaParamInterval(params, SNDRV_PCM_HW_PARAM_CHANNELS,
                          &info->minChannelCount, &info->maxChannelCount);
     getAlsaParamInterval(params, SNDRV_PCM_HW_PARAM_RATE,
                          &info->minSampleRate, &info->maxSampleRate);
-
-    // Ugly hack to recognize Remote mic and mark it for voice recognition
-    info->forVoiceRecognition = false;
-    len = s_get_alsa_card_name(cardName, sizeof(cardName), pcmCard);
-    ALOGD("AudioHotplugThread get_alsa_card_name returned %d, %s", len, cardName);
-    if (len > 0) {
-        if (strcmp(ANDROID_TV_REMOTE_AUDIO_DEVICE_NAME, cardName) == 0) {
-            ALOGD("AudioHotplugThread found Android TV remote mic on Card %d, for VOICE_RECOGNITION", pcmCard);
-            info->forVoiceRecognition = true;
-        }
+    getAlsaParamInterval(params, SNDRV_PCM_HW_PARAM_PERIOD_SIZE,
+                         &info->minPeriodSize, &info->maxPeriodSize);
+    getAlsaParamInterval(params, SNDRV_PCM_HW_PARAM_PERIODS,
+                         &info->minPeriodCount, &info->maxPeriodCount);
+
+    {
+        const struct snd_mask* formats = param_to_mask(&params,
+                SNDRV_PCM_HW_PARAM_FORMAT);
+        info->formatMask = static_cast<uint64_t>(formats->bits[0]) |
+                           (static_cast<uint64_t>(formats->bits[1]) << 32);
     }
+    info->rateMask = probeRates(alsaFD, info->minSampleRate, info->maxSampleRate);
+
+    ALOGD("AudioHotplugThread: %d:%d formats 0x%llx, rates 0x%x (%u-%u), "
+          "periods %u-%u x %u-%u frames", pcmCard, pcmDevice,
+          static_cast<unsigned long long>(info->formatMask), info->rateMask,
+          info->minSampleRate, info->maxSampleRate,
+          info->minPeriodCount, info->maxPeriodCount,
+          info->minPeriodSize, info->maxPeriodSize);
 
     result = true;
 
@@ -249,15 +485,99 @@ done:
     return result;
 }
 
-// scan the ALSA device directory for a usable capture device
-void AudioHotplugThread::scanForDevice()
+// Opening a playback node claims its substream; the HAL (or anyone else)
+// opening it for real while we had it would get EBUSY.  So playback nodes
+// are only looked up through the card's control device, which confirms the
+// PCM exists without touching it.  Their stream parameters are left unknown
+// (zero); the only playback consumer, the HDMI output, gets its caps from
+// HDMIAudioCaps.
+bool AudioHotplugThread::getPlaybackNodeInfo(unsigned int pcmCard,
+                                             unsigned int pcmDevice,
+                                             DeviceInfo* info)
+{
+    bool result = false;
+    struct snd_pcm_info pcmInfo;
+
+    String8 ctlPath = String8::format(kAlsaControlFmt, pcmCard);
+    int ctlFD = open(ctlPath.string(), O_RDONLY);
+    if (ctlFD == -1) {
+        ALOGE("AudioHotplugThread::getDeviceInfo open failed for %s", ctlPath.string());
+        goto done;
+    }
+
+    memset(&pcmInfo, 0, sizeof(pcmInfo));
+    pcmInfo.device = pcmDevice;
+    pcmInfo.subdevice = 0;
+    pcmInfo.stream = SNDRV_PCM_STREAM_PLAYBACK;
+    if (ioctl(ctlFD, SNDRV_CTL_IOCTL_PCM_INFO, &pcmInfo) == -1) {
+        ALOGE("AudioHotplugThread: PCM info ioctl failed for %u:%u (%s)",
+              pcmCard, pcmDevice, strerror(errno));
+        goto done;
+    }
+
+    info->minSampleBits = info->maxSampleBits = 0;
+    info->minChannelCount = info->maxChannelCount = 0;
+    info->minSampleRate = info->maxSampleRate = 0;
+    info->minPeriodSize = info->maxPeriodSize = 0;
+    info->minPeriodCount = info->maxPeriodCount = 0;
+    info->formatMask = 0;
+    info->rateMask = 0;
+
+    ALOGD("AudioHotplugThread: %u:%u playback \"%s\", %u subdevices", pcmCard,
+          pcmDevice, reinterpret_cast<const char*>(pcmInfo.name),
+          pcmInfo.subdevices_count);
+
+    result = true;
+
+done:
+    if (ctlFD != -1) {
+        close(ctlFD);
+    }
+    return result;
+}
+
+bool AudioHotplugThread::probeDevice(unsigned int pcmCard,
+                                     unsigned int pcmDevice,
+                                     bool playback,
+                                     DeviceInfo* info)
+{
+    uint32_t key = cacheKey(pcmCard, pcmDevice, playback);
+    ssize_t ndx = mCapsCache.indexOfKey(key);
+
+    if (ndx >= 0) {
+        *info = mCapsCache.valueAt(ndx);
+        return true;
+    }
+
+    if (!getDeviceInfo(pcmCard, pcmDevice, playback, info))
+        return false;
+
+    Mutex::Autolock _l(mLock);
+    mCapsCache.add(key, *info);
+    return true;
+}
+
+void AudioHotplugThread::invalidateCard(unsigned int card)
+{
+    Mutex::Autolock _l(mLock);
+
+    for (size_t i = mCapsCache.size(); i > 0; i--) {
+        if ((mCapsCache.keyAt(i - 1) >> 16) == card)
+            mCapsCache.removeItemsAt(i - 1);
+    }
+}
+
+// scan the ALSA device directory for usable capture and playback devices,
+// optionally restricted to one card
+bool AudioHotplugThread::scanForDevice(int card)
 {
     DIR* alsaDir;
     DeviceInfo deviceInfo;
+    bool allProbed = true;
 
     alsaDir = opendir(kAlsaDeviceDir);
     if (alsaDir == NULL)
-        return;
+        return false;
 
     while (true) {
         struct dirent entry, *result;
@@ -265,56 +585,285 @@ void AudioHotplugThread::scanForDevice()
         if (ret != 0 || result == NULL)
             break;
         unsigned int pcmCard, pcmDevice;
-        if (parseCaptureDeviceName(entry.d_name, &pcmCard, &pcmDevice)) {
-            if (getDeviceInfo(pcmCard, pcmDevice, &deviceInfo)) {
-                mCallback.onDeviceFound(deviceInfo);
+        bool playback;
+        if (parseDeviceName(entry.d_name, &pcmCard, &pcmDevice, &playback)) {
+            if ((card >= 0) && (pcmCard != static_cast<unsigned int>(card)))
+                continue;
+            if (probeDevice(pcmCard, pcmDevice, playback, &deviceInfo)) {
+                notifyDeviceFound(deviceInfo);
+            } else {
+                allProbed = false;
             }
         }
     }
 
     closedir(alsaDir);
+    return allProbed;
 }
 
-bool AudioHotplugThread::threadLoop()
+void AudioHotplugThread::scheduleCardScan(unsigned int card, nsecs_t delay)
+{
+    nsecs_t now = systemTime();
+
+    for (size_t i = 0; i < mPendingCards.size(); i++) {
+        PendingCard& p = mPendingCards.editItemAt(i);
+        if (p.card == card) {
+            if ((now + delay) < p.deadline)
+                p.deadline = now + delay;
+            return;
+        }
+    }
+
+    PendingCard p;
+    p.card = card;
+    p.firstEvent = now;
+    p.deadline = now + delay;
+    p.attempts = 0;
+    mPendingCards.add(p);
+}
+
+void AudioHotplugThread::cancelCardScan(unsigned int card)
+{
+    for (size_t i = 0; i < mPendingCards.size(); i++) {
+        if (mPendingCards[i].card == card) {
+            mPendingCards.removeAt(i);
+            return;
+        }
+    }
+}
+
+// Probe every card whose deadline has passed.  Cards are independent, so a
+// storm of reconnects costs one settle time rather than one per node.
+void AudioHotplugThread::runPendingScans()
+{
+    nsecs_t now = systemTime();
+
+    for (size_t i = 0; i < mPendingCards.size();) {
+        PendingCard& p = mPendingCards.editItemAt(i);
+        if (p.deadline > now) {
+            i++;
+            continue;
+        }
+
+        if (scanForDevice(p.card)) {
+            ALOGI("AudioHotplugThread: card %u probed %lld mSec after it appeared",
+                  p.card, static_cast<long long>(ns2ms(systemTime() - p.firstEvent)));
+        } else if (++p.attempts < kMaxProbeAttempts) {
+            p.deadline = now + (kRetryTime << (p.attempts - 1));
+            i++;
+            continue;
+        } else {
+            ALOGE("AudioHotplugThread: giving up on card %u after %d attempts",
+                  p.card, p.attempts);
+        }
+
+        mPendingCards.removeAt(i);
+    }
+}
+
+int AudioHotplugThread::pendingTimeoutMs()
+{
+    if (mPendingCards.isEmpty())
+        return -1;
+
+    nsecs_t deadline = mPendingCards[0].deadline;
+    for (size_t i = 1; i < mPendingCards.size(); i++) {
+        if (mPendingCards[i].deadline < deadline)
+            deadline = mPendingCards[i].deadline;
+    }
+
+    nsecs_t now = systemTime();
+    if (deadline <= now)
+        return 0;
+
+    // round up so we do not wake just short of the deadline
+    return static_cast<int>(ns2ms(deadline - now + 999999));
+}
+
+int AudioHotplugThread::openUeventSocket()
+{
+    // Large enough to absorb a burst of events from several cards arriving
+    // at once.
+    int fd = uevent_open_socket(64 * 1024, true);
+    if (fd == -1) {
+        ALOGW("AudioHotplugThread: unable to open uevent socket (%s)",
+              strerror(errno));
+        return -1;
+    }
+
+    int flags = fcntl(fd, F_GETFL, 0);
+    if ((flags == -1) || (fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1)) {
+        ALOGE("AudioHotplugThread: unable to make uevent socket non-blocking");
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+int AudioHotplugThread::openInotify(int* watchFD)
 {
     int inotifyFD = -1;
-    int watchFD = -1;
     int flags;
 
     // watch for changes to the ALSA device directory
     inotifyFD = inotify_init();
     if (inotifyFD == -1) {
         ALOGE("AudioHotplugThread: inotify_init failed");
-        goto done;
+        goto bailout;
     }
     flags = fcntl(inotifyFD, F_GETFL, 0);
     if (flags == -1) {
         ALOGE("AudioHotplugThread: F_GETFL failed");
-        goto done;
+        goto bailout;
     }
     if (fcntl(inotifyFD, F_SETFL, flags | O_NONBLOCK) == -1) {
         ALOGE("AudioHotplugThread: F_SETFL failed");
-        goto done;
+        goto bailout;
     }
 
-    watchFD = inotify_add_watch(inotifyFD, kAlsaDeviceDir,
-                                IN_CREATE | IN_DELETE);
-    if (watchFD == -1) {
+    *watchFD = inotify_add_watch(inotifyFD, kAlsaDeviceDir,
+                                 IN_CREATE | IN_DELETE);
+    if (*watchFD == -1) {
         ALOGE("AudioHotplugThread: inotify_add_watch failed");
-        goto done;
+        goto bailout;
+    }
+
+    return inotifyFD;
+
+bailout:
+    if (inotifyFD != -1) {
+        close(inotifyFD);
+    }
+    return -1;
+}
+
+// Sound subsystem uevents (see SoundUevent).  Each PCM node gets its own
+// add, and the card's control node is added once all of them are
+// registered, which is our cue to probe them together.  DRM hotplug events
+// tell us to look at the HDMI connector again.
+void AudioHotplugThread::handleUevent(int fd)
+{
+    char msg[2048 + 2];
+
+    while (true) {
+        ssize_t len = uevent_kernel_multicast_recv(fd, msg, sizeof(msg) - 2);
+        if (len <= 0)
+            break;
+        if (len >= static_cast<ssize_t>(sizeof(msg) - 2))
+            continue;   // truncated
+        msg[len] = msg[len + 1] = '\0';
+
+        SoundUevent ev;
+        if (!ev.parse(msg))
+            continue;
+
+        switch (ev.type) {
+            case SoundUevent::kPCMAdded:
+            case SoundUevent::kCardReady:
+                scheduleCardScan(ev.card, ev.scanDelay());
+                break;
+            case SoundUevent::kPCMRemoved:
+                notifyDeviceRemoved(ev.card, ev.device, ev.playback);
+                break;
+            case SoundUevent::kCardRemoved:
+                cancelCardScan(ev.card);
+                invalidateCard(ev.card);
+                break;
+            case SoundUevent::kHDMIHotplug:
+                updateHDMIState();
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+// Returns false if the inotify descriptor has failed.
+bool AudioHotplugThread::handleInotify(int fd)
+{
+    // parse the filesystem change events
+    char eventBuf[256];
+    int ret = read(fd, eventBuf, sizeof(eventBuf));
+    if (ret == -1) {
+        if (errno == EAGAIN)
+            return true;
+        ALOGE("AudioHotplugThread: read failed");
+        return false;
+    }
+
+    for (int i = 0; i < ret;) {
+        if ((ret - i) < (int)sizeof(struct inotify_event)) {
+            ALOGE("AudioHotplugThread: read an invalid inotify_event");
+            break;
+        }
+
+        struct inotify_event *event =
+                reinterpret_cast<struct inotify_event*>(eventBuf + i);
+
+        if ((ret - i) < (int)(sizeof(struct inotify_event) + event->len)) {
+            ALOGE("AudioHotplugThread: read a bad inotify_event length");
+            break;
+        }
+
+        char *name = ((char *) event) +
+                offsetof(struct inotify_event, name);
+
+        unsigned int pcmCard, pcmDevice;
+        bool playback;
+        if (parseDeviceName(name, &pcmCard, &pcmDevice, &playback)) {
+            if (event->mask & IN_CREATE) {
+                // Try straight away; runPendingScans backs off and retries
+                // if the node is not ready to be opened yet.
+                scheduleCardScan(pcmCard, 0);
+            } else if (event->mask & IN_DELETE) {
+                // Nodes only go away with their card.
+                invalidateCard(pcmCard);
+                notifyDeviceRemoved(pcmCard, pcmDevice, playback);
+            }
+        }
+
+        i += sizeof(struct inotify_event) + event->len;
     }
 
-    // check for any existing capture devices
+    return true;
+}
+
+bool AudioHotplugThread::threadLoop()
+{
+    int inotifyFD = -1;
+    int watchFD = -1;
+    bool useUevent;
+
+    // Prefer kernel uevents, which tell us when a card is ready.  Fall back
+    // to watching /dev/snd if we may not listen to them.  Either way the
+    // source is opened before the initial scan, so nothing is missed.
+    int hotplugFD = openUeventSocket();
+    useUevent = (hotplugFD != -1);
+    if (!useUevent) {
+        hotplugFD = inotifyFD = openInotify(&watchFD);
+        if (hotplugFD == -1)
+            goto done;
+    }
+    ALOGI("AudioHotplugThread: watching for devices with %s",
+          useUevent ? "uevents" : "inotify");
+
+    // check for any existing devices, and where HDMI stands.  Without
+    // uevents the HDMI state is only known from here.
     scanForDevice();
+    updateHDMIState();
 
     while (!exitPending()) {
-        // wait for a change to the ALSA directory or a shutdown signal
+        // wait for a hotplug event, a pending card's deadline or a shutdown
+        // signal
         struct pollfd fds[2] = {
-            { inotifyFD, POLLIN, 0 },
+            { hotplugFD, POLLIN, 0 },
             { mShutdownEventFD, POLLIN, 0 }
         };
-        int ret = poll(fds, NELEM(fds), -1);
+        int ret = poll(fds, NELEM(fds), pendingTimeoutMs());
         if (ret == -1) {
+            if (errno == EINTR)
+                continue;
             ALOGE("AudioHotplugThread: poll failed");
             break;
         } else if (fds[1].revents & POLLIN) {
@@ -322,70 +871,23 @@ bool AudioHotplugThread::threadLoop()
             break;
         }
 
-        if (!(fds[0].revents & POLLIN)) {
-            continue;
-        }
-
-        // parse the filesystem change events
-        char eventBuf[256];
-        ret = read(inotifyFD, eventBuf, sizeof(eventBuf));
-        if (ret == -1) {
-            ALOGE("AudioHotplugThread: read failed");
-            break;
-        }
-
-        for (int i = 0; i < ret;) {
-            if ((ret - i) < (int)sizeof(struct inotify_event)) {
-                ALOGE("AudioHotplugThread: read an invalid inotify_event");
+        if (fds[0].revents & POLLIN) {
+            if (useUevent) {
+                handleUevent(hotplugFD);
+            } else if (!handleInotify(hotplugFD)) {
                 break;
             }
-
-            struct inotify_event *event =
-                    reinterpret_cast<struct inotify_event*>(eventBuf + i);
-
-            if ((ret - i) < (int)(sizeof(struct inotify_event) + event->len)) {
-                ALOGE("AudioHotplugThread: read a bad inotify_event length");
-                break;
-            }
-
-            char *name = ((char *) event) +
-                    offsetof(struct inotify_event, name);
-
-            unsigned int pcmCard, pcmDevice;
-            if (parseCaptureDeviceName(name, &pcmCard, &pcmDevice)) {
-                if (event->mask & IN_CREATE) {
-                    // Some devices can not be opened immediately after the
-                    // inotify event occurs.  Add a delay to avoid these
-                    // races.  (50ms was chosen arbitrarily)
-                    const int kOpenTimeoutMs = 50;
-                    struct pollfd pfd = {mShutdownEventFD, POLLIN, 0};
-                    if (poll(&pfd, 1, kOpenTimeoutMs) == -1) {
-                        ALOGE("AudioHotplugThread: poll failed");
-                        break;
-                    } else if (pfd.revents & POLLIN) {
-                        // shutdown requested
-                        break;
-                    }
-
-                    DeviceInfo deviceInfo;
-                    if (getDeviceInfo(pcmCard, pcmDevice, &deviceInfo)) {
-                        mCallback.onDeviceFound(deviceInfo);
-                    }
-                } else if (event->mask & IN_DELETE) {
-                    mCallback.onDeviceRemoved(pcmCard, pcmDevice);
-                }
-            }
-
-            i += sizeof(struct inotify_event) + event->len;
         }
+
+        runPendingScans();
     }
 
 done:
     if (watchFD != -1) {
         inotify_rm_watch(inotifyFD, watchFD);
     }
-    if (inotifyFD != -1) {
-        close(inotifyFD);
+    if (hotplugFD != -1) {
+        close(hotplugFD);
     }
 
     return false;
@@ -18,7 +18,10 @@
 #ifndef ANDROID_AUDIO_HOTPLUG_THREAD_H
 #define ANDROID_AUDIO_HOTPLUG_THREAD_H
 
+#include <utils/KeyedVector.h>
 #include <utils/threads.h>
+#include <utils/Timers.h>
+#include <utils/Vector.h>
 
 namespace android {
 
@@ -30,15 +33,46 @@ class AudioHotplugThread : public Thread {
         unsigned int minSampleBits, maxSampleBits;
         unsigned int minChannelCount, maxChannelCount;
         unsigned int minSampleRate, maxSampleRate;
+        unsigned int minPeriodSize, maxPeriodSize;     // frames
+        unsigned int minPeriodCount, maxPeriodCount;
+        uint64_t formatMask;    // bit per SNDRV_PCM_FORMAT_*
+        uint32_t rateMask;      // bit per kStandardRates entry
         bool valid;
+        bool forPlayback;       // a playback node rather than a capture node
         bool forVoiceRecognition;
+        bool isHDMI;            // on the HDMI audio card
+
+        bool supportsRate(unsigned int rate) const;
+        // The format we capture in.  True if the format mask is unknown.
+        bool supportsS16LE() const;
+        // The rate to run the device at for a client at rate: the rate
+        // itself if supported, otherwise the cheapest conversion.
+        unsigned int bestRateFor(unsigned int rate) const;
     };
 
+    // Rates probed individually, since the refined rate interval says
+    // nothing about which rates inside it the hardware can actually run at.
+    static const unsigned int kStandardRates[];
+    static const size_t       kNumStandardRates;
+
+    // Called on the hotplug thread.  A device may be reported as found more
+    // than once.  Subscribers implement only the events they care about.
     class Callback {
       public:
         virtual ~Callback() {}
-        virtual void onDeviceFound(const DeviceInfo& devInfo) = 0;
-        virtual void onDeviceRemoved(unsigned int pcmCard, unsigned int pcmDevice) = 0;
+        // capture nodes
+        virtual void onDeviceFound(const DeviceInfo& devInfo) { (void) devInfo; }
+        virtual void onDeviceRemoved(unsigned int pcmCard, unsigned int pcmDevice) {
+            (void) pcmCard; (void) pcmDevice;
+        }
+        // playback nodes
+        virtual void onPlaybackDeviceFound(const DeviceInfo& devInfo) { (void) devInfo; }
+        virtual void onPlaybackDeviceRemoved(unsigned int pcmCard,
+                                             unsigned int pcmDevice) {
+            (void) pcmCard; (void) pcmDevice;
+        }
+        // the HDMI connector, as seen by the kernel
+        virtual void onHDMIStateChanged(bool connected) { (void) connected; }
     };
 
     AudioHotplugThread(Callback& callback);
@@ -47,21 +81,84 @@ class AudioHotplugThread : public Thread {
     bool        start();
     void        shutdown();
 
+    // Subscribe to hotplug events.  The new subscriber is immediately told
+    // about every device already known and the HDMI state, then about
+    // changes as they happen.  Once removeCallback returns, no further
+    // calls will be made to the subscriber.
+    void        addCallback(Callback* callback);
+    void        removeCallback(Callback* callback);
+
   private:
+    // A card with capture nodes still to be probed.  Nodes are probed a
+    // card at a time, once the card is ready, rather than one by one as they
+    // appear.
+    struct PendingCard {
+        unsigned int card;
+        nsecs_t      firstEvent;    // when we first heard of the card
+        nsecs_t      deadline;      // when to (next) probe it
+        int          attempts;
+    };
+
     static const char* kThreadName;
     static const char* kAlsaDeviceDir;
+    static const char* kAlsaControlFmt;
     static const char  kDeviceTypeCapture;
-    static bool parseCaptureDeviceName(const char *name, unsigned int *pcmCard,
-                                       unsigned int *pcmDevice);
+    static const char  kDeviceTypePlayback;
+    static const nsecs_t kRetryTime;
+    static const int   kMaxProbeAttempts;
+
+    static bool parseDeviceName(const char *name, unsigned int *pcmCard,
+                                unsigned int *pcmDevice, bool *playback);
     static bool getDeviceInfo(unsigned int pcmCard, unsigned int pcmDevice,
-                              DeviceInfo* info);
+                              bool playback, DeviceInfo* info);
+    static bool getCaptureNodeInfo(unsigned int pcmCard, unsigned int pcmDevice,
+                                   DeviceInfo* info);
+    static bool getPlaybackNodeInfo(unsigned int pcmCard, unsigned int pcmDevice,
+                                    DeviceInfo* info);
+    static uint32_t probeRates(int alsaFD, unsigned int minRate,
+                               unsigned int maxRate);
+
+    // Capabilities never change while a card is present, so each node is
+    // probed once and remembered until its card goes away.
+    bool probeDevice(unsigned int pcmCard, unsigned int pcmDevice,
+                     bool playback, DeviceInfo* info);
+    void invalidateCard(unsigned int card);
+    static uint32_t cacheKey(unsigned int pcmCard, unsigned int pcmDevice,
+                             bool playback) {
+        return (pcmCard << 16) | (pcmDevice << 1) | (playback ? 1 : 0);
+    }
+
+    void notifyDeviceFound(const DeviceInfo& info);
+    void notifyDeviceRemoved(unsigned int pcmCard, unsigned int pcmDevice,
+                             bool playback);
+    void updateHDMIState();
 
     virtual bool threadLoop();
 
-    void scanForDevice();
+    // Probe every PCM node, or only those of one card.  Returns false if
+    // any node could not be probed.
+    bool scanForDevice(int card = -1);
+
+    int  openUeventSocket();
+    int  openInotify(int* watchFD);
+    void handleUevent(int fd);
+    bool handleInotify(int fd);
+
+    void scheduleCardScan(unsigned int card, nsecs_t delay);
+    void cancelCardScan(unsigned int card);
+    void runPendingScans();
+    int  pendingTimeoutMs();
 
-    Callback& mCallback;
     int mShutdownEventFD;
+    Vector<PendingCard> mPendingCards;
+
+    // Held while calling subscribers, so that adding one can replay the
+    // current state without it racing with live events.  Guards the members
+    // below; the thread only takes it to change them.
+    Mutex mLock;
+    Vector<Callback*> mCallbacks;
+    KeyedVector<uint32_t, DeviceInfo> mCapsCache;  // keyed by cacheKey()
+    bool mHDMIConnected;
 };
 
 }; // namespace android
@@ -30,6 +30,7 @@
 #include "alsa_utils.h"
 #undef __DO_FUNCTION_IMPL__
 #include "AudioOutput.h"
+#include "HALStateWriter.h"
 
 namespace android {
 
@@ -49,6 +50,8 @@ AudioOutput::AudioOutput(const char* alsa_name,
         , mBytesPerChunk(0)
         , mStagingBuf(NULL)
         , mPrimeTimeoutChunks(0)
+        , mUnderflowCount(0)
+        , mResetCount(0)
         , mVolume(0.0)
         , mFixedLvl(0.0)
         , mMute(false)
@@ -59,6 +62,16 @@ AudioOutput::AudioOutput(const char* alsa_name,
 
     mMaxDelayCompFrames = 0;
     mExternalDelayUSec = 0;
+    mExternalDelayLocalTicks = 0;
+    mTgtDelayFrames = 0;
+    mDelayFrames.store(0, std::memory_order_relaxed);
+    mDelayLine = NULL;
+    mDelayOutBuf = NULL;
+    mDelayLineFrames = 0;
+    mDelayWritePos = 0;
+    mIsEncoded = false;
+    mEncodedBurstFrames = 0;
+    mEncodedPhase = 0;
 
     mDevice = NULL;
     mDeviceExtFd = -1;
@@ -69,6 +82,8 @@ AudioOutput::AudioOutput(const char* alsa_name,
 AudioOutput::~AudioOutput() {
     cleanupResources();
     delete[] mStagingBuf;
+    delete[] mDelayLine;
+    delete[] mDelayOutBuf;
 }
 
 status_t AudioOutput::initCheck() {
@@ -111,6 +126,7 @@ void AudioOutput::setupInternal() {
 #endif
     mBytesPerFrame = mBytesPerSample * mChannelCnt;
     mBytesPerChunk = mBytesPerFrame * mFramesPerChunk;
+    delete[] mStagingBuf;
     mStagingBuf = new uint8_t[mBytesPerChunk];
 
     memset(&mFramesToLocalTime, 0, sizeof(mFramesToLocalTime));
@@ -120,6 +136,15 @@ void AudioOutput::setupInternal() {
             &mFramesToLocalTime.a_to_b_numer,
             &mFramesToLocalTime.a_to_b_denom);
 
+    // Size the delay line for the worst case up front so that changes to
+    // the delay never need to allocate on the write path.
+    delete[] mDelayLine;
+    delete[] mDelayOutBuf;
+    mDelayLineFrames = mMaxDelayCompFrames + mFramesPerChunk;
+    mDelayLine = new int16_t[mDelayLineFrames * mChannelCnt];
+    mDelayOutBuf = new int16_t[mFramesPerChunk * mChannelCnt];
+    resetDelayLine();
+
     openPCMDevice();
 }
 
@@ -135,6 +160,10 @@ void AudioOutput::primeOutput(bool hasActiveOutputs) {
     if (hasActiveOutputs)
         primeAmt /= 2;
 
+    // Nothing is playing yet, so there's nothing to crossfade; start clean
+    // with the current target delay.
+    resetDelayLine();
+
     pushSilence(primeAmt);
     mPrimeTimeoutChunks = 0;
     mState = PRIMED;
@@ -267,8 +296,10 @@ status_t AudioOutput::getNextWriteTimestamp(int64_t* timestamp,
                           &frames_queued_to_driver);
     if (OK != ret) {
         if (mLastNextWriteTimeValid) {
-            if (!hasFatalError())
+            if (!hasFatalError()) {
                 ALOGE("Underflow detected for output \"%s\"", getOutputName());
+                mUnderflowCount++;
+            }
             *discon = true;
         }
 
@@ -300,6 +331,10 @@ status_t AudioOutput::getNextWriteTimestamp(int64_t* timestamp,
         goto bailout;
     }
 
+    // Data written now comes out of the delay line (and so hits the speakers)
+    // this much later than the data being queued to the driver.
+    *timestamp += mExternalDelayLocalTicks;
+
     mLastNextWriteTime = *timestamp;
     mLastNextWriteTimeValid = true;
 
@@ -332,13 +367,149 @@ uint32_t AudioOutput::getExternalDelay_uSec() const {
 }
 
 void AudioOutput::setExternalDelay_uSec(uint32_t delay_usec) {
+    uint64_t frames = (static_cast<uint64_t>(delay_usec) * mFramesPerSec)
+                    / 1000000;
+    if (frames > mMaxDelayCompFrames)
+        frames = mMaxDelayCompFrames;
+
+    // Encoded streams can only be delayed by whole bursts.  Round to the
+    // nearest one which still fits in the delay line.
+    if (mEncodedBurstFrames) {
+        frames = ((frames + (mEncodedBurstFrames / 2)) / mEncodedBurstFrames)
+               * mEncodedBurstFrames;
+        if (frames > mMaxDelayCompFrames)
+            frames -= mEncodedBurstFrames;
+    }
+
+    Mutex::Autolock _l(mDelayLock);
     mExternalDelayUSec = delay_usec;
+    mTgtDelayFrames = static_cast<uint32_t>(frames);
+}
+
+void AudioOutput::resetDelayLine() {
+    // Called from the write path only.
+    uint32_t tgtDelay;
+    {
+        Mutex::Autolock _l(mDelayLock);
+        tgtDelay = mTgtDelayFrames;
+    }
+
+    if (mDelayLine)
+        memset(mDelayLine, 0,
+               mDelayLineFrames * mChannelCnt * sizeof(mDelayLine[0]));
+    mDelayWritePos = 0;
+    mEncodedPhase = 0;
+    setDelayFrames(tgtDelay);
+}
+
+// Called from the write path only.  mExternalDelayLocalTicks is only read
+// by getNextWriteTimestamp, which AudioFlinger never calls concurrently with
+// write, so it needs no more than that.
+void AudioOutput::setDelayFrames(uint32_t frames) {
+    mDelayFrames.store(frames, std::memory_order_relaxed);
+    mExternalDelayLocalTicks = static_cast<int64_t>(
+            (static_cast<uint64_t>(frames) *
+             mFramesToLocalTime.a_to_b_numer) /
+            mFramesToLocalTime.a_to_b_denom);
+}
+
+void AudioOutput::doDelayedPCMWrite(const uint8_t* data, size_t len) {
+    const uint32_t frameBytes = mChannelCnt * sizeof(int16_t);
+    const int16_t* src = reinterpret_cast<const int16_t*>(data);
+    uint32_t framesLeft = len / frameBytes;
+    uint32_t curDelay = mDelayFrames.load(std::memory_order_relaxed);
+    uint32_t tgtDelay;
+
+    if (!mDelayLine || !mChannelCnt) {
+        doPCMWrite(data, len);
+        return;
+    }
+
+    {
+        Mutex::Autolock _l(mDelayLock);
+        tgtDelay = mTgtDelayFrames;
+    }
+
+    while (framesLeft && !hasFatalError()) {
+        uint32_t n = (framesLeft < mFramesPerChunk) ? framesLeft
+                                                    : mFramesPerChunk;
+
+        // Append the new data to the delay line, wrapping as needed.  The line
+        // is a chunk longer than the max delay, so this never overwrites data
+        // which is still to be read below.
+        uint32_t first = mDelayLineFrames - mDelayWritePos;
+        if (first > n)
+            first = n;
+        memcpy(mDelayLine + (mDelayWritePos * mChannelCnt), src,
+               first * frameBytes);
+        if (first < n)
+            memcpy(mDelayLine, src + (first * mChannelCnt),
+                   (n - first) * frameBytes);
+
+        // PCM crossfades to the new delay over this chunk.  IEC61937 bursts
+        // can't be mixed, so encoded streams jump straight to it instead, at
+        // the first burst boundary in the chunk (if there is one).
+        bool change = (tgtDelay != curDelay);
+        bool xfade = change && !mIsEncoded;
+        uint32_t jumpAt = n;
+        if (change && mIsEncoded) {
+            jumpAt = mEncodedBurstFrames
+                   ? ((mEncodedBurstFrames - mEncodedPhase) % mEncodedBurstFrames)
+                   : 0;
+        }
+
+        uint32_t oldPos = (mDelayWritePos + mDelayLineFrames - curDelay)
+                        % mDelayLineFrames;
+        uint32_t newPos = (mDelayWritePos + mDelayLineFrames - tgtDelay)
+                        % mDelayLineFrames;
+        int16_t* out = mDelayOutBuf;
+
+        for (uint32_t i = 0; i < n; ++i) {
+            if (i == jumpAt)
+                oldPos = (newPos + i) % mDelayLineFrames;
+
+            const int16_t* a = mDelayLine + (oldPos * mChannelCnt);
+            if (xfade) {
+                // Linear Q15 ramp from the old read position to the new one.
+                const int16_t* b = mDelayLine + (newPos * mChannelCnt);
+                int32_t g = static_cast<int32_t>(((i + 1) << 15) / n);
+                for (uint32_t c = 0; c < mChannelCnt; ++c)
+                    out[c] = static_cast<int16_t>(
+                            ((a[c] * (32768 - g)) + (b[c] * g)) >> 15);
+                if (++newPos == mDelayLineFrames)
+                    newPos = 0;
+            } else {
+                memcpy(out, a, frameBytes);
+            }
+
+            out += mChannelCnt;
+            if (++oldPos == mDelayLineFrames)
+                oldPos = 0;
+        }
+
+        if (xfade || (jumpAt < n)) {
+            curDelay = tgtDelay;
+            setDelayFrames(curDelay);
+        }
+
+        if (mEncodedBurstFrames)
+            mEncodedPhase = (mEncodedPhase + n) % mEncodedBurstFrames;
+
+        mDelayWritePos = (mDelayWritePos + n) % mDelayLineFrames;
+        doPCMWrite(reinterpret_cast<const uint8_t*>(mDelayOutBuf),
+                   n * frameBytes);
+
+        src += n * mChannelCnt;
+        framesLeft -= n;
+    }
 }
 
 void AudioOutput::reset() {
     if (hasFatalError())
         return;
 
+    mResetCount++;
+
     // Flush the driver level.
     cleanupResources();
     openPCMDevice();
@@ -405,7 +576,7 @@ void AudioOutput::processOneChunk(const uint8_t* data, size_t len,
         // We need to align the ALSA buffers first.
         break;
     case ACTIVE:
-        doPCMWrite(data, len);
+        doDelayedPCMWrite(data, len);
         mFramesQueuedToDriver += len / mBytesPerFrame;
         break;
     default:
@@ -521,6 +692,30 @@ void AudioOutput::setFixedOutputLevel(float level) {
     }
 }
 
+void AudioOutput::exportState(HALStateWriter& w) {
+    w.beginObject(NULL);
+    w.addString("name", getOutputName());
+    w.addInt("devMask", devMask());
+    w.addInt("state", mState);
+    w.addInt("sampleRate", mFramesPerSec);
+    w.addInt("channels", mChannelCnt);
+    w.addInt("framesPerChunk", mFramesPerChunk);
+    w.addInt("bufferChunks", mBufferChunks);
+    w.addInt("framesQueued", mFramesQueuedToDriver);
+    w.addInt("externalDelayUsec", mExternalDelayUSec);
+    w.addInt("externalDelayFrames", getExternalDelayFrames());
+    w.addInt("underflows", mUnderflowCount);
+    w.addInt("resets", mResetCount);
+    {
+        Mutex::Autolock _l(mVolumeLock);
+        w.addFloat("volume", mVolume);
+        w.addBool("mute", mMute);
+        w.addBool("fixed", mOutputFixed);
+        w.addFloat("fixedLevel", mFixedLvl);
+    }
+    w.endObject();
+}
+
 int  AudioOutput::getHardwareTimestamp(size_t *pAvail,
                             struct timespec *pTimestamp)
 {
@@ -18,6 +18,7 @@
 #ifndef ANDROID_AUDIO_OUTPUT_H
 #define ANDROID_AUDIO_OUTPUT_H
 
+#include <atomic>
 #include <semaphore.h>
 #include <tinyalsa/asoundlib.h>
 #include <utils/LinearTransform.h>
@@ -29,6 +30,7 @@
 namespace android {
 
 class AudioStreamOut;
+class HALStateWriter;
 
 class AudioOutput : public RefBase {
   public:
@@ -80,6 +82,9 @@ class AudioOutput : public RefBase {
 
     uint32_t            getExternalDelay_uSec() const;
     void                setExternalDelay_uSec(uint32_t delay);
+    uint32_t            getExternalDelayFrames() const {
+        return mDelayFrames.load(std::memory_order_relaxed);
+    }
     void                setDelayComp_uSec(uint32_t delay_usec);
 
     void                setVolume(float vol);
@@ -97,6 +102,7 @@ class AudioOutput : public RefBase {
     uint32_t            getKernelBufferSize() { return mFramesPerChunk * mBufferChunks; }
 
     virtual void        dump(String8& result) = 0;
+    virtual void        exportState(HALStateWriter& w);
 
     virtual const char* getOutputName() = 0;
     virtual uint32_t    devMask() const = 0;
@@ -121,6 +127,9 @@ class AudioOutput : public RefBase {
     virtual status_t    getDMAStartData(int64_t* dma_start_time,
                                         int64_t* frames_queued_to_driver);
     void                doPCMWrite(const uint8_t* data, size_t len);
+    void                doDelayedPCMWrite(const uint8_t* data, size_t len);
+    void                resetDelayLine();
+    void                setDelayFrames(uint32_t frames);
     void                setupInternal();
 
     // Current state machine state.
@@ -145,10 +154,32 @@ class AudioOutput : public RefBase {
     int64_t             mLastNextWriteTime;
     int64_t             mLastDMAStartTime;
 
-    // External delay compensation.
+    // External delay compensation.  Audio headed to the device passes
+    // through a circular delay line of mDelayLineFrames frames (enough for
+    // kMaxDelayCompensationMSec plus one chunk) in the stream's 16 bit sample
+    // format.  mTgtDelayFrames is set by the settings path under mDelayLock;
+    // the write path picks it up and crossfades from mDelayFrames to the new
+    // delay over the next chunk.  Encoded (SPDIF) streams can't be
+    // crossfaded.  Their delay is kept to a whole number of IEC61937 bursts
+    // (mEncodedBurstFrames output frames each) and jumps to the new value at
+    // a burst boundary, so the receiver only ever sees complete bursts.
+    // mEncodedPhase is the position of the write path within the current
+    // burst.  Only the write path changes mDelayFrames (and with it
+    // mExternalDelayLocalTicks, see setDelayFrames), but presentation
+    // position queries read it from other threads, so it is atomic.
     uint32_t            mMaxDelayCompFrames;
     uint32_t            mExternalDelayUSec;
-    uint32_t            mExternalDelayLocalTicks;
+    int64_t             mExternalDelayLocalTicks;
+    Mutex               mDelayLock;
+    uint32_t            mTgtDelayFrames;
+    std::atomic<uint32_t> mDelayFrames;
+    int16_t*            mDelayLine;
+    int16_t*            mDelayOutBuf;
+    uint32_t            mDelayLineFrames;
+    uint32_t            mDelayWritePos;
+    bool                mIsEncoded;
+    uint32_t            mEncodedBurstFrames;
+    uint32_t            mEncodedPhase;
 
     LinearTransform     mFramesToLocalTime;
 
@@ -160,6 +191,10 @@ class AudioOutput : public RefBase {
     uint64_t            mFramesQueuedToDriver;
     uint32_t            mPrimeTimeoutChunks;
 
+    // Counters reported through exportState.
+    uint32_t            mUnderflowCount;
+    uint32_t            mResetCount;
+
     // Volume stuff
     Mutex               mVolumeLock;
     float               mVolume;
@@ -20,23 +20,25 @@
 
 #include "AudioStreamIn.h"
 #include "AudioHardwareInput.h"
+#include "HALStateWriter.h"
+#include "atv_preprocess_proxy.h"
 
 #include <assert.h>
+#include <errno.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <time.h>
 
+#include <audio_effects/effect_agc.h>
+#include <audio_effects/effect_ns.h>
+#include <cutils/properties.h>
 #include <utils/String8.h>
 #include <media/AudioParameter.h>
 
-// for turning Remote mic on/off
-#ifdef REMOTE_CONTROL_INTERFACE
-#include <IRemoteControlService.h>
-#endif
-
 namespace android {
 
 const audio_format_t AudioStreamIn::kAudioFormat = AUDIO_FORMAT_PCM_16_BIT;
@@ -45,14 +47,47 @@ const uint32_t AudioStreamIn::kChannelMask = AUDIO_CHANNEL_IN_MONO;
 // number of periods in the ALSA buffer
 const int AudioStreamIn::kPeriodCount = 4;
 
+// Moving to a new device: how long the old and new captures are blended for,
+// and how long we wait for the new one to produce anything before giving up
+// on it and staying where we are.
+const uint32_t AudioStreamIn::kCrossfadeMsec = 20;
+const nsecs_t  AudioStreamIn::kMigrationTimeout = 1000000000;
+
+// How long pre-armed or hot standby capture resources may sit unused.
+static const char* kIdleTimeoutProp = "audio.atv.capture_idle_ms";
+static const int32_t kDefaultIdleTimeoutMs = 3000;
+
+// How stereo capture devices are folded down to mono: average, left or right.
+static const char* kDownmixParamKey = "atv.input.downmix";
+
+// Pre-processing stages to run regardless of attached effects, as a comma
+// separated list of PreprocessChain stage names (or "none").  Set per stream
+// through the parameter; the system property of the same name sets the
+// default for new streams.
+static const char* kPreprocessParamKey = "atv.input.preprocess";
+
 AudioStreamIn::AudioStreamIn(AudioHardwareInput& owner)
     : mOwnerHAL(owner)
-    , mCurrentDeviceInfo(NULL)
     , mRequestedSampleRate(0)
     , mStandby(true)
     , mDisabled(false)
     , mPcm(NULL)
     , mResampler(NULL)
+    , mNativeResampler(NULL)
+    , mDownmixMode(CaptureDSP::kDownmixAverage)
+    , mParamStages(0)
+    , mFramesLost(0)
+    , mMigration(NULL)
+    , mMigrations(0)
+    , mDeviceFramesRead(0)
+    , mCaptureFramesBase(0)
+    , mLastCaptureTime(0)
+    , mArmRequested(false)
+    , mArmed(false)
+    , mHotStandby(false)
+    , mIdleSince(0)
+    , mWarmStarts(0)
+    , mColdStarts(0)
     , mBuffer(NULL)
     , mBufferSize(0)
     , mInputSource(AUDIO_SOURCE_DEFAULT)
@@ -61,13 +96,43 @@ AudioStreamIn::AudioStreamIn(AudioHardwareInput& owner)
 {
     struct resampler_buffer_provider& provider =
             mResamplerProviderWrapper.provider;
+    memset(&mCurrentDevice, 0, sizeof(mCurrentDevice));
+
     provider.get_next_buffer = getNextBufferThunk;
     provider.release_buffer = releaseBufferThunk;
     mResamplerProviderWrapper.thiz = this;
+
+    int32_t idleMs = property_get_int32(kIdleTimeoutProp, kDefaultIdleTimeoutMs);
+    mIdleTimeout = (idleMs > 0) ? ms2ns(idleMs) : 0;
+
+    char stageList[PROPERTY_VALUE_MAX];
+    uint32_t stages;
+    if (property_get(kPreprocessParamKey, stageList, NULL) > 0) {
+        if (PreprocessChain::stagesFromString(stageList, &stages)) {
+            mParamStages = stages;
+            mPreprocess.setStages(stages);
+        } else
+            ALOGW("%s: bad %s value \"%s\"", __func__, kPreprocessParamKey,
+                  stageList);
+    }
 }
 
 AudioStreamIn::~AudioStreamIn()
 {
+    sp<ArmThread> thread;
+    {
+        Mutex::Autolock _l(mLock);
+        thread = mArmThread;
+        mArmThread.clear();
+        if (thread != NULL) {
+            thread->requestExit();
+            mArmCond.signal();
+        }
+    }
+
+    if (thread != NULL)
+        thread->requestExitAndWait();
+
     Mutex::Autolock _l(mLock);
     standby_l();
 }
@@ -93,6 +158,7 @@ status_t AudioStreamIn::set(audio_format_t *pFormat, uint32_t *pChannelMask,
     }
 
     mRequestedSampleRate = *pRate;
+    mPreprocess.configure(mRequestedSampleRate);
 
     return NO_ERROR;
 }
@@ -138,41 +204,81 @@ status_t AudioStreamIn::setFormat(audio_format_t format)
 }
 
 status_t AudioStreamIn::standby()
+{
+    Mutex::Autolock _l(mLock);
+
+    if (mHotStandby)
+        return NO_ERROR;
+
+    if (canHotStandby_l()) {
+        enterHotStandby_l();
+        return NO_ERROR;
+    }
+
+    return standby_l();
+}
+
+status_t AudioStreamIn::forceStandby()
 {
     Mutex::Autolock _l(mLock);
     return standby_l();
 }
 
+status_t AudioStreamIn::forceStandbyIfUsing(unsigned int pcmCard,
+                                             unsigned int pcmDevice)
+{
+    Mutex::Autolock _l(mLock);
+
+    // Losing the device we were moving to just means staying put.
+    if ((mMigration != NULL) && (mMigration->device.pcmCard == pcmCard) &&
+        (mMigration->device.pcmDevice == pcmDevice)) {
+        ALOGI("AudioStreamIn: migration target %u:%u went away", pcmCard, pcmDevice);
+        abortMigration_l();
+    }
+
+    if (!mCurrentDevice.valid || (mCurrentDevice.pcmCard != pcmCard) ||
+        (mCurrentDevice.pcmDevice != pcmDevice)) {
+        return NO_ERROR;
+    }
+
+    return standby_l();
+}
+
 status_t AudioStreamIn::standby_l()
 {
+    abortMigration_l();
+
     if (mStandby) {
         return NO_ERROR;
     }
-    if (mPcm) {
-        ALOGD("AudioStreamIn::standby_l, call pcm_close()");
-        pcm_close(mPcm);
-        mPcm = NULL;
+    if ((mCaptureEngine != NULL) && !mHotStandby) {
+        mFramesLost += collectFramesLost_l();
+        mCaptureFramesBase += deviceToClientFrames_l(
+                mCaptureEngine->framesCaptured(mCaptureClient.get()));
+    } else if (mPcm) {
+        mCaptureFramesBase += deviceToClientFrames_l(mDeviceFramesRead);
     }
+    mDeviceFramesRead = 0;
+    mCaptureFramesBase += mSilenceClock.stop();
 
-    // Turn OFF Remote MIC if we were recording from Remote.
-    if (mCurrentDeviceInfo != NULL) {
-        if (mCurrentDeviceInfo->forVoiceRecognition) {
-            setRemoteControlMicEnabled(false);
-        }
-    }
+    releaseCapture_l();
 
     if (mResampler) {
         release_resampler(mResampler);
         mResampler = NULL;
     }
+    delete mNativeResampler;
+    mNativeResampler = NULL;
     if (mBuffer) {
         delete [] mBuffer;
         mBuffer = NULL;
     }
 
-    mCurrentDeviceInfo = NULL;
+    mCurrentDevice.valid = false;
     mStandby = true;
     mDisabled = false;
+    mArmed = false;
+    mHotStandby = false;
 
     return NO_ERROR;
 }
@@ -191,10 +297,47 @@ status_t AudioStreamIn::dump(int fd)
 
     {
         DUMP("\toutput sample rate: %d\n", mRequestedSampleRate);
-        if (mPcm) {
+        if (mPcm || (mCaptureEngine != NULL)) {
             DUMP("\tinput sample rate: %d\n", mPcmConfig.rate);
             DUMP("\tinput channels: %d\n", mPcmConfig.channels);
         }
+        DUMP("\tdownmix: %s\n", CaptureDSP::downmixModeToString(mDownmixMode));
+        DUMP("\tpre-armed: %s, hot standby: %s\n",
+             mArmed ? "yes" : "no", mHotStandby ? "yes" : "no");
+        DUMP("\twarm starts: %u, cold starts: %u\n", mWarmStarts, mColdStarts);
+        if (mNativeResampler) {
+            DUMP("\tresampler: polyphase %u/%u, %u taps/phase\n",
+                 mNativeResampler->interpolation(),
+                 mNativeResampler->decimation(),
+                 mNativeResampler->tapsPerPhase());
+        } else if (mResampler) {
+            DUMP("\tresampler: audio_utils\n");
+        }
+        if (mCaptureEngine != NULL) {
+            DUMP("\tcapture engine: %u:%u\n", mCaptureEngine->card(),
+                 mCaptureEngine->device());
+        }
+        if (mMigration != NULL) {
+            DUMP("\tmigrating to: %u:%u at %u Hz, %s\n",
+                 mMigration->device.pcmCard, mMigration->device.pcmDevice,
+                 mMigration->config.rate,
+                 mMigration->delivering ? "crossfading" : "waiting for data");
+        }
+        DUMP("\tmigrations: %u\n", mMigrations);
+        DUMP("\tpre-processing:%s\n", mPreprocess.active() ? "" : " none");
+        // CPU use is reported as a share of the audio time processed.
+        uint64_t audioUsec = mPreprocess.sampleRate() ?
+                (mPreprocess.framesProcessed() * 1000000ULL) / mPreprocess.sampleRate() : 0;
+        for (int i = 0; i < PreprocessChain::kStageCount; i++) {
+            PreprocessChain::Stage stage = static_cast<PreprocessChain::Stage>(i);
+            if (!(mPreprocess.stages() & PreprocessChain::stageBit(stage)))
+                continue;
+            int64_t cpuUsec = ns2us(mPreprocess.stageCpuNsec(stage));
+            DUMP("\t\t%-4s : %lld uSec cpu, %.3f%% of real time\n",
+                 PreprocessChain::stageName(stage),
+                 static_cast<long long>(cpuUsec),
+                 audioUsec ? (100.0 * cpuUsec) / audioUsec : 0.0);
+        }
     }
 
     ::write(fd, result.string(), result.size());
@@ -202,6 +345,35 @@ status_t AudioStreamIn::dump(int fd)
     return NO_ERROR;
 }
 
+// Called with the owning AudioHardwareInput's lock held.  Like dump(), this
+// does not take mLock, since read() holds it while calling back into the HAL.
+void AudioStreamIn::exportState(HALStateWriter& w)
+{
+    w.beginObject(NULL);
+    w.addInt("sampleRate", mRequestedSampleRate);
+    w.addInt("inputSource", mInputSource);
+    w.addBool("standby", mStandby);
+    w.addBool("disabled", mDisabled);
+    if (mPcm || (mCaptureEngine != NULL)) {
+        w.addInt("pcmRate", mPcmConfig.rate);
+        w.addInt("pcmChannels", mPcmConfig.channels);
+        w.addInt("pcmPeriodSize", mPcmConfig.period_size);
+    }
+    w.addBool("resampling", (mResampler != NULL) || (mNativeResampler != NULL));
+    w.addBool("nativeResampler", mNativeResampler != NULL);
+    w.addBool("captureEngine", mCaptureEngine != NULL);
+    w.addBool("migrating", mMigration != NULL);
+    w.addInt("migrations", mMigrations);
+    w.addBool("armed", mArmed);
+    w.addBool("hotStandby", mHotStandby);
+    w.addInt("warmStarts", mWarmStarts);
+    w.addInt("coldStarts", mColdStarts);
+    w.addString("downmix", CaptureDSP::downmixModeToString(mDownmixMode));
+    w.addInt("preprocessStages", mPreprocess.stages());
+    w.addInt("readStatus", mReadStatus);
+    w.endObject();
+}
+
 status_t AudioStreamIn::setParameters(struct audio_stream* stream,
                                       const char* kvpairs)
 {
@@ -209,11 +381,43 @@ status_t AudioStreamIn::setParameters(struct audio_stream* stream,
     AudioParameter param = AudioParameter(String8(kvpairs));
     status_t status = NO_ERROR;
     String8 keySource = String8(AudioParameter::keyInputSource);
+    String8 keyDownmix = String8(kDownmixParamKey);
+    String8 keyPreprocess = String8(kPreprocessParamKey);
+    String8 strVal;
     int intVal;
 
     if (param.getInt(keySource, intVal) == NO_ERROR) {
         ALOGI("AudioStreamIn::setParameters, mInputSource set to %d", intVal);
-        mInputSource = intVal;
+        requestPrearm(intVal);
+    }
+
+    if (param.get(keyDownmix, strVal) == NO_ERROR) {
+        CaptureDSP::DownmixMode mode;
+        if (CaptureDSP::downmixModeFromString(strVal.string(), &mode)) {
+            ALOGI("AudioStreamIn::setParameters, downmix set to %s", strVal.string());
+            // The capture path reads it once per period, under mLock.
+            Mutex::Autolock _l(mLock);
+            mDownmixMode = mode;
+        } else {
+            ALOGW("AudioStreamIn::setParameters, bad %s value \"%s\"",
+                  kDownmixParamKey, strVal.string());
+            status = BAD_VALUE;
+        }
+    }
+
+    if (param.get(keyPreprocess, strVal) == NO_ERROR) {
+        uint32_t stages;
+        if (PreprocessChain::stagesFromString(strVal.string(), &stages)) {
+            ALOGI("AudioStreamIn::setParameters, pre-processing set to %s",
+                  strVal.string());
+            Mutex::Autolock _l(mLock);
+            mParamStages = stages;
+            updatePreprocessStages_l();
+        } else {
+            ALOGW("AudioStreamIn::setParameters, bad %s value \"%s\"",
+                  kPreprocessParamKey, strVal.string());
+            status = BAD_VALUE;
+        }
     }
 
     return status;
@@ -232,23 +436,138 @@ status_t AudioStreamIn::setGain(float gain)
     return NO_ERROR;
 }
 
+// Frames dropped by the capture engine since the last call, in units of the
+// client's sample rate.
+uint32_t AudioStreamIn::collectFramesLost_l()
+{
+    if ((mCaptureEngine == NULL) || !mPcmConfig.rate)
+        return 0;
+
+    uint64_t lost = mCaptureEngine->takeFramesLost(mCaptureClient.get());
+    return static_cast<uint32_t>((lost * mRequestedSampleRate) / mPcmConfig.rate);
+}
+
+int64_t AudioStreamIn::deviceToClientFrames_l(uint64_t deviceFrames)
+{
+    if (!mPcmConfig.rate)
+        return 0;
+
+    // Channel reduction does not change the frame count; resampling scales
+    // it by the rate ratio.
+    return static_cast<int64_t>((deviceFrames * mRequestedSampleRate) /
+                                mPcmConfig.rate);
+}
+
+// The position reported is the number of frames (at the client's rate) which
+// had been captured by the device as of the returned CLOCK_MONOTONIC time.
+status_t AudioStreamIn::getCapturePosition(int64_t* frames, int64_t* time)
+{
+    Mutex::Autolock _l(mLock);
+
+    // Nothing is being captured on our behalf while idle.
+    if (mHotStandby)
+        return INVALID_OPERATION;
+
+    // With no device, report the synthetic timeline we are pacing the silence
+    // against.
+    if ((mPcm == NULL) && (mCaptureEngine == NULL)) {
+        if (!mSilenceClock.active())
+            return INVALID_OPERATION;
+
+        *frames = mCaptureFramesBase + mSilenceClock.frames();
+        *time = mSilenceClock.position();
+        return NO_ERROR;
+    }
+
+    uint64_t deviceFrames;
+    struct timespec ts;
+
+    if (mCaptureEngine != NULL) {
+        if (!mCaptureEngine->getCapturePosition(mCaptureClient.get(),
+                                                &deviceFrames, &ts))
+            return INVALID_OPERATION;
+    } else {
+        unsigned int avail;
+        if (pcm_get_htimestamp(mPcm, &avail, &ts) < 0)
+            return INVALID_OPERATION;
+        deviceFrames = mDeviceFramesRead + avail;
+    }
+
+    *frames = mCaptureFramesBase + deviceToClientFrames_l(deviceFrames);
+    *time = (static_cast<int64_t>(ts.tv_sec) * 1000000000LL) + ts.tv_nsec;
+    return NO_ERROR;
+}
+
 uint32_t AudioStreamIn::getInputFramesLost()
 {
+    Mutex::Autolock _l(mLock);
+
+    uint32_t lost = mFramesLost + collectFramesLost_l();
+    mFramesLost = 0;
+    return lost;
+}
+
+// Map a pre-processing effect onto the stages of our own chain which stand
+// in for it.  Only our pass-through proxies qualify: any other AGC or NS
+// implementation does its own processing in AudioFlinger, and running ours
+// as well would process the audio twice.  Noise suppression becomes DC
+// removal, the high-pass filter and the noise gate.
+uint32_t AudioStreamIn::preprocessStagesForEffect(effect_handle_t effect)
+{
+    effect_descriptor_t desc;
+
+    if ((effect == NULL) || ((*effect)->get_descriptor(effect, &desc) != 0))
+        return 0;
+
+    if (!memcmp(&desc.type, FX_IID_AGC, sizeof(effect_uuid_t)) &&
+        !memcmp(&desc.uuid, &atv_preprocess_agc_uuid, sizeof(effect_uuid_t)))
+        return PreprocessChain::stageBit(PreprocessChain::kStageAGC);
+
+    if (!memcmp(&desc.type, FX_IID_NS, sizeof(effect_uuid_t)) &&
+        !memcmp(&desc.uuid, &atv_preprocess_ns_uuid, sizeof(effect_uuid_t)))
+        return PreprocessChain::stageBit(PreprocessChain::kStageDCRemoval) |
+               PreprocessChain::stageBit(PreprocessChain::kStageHighPass) |
+               PreprocessChain::stageBit(PreprocessChain::kStageNoiseGate);
+
     return 0;
 }
 
+void AudioStreamIn::updatePreprocessStages_l()
+{
+    uint32_t stages = mParamStages;
+
+    for (size_t i = 0; i < mEffectStages.size(); i++)
+        stages |= mEffectStages.valueAt(i);
+
+    // Newly enabled stages start from a clean slate.
+    if (stages & ~mPreprocess.stages())
+        mPreprocess.reset();
+    mPreprocess.setStages(stages);
+}
+
 status_t AudioStreamIn::addAudioEffect(effect_handle_t effect)
 {
-    (void) effect;
-    // In other HALs, this is a no-op and returns success.
-    return 0;
+    uint32_t stages = preprocessStagesForEffect(effect);
+
+    // Effects we have no equivalent for are a no-op, as in other HALs.
+    if (!stages)
+        return NO_ERROR;
+
+    Mutex::Autolock _l(mLock);
+    mEffectStages.add(effect, stages);
+    updatePreprocessStages_l();
+
+    return NO_ERROR;
 }
 
 status_t AudioStreamIn::removeAudioEffect(effect_handle_t effect)
 {
-    (void) effect;
-    // In other HALs, this is a no-op and returns success.
-    return 0;
+    Mutex::Autolock _l(mLock);
+
+    if (mEffectStages.removeItem(effect) >= 0)
+        updatePreprocessStages_l();
+
+    return NO_ERROR;
 }
 
 ssize_t AudioStreamIn::read(void* buffer, size_t bytes)
@@ -257,7 +576,16 @@ ssize_t AudioStreamIn::read(void* buffer, size_t bytes)
 
     status_t status = NO_ERROR;
 
+    if (mHotStandby)
+        resume_l();
+
+    if (mArmed) {
+        mArmed = false;
+        mWarmStarts++;
+    }
+
     if (mStandby) {
+        mColdStarts++;
         status = startInputStream_l();
         // Only try to start once to prevent pointless spew.
         // If mic is not available then read will return silence.
@@ -271,18 +599,20 @@ ssize_t AudioStreamIn::read(void* buffer, size_t bytes)
     if ((status == NO_ERROR) && !mDisabled) {
         int ret = readFrames_l(buffer, bytes / getFrameSize());
         status = (ret < 0) ? INVALID_OPERATION : NO_ERROR;
+
+        if ((status == NO_ERROR) && (mMigration != NULL))
+            stepMigration_l(static_cast<int16_t*>(buffer), bytes / getFrameSize());
     }
 
     if ((status != NO_ERROR) || mDisabled) {
         memset(buffer, 0, bytes);
-
-        // TODO: This code needs to project a timeline based on the number
-        // of audio frames synthesized from the last time we returned data
-        // from an actual audio device (or establish a fake timeline to obey
-        // if we have never returned any data from an actual device and need
-        // to synth on the first call to read)
-        usleep(bytes * 1000000 / getFrameSize() / mRequestedSampleRate);
+        waitForSilenceDeadline_l(bytes / getFrameSize());
     } else {
+        mLastCaptureTime = systemTime();
+        mCaptureFramesBase += mSilenceClock.stop();
+
+        mPreprocess.process(static_cast<int16_t*>(buffer), bytes / getFrameSize());
+
         bool mute;
         mOwnerHAL.getMicMute(&mute);
         if (mute) {
@@ -293,83 +623,98 @@ ssize_t AudioStreamIn::read(void* buffer, size_t bytes)
     return bytes;
 }
 
-void AudioStreamIn::setRemoteControlMicEnabled(bool flag)
+// Hand out silence at the rate a real device would have delivered it.  The
+// synthetic timeline continues from the last real read if there was one
+// recently, otherwise it starts now.
+void AudioStreamIn::waitForSilenceDeadline_l(size_t frames)
 {
-#ifdef REMOTE_CONTROL_INTERFACE
-    sp<IRemoteControlService> service = IRemoteControlService::getInstance();
-    if (service == NULL) {
-        ALOGE("%s: No RemoteControl service detected, ignoring\n", __func__);
-        return;
-    }
-    service->setMicEnabled(flag);
-#else
-    (void)flag;
-#endif
-}
+    nsecs_t now = systemTime();
 
-status_t AudioStreamIn::startInputStream_l()
-{
+    if (!mSilenceClock.active())
+        mSilenceClock.start(now, mLastCaptureTime, mRequestedSampleRate);
 
-    ALOGI("AudioStreamIn::startInputStream_l, entry, built %s", __DATE__);
+    nsecs_t deadline = mSilenceClock.advance(now, frames);
+    struct timespec ts;
+    ts.tv_sec = deadline / 1000000000LL;
+    ts.tv_nsec = deadline % 1000000000LL;
 
-    // Get the most appropriate device for the given input source, eg VOICE_RECOGNITION
-    const AudioHotplugThread::DeviceInfo *deviceInfo = mOwnerHAL.getBestDevice(mInputSource);
-    if (deviceInfo == NULL) {
-        return INVALID_OPERATION;
-    }
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+}
 
-    memset(&mPcmConfig, 0, sizeof(mPcmConfig));
+// The PCM configuration we would like to capture from a device with.
+void AudioStreamIn::buildPcmConfig(const AudioHotplugThread::DeviceInfo& deviceInfo,
+                                   struct pcm_config* config)
+{
+    memset(config, 0, sizeof(*config));
 
     unsigned int requestedChannelCount = getChannelCount();
 
     // Clip to min/max available.
-    if (requestedChannelCount < deviceInfo->minChannelCount ) {
-        mPcmConfig.channels = deviceInfo->minChannelCount;
-    } else if (requestedChannelCount > deviceInfo->maxChannelCount ) {
-        mPcmConfig.channels = deviceInfo->maxChannelCount;
+    if (requestedChannelCount < deviceInfo.minChannelCount ) {
+        config->channels = deviceInfo.minChannelCount;
+    } else if (requestedChannelCount > deviceInfo.maxChannelCount ) {
+        config->channels = deviceInfo.maxChannelCount;
     } else {
-        mPcmConfig.channels = requestedChannelCount;
+        config->channels = requestedChannelCount;
     }
 
-    ALOGD("AudioStreamIn::startInputStream_l, mRequestedSampleRate = %d",
-        mRequestedSampleRate);
+    // Use a native rate where we can, so no resampling is needed.
+    config->rate = deviceInfo.bestRateFor(mRequestedSampleRate);
 
-    // Clip to min/max available from driver.
-    uint32_t chosenSampleRate = mRequestedSampleRate;
-    if (chosenSampleRate < deviceInfo->minSampleRate) {
-        chosenSampleRate = deviceInfo->minSampleRate;
-    } else if (chosenSampleRate > deviceInfo->maxSampleRate) {
-        chosenSampleRate = deviceInfo->maxSampleRate;
+    config->period_size =
+            AudioHardwareInput::kPeriodMsec * config->rate / 1000;
+    if (deviceInfo.maxPeriodSize) {
+        if (config->period_size < deviceInfo.minPeriodSize) {
+            config->period_size = deviceInfo.minPeriodSize;
+        } else if (config->period_size > deviceInfo.maxPeriodSize) {
+            config->period_size = deviceInfo.maxPeriodSize;
+        }
     }
+    config->period_count = kPeriodCount;
+    config->format = PCM_FORMAT_S16_LE;
+}
 
-    // Turn on RemoteControl MIC if we are recording from it.
-    if (deviceInfo->forVoiceRecognition) {
-        setRemoteControlMicEnabled(true);
+status_t AudioStreamIn::startInputStream_l()
+{
+
+    ALOGI("AudioStreamIn::startInputStream_l, entry, built %s", __DATE__);
+
+    // Get the most appropriate device for the given input source, eg VOICE_RECOGNITION
+    AudioHotplugThread::DeviceInfo deviceInfo;
+    if (!mOwnerHAL.getBestDevice(mInputSource, mRequestedSampleRate,
+                                 getChannelCount(), &deviceInfo)) {
+        return INVALID_OPERATION;
     }
 
-    mPcmConfig.rate = chosenSampleRate;
+    ALOGD("AudioStreamIn::startInputStream_l, mRequestedSampleRate = %d",
+        mRequestedSampleRate);
 
-    mPcmConfig.period_size =
-            AudioHardwareInput::kPeriodMsec * mPcmConfig.rate / 1000;
-    mPcmConfig.period_count = kPeriodCount;
-    mPcmConfig.format = PCM_FORMAT_S16_LE;
+    buildPcmConfig(deviceInfo, &mPcmConfig);
 
-    ALOGD("AudioStreamIn::startInputStream_l, call pcm_open()");
-    struct pcm* pcm = pcm_open(deviceInfo->pcmCard, deviceInfo->pcmDevice,
-                               PCM_IN, &mPcmConfig);
+    if (CaptureEngine::isEnabled()) {
+        status_t res = mOwnerHAL.acquireCaptureEngine(&deviceInfo, mPcmConfig,
+                                                      &mCaptureEngine,
+                                                      &mCaptureClient);
+        if (res != NO_ERROR) {
+            ALOGE("ERROR AudioStreamIn::startInputStream_l, no capture engine");
+            return res;
+        }
 
-    if (!pcm_is_ready(pcm)) {
-        ALOGE("ERROR AudioStreamIn::startInputStream_l, pcm_open failed");
-        pcm_close(pcm);
-        if (deviceInfo->forVoiceRecognition) {
-            setRemoteControlMicEnabled(false);
+        // Someone else may already be capturing from this device, in which
+        // case we take the device as they configured it and convert from
+        // there.
+        mPcmConfig = mCaptureEngine->config();
+    } else {
+        status_t res = openPcm_l(deviceInfo);
+        if (res != NO_ERROR) {
+            return res;
         }
-        return NO_MEMORY;
     }
 
-    mCurrentDeviceInfo = deviceInfo;
+    mCurrentDevice = deviceInfo;
 
-    mBufferSize = pcm_frames_to_bytes(pcm, mPcmConfig.period_size);
+    mBufferSize = mPcmConfig.period_size * mPcmConfig.channels * sizeof(int16_t);
     if (mBuffer) {
         delete [] mBuffer;
     }
@@ -379,7 +724,18 @@ status_t AudioStreamIn::startInputStream_l()
         release_resampler(mResampler);
         mResampler = NULL;
     }
-    if (mPcmConfig.rate != mRequestedSampleRate) {
+    delete mNativeResampler;
+    mNativeResampler = NULL;
+    mFramesIn = 0;
+    mPreprocess.reset();
+
+    if ((mPcmConfig.rate != mRequestedSampleRate) &&
+        PolyphaseResampler::supports(mPcmConfig.rate, mRequestedSampleRate)) {
+        ALOGD("AudioStreamIn::startInputStream_l, polyphase resampler (%d to %d)",
+            mPcmConfig.rate, mRequestedSampleRate);
+        mNativeResampler = new PolyphaseResampler(mPcmConfig.rate,
+                                                  mRequestedSampleRate);
+    } else if (mPcmConfig.rate != mRequestedSampleRate) {
         ALOGD("AudioStreamIn::startInputStream_l, call create_resampler( %d  to %d)",
             mPcmConfig.rate, mRequestedSampleRate);
         int ret = create_resampler(mPcmConfig.rate,
@@ -390,16 +746,456 @@ status_t AudioStreamIn::startInputStream_l()
                                    &mResampler);
         if (ret != 0) {
             ALOGW("AudioStreamIn: unable to create resampler");
-            pcm_close(pcm);
+            releaseCapture_l();
+            mCurrentDevice.valid = false;
             return static_cast<status_t>(ret);
         }
     }
 
+    return NO_ERROR;
+}
+
+// Open a PCM of our own, for when streams are not sharing capture engines.
+status_t AudioStreamIn::openPcm_l(const AudioHotplugThread::DeviceInfo& deviceInfo)
+{
+    // Turn on RemoteControl MIC if we are recording from it.
+    if (deviceInfo.forVoiceRecognition) {
+        AudioHardwareInput::setRemoteControlMicEnabled(true);
+    }
+
+    ALOGD("AudioStreamIn::startInputStream_l, call pcm_open()");
+    // Use the PCM_MONOTONIC clock for get_capture_position.
+    struct pcm* pcm = pcm_open(deviceInfo.pcmCard, deviceInfo.pcmDevice,
+                               PCM_IN | PCM_MONOTONIC, &mPcmConfig);
+
+    if (!pcm_is_ready(pcm)) {
+        ALOGE("ERROR AudioStreamIn::startInputStream_l, pcm_open failed");
+        pcm_close(pcm);
+        if (deviceInfo.forVoiceRecognition) {
+            AudioHardwareInput::setRemoteControlMicEnabled(false);
+        }
+        return NO_MEMORY;
+    }
+
     mPcm = pcm;
+    return NO_ERROR;
+}
+
+// Give up whichever of mPcm or the capture engine we are reading from.
+void AudioStreamIn::releaseCapture_l()
+{
+    if (mCaptureEngine != NULL) {
+        mOwnerHAL.releaseCaptureEngine(mCaptureEngine, mCaptureClient);
+        mCaptureEngine.clear();
+        mCaptureClient.clear();
+    }
+
+    if (mPcm) {
+        ALOGD("AudioStreamIn::standby_l, call pcm_close()");
+        pcm_close(mPcm);
+        mPcm = NULL;
+
+        // Turn OFF Remote MIC if we were recording from Remote.
+        if (mCurrentDevice.valid && mCurrentDevice.forVoiceRecognition) {
+            AudioHardwareInput::setRemoteControlMicEnabled(false);
+        }
+    }
+}
+
+bool AudioStreamIn::ensureArmThread_l()
+{
+    if (mArmThread != NULL)
+        return true;
+
+    mArmThread = new ArmThread(*this);
+    if (mArmThread->run("ATVCaptureArm") != NO_ERROR) {
+        ALOGE("AudioStreamIn: unable to start pre-arm thread");
+        mArmThread.clear();
+        return false;
+    }
+
+    return true;
+}
+
+void AudioStreamIn::requestPrearm(int inputSource)
+{
+    Mutex::Autolock _l(mLock);
+
+    if (inputSource != AUDIO_SOURCE_DEFAULT)
+        mInputSource = inputSource;
+
+    if (!mIdleTimeout || !mStandby || !ensureArmThread_l())
+        return;
+
+    mArmRequested = true;
+    mArmCond.signal();
+}
+
+void AudioStreamIn::prearm_l()
+{
+    if (!mStandby || mDisabled)
+        return;
+
+    // On failure, stay in standby and let the first read() try again (and
+    // fall back to silence) the way it always has.
+    if (startInputStream_l() != NO_ERROR) {
+        ALOGW("AudioStreamIn: pre-arm for source %d failed", mInputSource);
+        return;
+    }
+
+    ALOGI("AudioStreamIn: pre-armed capture for source %d", mInputSource);
+    mStandby = false;
+    mArmed = true;
+    mIdleSince = systemTime();
+}
+
+// Only the voice recognition device is kept hot; it is the one whose start
+// up cost (a binder round trip to the remote control service, and the remote
+// turning its mic on) lands in front of the user's first syllable.
+bool AudioStreamIn::canHotStandby_l()
+{
+    return mIdleTimeout && !mStandby && !mDisabled &&
+           ((mPcm != NULL) || (mCaptureEngine != NULL)) &&
+           mCurrentDevice.valid && mCurrentDevice.forVoiceRecognition &&
+           ensureArmThread_l();
+}
+
+void AudioStreamIn::enterHotStandby_l()
+{
+    // resume_l() re-picks the device anyway.
+    abortMigration_l();
+
+    if (mCaptureEngine != NULL) {
+        // Stay attached.  The engine keeps running (other streams may be
+        // using it anyway) and resume_l() rejoins at the live edge.
+        mFramesLost += collectFramesLost_l();
+        mCaptureFramesBase += deviceToClientFrames_l(
+                mCaptureEngine->framesCaptured(mCaptureClient.get()));
+    } else {
+        mCaptureFramesBase += deviceToClientFrames_l(mDeviceFramesRead);
+        mDeviceFramesRead = 0;
+
+        // Stop (but keep) the PCM and leave the remote's mic on.  The next
+        // pcm_read restarts capture.
+        pcm_stop(mPcm);
+    }
+
+    mArmed = false;
+    mHotStandby = true;
+    mIdleSince = systemTime();
+    mArmCond.signal();
+}
+
+void AudioStreamIn::resume_l()
+{
+    mHotStandby = false;
+
+    // The input source may have changed while we were idle.
+    AudioHotplugThread::DeviceInfo best;
+    if (!mOwnerHAL.getBestDevice(mInputSource, mRequestedSampleRate,
+                                 getChannelCount(), &best) ||
+        (best.pcmCard != mCurrentDevice.pcmCard) ||
+        (best.pcmDevice != mCurrentDevice.pcmDevice)) {
+        standby_l();
+        return;
+    }
+
+    // Anything still buffered is stale.
+    mFramesIn = 0;
+    if (mNativeResampler)
+        mNativeResampler->reset();
+    if (mResampler)
+        mResampler->reset(mResampler);
+    mPreprocess.reset();
+
+    if (mCaptureEngine != NULL)
+        mCaptureEngine->skipToLive(mCaptureClient.get());
+    mWarmStarts++;
+}
+
+/*
+ * Device migration
+ */
+
+AudioStreamIn::Migration::Migration()
+    : resampler(NULL)
+    , buffer(NULL)
+    , framesIn(0)
+    , scratch(NULL)
+    , scratchFrames(0)
+    , delivering(false)
+    , fadePos(0)
+    , fadeLen(0)
+    , started(0)
+{
+    memset(&device, 0, sizeof(device));
+    memset(&config, 0, sizeof(config));
+}
+
+AudioStreamIn::Migration::~Migration()
+{
+    delete resampler;
+    delete [] buffer;
+    delete [] scratch;
+}
+
+void AudioStreamIn::reevaluateDevice()
+{
+    Mutex::Autolock _l(mLock);
+
+    // Idle streams pick their device when they next start (or resume).
+    if (mStandby || mHotStandby)
+        return;
+
+    // Handing out silence for want of a device; start over on the new one.
+    if (mDisabled) {
+        standby_l();
+        return;
+    }
+
+    AudioHotplugThread::DeviceInfo best;
+    if (!mOwnerHAL.getBestDevice(mInputSource, mRequestedSampleRate,
+                                 getChannelCount(), &best))
+        return;
+
+    if ((best.pcmCard == mCurrentDevice.pcmCard) &&
+        (best.pcmDevice == mCurrentDevice.pcmDevice)) {
+        // Still the best; forget any move to a device we no longer prefer.
+        abortMigration_l();
+        return;
+    }
+
+    if ((mMigration != NULL) && (mMigration->device.pcmCard == best.pcmCard) &&
+        (mMigration->device.pcmDevice == best.pcmDevice))
+        return;
+
+    abortMigration_l();
+
+    ALOGI("AudioStreamIn: moving from %u:%u to %u:%u", mCurrentDevice.pcmCard,
+          mCurrentDevice.pcmDevice, best.pcmCard, best.pcmDevice);
+
+    // Nobody is reading yet, so there is nothing to keep continuous.
+    if (mArmed) {
+        standby_l();
+        prearm_l();
+        return;
+    }
+
+    if ((mCaptureEngine == NULL) || (startMigration_l(best) != NO_ERROR)) {
+        ALOGI("AudioStreamIn: no seamless move possible, restarting capture");
+        standby_l();
+    }
+}
+
+status_t AudioStreamIn::startMigration_l(const AudioHotplugThread::DeviceInfo& target)
+{
+    Migration* m = new Migration();
+    struct pcm_config config;
+
+    buildPcmConfig(target, &config);
+    status_t res = mOwnerHAL.acquireCaptureEngine(&target, config, &m->engine,
+                                                  &m->client);
+    if (res != NO_ERROR) {
+        delete m;
+        return res;
+    }
+
+    m->device = target;
+    m->config = m->engine->config();
+
+    // The old side may be using the audio_utils resampler through the
+    // buffer provider; the new side has to make do without one.
+    if (m->config.rate != mRequestedSampleRate) {
+        if (!PolyphaseResampler::supports(m->config.rate, mRequestedSampleRate)) {
+            mOwnerHAL.releaseCaptureEngine(m->engine, m->client);
+            delete m;
+            return INVALID_OPERATION;
+        }
+        m->resampler = new PolyphaseResampler(m->config.rate, mRequestedSampleRate);
+    }
+
+    m->buffer = new int16_t[m->config.period_size * m->config.channels];
+    m->fadeLen = (kCrossfadeMsec * mRequestedSampleRate) / 1000;
+    m->started = systemTime();
+    mMigration = m;
 
     return NO_ERROR;
 }
 
+void AudioStreamIn::abortMigration_l()
+{
+    if (mMigration == NULL)
+        return;
+
+    mOwnerHAL.releaseCaptureEngine(mMigration->engine, mMigration->client);
+    delete mMigration;
+    mMigration = NULL;
+}
+
+// Run the migration alongside a successful read of frames from the current
+// device into buffer.
+void AudioStreamIn::stepMigration_l(int16_t* buffer, size_t frames)
+{
+    Migration* m = mMigration;
+
+    if (!m->delivering) {
+        // Devices (Bluetooth remotes in particular) can take a while to
+        // produce their first period.  Until then the old one carries on
+        // alone.
+        if (m->engine->framesAvailable(m->client.get()) < m->config.period_size) {
+            if ((systemTime() - m->started) > kMigrationTimeout) {
+                ALOGW("AudioStreamIn: %u:%u delivered nothing, staying on %u:%u",
+                      m->device.pcmCard, m->device.pcmDevice,
+                      mCurrentDevice.pcmCard, mCurrentDevice.pcmDevice);
+                abortMigration_l();
+            }
+            return;
+        }
+
+        ALOGI("AudioStreamIn: %u:%u delivering after %lld mSec, crossfading",
+              m->device.pcmCard, m->device.pcmDevice,
+              static_cast<long long>(ns2ms(systemTime() - m->started)));
+        m->delivering = true;
+    }
+
+    if (m->scratchFrames < frames) {
+        delete [] m->scratch;
+        m->scratch = new int16_t[frames];
+        m->scratchFrames = frames;
+    }
+
+    int ret = readMigration_l(m->scratch, frames);
+    if (ret != 0) {
+        ALOGW("AudioStreamIn: read error %d from %u:%u, staying on %u:%u", ret,
+              m->device.pcmCard, m->device.pcmDevice,
+              mCurrentDevice.pcmCard, mCurrentDevice.pcmDevice);
+        abortMigration_l();
+        return;
+    }
+
+    CaptureDSP::crossfade(buffer, buffer, m->scratch, frames, m->fadePos, m->fadeLen);
+    m->fadePos += frames;
+
+    if (m->fadePos >= m->fadeLen)
+        completeMigration_l();
+}
+
+// Like readFramesNative_l, for the device being migrated to.
+int AudioStreamIn::readMigration_l(int16_t* out, size_t frames)
+{
+    Migration* m = mMigration;
+    size_t done = 0;
+
+    while (done < frames) {
+        if (m->framesIn == 0) {
+            int ret = m->engine->read(m->client.get(), m->buffer,
+                                      m->config.period_size);
+            if (ret)
+                return ret;
+
+            m->framesIn = m->config.period_size;
+            if (m->config.channels == 2) {
+                CaptureDSP::downmixStereo(m->buffer, m->buffer, m->framesIn,
+                                          mDownmixMode);
+            }
+        }
+
+        const int16_t* in = m->buffer + (m->config.period_size - m->framesIn);
+        if (m->resampler) {
+            size_t consumed = 0;
+            done += m->resampler->process(in, m->framesIn, &consumed,
+                                          out + done, frames - done);
+            m->framesIn -= consumed;
+        } else {
+            size_t n = frames - done;
+            if (n > m->framesIn)
+                n = m->framesIn;
+            memcpy(out + done, in, n * sizeof(*out));
+            done += n;
+            m->framesIn -= n;
+        }
+    }
+
+    return 0;
+}
+
+// The fade is done; the new device becomes the current one.
+void AudioStreamIn::completeMigration_l()
+{
+    Migration* m = mMigration;
+
+    mFramesLost += collectFramesLost_l();
+    mCaptureFramesBase += deviceToClientFrames_l(
+            mCaptureEngine->framesCaptured(mCaptureClient.get()));
+    releaseCapture_l();
+
+    if (mResampler) {
+        release_resampler(mResampler);
+        mResampler = NULL;
+    }
+    delete mNativeResampler;
+    delete [] mBuffer;
+
+    mCaptureEngine = m->engine;
+    mCaptureClient = m->client;
+    mPcmConfig = m->config;
+    mCurrentDevice = m->device;
+    mNativeResampler = m->resampler;
+    mBuffer = m->buffer;
+    mBufferSize = mPcmConfig.period_size * mPcmConfig.channels * sizeof(int16_t);
+    mFramesIn = m->framesIn;
+
+    // The position carries on from where the old device left it; what the
+    // new one captured during the fade is already behind us.
+    mCaptureFramesBase -= deviceToClientFrames_l(
+            mCaptureEngine->framesCaptured(mCaptureClient.get()));
+
+    m->resampler = NULL;
+    m->buffer = NULL;
+    delete m;
+    mMigration = NULL;
+    mMigrations++;
+
+    ALOGI("AudioStreamIn: now capturing from %u:%u at %u Hz",
+          mCurrentDevice.pcmCard, mCurrentDevice.pcmDevice, mPcmConfig.rate);
+}
+
+nsecs_t AudioStreamIn::idleDeadline_l()
+{
+    if (!mIdleTimeout || (!mArmed && !mHotStandby))
+        return 0;
+
+    return mIdleSince + mIdleTimeout;
+}
+
+bool AudioStreamIn::ArmThread::threadLoop()
+{
+    Mutex::Autolock _l(mOwner.mLock);
+
+    if (exitPending())
+        return false;
+
+    if (mOwner.mArmRequested) {
+        mOwner.mArmRequested = false;
+        mOwner.prearm_l();
+    }
+
+    nsecs_t deadline = mOwner.idleDeadline_l();
+    nsecs_t now = systemTime();
+
+    if (!deadline) {
+        mOwner.mArmCond.wait(mOwner.mLock);
+    } else if (now >= deadline) {
+        ALOGI("AudioStreamIn: capture idle for %lld mSec, releasing",
+              static_cast<long long>(ns2ms(mOwner.mIdleTimeout)));
+        mOwner.standby_l();
+    } else {
+        mOwner.mArmCond.waitRelative(mOwner.mLock, deadline - now);
+    }
+
+    return true;
+}
+
 // readFrames() reads frames from kernel driver, down samples to the capture
 // rate if necessary and outputs the number of frames requested to the buffer
 // specified
@@ -408,6 +1204,22 @@ ssize_t AudioStreamIn::readFrames_l(void* buffer, ssize_t frames)
     ssize_t framesWr = 0;
     size_t frameSize = getFrameSize();
 
+    if (mNativeResampler)
+        return readFramesNative_l(buffer, frames);
+
+    // Mono at the client's rate needs no processing at all, so copy straight
+    // out of the engine's ring into the client's buffer.
+    if ((mCaptureEngine != NULL) && (mResampler == NULL) &&
+        (mPcmConfig.channels == 1) && (mFramesIn == 0)) {
+        mReadStatus = mCaptureEngine->read(mCaptureClient.get(),
+                                           static_cast<int16_t*>(buffer), frames);
+        if (mReadStatus != 0) {
+            ALOGE("readFrames_l() capture engine read error %d", mReadStatus);
+            return mReadStatus;
+        }
+        return frames;
+    }
+
     while (framesWr < frames) {
         size_t framesRd = frames - framesWr;
         if (mResampler) {
@@ -441,6 +1253,33 @@ ssize_t AudioStreamIn::readFrames_l(void* buffer, ssize_t frames)
     return framesWr;
 }
 
+// Same as readFrames_l, but driving the polyphase resampler straight from the
+// period buffer rather than through the resampler_buffer_provider interface.
+ssize_t AudioStreamIn::readFramesNative_l(void* buffer, ssize_t frames)
+{
+    int16_t* out = static_cast<int16_t*>(buffer);
+    ssize_t framesWr = 0;
+
+    while (framesWr < frames) {
+        struct resampler_buffer buf;
+        buf.raw = NULL;
+        buf.frame_count = mPcmConfig.period_size;
+
+        getNextBuffer(&buf);
+        if (mReadStatus != 0)
+            return mReadStatus;
+
+        size_t consumed = 0;
+        framesWr += mNativeResampler->process(buf.i16, buf.frame_count,
+                                              &consumed, out + framesWr,
+                                              frames - framesWr);
+        buf.frame_count = consumed;
+        releaseBuffer(&buf);
+    }
+
+    return framesWr;
+}
+
 int AudioStreamIn::getNextBufferThunk(
         struct resampler_buffer_provider* bufferProvider,
         struct resampler_buffer* buffer)
@@ -472,7 +1311,7 @@ int AudioStreamIn::getNextBuffer(struct resampler_buffer* buffer)
         return -EINVAL;
     }
 
-    if (mPcm == NULL) {
+    if ((mPcm == NULL) && (mCaptureEngine == NULL)) {
         buffer->raw = NULL;
         buffer->frame_count = 0;
         mReadStatus = -ENODEV;
@@ -480,7 +1319,14 @@ int AudioStreamIn::getNextBuffer(struct resampler_buffer* buffer)
     }
 
     if (mFramesIn == 0) {
-        mReadStatus = pcm_read(mPcm, mBuffer, mBufferSize);
+        if (mCaptureEngine != NULL) {
+            mReadStatus = mCaptureEngine->read(mCaptureClient.get(), mBuffer,
+                                               mPcmConfig.period_size);
+        } else {
+            mReadStatus = pcm_read(mPcm, mBuffer, mBufferSize);
+            if (!mReadStatus)
+                mDeviceFramesRead += mPcmConfig.period_size;
+        }
         if (mReadStatus) {
             ALOGE("get_next_buffer() pcm_read error %d", mReadStatus);
             buffer->raw = NULL;
@@ -490,12 +1336,7 @@ int AudioStreamIn::getNextBuffer(struct resampler_buffer* buffer)
 
         mFramesIn = mPcmConfig.period_size;
         if (mPcmConfig.channels == 2) {
-            // Discard the right channel.
-            // TODO: this is what other HALs are doing to handle stereo input
-            // devices.  Need to verify if this is appropriate for ATV Remote.
-            for (unsigned int i = 1; i < mFramesIn; i++) {
-                mBuffer[i] = mBuffer[i * 2];
-            }
+            CaptureDSP::downmixStereo(mBuffer, mBuffer, mFramesIn, mDownmixMode);
         }
     }
 
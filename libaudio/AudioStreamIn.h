@@ -22,13 +22,18 @@
 #include <hardware/audio.h>
 #include <tinyalsa/asoundlib.h>
 #include <utils/Errors.h>
+#include <utils/KeyedVector.h>
 #include <utils/threads.h>
 
 #include "AudioHotplugThread.h"
+#include "CaptureDSP.h"
+#include "CaptureEngine.h"
+#include "SilenceClock.h"
 
 namespace android {
 
 class AudioHardwareInput;
+class HALStateWriter;
 
 class AudioStreamIn {
   public:
@@ -42,13 +47,18 @@ class AudioStreamIn {
     audio_format_t    getFormat();
     status_t          setFormat(audio_format_t format);
     status_t          standby();
+    // Full standby, never leaving a hot PCM behind.  Used by the HAL when the
+    // device set changes or the stream is closed.
+    status_t          forceStandby();
     status_t          dump(int fd);
+    void              exportState(HALStateWriter& w);
     status_t          setParameters(struct audio_stream* stream,
                                     const char* kvpairs);
     char*             getParameters(const char* keys);
     status_t          setGain(float gain);
     ssize_t           read(void* buffer, size_t bytes);
     uint32_t          getInputFramesLost();
+    status_t          getCapturePosition(int64_t* frames, int64_t* time);
     status_t          addAudioEffect(effect_handle_t effect);
     status_t          removeAudioEffect(effect_handle_t effect);
 
@@ -56,9 +66,55 @@ class AudioStreamIn {
                           uint32_t       *pChannelMask,
                           uint32_t       *pRate);
 
-    const AudioHotplugThread::DeviceInfo* getDeviceInfo() { return mCurrentDeviceInfo; };
+    // forceStandby() if the stream is capturing from the given device.
+    status_t          forceStandbyIfUsing(unsigned int pcmCard,
+                                          unsigned int pcmDevice);
+
+    // Called when a capture device appears.  If the stream would now pick a
+    // different device, move it there: through a crossfade from the old
+    // capture engine to the new one where possible, or else via standby.
+    void              reevaluateDevice();
+
+    // Set the input source (if not AUDIO_SOURCE_DEFAULT) and bring the
+    // capture path up in the background, so the first read() does not pay
+    // for it.
+    void              requestPrearm(int inputSource);
 
   private:
+    // Services pre-arm requests, and drops pre-armed or hot standby
+    // resources which have sat idle for longer than mIdleTimeout.
+    class ArmThread : public Thread {
+      public:
+        explicit ArmThread(AudioStreamIn& owner)
+            : Thread(false), mOwner(owner) {}
+      private:
+        virtual bool threadLoop();
+        AudioStreamIn& mOwner;
+    };
+
+    // A move to another device in progress.  The new engine's output is
+    // converted to the client format alongside the old one's until it is
+    // delivering, then faded in over kCrossfadeMsec, after which it takes
+    // the place of the old.
+    struct Migration {
+        Migration();
+        ~Migration();
+
+        AudioHotplugThread::DeviceInfo device;
+        struct pcm_config         config;
+        sp<CaptureEngine>         engine;
+        sp<CaptureEngine::Client> client;
+        PolyphaseResampler*       resampler;
+        int16_t*                  buffer;       // one period, downmixed in place
+        unsigned int              framesIn;     // unconsumed frames in buffer
+        int16_t*                  scratch;      // the new side of a crossfade
+        size_t                    scratchFrames;
+        bool                      delivering;
+        size_t                    fadePos;
+        size_t                    fadeLen;
+        nsecs_t                   started;
+    };
+
     static const uint32_t kChannelMask;
     static const uint32_t kChannelCount;
     static const audio_format_t kAudioFormat;
@@ -71,12 +127,32 @@ class AudioStreamIn {
         return getChannelCount() * audio_bytes_per_sample(kAudioFormat);
     }
 
-    void              setRemoteControlMicEnabled(bool flag);
-
+    void              buildPcmConfig(const AudioHotplugThread::DeviceInfo& deviceInfo,
+                                     struct pcm_config* config);
     status_t          startInputStream_l();
+    void              waitForSilenceDeadline_l(size_t frames);
     status_t          standby_l();
+    status_t          openPcm_l(const AudioHotplugThread::DeviceInfo& deviceInfo);
+    void              releaseCapture_l();
+    void              prearm_l();
+    bool              canHotStandby_l();
+    void              enterHotStandby_l();
+    void              resume_l();
+    nsecs_t           idleDeadline_l();
+    bool              ensureArmThread_l();
+    uint32_t          collectFramesLost_l();
+    void              updatePreprocessStages_l();
+    static uint32_t   preprocessStagesForEffect(effect_handle_t effect);
+    int64_t           deviceToClientFrames_l(uint64_t deviceFrames);
+
+    status_t          startMigration_l(const AudioHotplugThread::DeviceInfo& target);
+    void              abortMigration_l();
+    void              stepMigration_l(int16_t* buffer, size_t frames);
+    void              completeMigration_l();
+    int               readMigration_l(int16_t* out, size_t frames);
 
     ssize_t           readFrames_l(void* buffer, ssize_t frames);
+    ssize_t           readFramesNative_l(void* buffer, ssize_t frames);
 
     // resampler buffer provider thunks
     static int        getNextBufferThunk(
@@ -91,9 +167,12 @@ class AudioStreamIn {
     void              releaseBuffer(struct resampler_buffer* buffer);
 
     static const int  kPeriodCount;
+    static const uint32_t kCrossfadeMsec;
+    static const nsecs_t  kMigrationTimeout;
 
     AudioHardwareInput& mOwnerHAL;
-    const AudioHotplugThread::DeviceInfo* mCurrentDeviceInfo;
+    // A copy of the device we are capturing from; valid is false when none.
+    AudioHotplugThread::DeviceInfo mCurrentDevice;
 
     Mutex mLock;
 
@@ -110,6 +189,57 @@ class AudioStreamIn {
         AudioStreamIn* thiz;
     } mResamplerProviderWrapper;
 
+    // Used instead of mResampler whenever it supports the conversion.
+    PolyphaseResampler*     mNativeResampler;
+    CaptureDSP::DownmixMode mDownmixMode;
+
+    // Pre-processing run on the client stream.  The stages are those standing
+    // in for attached proxy effects (see atv_preprocess_proxy.h) plus any set
+    // through atv.input.preprocess.
+    PreprocessChain   mPreprocess;
+    KeyedVector<effect_handle_t, uint32_t> mEffectStages;
+    uint32_t          mParamStages;
+
+    // The shared engine for our device, which owns the PCM in place of mPcm
+    // (see CaptureEngine::isEnabled).  Resampling, downmix and mute are
+    // still done per stream, on the way out of the engine's ring.
+    sp<CaptureEngine>         mCaptureEngine;
+    sp<CaptureEngine::Client> mCaptureClient;
+    uint32_t                  mFramesLost;
+
+    // NULL unless we are moving to another device.
+    Migration*                mMigration;
+    uint32_t                  mMigrations;
+
+    // Capture position bookkeeping.  mDeviceFramesRead counts frames pulled
+    // from mPcm by pcm_read (when there is no capture engine) since the
+    // stream last left standby.  mCaptureFramesBase is the capture position,
+    // in client frames, at that point, so that the position never goes
+    // backwards across standby.
+    uint64_t          mDeviceFramesRead;
+    int64_t           mCaptureFramesBase;
+
+    // Paces the silence returned while there is no usable device.
+    // mLastCaptureTime is when the last real period was delivered, so that
+    // the synthetic timeline can pick up where the device left off.
+    SilenceClock      mSilenceClock;
+    nsecs_t           mLastCaptureTime;
+
+    // Warm start.  mArmed is set when the capture path was brought up ahead
+    // of the first read(); mHotStandby when standby() left the voice
+    // recognition PCM open (stopped, or still attached to its engine).  Either state lapses into a full
+    // standby after mIdleTimeout (audio.atv.capture_idle_ms, 0 disables
+    // both).  mArmCond is used with mLock.
+    sp<ArmThread>     mArmThread;
+    Condition         mArmCond;
+    bool              mArmRequested;
+    bool              mArmed;
+    bool              mHotStandby;
+    nsecs_t           mIdleSince;
+    nsecs_t           mIdleTimeout;
+    uint32_t          mWarmStarts;
+    uint32_t          mColdStarts;
+
     int16_t*          mBuffer;
     size_t            mBufferSize;
     int               mInputSource;
@@ -21,6 +21,7 @@
 
 #include "AudioHardwareOutput.h"
 #include "AudioStreamOut.h"
+#include "HALStateWriter.h"
 
 // Set to 1 to print timestamp data in CSV format.
 #ifndef HAL_PRINT_TIMESTAMP_CSV
@@ -406,12 +407,28 @@ status_t AudioStreamOut::getPresentationPosition(uint64_t *frames,
                     (int64_t)audioOutput->getKernelBufferSize() - (int64_t)avail;
                 framesInDriverBuffer = framesInDriverBuffer / getRateMultiplier();
 
+                // Audio still sitting in the output's delay compensation line
+                // has not been presented either.
+                framesInDriverBuffer +=
+                    audioOutput->getExternalDelayFrames() / getRateMultiplier();
+
                 int64_t pendingFrames = framesInDriverBuffer + fudgeFrames;
+
+                // When a vsync based estimate of the video delay is
+                // available, pull the audio back by that much so that video
+                // which will reach the display late is released early enough.
+                // Never by more than is actually pending, though; a large
+                // estimate would otherwise make pendingFrames negative and
+                // fail every call until the estimate came back down.
+                uint32_t vcompUsec;
+                if (mOwnerHAL.getVideoDelayEstimateUsec(&vcompUsec)) {
+                    pendingFrames -= (static_cast<int64_t>(vcompUsec) *
+                                      sampleRate()) / 1000000;
+                    if (pendingFrames < 0)
+                        pendingFrames = 0;
+                }
                 int64_t signedFrames = mFramesPresented - pendingFrames;
-                if (pendingFrames < 0) {
-                    ALOGE("getPresentationPosition: negative pendingFrames = %lld",
-                        pendingFrames);
-                } else if (signedFrames < 0) {
+                if (signedFrames < 0) {
                     ALOGI("getPresentationPosition: playing silent preroll"
                         ", mFramesPresented = %llu, pendingFrames = %lld",
                         mFramesPresented, pendingFrames);
@@ -424,6 +441,7 @@ status_t AudioStreamOut::getPresentationPosition(uint64_t *frames,
                             mFramesPresented, avail, signedFrames, nanos);
 #endif
                     *frames = (uint64_t) signedFrames;
+                    mOwnerHAL.onPresentationTimestamp(*timestamp);
                     result = NO_ERROR;
                 }
             } else {
@@ -767,4 +785,32 @@ status_t AudioStreamOut::dump(int fd)
 #undef B2STR
 #undef DUMP
 
+void AudioStreamOut::exportState(HALStateWriter& w)
+{
+    w.beginObject(NULL);
+    w.addString("name", getName());
+    w.addInt("sampleRate", sampleRate());
+    w.addInt("outputSampleRate", outputSampleRate());
+    w.addInt("bufferSize", bufferSize());
+    w.addInt("chanMask", chanMask());
+    w.addInt("format", format());
+    w.addBool("encoded", mIsEncoded);
+    w.addInt("tgtDevices", mTgtDevices);
+    w.addBool("standby", mInStandby);
+    w.addInt("latencyMs", latency());
+    w.addInt("framesPresented", mFramesPresented);
+    w.addInt("framesRendered", mFramesRendered);
+
+    mRoutingLock.lock();
+    AudioOutputList outSnapshot(mPhysOutputs);
+    mRoutingLock.unlock();
+
+    w.beginArray("outputs");
+    AudioOutputList::iterator I;
+    for (I = outSnapshot.begin(); I != outSnapshot.end(); ++I)
+        (*I)->exportState(w);
+    w.endArray();
+    w.endObject();
+}
+
 }  // android
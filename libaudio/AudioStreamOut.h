@@ -31,6 +31,7 @@
 namespace android {
 
 class AudioHardwareOutput;
+class HALStateWriter;
 
 class AudioStreamOut {
   public:
@@ -43,6 +44,7 @@ class AudioStreamOut {
     status_t            getNextWriteTimestamp(int64_t *timestamp);
     status_t            standby();
     status_t            dump(int fd);
+    void                exportState(HALStateWriter& w);
 
     uint32_t            sampleRate()        const { return mInputSampleRate; }
     uint32_t            outputSampleRate()  const;
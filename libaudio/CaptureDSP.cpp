@@ -0,0 +1,743 @@
+/*
+**
+** Copyright 2014, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#define LOG_TAG "AudioHAL:CaptureDSP"
+
+#include <utils/Log.h>
+
+#include <math.h>
+#include <string.h>
+
+#include <utils/Timers.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "CaptureDSP.h"
+
+namespace android {
+
+/*
+ * Downmix
+ */
+
+void CaptureDSP::downmixStereo(int16_t* dst, const int16_t* src,
+                               size_t frames, DownmixMode mode)
+{
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    // Eight frames at a time.  Both input vectors are loaded before anything
+    // is stored, so running in place is safe.
+    const __m128i ones = _mm_set1_epi16(1);
+    for (; (i + 8) <= frames; i += 8) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + (i * 2)));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + (i * 2) + 8));
+
+        switch (mode) {
+            case kDownmixLeft:
+                // Sign extend the low half of each 32 bit L/R pair.
+                a = _mm_srai_epi32(_mm_slli_epi32(a, 16), 16);
+                b = _mm_srai_epi32(_mm_slli_epi32(b, 16), 16);
+                break;
+            case kDownmixRight:
+                a = _mm_srai_epi32(a, 16);
+                b = _mm_srai_epi32(b, 16);
+                break;
+            default:
+                // L + R as 32 bit sums, then halve.
+                a = _mm_srai_epi32(_mm_madd_epi16(a, ones), 1);
+                b = _mm_srai_epi32(_mm_madd_epi16(b, ones), 1);
+                break;
+        }
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packs_epi32(a, b));
+    }
+#endif
+
+    for (; i < frames; ++i) {
+        int32_t l = src[i * 2];
+        int32_t r = src[(i * 2) + 1];
+
+        switch (mode) {
+            case kDownmixLeft:  dst[i] = l; break;
+            case kDownmixRight: dst[i] = r; break;
+            default:            dst[i] = (l + r) >> 1; break;
+        }
+    }
+}
+
+// Q14 weight of the incoming signal n frames into a fade of len frames.
+static inline int32_t fadeWeight(size_t n, size_t len)
+{
+    if (n >= len)
+        return 1 << 14;
+
+    return static_cast<int32_t>((static_cast<uint64_t>(n) << 14) / len);
+}
+
+void CaptureDSP::crossfade(int16_t* dst, const int16_t* a, const int16_t* b,
+                           size_t frames, size_t pos, size_t len)
+{
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    // Interleave a and b so that one madd against (1 - w, w) pairs does the
+    // whole mix.  The weight steps once per eight frames.
+    const __m128i round = _mm_set1_epi32(1 << 13);
+    for (; (i + 8) <= frames; i += 8) {
+        int32_t w = fadeWeight(pos + i, len);
+        __m128i vw = _mm_set1_epi32(((1 << 14) - w) | (w << 16));
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+        __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi16(va, vb), vw);
+        __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi16(va, vb), vw);
+
+        lo = _mm_srai_epi32(_mm_add_epi32(lo, round), 14);
+        hi = _mm_srai_epi32(_mm_add_epi32(hi, round), 14);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packs_epi32(lo, hi));
+    }
+#endif
+
+    for (; i < frames; ++i) {
+        int32_t w = fadeWeight(pos + i, len);
+        int32_t v = ((a[i] * ((1 << 14) - w)) + (b[i] * w) + (1 << 13)) >> 14;
+        dst[i] = (v > 32767) ? 32767 : ((v < -32768) ? -32768 : v);
+    }
+}
+
+static const char* kDownmixNames[] = { "average", "left", "right" };
+
+const char* CaptureDSP::downmixModeToString(DownmixMode mode)
+{
+    if (static_cast<size_t>(mode) >= (sizeof(kDownmixNames) / sizeof(*kDownmixNames)))
+        return "invalid";
+
+    return kDownmixNames[mode];
+}
+
+bool CaptureDSP::downmixModeFromString(const char* name, DownmixMode* mode)
+{
+    for (size_t i = 0; i < (sizeof(kDownmixNames) / sizeof(*kDownmixNames)); ++i) {
+        if (!strcmp(name, kDownmixNames[i])) {
+            *mode = static_cast<DownmixMode>(i);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * Polyphase resampler
+ */
+
+const uint32_t PolyphaseResampler::kMaxPhases = 160;
+const uint32_t PolyphaseResampler::kMaxDecimation = 6;
+const uint32_t PolyphaseResampler::kBaseTaps = 24;
+
+uint32_t PolyphaseResampler::gcd(uint32_t a, uint32_t b)
+{
+    while (b) {
+        uint32_t t = a % b;
+        a = b;
+        b = t;
+    }
+
+    return a;
+}
+
+bool PolyphaseResampler::supports(uint32_t inRate, uint32_t outRate)
+{
+    if (!inRate || !outRate || (inRate == outRate))
+        return false;
+
+    uint32_t g = gcd(inRate, outRate);
+    uint32_t L = outRate / g;
+    uint32_t M = inRate / g;
+
+    return (L <= kMaxPhases) && (M <= kMaxPhases) && (M <= (L * kMaxDecimation));
+}
+
+PolyphaseResampler::PolyphaseResampler(uint32_t inRate, uint32_t outRate)
+{
+    uint32_t g = gcd(inRate, outRate);
+    mL = outRate / g;
+    mM = inRate / g;
+
+    uint32_t mult = (mM + mL - 1) / mL;
+    mTaps = (kBaseTaps * mult + 7) & ~7;
+
+    mCoefs = new int16_t[mL * mTaps];
+    mHist = new int16_t[mTaps * 2];
+
+    designFilter();
+    reset();
+}
+
+PolyphaseResampler::~PolyphaseResampler()
+{
+    delete [] mCoefs;
+    delete [] mHist;
+}
+
+void PolyphaseResampler::reset()
+{
+    memset(mHist, 0, sizeof(*mHist) * mTaps * 2);
+    mHistPos = 0;
+    mPhase = mL;
+}
+
+// Zeroth order modified Bessel function of the first kind, for the Kaiser
+// window.  The series converges quickly for the betas used here.
+static double besselI0(double x)
+{
+    double sum = 1.0;
+    double term = 1.0;
+    double q = (x * x) / 4.0;
+
+    for (int k = 1; k < 32; ++k) {
+        term *= q / (static_cast<double>(k) * k);
+        sum += term;
+        if (term < (sum * 1e-12))
+            break;
+    }
+
+    return sum;
+}
+
+void PolyphaseResampler::designFilter()
+{
+    // Kaiser windowed sinc at the upsampled rate (L times the input rate),
+    // with the cutoff a little below the lower of the two Nyquist rates.
+    // beta = 7 gives roughly 70dB of stopband attenuation.
+    static const double kBeta = 7.0;
+    static const double kCutoffScale = 0.90;
+
+    uint32_t len = mL * mTaps;
+    double fc = (0.5 * kCutoffScale) / ((mL > mM) ? mL : mM);
+    double center = (len - 1) / 2.0;
+    double i0Beta = besselI0(kBeta);
+    double* proto = new double[len];
+
+    for (uint32_t n = 0; n < len; ++n) {
+        double t = n - center;
+        double sinc = (fabs(t) < 1e-9) ? 1.0 : (sin(2.0 * M_PI * fc * t) / (2.0 * M_PI * fc * t));
+        double r = t / center;
+        double w = besselI0(kBeta * sqrt(fmax(0.0, 1.0 - (r * r)))) / i0Beta;
+        proto[n] = 2.0 * fc * sinc * w;
+    }
+
+    // Split the prototype into its L phases.  Tap i of phase p (i == 0 being
+    // the newest input) is proto[(i * L) + p]; each phase is stored oldest
+    // sample first so it lines up with the history window.  Every phase is
+    // normalized to unity DC gain so that the interpolated output does not
+    // ripple with the phase.
+    for (uint32_t p = 0; p < mL; ++p) {
+        int16_t* c = mCoefs + (p * mTaps);
+        double sum = 0.0;
+
+        for (uint32_t i = 0; i < mTaps; ++i)
+            sum += proto[(i * mL) + p];
+        if (fabs(sum) < 1e-9)
+            sum = 1.0;
+
+        for (uint32_t i = 0; i < mTaps; ++i) {
+            long v = lrint((proto[(i * mL) + p] / sum) * 32768.0);
+            if (v > 32767)
+                v = 32767;
+            else if (v < -32768)
+                v = -32768;
+            c[mTaps - 1 - i] = static_cast<int16_t>(v);
+        }
+    }
+
+    delete [] proto;
+}
+
+int16_t PolyphaseResampler::dot(const int16_t* a, const int16_t* b) const
+{
+    int32_t acc;
+
+#if defined(__SSE2__)
+    __m128i sum = _mm_setzero_si128();
+    for (uint32_t i = 0; i < mTaps; i += 8) {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+        sum = _mm_add_epi32(sum, _mm_madd_epi16(va, vb));
+    }
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+    acc = _mm_cvtsi128_si32(sum);
+#else
+    acc = 0;
+    for (uint32_t i = 0; i < mTaps; ++i)
+        acc += static_cast<int32_t>(a[i]) * b[i];
+#endif
+
+    acc = (acc + (1 << 14)) >> 15;
+    if (acc > 32767)
+        return 32767;
+    if (acc < -32768)
+        return -32768;
+    return static_cast<int16_t>(acc);
+}
+
+size_t PolyphaseResampler::process(const int16_t* in, size_t inFrames,
+                                   size_t* inConsumed, int16_t* out,
+                                   size_t outFrames)
+{
+    size_t inNdx = 0;
+    size_t outNdx = 0;
+
+    // Output sample k sits at (k * M) / L on the input timeline; mPhase is
+    // its fractional part in units of 1/L.  Pull input until the newest
+    // sample in the history is the one just before the output point.
+    while (outNdx < outFrames) {
+        while (mPhase >= mL) {
+            if (inNdx >= inFrames)
+                goto done;
+
+            int16_t s = in[inNdx++];
+            mHist[mHistPos] = s;
+            mHist[mHistPos + mTaps] = s;
+            if (++mHistPos >= mTaps)
+                mHistPos = 0;
+            mPhase -= mL;
+        }
+
+        out[outNdx++] = dot(mHist + mHistPos, mCoefs + (mPhase * mTaps));
+        mPhase += mM;
+    }
+
+done:
+    *inConsumed = inNdx;
+    return outNdx;
+}
+
+/*
+ * Pre-processing chain
+ */
+
+// Levels are 16 bit full scale amplitudes; gains are Q12.
+static const int32_t  kUnityGain = 1 << 12;
+
+static const uint32_t kDCTauMsec = 200;
+static const double   kHighPassHz = 80.0;
+
+// Noise gate: open above -50dBFS RMS, close below -54dBFS once the hold time
+// has run out, and attenuate by 18dB rather than muting outright.
+static const uint32_t kGateOpenLevel = 104;
+static const uint32_t kGateCloseLevel = 65;
+static const int32_t  kGateFloorGain = kUnityGain / 8;
+static const uint32_t kGateHoldMsec = 150;
+static const uint32_t kGateCloseMsec = 50;
+
+// AGC: steer speech towards -20dBFS RMS, between -6dB and +18dB of gain.
+// Blocks quieter than -60dBFS hold the current gain so that room noise is
+// not pumped up between phrases.
+static const uint32_t kAGCTargetLevel = 3277;
+static const uint32_t kAGCFloorLevel = 33;
+static const int32_t  kAGCMinGain = kUnityGain / 2;
+static const int32_t  kAGCMaxGain = 32767;
+static const uint32_t kAGCAttackMsec = 10;
+static const uint32_t kAGCReleaseMsec = 500;
+
+static const char* kStageNames[PreprocessChain::kStageCount] = {
+    "dc", "hpf", "gate", "agc",
+};
+
+static uint32_t isqrt(uint32_t v)
+{
+    uint32_t res = 0;
+    uint32_t bit = 1u << 30;
+
+    while (bit > v)
+        bit >>= 2;
+
+    while (bit) {
+        if (v >= (res + bit)) {
+            v -= res + bit;
+            res = (res >> 1) + bit;
+        } else {
+            res >>= 1;
+        }
+        bit >>= 2;
+    }
+
+    return res;
+}
+
+static inline int16_t clamp16(int32_t v)
+{
+    if (v > 32767)
+        return 32767;
+    if (v < -32768)
+        return -32768;
+    return static_cast<int16_t>(v);
+}
+
+PreprocessChain::PreprocessChain()
+    : mStages(0)
+{
+    configure(16000);
+}
+
+void PreprocessChain::configure(uint32_t sampleRate)
+{
+    mRate = sampleRate ? sampleRate : 16000;
+
+    mDCTau = (mRate * kDCTauMsec) / 1000;
+    mGateHoldFrames = (mRate * kGateHoldMsec) / 1000;
+    mGateCloseTau = (mRate * kGateCloseMsec) / 1000;
+    mAGCAttackTau = (mRate * kAGCAttackMsec) / 1000;
+    mAGCReleaseTau = (mRate * kAGCReleaseMsec) / 1000;
+
+    // Second order Butterworth high-pass (RBJ cookbook, Q = 1/sqrt(2)).
+    double w0 = (2.0 * M_PI * kHighPassHz) / mRate;
+    double alpha = sin(w0) / (2.0 * M_SQRT1_2);
+    double cw = cos(w0);
+    double a0 = 1.0 + alpha;
+    const double q28 = static_cast<double>(1 << 28);
+
+    mB0 = static_cast<int32_t>(lrint((((1.0 + cw) / 2.0) / a0) * q28));
+    mB1 = static_cast<int32_t>(lrint((-(1.0 + cw) / a0) * q28));
+    mB2 = mB0;
+    mA1 = static_cast<int32_t>(lrint(((-2.0 * cw) / a0) * q28));
+    mA2 = static_cast<int32_t>(lrint(((1.0 - alpha) / a0) * q28));
+
+    memset(mCpuNsec, 0, sizeof(mCpuNsec));
+    mFrames = 0;
+
+    reset();
+}
+
+void PreprocessChain::reset()
+{
+    mDC = 0;
+    mX1 = mX2 = mY1 = mY2 = 0;
+    mGateOpen = false;
+    mGateHold = 0;
+    mGateGain = kUnityGain;
+    mAGCGain = kUnityGain;
+}
+
+const char* PreprocessChain::stageName(Stage s)
+{
+    if (static_cast<size_t>(s) >= kStageCount)
+        return "invalid";
+
+    return kStageNames[s];
+}
+
+bool PreprocessChain::stagesFromString(const char* list, uint32_t* mask)
+{
+    uint32_t res = 0;
+
+    if (!strcmp(list, "none")) {
+        *mask = 0;
+        return true;
+    }
+
+    while (*list) {
+        const char* end = strchr(list, ',');
+        size_t len = end ? static_cast<size_t>(end - list) : strlen(list);
+        bool found = false;
+
+        for (int i = 0; i < kStageCount; ++i) {
+            if ((strlen(kStageNames[i]) == len) &&
+                !strncmp(list, kStageNames[i], len)) {
+                res |= stageBit(static_cast<Stage>(i));
+                found = true;
+                break;
+            }
+        }
+
+        if (!found)
+            return false;
+
+        list += len;
+        if (*list == ',')
+            ++list;
+    }
+
+    *mask = res;
+    return true;
+}
+
+int32_t PreprocessChain::smoothingWeight(size_t frames, uint32_t tau)
+{
+    return static_cast<int32_t>((static_cast<uint64_t>(frames) << 16) /
+                                (frames + tau + 1));
+}
+
+void PreprocessChain::measure(const int16_t* buf, size_t frames,
+                              uint32_t* rms, int32_t* peak)
+{
+    uint64_t energy = 0;
+    int32_t hi = 0;
+    int32_t lo = 0;
+    size_t i = 0;
+
+    if (!frames) {
+        *rms = 0;
+        *peak = 0;
+        return;
+    }
+
+#if defined(__SSE2__)
+    // Squares are taken of the input halved, so that a pair summed by madd
+    // cannot overflow, and widened to 64 bits straight away.
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc = zero;
+    __m128i vmax = zero;
+    __m128i vmin = zero;
+    for (; (i + 8) <= frames; i += 8) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + i));
+        __m128i h = _mm_srai_epi16(v, 1);
+        __m128i sq = _mm_madd_epi16(h, h);
+
+        acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(sq, zero));
+        acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(sq, zero));
+        vmax = _mm_max_epi16(vmax, v);
+        vmin = _mm_min_epi16(vmin, v);
+    }
+
+    uint64_t e[2];
+    int16_t mx[8];
+    int16_t mn[8];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(e), acc);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(mx), vmax);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(mn), vmin);
+    energy = (e[0] + e[1]) << 2;
+    for (int k = 0; k < 8; ++k) {
+        if (mx[k] > hi)
+            hi = mx[k];
+        if (mn[k] < lo)
+            lo = mn[k];
+    }
+#endif
+
+    for (; i < frames; ++i) {
+        int32_t v = buf[i];
+        energy += static_cast<uint64_t>(v * v);
+        if (v > hi)
+            hi = v;
+        if (v < lo)
+            lo = v;
+    }
+
+    *rms = isqrt(static_cast<uint32_t>(energy / frames));
+    *peak = (hi > -lo) ? hi : -lo;
+}
+
+void PreprocessChain::applyGain(int16_t* buf, size_t frames,
+                                int32_t g0, int32_t g1)
+{
+    size_t i = 0;
+
+    if ((g0 == kUnityGain) && (g1 == kUnityGain))
+        return;
+
+#if defined(__SSE2__)
+    // The gain steps once per eight samples, which is far finer than any of
+    // the ramps we ask for.
+    const __m128i round = _mm_set1_epi32(1 << 11);
+    for (; (i + 8) <= frames; i += 8) {
+        int32_t g = g0 + static_cast<int32_t>(
+                (static_cast<int64_t>(g1 - g0) * static_cast<int64_t>(i)) /
+                static_cast<int64_t>(frames));
+        __m128i vg = _mm_set1_epi16(static_cast<int16_t>(g));
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + i));
+        __m128i pl = _mm_mullo_epi16(v, vg);
+        __m128i ph = _mm_mulhi_epi16(v, vg);
+        __m128i a = _mm_unpacklo_epi16(pl, ph);
+        __m128i b = _mm_unpackhi_epi16(pl, ph);
+
+        a = _mm_srai_epi32(_mm_add_epi32(a, round), 12);
+        b = _mm_srai_epi32(_mm_add_epi32(b, round), 12);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(buf + i), _mm_packs_epi32(a, b));
+    }
+#endif
+
+    for (; i < frames; ++i) {
+        int32_t g = g0 + static_cast<int32_t>(
+                (static_cast<int64_t>(g1 - g0) * static_cast<int64_t>(i)) /
+                static_cast<int64_t>(frames));
+        buf[i] = clamp16(((buf[i] * g) + (1 << 11)) >> 12);
+    }
+}
+
+// Track the DC offset with a slow one pole average of the block means, and
+// subtract it with saturation.
+void PreprocessChain::removeDC(int16_t* buf, size_t frames)
+{
+    int64_t sum = 0;
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    const __m128i ones = _mm_set1_epi16(1);
+    __m128i acc = _mm_setzero_si128();
+    for (; (i + 8) <= frames; i += 8) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + i));
+        __m128i s = _mm_madd_epi16(v, ones);
+        __m128i sign = _mm_srai_epi32(s, 31);
+
+        acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(s, sign));
+        acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(s, sign));
+    }
+
+    int64_t part[2];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(part), acc);
+    sum = part[0] + part[1];
+#endif
+
+    for (size_t k = i; k < frames; ++k)
+        sum += buf[k];
+
+    int32_t mean = static_cast<int32_t>((sum * 256) / static_cast<int64_t>(frames));
+    int32_t w = smoothingWeight(frames, mDCTau);
+    mDC += static_cast<int32_t>((static_cast<int64_t>(mean - mDC) * w) >> 16);
+
+    int16_t dc = clamp16((mDC + (1 << 7)) >> 8);
+    if (!dc)
+        return;
+
+    i = 0;
+#if defined(__SSE2__)
+    const __m128i vdc = _mm_set1_epi16(dc);
+    for (; (i + 8) <= frames; i += 8) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(buf + i), _mm_subs_epi16(v, vdc));
+    }
+#endif
+
+    for (; i < frames; ++i)
+        buf[i] = clamp16(buf[i] - dc);
+}
+
+void PreprocessChain::highPass(int16_t* buf, size_t frames)
+{
+    for (size_t i = 0; i < frames; ++i) {
+        int32_t x = buf[i];
+
+        // Q28 coefficients against Q0 inputs (scaled up to Q36) and Q8
+        // outputs.  Scaled by multiplication; a left shift of a negative
+        // value is undefined.
+        int64_t acc = ((static_cast<int64_t>(mB0) * x) +
+                       (static_cast<int64_t>(mB1) * mX1) +
+                       (static_cast<int64_t>(mB2) * mX2)) * 256;
+        acc -= (static_cast<int64_t>(mA1) * mY1) +
+               (static_cast<int64_t>(mA2) * mY2);
+        int32_t y = static_cast<int32_t>((acc + (1 << 27)) >> 28);
+
+        mX2 = mX1;
+        mX1 = x;
+        mY2 = mY1;
+        mY1 = y;
+
+        buf[i] = clamp16((y + (1 << 7)) >> 8);
+    }
+}
+
+void PreprocessChain::noiseGate(int16_t* buf, size_t frames)
+{
+    uint32_t rms;
+    int32_t peak;
+
+    measure(buf, frames, &rms, &peak);
+
+    if (rms >= kGateOpenLevel) {
+        mGateOpen = true;
+        mGateHold = mGateHoldFrames;
+    } else if (mGateOpen && (rms < kGateCloseLevel)) {
+        mGateHold -= frames;
+        if (mGateHold <= 0)
+            mGateOpen = false;
+    }
+
+    // Open within a block so the start of a word is not clipped; close
+    // gradually.
+    int32_t prev = mGateGain;
+    if (mGateOpen) {
+        mGateGain = kUnityGain;
+    } else {
+        int32_t w = smoothingWeight(frames, mGateCloseTau);
+        mGateGain += static_cast<int32_t>(
+                (static_cast<int64_t>(kGateFloorGain - mGateGain) * w) >> 16);
+    }
+
+    applyGain(buf, frames, prev, mGateGain);
+}
+
+void PreprocessChain::agc(int16_t* buf, size_t frames)
+{
+    uint32_t rms;
+    int32_t peak;
+
+    measure(buf, frames, &rms, &peak);
+
+    int32_t prev = mAGCGain;
+    if (rms >= kAGCFloorLevel) {
+        int32_t desired = static_cast<int32_t>((kAGCTargetLevel << 12) / rms);
+        if (desired < kAGCMinGain)
+            desired = kAGCMinGain;
+        else if (desired > kAGCMaxGain)
+            desired = kAGCMaxGain;
+
+        // Never let the gain push this block's peak into clipping; that
+        // limit applies at once rather than through the attack time.
+        int32_t limit = peak ? static_cast<int32_t>((32767 << 12) / peak) : kAGCMaxGain;
+        if (mAGCGain > limit) {
+            mAGCGain = (limit > kAGCMinGain) ? limit : kAGCMinGain;
+        } else {
+            uint32_t tau = (desired < mAGCGain) ? mAGCAttackTau : mAGCReleaseTau;
+            int32_t w = smoothingWeight(frames, tau);
+            mAGCGain += static_cast<int32_t>(
+                    (static_cast<int64_t>(desired - mAGCGain) * w) >> 16);
+            if (mAGCGain > limit)
+                mAGCGain = limit;
+        }
+    }
+
+    applyGain(buf, frames, prev, mAGCGain);
+}
+
+void PreprocessChain::process(int16_t* buf, size_t frames)
+{
+    if (!mStages || !frames)
+        return;
+
+    for (int s = 0; s < kStageCount; ++s) {
+        if (!(mStages & stageBit(static_cast<Stage>(s))))
+            continue;
+
+        nsecs_t start = systemTime(SYSTEM_TIME_THREAD);
+        switch (s) {
+            case kStageDCRemoval: removeDC(buf, frames); break;
+            case kStageHighPass:  highPass(buf, frames); break;
+            case kStageNoiseGate: noiseGate(buf, frames); break;
+            case kStageAGC:       agc(buf, frames); break;
+        }
+        mCpuNsec[s] += systemTime(SYSTEM_TIME_THREAD) - start;
+    }
+
+    mFrames += frames;
+}
+
+}  // namespace android
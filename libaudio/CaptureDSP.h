@@ -0,0 +1,187 @@
+/*
+**
+** Copyright 2014, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#ifndef ANDROID_CAPTURE_DSP_H
+#define ANDROID_CAPTURE_DSP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace android {
+
+// Processing applied to captured audio between pcm_read and the client's
+// buffer.  All of it operates on 16 bit PCM and has SSE2 paths (with scalar
+// fallbacks for other targets).
+class CaptureDSP {
+  public:
+    // How a stereo capture device is folded down to the mono stream we
+    // present.
+    enum DownmixMode {
+        kDownmixAverage = 0,    // (L + R) / 2
+        kDownmixLeft,
+        kDownmixRight,
+    };
+
+    // Fold interleaved stereo down to mono.  dst may be the same buffer as
+    // src.
+    static void downmixStereo(int16_t* dst, const int16_t* src,
+                              size_t frames, DownmixMode mode);
+
+    // dst = a faded out and b faded in, linearly over len frames, of which
+    // the first pos have already been done by earlier calls.  Past the end
+    // of the fade dst is b.  dst may be the same buffer as a or b.
+    static void crossfade(int16_t* dst, const int16_t* a, const int16_t* b,
+                          size_t frames, size_t pos, size_t len);
+
+    static const char* downmixModeToString(DownmixMode mode);
+    // Returns false if the name is not recognized.
+    static bool downmixModeFromString(const char* name, DownmixMode* mode);
+};
+
+// Mono polyphase FIR resampler for rational rate changes of modest order,
+// which covers every conversion the capture path sees in practice (16k <->
+// 48k, 8k <-> 16k, 44.1k -> 48k and friends).  The windowed sinc prototype
+// is designed once at construction time and stored as one Q15 filter per
+// output phase.
+class PolyphaseResampler {
+  public:
+    // True if the ratio between the two rates is one we can handle.
+    static bool supports(uint32_t inRate, uint32_t outRate);
+
+    PolyphaseResampler(uint32_t inRate, uint32_t outRate);
+    ~PolyphaseResampler();
+
+    // Forget all history.
+    void reset();
+
+    // Consume up to inFrames of input and produce up to outFrames of output.
+    // Stops as soon as either runs out.  Returns the number of frames
+    // produced and reports how many were consumed through inConsumed.
+    size_t process(const int16_t* in, size_t inFrames, size_t* inConsumed,
+                   int16_t* out, size_t outFrames);
+
+    uint32_t interpolation() const { return mL; }
+    uint32_t decimation() const { return mM; }
+    uint32_t tapsPerPhase() const { return mTaps; }
+
+  private:
+    // Limits on the reduced ratio L/M.  44.1k -> 48k is 160/147.
+    static const uint32_t kMaxPhases;
+    static const uint32_t kMaxDecimation;
+    // Taps per phase when not decimating.  Decimation by M scales this by
+    // ceil(M / L) to keep the transition band in the same place relative to
+    // the output rate.
+    static const uint32_t kBaseTaps;
+
+    static uint32_t gcd(uint32_t a, uint32_t b);
+    void designFilter();
+    int16_t dot(const int16_t* a, const int16_t* b) const;
+
+    uint32_t mL;            // interpolation factor
+    uint32_t mM;            // decimation factor
+    uint32_t mTaps;         // taps per phase, a multiple of 8
+    uint32_t mPhase;
+    uint32_t mHistPos;
+    int16_t* mCoefs;        // mL filters of mTaps each, oldest sample first
+    int16_t* mHist;         // last mTaps inputs, stored twice back to back
+};
+
+// Voice pre-processing run in place on the mono client stream, after
+// resampling: DC removal, a high-pass filter, a noise gate and AGC, in that
+// order.  Everything is fixed point and works within the caller's buffer, so
+// nothing is allocated per read.  Levels are measured and gains applied with
+// SSE2; the high-pass biquad is recursive and stays scalar.  Time constants
+// are expressed in frames, so behaviour does not depend on the read size.
+class PreprocessChain {
+  public:
+    enum Stage {
+        kStageDCRemoval = 0,
+        kStageHighPass,
+        kStageNoiseGate,
+        kStageAGC,
+        kStageCount,
+    };
+
+    PreprocessChain();
+
+    // Recompute coefficients for sampleRate and forget all state.
+    void configure(uint32_t sampleRate);
+    // Forget filter history and gains, e.g. after a gap in capture.
+    void reset();
+
+    // One bit per Stage; see stageBit().
+    void     setStages(uint32_t mask) { mStages = mask; }
+    uint32_t stages() const { return mStages; }
+    bool     active() const { return mStages != 0; }
+
+    void process(int16_t* buf, size_t frames);
+
+    // Thread CPU time spent in a stage, and frames run through the chain.
+    int64_t  stageCpuNsec(Stage s) const { return mCpuNsec[s]; }
+    uint64_t framesProcessed() const { return mFrames; }
+    uint32_t sampleRate() const { return mRate; }
+
+    static uint32_t    stageBit(Stage s) { return 1u << s; }
+    static const char* stageName(Stage s);
+    // Parse a comma separated list of stage names, or "none".  Returns false
+    // if any name is not recognized.
+    static bool        stagesFromString(const char* list, uint32_t* mask);
+
+  private:
+    void removeDC(int16_t* buf, size_t frames);
+    void highPass(int16_t* buf, size_t frames);
+    void noiseGate(int16_t* buf, size_t frames);
+    void agc(int16_t* buf, size_t frames);
+
+    // Q16 weight for a one pole smoother with time constant tau frames,
+    // stepped by frames at once.
+    static int32_t smoothingWeight(size_t frames, uint32_t tau);
+    static void    measure(const int16_t* buf, size_t frames,
+                           uint32_t* rms, int32_t* peak);
+    // Multiply by a Q12 gain ramping linearly from g0 to g1.
+    static void    applyGain(int16_t* buf, size_t frames, int32_t g0, int32_t g1);
+
+    uint32_t mRate;
+    uint32_t mStages;
+
+    // DC estimate, Q8.
+    int32_t  mDC;
+    uint32_t mDCTau;
+
+    // High-pass biquad, Q28 coefficients (a0 normalized out); input history
+    // in Q0, output history in Q8.
+    int32_t  mB0, mB1, mB2, mA1, mA2;
+    int32_t  mX1, mX2, mY1, mY2;
+
+    // Noise gate.  Gains are Q12.
+    bool     mGateOpen;
+    int32_t  mGateHold;
+    int32_t  mGateGain;
+    uint32_t mGateHoldFrames;
+    uint32_t mGateCloseTau;
+
+    // AGC.
+    int32_t  mAGCGain;
+    uint32_t mAGCAttackTau;
+    uint32_t mAGCReleaseTau;
+
+    int64_t  mCpuNsec[kStageCount];
+    uint64_t mFrames;
+};
+
+}  // namespace android
+#endif  // ANDROID_CAPTURE_DSP_H
@@ -0,0 +1,316 @@
+/*
+**
+** Copyright 2014, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#define LOG_TAG "AudioHAL:CaptureEngine"
+
+#include <utils/Log.h>
+
+#include <errno.h>
+#include <sched.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <cutils/properties.h>
+
+#include "CaptureEngine.h"
+
+namespace android {
+
+// Enough to ride out a Bluetooth remote delivering a burst of packets while
+// the client is descheduled.
+const uint32_t CaptureEngine::kRingMsec = 320;
+const int      CaptureEngine::kFifoPriority = 2;
+const nsecs_t  CaptureEngine::kReadTimeout = 1000000000;
+const uint32_t CaptureEngine::kStopRetryUsec = 5000;
+
+bool CaptureEngine::isEnabled()
+{
+    return property_get_bool("audio.atv.capture_thread", true);
+}
+
+CaptureEngine::Client::Client()
+    : mErrorSeen(0)
+    , mStartFrames(0)
+{
+}
+
+uint32_t CaptureEngine::ringSlots(const struct pcm_config& config)
+{
+    uint32_t ringFrames = (config.rate * kRingMsec) / 1000;
+    uint32_t slots = (ringFrames + config.period_size - 1) / config.period_size;
+
+    return (slots < 4) ? 4 : slots;
+}
+
+CaptureEngine::CaptureEngine(unsigned int card, unsigned int device,
+                             const struct pcm_config& config)
+    : Thread(false)
+    , mCard(card)
+    , mDevice(device)
+    , mConfig(config)
+    , mPcm(NULL)
+    , mChannels(config.channels)
+    , mPeriodFrames(config.period_size)
+    , mRing(ringSlots(config), config.period_size, config.channels)
+    , mFramesRead(0)
+    , mPosValid(false)
+    , mPosFrames(0)
+    , mErrorSeq(0)
+    , mLastError(0)
+    , mIsFifo(false)
+    , mReadErrors(0)
+{
+}
+
+CaptureEngine::~CaptureEngine()
+{
+    if (mPcm)
+        pcm_close(mPcm);
+}
+
+status_t CaptureEngine::open()
+{
+    ALOGD("%s: opening capture PCM %u:%u at %u Hz", __func__, mCard, mDevice,
+          mConfig.rate);
+
+    // Use the PCM_MONOTONIC clock for get_capture_position.
+    mPcm = pcm_open(mCard, mDevice, PCM_IN | PCM_MONOTONIC, &mConfig);
+    if (!pcm_is_ready(mPcm)) {
+        ALOGE("%s: pcm_open failed", __func__);
+        pcm_close(mPcm);
+        mPcm = NULL;
+        return NO_MEMORY;
+    }
+
+    status_t res = run("ATVCapture", PRIORITY_URGENT_AUDIO);
+    if (res != NO_ERROR) {
+        pcm_close(mPcm);
+        mPcm = NULL;
+    }
+
+    return res;
+}
+
+void CaptureEngine::close()
+{
+    if (mPcm == NULL)
+        return;
+
+    requestExit();
+
+    // pcm_read may be parked waiting on a remote which has gone quiet.
+    // Stopping the PCM kicks it loose.  A single stop is not enough: the
+    // thread may have checked exitPending just before we set it and be about
+    // to call pcm_read, which restarts a stopped PCM and would then wait for
+    // data forever.  Keep stopping it until the thread is actually gone.
+    while (isRunning()) {
+        pcm_stop(mPcm);
+        usleep(kStopRetryUsec);
+    }
+    requestExitAndWait();
+
+    pcm_close(mPcm);
+    mPcm = NULL;
+
+    Mutex::Autolock _l(mLock);
+    mDataAvail.broadcast();
+}
+
+sp<CaptureEngine::Client> CaptureEngine::attach()
+{
+    sp<Client> client = new Client();
+    Mutex::Autolock _l(mLock);
+
+    mRing.seekToLive(&client->mCursor);
+    client->mErrorSeen = mErrorSeq;
+    client->mStartFrames = mFramesRead;
+    mClients.add(client);
+
+    return client;
+}
+
+void CaptureEngine::detach(const sp<Client>& client)
+{
+    Mutex::Autolock _l(mLock);
+
+    for (size_t i = 0; i < mClients.size(); ++i) {
+        if (mClients[i] == client) {
+            mClients.removeAt(i);
+            break;
+        }
+    }
+}
+
+size_t CaptureEngine::clientCount()
+{
+    Mutex::Autolock _l(mLock);
+    return mClients.size();
+}
+
+status_t CaptureEngine::readyToRun()
+{
+    struct sched_param param;
+
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = kFifoPriority;
+    if (sched_setscheduler(0, SCHED_FIFO, &param)) {
+        ALOGW("%s: unable to use SCHED_FIFO (%s), staying at urgent audio priority",
+              __func__, strerror(errno));
+    } else {
+        mIsFifo = true;
+    }
+
+    return NO_ERROR;
+}
+
+bool CaptureEngine::threadLoop()
+{
+    // Capture straight into the ring.
+    int ret = pcm_read(mPcm, mRing.beginWrite(),
+                       pcm_frames_to_bytes(mPcm, mPeriodFrames));
+
+    if (exitPending())
+        return false;
+
+    if (ret) {
+        // Hand the error to the readers and back off for a period so that a
+        // device which has gone away does not have us spinning.
+        {
+            Mutex::Autolock _l(mLock);
+            mReadErrors++;
+            mErrorSeq++;
+            mLastError = ret;
+            mDataAvail.broadcast();
+        }
+        usleep((mPeriodFrames * 1000000ULL) / mConfig.rate);
+        return true;
+    }
+
+    // Sample the capture position while we know exactly how many frames have
+    // been pulled out of the PCM.
+    unsigned int avail;
+    struct timespec ts;
+    bool posValid = (pcm_get_htimestamp(mPcm, &avail, &ts) == 0);
+
+    mRing.endWrite();
+
+    Mutex::Autolock _l(mLock);
+    mFramesRead += mPeriodFrames;
+    if (posValid) {
+        mPosValid = true;
+        mPosFrames = mFramesRead + avail;
+        mPosTime = ts;
+    }
+    mDataAvail.broadcast();
+    return true;
+}
+
+int CaptureEngine::read(Client* c, int16_t* dst, size_t frames)
+{
+    size_t done = 0;
+    nsecs_t deadline = systemTime() + kReadTimeout;
+
+    while (true) {
+        done += mRing.read(&c->mCursor, dst + (done * mChannels), frames - done);
+        if (done >= frames)
+            break;
+
+        // Caught up; wait for the next period (or an error).
+        Mutex::Autolock _l(mLock);
+
+        if (c->mErrorSeen != mErrorSeq) {
+            c->mErrorSeen = mErrorSeq;
+            return mLastError;
+        }
+
+        if (mRing.framesAvailable(c->mCursor))
+            continue;
+
+        nsecs_t now = systemTime();
+        if ((now >= deadline) || exitPending())
+            return -ETIMEDOUT;
+
+        mDataAvail.waitRelative(mLock, deadline - now);
+    }
+
+    return 0;
+}
+
+size_t CaptureEngine::framesAvailable(Client* c)
+{
+    return mRing.framesAvailable(c->mCursor);
+}
+
+void CaptureEngine::skipToLive(Client* c)
+{
+    mRing.seekToLive(&c->mCursor);
+
+    Mutex::Autolock _l(mLock);
+    c->mErrorSeen = mErrorSeq;
+    c->mStartFrames = mFramesRead;
+}
+
+uint32_t CaptureEngine::takeFramesLost(Client* c)
+{
+    uint32_t lost = c->mCursor.framesLost;
+
+    c->mCursor.framesLost = 0;
+    return lost;
+}
+
+uint64_t CaptureEngine::framesCaptured(Client* c)
+{
+    Mutex::Autolock _l(mLock);
+    return mFramesRead - c->mStartFrames;
+}
+
+bool CaptureEngine::getCapturePosition(Client* c, uint64_t* frames,
+                                       struct timespec* time)
+{
+    Mutex::Autolock _l(mLock);
+
+    if (!mPosValid || (mPosFrames < c->mStartFrames))
+        return false;
+
+    *frames = mPosFrames - c->mStartFrames;
+    *time = mPosTime;
+    return true;
+}
+
+void CaptureEngine::dump(String8& result)
+{
+    Mutex::Autolock _l(mLock);
+
+    result.appendFormat("\tCapture Engine %u:%u\n", mCard, mDevice);
+    result.appendFormat("\t\tSCHED_FIFO        : %s\n", mIsFifo ? "yes" : "no");
+    result.appendFormat("\t\tConfig            : %u Hz, %u ch, %u x %u frames\n",
+                        mConfig.rate, mConfig.channels, mRing.slots(), mPeriodFrames);
+    result.appendFormat("\t\tClients           : %zu\n", mClients.size());
+    result.appendFormat("\t\tPeriods Captured  : %u\n",
+                        mRing.writeSeq());
+    result.appendFormat("\t\tRead Errors       : %u\n", mReadErrors);
+
+    for (size_t i = 0; i < mClients.size(); ++i) {
+        const sp<Client>& c = mClients[i];
+        result.appendFormat("\t\tClient %zu          : %u periods behind, "
+                            "%u overruns (%u torn reads)\n", i,
+                            mRing.writeSeq() - c->mCursor.seq,
+                            c->mCursor.overruns, c->mCursor.tornReads);
+    }
+}
+
+}  // namespace android
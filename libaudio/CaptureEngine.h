@@ -0,0 +1,137 @@
+/*
+**
+** Copyright 2014, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#ifndef ANDROID_CAPTURE_ENGINE_H
+#define ANDROID_CAPTURE_ENGINE_H
+
+#include <stdint.h>
+
+#include <tinyalsa/asoundlib.h>
+#include <utils/Errors.h>
+#include <utils/RefBase.h>
+#include <utils/String8.h>
+#include <utils/threads.h>
+#include <utils/Vector.h>
+#include <utils/Timers.h>
+
+#include "CaptureRing.h"
+
+namespace android {
+
+// Owns the capture PCM of one device and drains it from a dedicated
+// (SCHED_FIFO, when permitted) thread into a CaptureRing, so that a late
+// reader does not cost us data inside ALSA.  Any number of streams may
+// attach; each gets a Client holding its own read cursor and loss
+// accounting.
+class CaptureEngine : public Thread {
+  public:
+    class Client : public RefBase {
+      public:
+        Client();
+      private:
+        friend class CaptureEngine;
+        // Only ever touched from the attached stream (under its lock), apart
+        // from initialization in attach().
+        CaptureRing::Cursor mCursor;
+        uint32_t mErrorSeen;
+        uint64_t mStartFrames;  // engine frames read as of attach()
+    };
+
+    CaptureEngine(unsigned int card, unsigned int device,
+                  const struct pcm_config& config);
+    virtual ~CaptureEngine();
+
+    // open() opens the PCM and starts the thread; close() undoes it.
+    status_t open();
+    void     close();
+
+    unsigned int card() const { return mCard; }
+    unsigned int device() const { return mDevice; }
+    const struct pcm_config& config() const { return mConfig; }
+
+    sp<Client> attach();
+    void       detach(const sp<Client>& client);
+    size_t     clientCount();
+
+    // Block until frames worth of data is available to this client (or the
+    // engine reports an error) and copy it out.  Returns 0 or a negative
+    // errno, like pcm_read.
+    int      read(Client* client, int16_t* dst, size_t frames);
+
+    // Frames the client could read right now without blocking.
+    size_t   framesAvailable(Client* client);
+
+    // Drop whatever the client has not read yet and continue from the most
+    // recent period, as though it had just attached.
+    void     skipToLive(Client* client);
+
+    // Frames the client lost since the last call.
+    uint32_t takeFramesLost(Client* client);
+
+    // Device frames captured since the client attached.
+    uint64_t framesCaptured(Client* client);
+
+    // Device frames captured since the client attached, as of the returned
+    // CLOCK_MONOTONIC time, sampled right after the most recent pcm_read.
+    // Returns false until the first sample has been taken.
+    bool     getCapturePosition(Client* client, uint64_t* frames,
+                                struct timespec* time);
+
+    void     dump(String8& result);
+
+    // Whether streams should capture through an engine at all
+    // (audio.atv.capture_thread, on by default).  Without one, each stream
+    // reads its own PCM synchronously and devices cannot be shared.
+    static bool isEnabled();
+
+  private:
+    static const uint32_t kRingMsec;
+    static const int      kFifoPriority;
+    static const nsecs_t  kReadTimeout;
+    static const uint32_t kStopRetryUsec;
+
+    virtual status_t readyToRun();
+    virtual bool     threadLoop();
+
+    static uint32_t ringSlots(const struct pcm_config& config);
+
+    const unsigned int    mCard;
+    const unsigned int    mDevice;
+    struct pcm_config     mConfig;
+    struct pcm*           mPcm;
+    const uint32_t        mChannels;
+    const uint32_t        mPeriodFrames;
+    CaptureRing           mRing;
+
+    // Protects everything below.  Also used to park readers while they are
+    // caught up; the data path itself never takes it.
+    Mutex                 mLock;
+    Condition             mDataAvail;
+    Vector< sp<Client> >  mClients;
+    uint64_t              mFramesRead;
+    bool                  mPosValid;
+    uint64_t              mPosFrames;
+    struct timespec       mPosTime;
+    uint32_t              mErrorSeq;
+    int                   mLastError;
+
+    bool                  mIsFifo;
+    uint32_t              mReadErrors;
+};
+
+}  // namespace android
+#endif  // ANDROID_CAPTURE_ENGINE_H
@@ -0,0 +1,139 @@
+/*
+**
+** Copyright 2014, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#include <string.h>
+
+#include "CaptureRing.h"
+
+namespace android {
+
+CaptureRing::CaptureRing(uint32_t slots, uint32_t periodFrames,
+                         uint32_t channels)
+    : mSlots(slots)
+    , mPeriodFrames(periodFrames)
+    , mChannels(channels)
+    , mWriteSeq(0)
+    , mWriteBegin(0)
+{
+    mRing = new int16_t[mSlots * mPeriodFrames * mChannels];
+}
+
+CaptureRing::~CaptureRing()
+{
+    delete [] mRing;
+}
+
+int16_t* CaptureRing::beginWrite()
+{
+    uint32_t seq = mWriteSeq.load(std::memory_order_relaxed);
+
+    // Let readers know the slot is about to be overwritten before touching it.
+    mWriteBegin.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    return slot(seq);
+}
+
+void CaptureRing::endWrite()
+{
+    mWriteSeq.store(mWriteSeq.load(std::memory_order_relaxed) + 1,
+                    std::memory_order_release);
+}
+
+void CaptureRing::skipTo(Cursor* c, uint32_t seq)
+{
+    c->framesLost += ((seq - c->seq) * mPeriodFrames) - c->offset;
+    c->overruns++;
+    c->seq = seq;
+    c->offset = 0;
+}
+
+const int16_t* CaptureRing::peek(Cursor* c, size_t* frames)
+{
+    uint32_t w = mWriteSeq.load(std::memory_order_acquire);
+    if (c->seq == w)
+        return NULL;
+
+    // The slot after the newest complete period is the next one to be
+    // overwritten, so at most mSlots - 1 periods are readable.
+    if ((w - c->seq) > (mSlots - 1))
+        skipTo(c, w - (mSlots - 1));
+
+    size_t n = mPeriodFrames - c->offset;
+    if (n < *frames)
+        *frames = n;
+
+    return slot(c->seq) + (c->offset * mChannels);
+}
+
+bool CaptureRing::commitRead(Cursor* c, size_t frames)
+{
+    // If the writer started on this slot while we were copying, what we
+    // copied may be torn.  Jump to the oldest period the writer cannot be
+    // in; waiting for mWriteSeq to show the overrun would mean spinning
+    // until the writer finishes the period.
+    std::atomic_thread_fence(std::memory_order_acquire);
+    uint32_t begin = mWriteBegin.load(std::memory_order_relaxed);
+    if ((begin - c->seq) > mSlots) {
+        c->tornReads++;
+        skipTo(c, begin - mSlots + 1);
+        return false;
+    }
+
+    c->offset += frames;
+    if (c->offset >= mPeriodFrames) {
+        c->seq++;
+        c->offset = 0;
+    }
+    return true;
+}
+
+size_t CaptureRing::read(Cursor* c, int16_t* dst, size_t frames)
+{
+    size_t done = 0;
+
+    while (done < frames) {
+        size_t n = frames - done;
+        const int16_t* src = peek(c, &n);
+        if (src == NULL)
+            break;
+
+        memcpy(dst + (done * mChannels), src, n * mChannels * sizeof(*dst));
+        if (commitRead(c, n))
+            done += n;
+    }
+
+    return done;
+}
+
+size_t CaptureRing::framesAvailable(const Cursor& c) const
+{
+    uint32_t w = mWriteSeq.load(std::memory_order_acquire);
+
+    if (w == c.seq)
+        return 0;
+
+    return ((w - c.seq) * mPeriodFrames) - c.offset;
+}
+
+void CaptureRing::seekToLive(Cursor* c) const
+{
+    c->seq = mWriteSeq.load(std::memory_order_acquire);
+    c->offset = 0;
+}
+
+}  // namespace android
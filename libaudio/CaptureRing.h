@@ -0,0 +1,94 @@
+/*
+**
+** Copyright 2014, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#ifndef ANDROID_CAPTURE_RING_H
+#define ANDROID_CAPTURE_RING_H
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace android {
+
+// Ring of period sized slots with one writer and any number of readers, each
+// with its own Cursor.  The writer never waits for readers: a reader which
+// falls more than a ring's worth behind skips ahead, and the skipped frames
+// are counted against it.
+//
+// The ring is lock free.  The writer publishes mWriteBegin before it starts
+// overwriting a slot and mWriteSeq once the period is complete; a reader
+// validates each copy against mWriteBegin afterwards, seqlock style.
+class CaptureRing {
+  public:
+    struct Cursor {
+        Cursor() : seq(0), offset(0), framesLost(0), overruns(0), tornReads(0) {}
+
+        uint32_t seq;           // next period to read
+        uint32_t offset;        // frames of it already read
+        uint32_t framesLost;
+        uint32_t overruns;
+        uint32_t tornReads;     // copies the writer overtook
+    };
+
+    CaptureRing(uint32_t slots, uint32_t periodFrames, uint32_t channels);
+    ~CaptureRing();
+
+    uint32_t slots() const { return mSlots; }
+    uint32_t periodFrames() const { return mPeriodFrames; }
+
+    // Writer.  beginWrite returns the slot for the next period, which is
+    // made readable by endWrite.  Calling beginWrite again without endWrite
+    // (eg. after a failed capture) reuses the same slot.
+    int16_t* beginWrite();
+    void     endWrite();
+
+    // Periods completed.
+    uint32_t writeSeq() const { return mWriteSeq.load(std::memory_order_acquire); }
+
+    // Reader.  Copy out up to frames without waiting, and return how many
+    // were copied; fewer than asked means the cursor has caught up.
+    size_t   read(Cursor* c, int16_t* dst, size_t frames);
+
+    // read() in two steps, seqlock style.  peek returns the next run of up
+    // to frames readable frames (all in one slot) and sets frames to its
+    // length, or returns NULL once the cursor has caught up.  After copying
+    // them out, commitRead consumes them; if it returns false the writer
+    // overtook the copy, which must be discarded, and the cursor has been
+    // moved past the damage.
+    const int16_t* peek(Cursor* c, size_t* frames);
+    bool     commitRead(Cursor* c, size_t frames);
+    size_t   framesAvailable(const Cursor& c) const;
+    // Continue from the most recent period, dropping anything unread.
+    void     seekToLive(Cursor* c) const;
+
+  private:
+    int16_t* slot(uint32_t seq) const {
+        return mRing + ((seq % mSlots) * mPeriodFrames * mChannels);
+    }
+
+    void     skipTo(Cursor* c, uint32_t seq);
+
+    const uint32_t        mSlots;
+    const uint32_t        mPeriodFrames;
+    const uint32_t        mChannels;
+    int16_t*              mRing;
+    std::atomic<uint32_t> mWriteSeq;    // periods completed
+    std::atomic<uint32_t> mWriteBegin;  // periods started
+};
+
+}  // namespace android
+#endif  // ANDROID_CAPTURE_RING_H
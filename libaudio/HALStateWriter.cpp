@@ -0,0 +1,255 @@
+/*
+**
+** Copyright 2014, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#define LOG_TAG "AudioHAL:HALStateWriter"
+
+#include <utils/Log.h>
+
+#include <math.h>
+#include <string.h>
+
+#include "HALStateWriter.h"
+
+namespace android {
+
+HALStateWriter::HALStateWriter(Format fmt)
+    : mFormat(fmt)
+    , mDepth(0)
+    , mDropped(0)
+{
+    mFirst[0] = true;
+
+    if (mFormat == kFormatBinary) {
+        mBinary.setCapacity(1024);
+        putByte('A');
+        putByte('T');
+        putByte('V');
+        putByte('S');
+        putByte(kVersion);
+    }
+}
+
+void HALStateWriter::putByte(uint8_t b) {
+    mBinary.add(b);
+}
+
+void HALStateWriter::putVarint(uint64_t val) {
+    while (val >= 0x80) {
+        putByte(static_cast<uint8_t>(val | 0x80));
+        val >>= 7;
+    }
+    putByte(static_cast<uint8_t>(val));
+}
+
+void HALStateWriter::putJSONString(const char* str) {
+    mJSON.append("\"");
+    for (const char* p = str; *p; ++p) {
+        unsigned char c = static_cast<unsigned char>(*p);
+        switch (c) {
+            case '"':  mJSON.append("\\\""); break;
+            case '\\': mJSON.append("\\\\"); break;
+            case '\n': mJSON.append("\\n"); break;
+            case '\t': mJSON.append("\\t"); break;
+            default:
+                if (c < 0x20)
+                    mJSON.appendFormat("\\u%04x", c);
+                else
+                    mJSON.append(p, 1);
+                break;
+        }
+    }
+    mJSON.append("\"");
+}
+
+void HALStateWriter::beginValue(const char* name, Tag tag) {
+    if (mFormat == kFormatBinary) {
+        putByte(static_cast<uint8_t>(tag));
+        if (name != NULL) {
+            size_t len = strlen(name);
+            if (len > 0xFF)
+                len = 0xFF;
+            putByte(static_cast<uint8_t>(len));
+            for (size_t i = 0; i < len; ++i)
+                putByte(static_cast<uint8_t>(name[i]));
+        }
+        return;
+    }
+
+    if (!mFirst[mDepth])
+        mJSON.append(",");
+    mFirst[mDepth] = false;
+
+    if (name != NULL) {
+        putJSONString(name);
+        mJSON.append(":");
+    }
+}
+
+// Containers nested past kMaxDepth are dropped along with everything in
+// them.  mDropped counts the levels opened since, so that their ends (and
+// not the ends of the containers we did write) are the ones swallowed.
+bool HALStateWriter::dropping(const char* name) {
+    if (!mDropped && (mDepth < (kMaxDepth - 1)))
+        return false;
+
+    if (!mDropped)
+        ALOGW("%s: state nested too deeply, dropping %s", __func__,
+              name ? name : "(anonymous)");
+    mDropped++;
+    return true;
+}
+
+void HALStateWriter::beginObject(const char* name) {
+    if (dropping(name))
+        return;
+
+    beginValue(name, kTagObject);
+    if (mFormat == kFormatJSON)
+        mJSON.append("{");
+    mFirst[++mDepth] = true;
+}
+
+void HALStateWriter::endObject() {
+    if (mDropped) {
+        mDropped--;
+        return;
+    }
+
+    if (mDepth <= 0)
+        return;
+
+    mDepth--;
+    if (mFormat == kFormatBinary)
+        putByte(kTagEnd);
+    else
+        mJSON.append("}");
+}
+
+void HALStateWriter::beginArray(const char* name) {
+    if (dropping(name))
+        return;
+
+    beginValue(name, kTagArray);
+    if (mFormat == kFormatJSON)
+        mJSON.append("[");
+    mFirst[++mDepth] = true;
+}
+
+void HALStateWriter::endArray() {
+    if (mDropped) {
+        mDropped--;
+        return;
+    }
+
+    if (mDepth <= 0)
+        return;
+
+    mDepth--;
+    if (mFormat == kFormatBinary)
+        putByte(kTagEnd);
+    else
+        mJSON.append("]");
+}
+
+void HALStateWriter::addBool(const char* name, bool val) {
+    if (mDropped)
+        return;
+
+    beginValue(name, kTagBool);
+    if (mFormat == kFormatBinary)
+        putByte(val ? 1 : 0);
+    else
+        mJSON.append(val ? "true" : "false");
+}
+
+void HALStateWriter::addInt(const char* name, int64_t val) {
+    if (mDropped)
+        return;
+
+    beginValue(name, kTagInt);
+    if (mFormat == kFormatBinary)
+        putVarint((static_cast<uint64_t>(val) << 1) ^
+                  static_cast<uint64_t>(val >> 63));
+    else
+        mJSON.appendFormat("%lld", static_cast<long long>(val));
+}
+
+void HALStateWriter::addFloat(const char* name, float val) {
+    if (mDropped)
+        return;
+
+    beginValue(name, kTagFloat);
+    if (mFormat == kFormatBinary) {
+        uint32_t bits;
+        memcpy(&bits, &val, sizeof(bits));
+        for (int i = 0; i < 4; ++i)
+            putByte(static_cast<uint8_t>(bits >> (8 * i)));
+    } else if (isfinite(val)) {
+        mJSON.appendFormat("%.3f", val);
+    } else {
+        mJSON.append("null");
+    }
+}
+
+void HALStateWriter::addString(const char* name, const char* val) {
+    if (mDropped)
+        return;
+
+    if (val == NULL)
+        val = "";
+
+    beginValue(name, kTagString);
+    if (mFormat == kFormatBinary) {
+        size_t len = strlen(val);
+        putVarint(len);
+        for (size_t i = 0; i < len; ++i)
+            putByte(static_cast<uint8_t>(val[i]));
+    } else {
+        putJSONString(val);
+    }
+}
+
+String8 HALStateWriter::result() const {
+    if (mFormat == kFormatJSON)
+        return mJSON;
+
+    static const char kB64[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    const uint8_t* src = mBinary.array();
+    size_t len = mBinary.size();
+    String8 out;
+
+    for (size_t i = 0; i < len; i += 3) {
+        uint32_t chunk = static_cast<uint32_t>(src[i]) << 16;
+        size_t remain = len - i;
+        if (remain > 1)
+            chunk |= static_cast<uint32_t>(src[i + 1]) << 8;
+        if (remain > 2)
+            chunk |= static_cast<uint32_t>(src[i + 2]);
+
+        char quad[4];
+        quad[0] = kB64[(chunk >> 18) & 0x3F];
+        quad[1] = kB64[(chunk >> 12) & 0x3F];
+        quad[2] = (remain > 1) ? kB64[(chunk >> 6) & 0x3F] : '=';
+        quad[3] = (remain > 2) ? kB64[chunk & 0x3F] : '=';
+        out.append(quad, sizeof(quad));
+    }
+
+    return out;
+}
+
+}  // namespace android
@@ -0,0 +1,96 @@
+/*
+**
+** Copyright 2014, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#ifndef ANDROID_HAL_STATE_WRITER_H
+#define ANDROID_HAL_STATE_WRITER_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <utils/String8.h>
+#include <utils/Vector.h>
+
+namespace android {
+
+// Serializer used by the HAL objects to export their state in a machine
+// readable form (as opposed to the human readable text produced by dump()).
+//
+// The same sequence of calls can be rendered either as JSON or as a compact
+// tagged binary stream.  The binary stream is laid out as...
+//
+//   magic "ATVS" | version u8 | record
+//
+// where the record is the anonymous root object (the same one which wraps the
+// JSON output), and each record is a tag byte, followed by a u8 length prefixed key (for
+// members of objects), followed by the value.  Integers are zig-zag varints,
+// floats are little endian IEEE-754 singles, strings are varint length
+// prefixed, and objects/arrays are terminated by kTagEnd.  Objects and arrays
+// nested more than kMaxDepth deep are left out, contents and all.
+class HALStateWriter {
+  public:
+    enum Format {
+        kFormatJSON,
+        kFormatBinary,
+    };
+
+    explicit HALStateWriter(Format fmt);
+
+    void beginObject(const char* name);
+    void endObject();
+    void beginArray(const char* name);
+    void endArray();
+
+    void addBool(const char* name, bool val);
+    void addInt(const char* name, int64_t val);
+    void addFloat(const char* name, float val);
+    void addString(const char* name, const char* val);
+
+    // Fetch the serialized state.  Binary output is base64 encoded so that it
+    // can be carried in the value of a key/value parameter string.
+    String8 result() const;
+
+    static const uint8_t kVersion = 1;
+
+  private:
+    enum Tag {
+        kTagEnd    = 0,
+        kTagObject = 1,
+        kTagArray  = 2,
+        kTagBool   = 3,
+        kTagInt    = 4,
+        kTagFloat  = 5,
+        kTagString = 6,
+    };
+
+    static const int kMaxDepth = 16;
+
+    bool dropping(const char* name);
+    void beginValue(const char* name, Tag tag);
+    void putByte(uint8_t b);
+    void putVarint(uint64_t val);
+    void putJSONString(const char* str);
+
+    const Format    mFormat;
+    String8         mJSON;
+    Vector<uint8_t> mBinary;
+    int             mDepth;
+    int             mDropped;
+    bool            mFirst[kMaxDepth];
+};
+
+}  // namespace android
+#endif  // ANDROID_HAL_STATE_WRITER_H
@@ -29,6 +29,10 @@ namespace android {
 
 extern AudioHardwareOutput gAudioHardwareOutput;
 
+// IEC61937 burst repetition period, in output frames at the base (1x) rate:
+// one AC-3 sync frame.  E-AC3 runs at 4x and repeats every 6144 frames.
+static const uint32_t kIEC61937BurstFrames = 1536;
+
 HDMIAudioOutput::HDMIAudioOutput()
     : AudioOutput(kHDMI_ALSADeviceName, PCM_FORMAT_S24_LE)
 {
@@ -44,6 +48,10 @@ status_t HDMIAudioOutput::setupForStream(const AudioStreamOut& stream)
     mFramesPerSec = stream.outputSampleRate();
     mBufferChunks = stream.nomChunksInFlight();
     mChannelCnt = audio_channel_count_from_out_mask(stream.chanMask());
+    mIsEncoded = stream.isEncoded();
+    mEncodedBurstFrames = mIsEncoded
+                        ? (kIEC61937BurstFrames * stream.getRateMultiplier())
+                        : 0;
 
     ALOGI("setupForStream format %08x, rate = %u", stream.format(), mFramesPerSec);
 
@@ -85,11 +93,14 @@ void HDMIAudioOutput::dump(String8& result)
             "\t%s Audio Output\n"
             "\t\tSample Rate       : %d\n"
             "\t\tChannel Count     : %d\n"
-            "\t\tState             : %d\n",
+            "\t\tState             : %d\n"
+            "\t\tDelay Comp        : %u uSec (%u frames)\n",
             getOutputName(),
             mFramesPerSec,
             mChannelCnt,
-            mState);
+            mState,
+            mExternalDelayUSec,
+            getExternalDelayFrames());
     result.append(buffer);
 }
 
@@ -0,0 +1,282 @@
+/*
+**
+** Copyright 2014, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#define LOG_TAG "AudioHAL:RemoteControlState"
+#include <utils/Log.h>
+
+#ifdef REMOTE_CONTROL_INTERFACE
+#include <binder/IBinder.h>
+#include <binder/IInterface.h>
+#include <IRemoteControlService.h>
+#endif
+
+#include "HALStateWriter.h"
+#include "RemoteControlState.h"
+
+namespace android {
+
+const nsecs_t RemoteControlState::kMinReconnectDelay = 250000000;   // 250 mSec
+const nsecs_t RemoteControlState::kMaxReconnectDelay = 8000000000LL; // 8 Sec
+
+#ifdef REMOTE_CONTROL_INTERFACE
+// A connection to the real service, which is also the service's death
+// recipient.
+class BinderRemoteControlService : public RemoteControlState::Service,
+                                   public IBinder::DeathRecipient {
+  public:
+    BinderRemoteControlService(const sp<IRemoteControlService>& service,
+                               RemoteControlState* owner)
+        : mService(service), mOwner(owner) {}
+
+    virtual bool hasActiveRemote() { return mService->hasActiveRemote(); }
+    virtual void setMicEnabled(bool enabled) { mService->setMicEnabled(enabled); }
+
+    virtual void binderDied(const wp<IBinder>& who)
+    {
+        (void)who;
+        sp<RemoteControlState> owner = mOwner.promote();
+        if (owner != NULL)
+            owner->onServiceDied(this);
+    }
+
+    sp<IBinder> binder() const { return IInterface::asBinder(mService); }
+
+  private:
+    const sp<IRemoteControlService> mService;
+    const wp<RemoteControlState> mOwner;
+};
+
+class BinderConnector : public RemoteControlState::Connector {
+  public:
+    virtual sp<RemoteControlState::Service> connect(RemoteControlState* owner)
+    {
+        sp<IRemoteControlService> service = IRemoteControlService::getInstance();
+        if (service == NULL)
+            return NULL;
+
+        sp<BinderRemoteControlService> conn =
+            new BinderRemoteControlService(service, owner);
+        status_t res = conn->binder()->linkToDeath(conn);
+        if (res != NO_ERROR) {
+            // Most likely died already; try again next time.
+            ALOGW("%s: unable to watch RemoteControl service (%d)", __func__, res);
+            return NULL;
+        }
+
+        return conn;
+    }
+};
+#else
+class NullConnector : public RemoteControlState::Connector {
+  public:
+    virtual sp<RemoteControlState::Service> connect(RemoteControlState* owner)
+    {
+        (void)owner;
+        return NULL;
+    }
+    virtual bool builtIn() const { return false; }
+};
+#endif
+
+sp<RemoteControlState> RemoteControlState::getInstance()
+{
+#ifdef REMOTE_CONTROL_INTERFACE
+    static BinderConnector sConnector;
+#else
+    static NullConnector sConnector;
+#endif
+    static sp<RemoteControlState> sInstance = new RemoteControlState(&sConnector);
+    return sInstance;
+}
+
+RemoteControlState::RemoteControlState(Connector* connector)
+    : mConnector(connector)
+    , mActiveRemote(false)
+    , mReconnectDelay(kMinReconnectDelay)
+    , mConnects(0)
+    , mDeaths(0)
+    , mRefreshes(0)
+{
+}
+
+RemoteControlState::~RemoteControlState()
+{
+    sp<ReconnectThread> thread;
+
+    {
+        Mutex::Autolock _l(mLock);
+        thread = mReconnectThread;
+        mReconnectThread.clear();
+        if (thread != NULL) {
+            thread->requestExit();
+            mReconnectCond.signal();
+        }
+    }
+
+    if (thread != NULL)
+        thread->requestExitAndWait();
+}
+
+sp<RemoteControlState::Service> RemoteControlState::getService_l()
+{
+    if (mService != NULL)
+        return mService;
+
+    mService = mConnector->connect(this);
+    if (mService == NULL)
+        return NULL;
+
+    mConnects++;
+    return mService;
+}
+
+void RemoteControlState::refresh_l()
+{
+    bool active = false;
+
+    sp<Service> service = getService_l();
+    if (service == NULL) {
+        ALOGV("%s: No RemoteControl service detected", __func__);
+    } else {
+        active = service->hasActiveRemote();
+    }
+
+    mRefreshes++;
+    if (active != mActiveRemote.load(std::memory_order_relaxed))
+        ALOGI("%s: remote is %s", __func__, active ? "active" : "inactive");
+    mActiveRemote.store(active, std::memory_order_release);
+}
+
+void RemoteControlState::onConnectionChanged()
+{
+    Mutex::Autolock _l(mLock);
+    refresh_l();
+}
+
+void RemoteControlState::setMicEnabled(bool enabled)
+{
+    Mutex::Autolock _l(mLock);
+
+    sp<Service> service = getService_l();
+    if (service == NULL) {
+        if (mConnector->builtIn())
+            ALOGE("%s: No RemoteControl service detected, ignoring", __func__);
+        return;
+    }
+
+    service->setMicEnabled(enabled);
+
+    // Voice capture starting or stopping is when the active remote matters
+    // most, and a remote may have connected or gone away without the policy
+    // manager seeing the mic device change.
+    refresh_l();
+}
+
+void RemoteControlState::onServiceDied(const sp<Service>& service)
+{
+    Mutex::Autolock _l(mLock);
+
+    // A connection we already replaced.
+    if (service != mService)
+        return;
+
+    ALOGW("%s: RemoteControl service died", __func__);
+    mService.clear();
+    mDeaths++;
+
+    // Whatever remote there was went with it.
+    mActiveRemote.store(false, std::memory_order_release);
+
+    if (mReconnectThread == NULL) {
+        mReconnectDelay = kMinReconnectDelay;
+        mReconnectThread = new ReconnectThread(*this);
+        status_t res = mReconnectThread->run("RemoteControlReconnect");
+        if (res != OK) {
+            // Fall back to picking it up on the next connection change.
+            ALOGE("%s: unable to start reconnect thread (%d)", __func__, res);
+            mReconnectThread.clear();
+        }
+    }
+}
+
+// Called on the reconnect thread.  Returns how long to wait before the next
+// attempt, or -1 once connected.
+nsecs_t RemoteControlState::reconnect()
+{
+    Mutex::Autolock _l(mLock);
+
+    if (mService == NULL)
+        refresh_l();
+
+    if (mService != NULL) {
+        ALOGI("%s: reconnected to RemoteControl service", __func__);
+        mReconnectThread.clear();
+        return -1;
+    }
+
+    nsecs_t delay = mReconnectDelay;
+    mReconnectDelay = (delay * 2 < kMaxReconnectDelay) ? (delay * 2)
+                                                       : kMaxReconnectDelay;
+    return delay;
+}
+
+bool RemoteControlState::ReconnectThread::threadLoop()
+{
+    nsecs_t delay = mOwner.reconnect();
+    if (delay < 0)
+        return false;
+
+    Mutex::Autolock _l(mOwner.mLock);
+    if (!exitPending())
+        mOwner.mReconnectCond.waitRelative(mOwner.mLock, delay);
+
+    return true;
+}
+
+void RemoteControlState::dump(String8& result)
+{
+    Mutex::Autolock _l(mLock);
+
+    result.appendFormat("\tRemote Control\n");
+    if (!mConnector->builtIn()) {
+        result.appendFormat("\t\tService           : not built in\n");
+    } else {
+        result.appendFormat("\t\tService           : %s\n",
+                            (mService != NULL) ? "connected" :
+                            (mReconnectThread != NULL) ? "reconnecting" :
+                            "not connected");
+    }
+    result.appendFormat("\t\tActive Remote     : %s\n", hasActiveRemote() ? "yes" : "no");
+    result.appendFormat("\t\tConnects/Deaths   : %u/%u\n", mConnects, mDeaths);
+    result.appendFormat("\t\tRefreshes         : %u\n", mRefreshes);
+}
+
+void RemoteControlState::exportState(HALStateWriter& w)
+{
+    Mutex::Autolock _l(mLock);
+
+    w.beginObject("remoteControl");
+    w.addBool("serviceConnected", mService != NULL);
+    w.addBool("reconnecting", mReconnectThread != NULL);
+    w.addBool("activeRemote", hasActiveRemote());
+    w.addInt("connects", mConnects);
+    w.addInt("deaths", mDeaths);
+    w.addInt("refreshes", mRefreshes);
+    w.endObject();
+}
+
+}  // namespace android
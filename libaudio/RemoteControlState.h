@@ -0,0 +1,128 @@
+/*
+**
+** Copyright 2014, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#ifndef ANDROID_REMOTE_CONTROL_STATE_H
+#define ANDROID_REMOTE_CONTROL_STATE_H
+
+#include <atomic>
+#include <stdint.h>
+
+#include <utils/RefBase.h>
+#include <utils/String8.h>
+#include <utils/threads.h>
+
+namespace android {
+
+class HALStateWriter;
+
+// Process wide view of the RemoteControl service, shared by the HAL and the
+// policy manager (which live in the same process).  It holds the one
+// connection to the service, watches it for death, and keeps a copy of
+// whether a remote is active, so that routing can ask without a binder
+// transaction.
+//
+// The service has no way to push connection changes to us.  The remote's mic
+// is announced to the policy manager as AUDIO_DEVICE_IN_WIRED_HEADSET,
+// though, and the policy manager calls onConnectionChanged() whenever that
+// comes or goes; the copy is refreshed from the service there, whenever the
+// remote's mic is turned on or off for voice capture, and whenever the
+// connection to the service is (re)established.  If the service dies, a
+// background thread keeps trying to reconnect until it is back.
+//
+// In builds without REMOTE_CONTROL_INTERFACE there is no service; no remote
+// is ever active, and the mic control is a no-op.
+class RemoteControlState : public RefBase {
+  public:
+    // One connection to the service.  The real one wraps
+    // IRemoteControlService; tests use a local stand-in.
+    class Service : public virtual RefBase {
+      public:
+        virtual bool hasActiveRemote() = 0;
+        virtual void setMicEnabled(bool enabled) = 0;
+    };
+
+    // Makes connections.  connect() returns NULL if the service is not
+    // running.  Otherwise, when the service dies, the connection calls
+    // onServiceDied() on the owner, if the owner is still around.
+    class Connector {
+      public:
+        virtual ~Connector() {}
+        virtual sp<Service> connect(RemoteControlState* owner) = 0;
+        // False if this build has no service to connect to.
+        virtual bool builtIn() const { return true; }
+    };
+
+    static sp<RemoteControlState> getInstance();
+
+    // A state of its own, connecting through connector, which must outlive
+    // it.  Only tests need anything but getInstance().
+    explicit RemoteControlState(Connector* connector);
+    virtual ~RemoteControlState();
+
+    // The cached state.  Never blocks.
+    bool     hasActiveRemote() const {
+        return mActiveRemote.load(std::memory_order_acquire);
+    }
+
+    // Re-read the state from the service, connecting first if need be.
+    void     onConnectionChanged();
+
+    // Turn the remote's mic on or off, then re-read the state.
+    void     setMicEnabled(bool enabled);
+
+    // Called by a connection whose service has died.
+    void     onServiceDied(const sp<Service>& service);
+
+    void     dump(String8& result);
+    void     exportState(HALStateWriter& w);
+
+  private:
+    // Reconnects to a service which has died, once it is back, and
+    // refreshes the state from it.
+    class ReconnectThread : public Thread {
+      public:
+        explicit ReconnectThread(RemoteControlState& owner)
+            : Thread(false), mOwner(owner) {}
+      private:
+        virtual bool threadLoop();
+        RemoteControlState& mOwner;
+    };
+
+    static const nsecs_t kMinReconnectDelay;
+    static const nsecs_t kMaxReconnectDelay;
+
+    sp<Service> getService_l();
+    void        refresh_l();
+    nsecs_t     reconnect();
+
+    Connector* const  mConnector;
+
+    // Protects everything but mActiveRemote.  Calls to the service are made
+    // with it held, so that refreshes are not reordered.
+    Mutex             mLock;
+    sp<Service>       mService;
+    std::atomic<bool> mActiveRemote;
+    sp<ReconnectThread> mReconnectThread;
+    Condition         mReconnectCond;
+    nsecs_t           mReconnectDelay;
+    uint32_t          mConnects;
+    uint32_t          mDeaths;
+    uint32_t          mRefreshes;
+};
+
+}  // namespace android
+#endif  // ANDROID_REMOTE_CONTROL_STATE_H
@@ -0,0 +1,67 @@
+/*
+**
+** Copyright 2014, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#include "SilenceClock.h"
+
+namespace android {
+
+const nsecs_t SilenceClock::kMaxLag = 100000000;
+
+SilenceClock::SilenceClock()
+    : mActive(false)
+    , mAnchor(0)
+    , mRate(0)
+    , mFrames(0)
+{
+}
+
+void SilenceClock::start(nsecs_t now, nsecs_t anchor, uint32_t rate)
+{
+    mActive = true;
+    mRate = rate;
+    mFrames = 0;
+    mAnchor = (anchor && (anchor <= now) && ((now - anchor) <= kMaxLag))
+            ? anchor : now;
+}
+
+uint64_t SilenceClock::stop()
+{
+    uint64_t frames = mFrames;
+
+    mActive = false;
+    mFrames = 0;
+    return frames;
+}
+
+nsecs_t SilenceClock::position() const
+{
+    if (!mRate)
+        return mAnchor;
+
+    return mAnchor + static_cast<nsecs_t>((mFrames * 1000000000ULL) / mRate);
+}
+
+nsecs_t SilenceClock::advance(nsecs_t now, size_t frames)
+{
+    if ((now - position()) > kMaxLag)
+        mAnchor += (now - position());
+
+    mFrames += frames;
+    return position();
+}
+
+}  // namespace android
@@ -0,0 +1,65 @@
+/*
+**
+** Copyright 2014, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#ifndef ANDROID_SILENCE_CLOCK_H
+#define ANDROID_SILENCE_CLOCK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <utils/Timers.h>
+
+namespace android {
+
+// Timeline for the silence we hand out when there is no device to capture
+// from.  Deadlines are derived from the total number of frames synthesized
+// rather than accumulated per read, so they never drift; the caller sleeps
+// until each one with an absolute (TIMER_ABSTIME) wait.  Pure bookkeeping,
+// driven entirely by the times passed in.
+class SilenceClock {
+  public:
+    SilenceClock();
+
+    // Begin a timeline at rate.  If anchor (the time the last real frame was
+    // captured) is recent, the timeline continues from it; otherwise it
+    // starts now.
+    void     start(nsecs_t now, nsecs_t anchor, uint32_t rate);
+    // Returns the frames synthesized, so the caller can fold them into its
+    // capture position.
+    uint64_t stop();
+
+    // Account for frames more frames and return the absolute time at which
+    // the last of them is due.  A caller which has fallen more than kMaxLag
+    // behind is re-anchored to now rather than being handed a burst.
+    nsecs_t  advance(nsecs_t now, size_t frames);
+
+    bool     active() const { return mActive; }
+    uint64_t frames() const { return mFrames; }
+    // Due time of the last frame handed out.
+    nsecs_t  position() const;
+
+  private:
+    static const nsecs_t kMaxLag;
+
+    bool     mActive;
+    nsecs_t  mAnchor;
+    uint32_t mRate;
+    uint64_t mFrames;
+};
+
+}  // namespace android
+#endif  // ANDROID_SILENCE_CLOCK_H
@@ -0,0 +1,124 @@
+/*
+**
+** Copyright 2014, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "SoundUevent.h"
+
+namespace android {
+
+const nsecs_t SoundUevent::kCardSettleTime = 50000000;
+
+// filename suffixes for ALSA nodes representing capture and playback devices
+static const char kDeviceTypeCapture = 'c';
+static const char kDeviceTypePlayback = 'p';
+
+bool SoundUevent::parseNodeName(const char* name, unsigned int* card,
+                                unsigned int* device, bool* playback,
+                                bool* control)
+{
+    char deviceType;
+    char extra;
+
+    if (sscanf(name, "controlC%u%c", card, &extra) == 1) {
+        *control = true;
+        return true;
+    }
+
+    if (sscanf(name, "pcmC%uD%u%c", card, device, &deviceType) != 3)
+        return false;
+
+    *control = false;
+    *playback = (deviceType == kDeviceTypePlayback);
+    return (deviceType == kDeviceTypeCapture) || *playback;
+}
+
+bool SoundUevent::parse(const char* msg)
+{
+    const char* action = NULL;
+    const char* subsystem = NULL;
+    const char* devpath = NULL;
+    const char* devname = NULL;
+    bool hotplug = false;
+
+    type = kIgnored;
+
+    for (const char* cp = msg; *cp; cp += strlen(cp) + 1) {
+        if (!strncmp(cp, "ACTION=", 7))
+            action = cp + 7;
+        else if (!strncmp(cp, "SUBSYSTEM=", 10))
+            subsystem = cp + 10;
+        else if (!strncmp(cp, "DEVPATH=", 8))
+            devpath = cp + 8;
+        else if (!strncmp(cp, "DEVNAME=", 8))
+            devname = cp + 8;
+        else if (!strcmp(cp, "HOTPLUG=1"))
+            hotplug = true;
+    }
+
+    if (!action || !subsystem)
+        return false;
+
+    bool add = !strcmp(action, "add");
+    bool remove = !strcmp(action, "remove");
+
+    if (!strcmp(subsystem, "drm")) {
+        if (hotplug)
+            type = kHDMIHotplug;
+        return (type != kIgnored);
+    }
+
+    if (strcmp(subsystem, "sound"))
+        return false;
+
+    // Device nodes: PCMs and the control node.
+    bool control;
+    if (devname && !strncmp(devname, "snd/", 4) &&
+        parseNodeName(devname + 4, &card, &device, &playback, &control)) {
+        if (control) {
+            if (add)
+                type = kCardReady;
+            else if (remove)
+                type = kCardRemoved;
+        } else {
+            if (add)
+                type = kPCMAdded;
+            else if (remove)
+                type = kPCMRemoved;
+        }
+        return (type != kIgnored);
+    }
+
+    // The card itself, which has no node.
+    const char* name = devpath ? strrchr(devpath, '/') : NULL;
+    if (name && (sscanf(name, "/card%u", &card) == 1) && remove)
+        type = kCardRemoved;
+
+    return (type != kIgnored);
+}
+
+nsecs_t SoundUevent::scanDelay() const
+{
+    switch (type) {
+        case kPCMAdded:  return kCardSettleTime;
+        case kCardReady: return 0;
+        default:         return -1;
+    }
+}
+
+}  // namespace android
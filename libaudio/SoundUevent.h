@@ -0,0 +1,70 @@
+/*
+**
+** Copyright 2014, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#ifndef ANDROID_SOUND_UEVENT_H
+#define ANDROID_SOUND_UEVENT_H
+
+#include <utils/Timers.h>
+
+namespace android {
+
+// A kernel uevent, reduced to what AudioHotplugThread acts on.  Kept apart
+// from the thread so that it can be exercised on the host.
+//
+// A card's devices are registered one at a time, each with its own add.  The
+// control node (controlC<N>) is registered after all of the card's PCMs, so
+// its add is the signal that the card is complete.  There is no "change" on
+// the card to wait for; that is synthesized by udev, which Android does not
+// run.
+struct SoundUevent {
+    enum Type {
+        kIgnored,
+        kPCMAdded,
+        kPCMRemoved,
+        kCardReady,     // control node added
+        kCardRemoved,
+        kHDMIHotplug,
+    };
+
+    // How long after one of its PCMs appears to probe a card whose control
+    // node has not, in case we missed it (eg. the socket overflowed).
+    static const nsecs_t kCardSettleTime;
+
+    Type         type;
+    unsigned int card;
+    unsigned int device;    // PCM events only
+    bool         playback;  // PCM events only
+
+    SoundUevent() : type(kIgnored), card(0), device(0), playback(false) {}
+
+    // Parse a uevent message: NUL separated KEY=value strings, ended by an
+    // empty one.  Returns false for events of no interest.
+    bool parse(const char* msg);
+
+    // When to probe the card in response to this event, or -1 for never.
+    nsecs_t scanDelay() const;
+
+    // Parse the name of an ALSA node in /dev/snd: pcmC<card>D<device>{c,p}
+    // or controlC<card>.  device and playback are only set for PCMs.
+    static bool parseNodeName(const char* name, unsigned int* card,
+                              unsigned int* device, bool* playback,
+                              bool* control);
+};
+
+}  // namespace android
+
+#endif  // ANDROID_SOUND_UEVENT_H
@@ -0,0 +1,154 @@
+/*
+**
+** Copyright 2014, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#define LOG_TAG "AudioHAL:alsa_caps_mixer"
+
+#include <utils/Log.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include <tinyalsa/asoundlib.h>
+
+#include "alsa_utils.h"
+
+namespace android {
+
+// tinyalsa backed implementation of HDMICapsMixer.  This is the only place
+// which knows how the Intel HDMI audio driver names its caps controls.
+class TinyALSACapsMixer : public HDMICapsMixer {
+  public:
+    explicit TinyALSACapsMixer(struct mixer* mixer);
+    virtual ~TinyALSACapsMixer();
+
+    virtual bool hasQueryCtrls();
+    virtual int getValue(Ctrl ctrl);
+    virtual int setValue(Ctrl ctrl, int value);
+    virtual ssize_t readELD(uint8_t* buf, size_t len);
+    virtual ssize_t readEDID(uint8_t* buf, size_t len);
+
+  private:
+    static const char *kCtrlNames[kCtrlCount];
+
+    // Name of the (optional) byte control through which the driver exposes
+    // the raw ELD of the attached sink.
+    static const char *kELDCtrlName;
+
+    struct mixer*     mMixer;
+    struct mixer_ctl* mCtrls[kCtrlCount];
+};
+
+const char *TinyALSACapsMixer::kCtrlNames[kCtrlCount] = {
+    "Basic Audio Supported",
+    "Speaker Allocation",
+    "Audio Mode Count",
+    "Audio Mode To Query",
+    "Query Mode : Format",
+    "Query Mode : Max Ch Count",
+    "Query Mode : Sample Rate Mask",
+    "Query Mode : PCM Bits/Sample Mask",
+    "Query Mode : Max Compressed Bitrate"
+};
+const char *TinyALSACapsMixer::kELDCtrlName = "ELD";
+
+HDMICapsMixer* HDMICapsMixer::open(int ALSADeviceID) {
+    struct mixer* mixer = mixer_open(ALSADeviceID);
+
+    if (NULL == mixer) {
+        ALOGE("%s: mixer_open(%d) failed", __func__, ALSADeviceID);
+        return NULL;
+    }
+
+    return new TinyALSACapsMixer(mixer);
+}
+
+TinyALSACapsMixer::TinyALSACapsMixer(struct mixer* mixer)
+    : mMixer(mixer)
+{
+    // No need to free/release these later, they are just pointers into the
+    // tinyalsa mixer structure itself.
+    for (size_t i = 0; i < kCtrlCount; ++i)
+        mCtrls[i] = mixer_get_ctl_by_name(mMixer, kCtrlNames[i]);
+}
+
+TinyALSACapsMixer::~TinyALSACapsMixer()
+{
+    mixer_close(mMixer);
+}
+
+bool TinyALSACapsMixer::hasQueryCtrls() {
+    for (size_t i = 0; i < kCtrlCount; ++i) {
+        if (NULL == mCtrls[i]) {
+            ALOGE("%s: mixer_get_ctrl_by_name(%s) failed", __func__, kCtrlNames[i]);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+int TinyALSACapsMixer::getValue(Ctrl ctrl) {
+    if ((ctrl >= kCtrlCount) || (NULL == mCtrls[ctrl]))
+        return -ENODEV;
+
+    return mixer_ctl_get_value(mCtrls[ctrl], 0);
+}
+
+int TinyALSACapsMixer::setValue(Ctrl ctrl, int value) {
+    if ((ctrl >= kCtrlCount) || (NULL == mCtrls[ctrl]))
+        return -ENODEV;
+
+    return mixer_ctl_set_value(mCtrls[ctrl], 0, value);
+}
+
+ssize_t TinyALSACapsMixer::readELD(uint8_t* buf, size_t len) {
+    struct mixer_ctl* eld = mixer_get_ctl_by_name(mMixer, kELDCtrlName);
+
+    if ((NULL == eld) || (MIXER_CTL_TYPE_BYTE != mixer_ctl_get_type(eld)))
+        return -ENODEV;
+
+    unsigned int cnt = mixer_ctl_get_num_values(eld);
+    if (cnt > len)
+        cnt = len;
+
+    if (!cnt || mixer_ctl_get_array(eld, buf, cnt))
+        return -EIO;
+
+    return cnt;
+}
+
+// Raw EDID of the HDMI connector, as exposed by DRM.
+ssize_t TinyALSACapsMixer::readEDID(uint8_t* buf, size_t len) {
+    char path[PATH_MAX];
+    if (find_hdmi_connector_attr(kDRM_ClassDir, "edid", path, sizeof(path)))
+        return -ENODEV;
+
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0)
+        return -errno;
+
+    ssize_t ret = read(fd, buf, len);
+    if (ret < 0)
+        ret = -errno;
+
+    close(fd);
+    return ret;
+}
+
+}  // namespace android
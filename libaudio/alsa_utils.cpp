@@ -17,16 +17,21 @@
 
 #define LOG_TAG "AudioHAL:alsa_utils"
 
+#include <dirent.h>
+#include <stdio.h>
+
 #include "alsa_utils.h"
+#include "edid_parser.h"
+#include "HALStateWriter.h"
 
+// When set, the details of each newly published caps generation are logged.
 #ifndef ALSA_UTILS_PRINT_FORMATS
-#define ALSA_UTILS_PRINT_FORMATS  1
+#define ALSA_UTILS_PRINT_FORMATS  0
 #endif
 
 int find_alsa_card_by_name(const char* name) {
     int card_id = 0;
     int ret = -1;
-    int fd;
 
     do {
         int fd;
@@ -56,96 +61,245 @@ int find_alsa_card_by_name(const char* name) {
     return ret;
 }
 
+int find_hdmi_connector_attr(const char* drm_dir, const char* attr,
+                             char* path, size_t len) {
+    unsigned int best_card = 0, best_conn = 0;
+    char best_name[64];
+    struct dirent* entry;
+    DIR* dir;
+    int ret;
+
+    dir = opendir(drm_dir);
+    if (dir == NULL)
+        return -1;
+
+    best_name[0] = 0;
+    while ((entry = readdir(dir)) != NULL) {
+        unsigned int card, conn;
+        int end = 0;
+
+        if ((sscanf(entry->d_name, "card%u-HDMI-A-%u%n", &card, &conn, &end) != 2) ||
+            entry->d_name[end] || (end >= (int)sizeof(best_name)))
+            continue;
+
+        if (best_name[0] &&
+            ((card > best_card) || ((card == best_card) && (conn > best_conn))))
+            continue;
+
+        best_card = card;
+        best_conn = conn;
+        strcpy(best_name, entry->d_name);
+    }
+
+    closedir(dir);
+
+    if (!best_name[0])
+        return -1;
+
+    ret = snprintf(path, len, "%s/%s/%s", drm_dir, best_name, attr);
+    if ((ret < 0) || ((size_t)ret >= len))
+        return -1;
+
+    return 0;
+}
+
 #ifdef __cplusplus
-#include <tinyalsa/asoundlib.h>
 #include <utils/misc.h>
 
 namespace android {
 
-static const char *kCtrlNames[] = {
-    "Basic Audio Supported",
-    "Speaker Allocation",
-    "Audio Mode Count",
-    "Audio Mode To Query",
-    "Query Mode : Format",
-    "Query Mode : Max Ch Count",
-    "Query Mode : Sample Rate Mask",
-    "Query Mode : PCM Bits/Sample Mask",
-    "Query Mode : Max Compressed Bitrate"
-};
-static const size_t kCtrlCount    = sizeof(kCtrlNames)/sizeof(*kCtrlNames);
-static const size_t kBasicAudNdx  = 0;
-static const size_t kSpeakerAlloc = 1;
-static const size_t kModeCntNdx   = 2;
-static const size_t kModeSelNdx   = 3;
-static const size_t kFmtNdx       = 4;
-static const size_t kMaxChCntNdx  = 5;
-static const size_t kSampRateNdx  = 6;
-static const size_t kBPSNdx       = 7;
-static const size_t kMaxCompBRNdx = 8;
+// Largest ELD and EDID we are prepared to look at.
+static const size_t kMaxELDSize   = 256;
+static const size_t kMaxEDIDSize  = 512;
+
+// The driver reports far fewer modes than this in practice; anything larger
+// is garbage and would have us spin on the mode selector for no reason.
+static const int kMaxModeCount    = 64;
+
+// FNV-1a, used to fingerprint the sink for the capability cache.
+static uint32_t fnv1a(uint32_t hash, const void* data, size_t len) {
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < len; ++i) {
+        hash ^= p[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+static const uint32_t kFNVOffsetBasis = 2166136261u;
 
 HDMIAudioCaps::HDMIAudioCaps()
+    : mRequestSeq(0)
+    , mCommittedSeq(0)
+    , mRequestDevice(-1)
+    , mLoadPending(false)
+    , mCallback(NULL)
+    , mCacheClock(0)
+    , mCurrentKey(0)
+    , mTableGeneration(0)
+    , mVerifyQueued(false)
+    , mVerifyQueuedDevice(-1)
+    , mVerifyQueuedKey(0)
+    , mCacheHits(0)
+    , mCacheMisses(0)
+    , mVerifyMismatches(0)
+    , mLoadsCompleted(0)
+    , mLoadsSuperseded(0)
+    , mLastLoadTime(0)
+    , mLastEnumTime(0)
 {
     // Its unlikely we will need storage for more than 16 modes, but if we do,
     // the vector will resize for us.
     mModes.setCapacity(16);
+    for (size_t i = 0; i < kCacheEntries; ++i)
+        mCache[i].valid = false;
     reset();
 }
 
-bool HDMIAudioCaps::loadCaps(int ALSADeviceID) {
-    bool ret = false;
-    struct mixer* mixer = NULL;
-    struct mixer_ctl* ctrls[kCtrlCount] = {NULL};
-    int tmp, mode_cnt;
-    Mutex::Autolock _l(mLock);
+HDMIAudioCaps::~HDMIAudioCaps()
+{
+    sp<VerifyThread> verify;
+    sp<LoadThread> loader;
+    {
+        Mutex::Autolock _l(mLock);
+        verify = mVerifyThread;
+        mVerifyThread.clear();
+        mVerifyQueued = false;
+        mCallback = NULL;
+    }
 
-    ALOGE("%s: start", __func__);
+    {
+        Mutex::Autolock _l(mLoadLock);
+        loader = mLoadThread;
+        mLoadThread.clear();
+        mLoadPending = false;
+        if (loader != NULL) {
+            loader->requestExit();
+            mLoadCond.signal();
+        }
+    }
 
-    reset_l();
+    if (loader != NULL)
+        loader->requestExitAndWait();
+
+    if (verify != NULL)
+        verify->requestExitAndWait();
+
+    reset();
+}
 
-    // Open the mixer for the chosen ALSA device
-    if (NULL == (mixer = mixer_open(ALSADeviceID))) {
-        ALOGE("%s: mixer_open(%d) failed", __func__, ALSADeviceID);
-        goto bailout;
+bool HDMIAudioCaps::readCapsBlob(HDMICapsMixer* mixer, CapsSource* src,
+                                 uint16_t* speakerAlloc, Vector<Mode>* modes,
+                                 int* avSyncDelayMs) {
+    static const uint32_t kCEARates[] = {
+        kSR_32000, kSR_44100, kSR_48000, kSR_88200,
+        kSR_96000, kSR_176400, kSR_192000 };
+    static const uint32_t kCEABPS[] = { kBPS_16bit, kBPS_20bit, kBPS_24bit };
+    EDIDAudioInfo info;
+    bool ok = false;
+
+    // Prefer the ELD, which the audio driver keeps current for the attached
+    // sink; otherwise try the connector's EDID.
+    {
+        uint8_t buf[kMaxELDSize];
+        ssize_t len = mixer->readELD(buf, sizeof(buf));
+
+        if ((len > 0) && parseELD(buf, len, &info) && info.basicAudio) {
+            *src = kSrcELD;
+            ok = true;
+        }
     }
 
-    // Gather handles to all of the controls we will need in order to enumerate
-    // the audio capabilities of this HDMI link.  No need to free/release these
-    // later, they are just pointers into the tinyalsa mixer structure itself.
-    for (size_t i = 0; i < kCtrlCount; ++i) {
-        ctrls[i] = mixer_get_ctl_by_name(mixer, kCtrlNames[i]);
-        if (NULL == ctrls[i]) {
-            ALOGE("%s: mixer_get_ctrl_by_name(%s) failed", __func__, kCtrlNames[i]);
-            goto bailout;
-	}
+    if (!ok) {
+        uint8_t buf[kMaxEDIDSize];
+        ssize_t len = mixer->readEDID(buf, sizeof(buf));
+
+        if ((len > 0) && parseEDID(buf, len, &info) && info.basicAudio) {
+            *src = kSrcEDID;
+            ok = true;
+        }
     }
 
-    // Start by checking to see if this HDMI connection supports even basic
-    // audio.  If it does not, there is no point in proceeding.
-    if ((tmp = mixer_ctl_get_value(ctrls[kBasicAudNdx], 0)) <= 0) {
-        ALOGI("%s: Basic audio not supported by attached device", __func__);
-        goto bailout;
+    if (!ok)
+        return false;
+
+    modes->clear();
+    *speakerAlloc = info.speakerAlloc;
+    *avSyncDelayMs = info.avSyncDelayMs;
+
+    for (size_t i = 0; i < info.sadCount; ++i) {
+        const EDIDAudioInfo::SAD& sad = info.sads[i];
+        Mode m;
+
+        m.fmt = static_cast<AudFormat>(sad.fmt);
+        m.max_ch = sad.maxCh;
+        m.sr_bitmask = 0;
+        m.bps_bitmask = 0;
+        m.comp_bitrate = sad.maxBitrate;
+
+        for (size_t b = 0; b < NELEM(kCEARates); ++b)
+            if (sad.srMask & (1 << b))
+                m.sr_bitmask |= kCEARates[b];
+
+        for (size_t b = 0; b < NELEM(kCEABPS); ++b)
+            if (sad.bpsMask & (1 << b))
+                m.bps_bitmask |= kCEABPS[b];
+
+        if (sanityCheckMode(m))
+            modes->add(m);
     }
 
-    // Looks like we support basic audio.  Get a count of the available
-    // non-basic modes.
-    mBasicAudioSupported = true;
-    if ((mode_cnt = mixer_ctl_get_value(ctrls[kModeCntNdx], 0)) < 0)
-        goto bailout;
+    return true;
+}
 
-    // Fetch the speaker allocation data block, if available.
-    if ((tmp = mixer_ctl_get_value(ctrls[kSpeakerAlloc], 0)) < 0)
-        goto bailout;
-    mSpeakerAlloc = static_cast<uint16_t>(tmp);
-    ALOGI("%s: Speaker Allocation Map for attached device is: 0x%hx", __func__, mSpeakerAlloc);
+uint32_t HDMIAudioCaps::computeSinkKey(HDMICapsMixer* mixer) {
+    uint32_t hash = kFNVOffsetBasis;
+
+    // Prefer the raw ELD if the driver exposes it.  It carries the SADs and
+    // speaker allocation of the sink, as well as its manufacturer and product
+    // IDs and monitor name.
+    uint8_t buf[kMaxELDSize];
+    ssize_t len = mixer->readELD(buf, sizeof(buf));
+    if (len > 0)
+        return fnv1a(hash, buf, len);
+
+    // Otherwise, fall back on the header of the mode table.  This is a much
+    // weaker fingerprint, but any collisions will be caught and corrected by
+    // the background verification which follows every cache hit.
+    static const HDMICapsMixer::Ctrl kKeyCtrls[] = {
+        HDMICapsMixer::kCtrlBasicAudio,
+        HDMICapsMixer::kCtrlSpeakerAlloc,
+        HDMICapsMixer::kCtrlModeCount };
+    for (size_t i = 0; i < NELEM(kKeyCtrls); ++i) {
+        int val = mixer->getValue(kKeyCtrls[i]);
+        hash = fnv1a(hash, &val, sizeof(val));
+    }
+
+    return hash;
+}
+
+bool HDMIAudioCaps::enumerateModes(HDMICapsMixer* mixer,
+                                   uint16_t* speakerAlloc,
+                                   Vector<Mode>* modes) {
+    int tmp, mode_cnt;
+
+    modes->clear();
+
+    // Get a count of the available non-basic modes.
+    if ((mode_cnt = mixer->getValue(HDMICapsMixer::kCtrlModeCount)) < 0)
+        return false;
 
-    // If there are no non-basic modes available, then we are done.  Be sure to
-    // flag this as a successful operation.
-    if (!mode_cnt) {
-        ret = true;
-        goto bailout;
+    if (mode_cnt > kMaxModeCount) {
+        ALOGW("%s: driver reports %d modes, only looking at the first %d",
+              __func__, mode_cnt, kMaxModeCount);
+        mode_cnt = kMaxModeCount;
     }
 
+    // Fetch the speaker allocation data block, if available.
+    if ((tmp = mixer->getValue(HDMICapsMixer::kCtrlSpeakerAlloc)) < 0)
+        return false;
+    *speakerAlloc = static_cast<uint16_t>(tmp);
+    ALOGI("%s: Speaker Allocation Map for attached device is: 0x%hx", __func__, *speakerAlloc);
+
     // Now enumerate the non-basic modes.  Any errors at this point in time
     // should indicate that the HDMI cable was unplugged and we should just
     // abort with an empty set of audio capabilities.
@@ -153,188 +307,562 @@ bool HDMIAudioCaps::loadCaps(int ALSADeviceID) {
         Mode m;
 
         // Pick the mode we want to fetch info for.
-        if (mixer_ctl_set_value(ctrls[kModeSelNdx], 0, i) < 0)
-            goto bailout;
+        if (mixer->setValue(HDMICapsMixer::kCtrlModeSelect, i) < 0)
+            return false;
 
         // Now fetch the common fields.
-        if ((tmp = mixer_ctl_get_value(ctrls[kFmtNdx], 0)) < 0)
-            goto bailout;
-        m.fmt = static_cast<AudFormat>(tmp);
-        ALOGI("Got mode %d from ALSA driver.", m.fmt);
-
-        if ((tmp = mixer_ctl_get_value(ctrls[kMaxChCntNdx], 0)) < 0)
-            goto bailout;
+        if ((tmp = mixer->getValue(HDMICapsMixer::kCtrlFormat)) < 0)
+            return false;
+        // A format code past the last one we know is as good as invalid,
+        // and must not be squeezed into an AudFormat.
+        m.fmt = (tmp <= kFmtMPGSUR) ? static_cast<AudFormat>(tmp) : kFmtInvalid;
+        ALOGV("Got mode %d from ALSA driver.", m.fmt);
+
+        if ((tmp = mixer->getValue(HDMICapsMixer::kCtrlMaxChCount)) < 0)
+            return false;
         m.max_ch = static_cast<uint32_t>(tmp);
 
-        if ((tmp = mixer_ctl_get_value(ctrls[kSampRateNdx], 0)) < 0)
-            goto bailout;
+        if ((tmp = mixer->getValue(HDMICapsMixer::kCtrlSampleRates)) < 0)
+            return false;
         m.sr_bitmask = static_cast<uint32_t>(tmp);
 
         // Now for the mode dependent fields.  Only LPCM has the bits-per-sample
-        // mask.  Only AC3 through ATRAC have the compressed bitrate field.
+        // mask.  Only AC3 through ATRAC (CEA-861 format codes 2 - 8) have the
+        // compressed bitrate field; the codes which follow ATRAC use the third
+        // SAD byte for format specific data instead.
         m.bps_bitmask = 0;
         m.comp_bitrate = 0;
 
         if (m.fmt == kFmtLPCM) {
-            if ((tmp = mixer_ctl_get_value(ctrls[kBPSNdx], 0)) < 0)
-                goto bailout;
+            if ((tmp = mixer->getValue(HDMICapsMixer::kCtrlBPS)) < 0)
+                return false;
             m.bps_bitmask = static_cast<uint32_t>(tmp);
-        } else if ((m.fmt >= kFmtAC3) && (m.fmt <= kFmtATRAC)) { // FIXME ATRAC is not last format!?
-            if ((tmp = mixer_ctl_get_value(ctrls[kMaxCompBRNdx], 0)) < 0)
-                goto bailout;
+        } else if ((m.fmt >= kFmtAC3) && (m.fmt <= kFmtATRAC)) {
+            if ((tmp = mixer->getValue(HDMICapsMixer::kCtrlMaxCompBitrate)) < 0)
+                return false;
             m.comp_bitrate = static_cast<uint32_t>(tmp);
         }
 
         // Finally, sanity check the info.  If it passes, add it to the vector
         // of available modes.
         if (sanityCheckMode(m))  {
-            ALOGI("Passed sanity check for mode %d from ALSA driver.", m.fmt);
-            mModes.add(m);
+            ALOGV("Passed sanity check for mode %d from ALSA driver.", m.fmt);
+            modes->add(m);
         }
     }
 
-    // Looks like we managed to enumerate all of the modes before someone
-    // unplugged the HDMI cable.  Signal success and get out.
-    ret = true;
+    return true;
+}
 
-bailout:
-    if (NULL != mixer)
-        mixer_close(mixer);
+void HDMIAudioCaps::setCallback(Callback* callback) {
+    Mutex::Autolock _l(mLock);
+    mCallback = callback;
+}
 
-    if (!ret)
-        reset_l();
+void HDMIAudioCaps::loadCapsAsync(int ALSADeviceID) {
+    Mutex::Autolock _l(mLoadLock);
+
+    mRequestSeq++;
+    mRequestDevice = ALSADeviceID;
+    mLoadPending = true;
+
+    if (mLoadThread == NULL) {
+        mLoadThread = new LoadThread(*this);
+        if (mLoadThread->run("HDMICapsLoad") != NO_ERROR) {
+            ALOGE("%s: unable to start caps loading thread", __func__);
+            mLoadThread.clear();
+            mLoadPending = false;
+            // Nothing is coming; don't leave anyone waiting for it.
+            mCommittedSeq = mRequestSeq;
+            mLoadDoneCond.broadcast();
+            return;
+        }
+    }
 
-    return ret;
+    mLoadCond.signal();
 }
 
-void HDMIAudioCaps::reset() {
-    Mutex::Autolock _l(mLock);
-    reset_l();
+bool HDMIAudioCaps::waitForLoad(nsecs_t timeout) {
+    Mutex::Autolock _l(mLoadLock);
+    nsecs_t deadline = systemTime() + timeout;
+
+    while (mCommittedSeq != mRequestSeq) {
+        nsecs_t now = systemTime();
+        if (now >= deadline) {
+            ALOGW("%s: caps load still running after %lld mSec", __func__,
+                  static_cast<long long>(ns2ms(timeout)));
+            return false;
+        }
+        mLoadDoneCond.waitRelative(mLoadLock, deadline - now);
+    }
+
+    return true;
 }
 
-void HDMIAudioCaps::reset_l() {
-    mBasicAudioSupported = false;
-    mSpeakerAlloc = 0;
-    mModes.clear();
+bool HDMIAudioCaps::LoadThread::threadLoop() {
+    int device;
+    uint32_t seq;
+
+    {
+        Mutex::Autolock _l(mOwner.mLoadLock);
+        while (!mOwner.mLoadPending && !exitPending())
+            mOwner.mLoadCond.wait(mOwner.mLoadLock);
+
+        if (exitPending())
+            return false;
+
+        device = mOwner.mRequestDevice;
+        seq = mOwner.mRequestSeq;
+        mOwner.mLoadPending = false;
+    }
+
+    // Only the load which actually published gets reported; a superseded
+    // one says nothing about the caps now in force.
+    bool basic;
+    if (!mOwner.loadCaps(device, seq, &basic))
+        return true;
+
+    Callback* cb;
+    {
+        Mutex::Autolock _l(mOwner.mLock);
+        cb = mOwner.mCallback;
+    }
+
+    if (cb != NULL)
+        cb->onCapsLoaded(basic);
+
+    return true;
 }
 
-void HDMIAudioCaps::getRatesForAF(String8& rates) {
-    Mutex::Autolock _l(mLock);
-    rates.clear();
+// Returns whether the results were published, and if so whether the sink
+// supports basic audio in *basicAudioSupported.
+bool HDMIAudioCaps::loadCaps(int ALSADeviceID, uint32_t seq,
+                             bool* basicAudioSupported) {
+    bool ret = false;
+    bool hit = false;
+    HDMICapsMixer* mixer = NULL;
+    uint32_t key = 0;
+    uint16_t speakerAlloc = 0;
+    Vector<Mode> modes;
+    CapsSource src = kSrcNone;
+    int avSyncDelayMs = EDIDAudioInfo::kLatencyUnknown;
+    nsecs_t enumTime = 0;
+    nsecs_t start = systemTime();
+
+    ALOGI("%s: start", __func__);
+
+    // Talk to the mixer without holding mLock so that queries (which only
+    // look at the published table) and resets are never held up by mixer I/O.
+    {
+        Mutex::Autolock _e(mEnumLock);
+
+        if (NULL == (mixer = HDMICapsMixer::open(ALSADeviceID)))
+            goto commit;
+
+        // A single read of the sink's ELD (or EDID) tells us everything the
+        // mode-at-a-time controls below would, and then some.
+        if (readCapsBlob(mixer, &src, &speakerAlloc, &modes, &avSyncDelayMs)) {
+            ret = true;
+            goto commit;
+        }
 
-    // If the sink does not support basic audio, then it supports no audio.
-    if (!mBasicAudioSupported)
-        return;
-
-    // Basic audio always supports from 32k through 38k.
-    uint32_t tmp = kSR_32000 | kSR_44100 | kSR_48000;
-
-    // To keep things simple, only report mode information for the PCM mode
-    // which supports the maximum number of channels.
-    ssize_t ndx = getMaxChModeNdx_l();
-    if (ndx >= 0)
-        tmp |= mModes[ndx].sr_bitmask;
-
-    bool first = true;
-    for (uint32_t i = 1; tmp; i <<= 1) {
-        if (i & tmp) {
-            rates.appendFormat(first ? "%d" : "|%d", srMaskToSR(i));
-            first = false;
-            tmp &= ~i;
+        src = kSrcMixer;
+        if (!mixer->hasQueryCtrls())
+            goto commit;
+
+        // Start by checking to see if this HDMI connection supports even basic
+        // audio.  If it does not, there is no point in proceeding.
+        if (mixer->getValue(HDMICapsMixer::kCtrlBasicAudio) <= 0) {
+            ALOGI("%s: Basic audio not supported by attached device", __func__);
+            goto commit;
+        }
+
+        // If we have seen this sink before, restore its capabilities right
+        // away and double check them in the background.
+        key = computeSinkKey(mixer);
+        {
+            Mutex::Autolock _l(mLock);
+            CacheEntry* entry = findCacheEntry_l(key);
+            if (NULL != entry) {
+                speakerAlloc = entry->speakerAlloc;
+                modes = entry->modes;
+                entry->lastUsed = ++mCacheClock;
+                hit = true;
+            }
+        }
+
+        if (hit) {
+            ALOGI("%s: capability cache hit for sink 0x%08x", __func__, key);
+            ret = true;
+        } else {
+            // Cache miss.  Enumerate the modes the slow way.
+            nsecs_t enumStart = systemTime();
+            ret = enumerateModes(mixer, &speakerAlloc, &modes);
+            enumTime = systemTime() - enumStart;
         }
     }
-}
 
-void HDMIAudioCaps::getFmtsForAF(String8& fmts) {
+commit:
+    delete mixer;
+
     Mutex::Autolock _l(mLock);
-    fmts.clear();
 
-    // If the sink does not support basic audio, then it supports no audio.
-    if (!mBasicAudioSupported) {
-        ALOGI("ALSAFORMATS: basic audio not supported");
-        return;
+    {
+        Mutex::Autolock _r(mLoadLock);
+        if (seq != mRequestSeq) {
+            ALOGI("%s: discarding superseded caps load", __func__);
+            mLoadsSuperseded++;
+            return false;
+        }
     }
 
-    fmts.append("AUDIO_FORMAT_PCM_16_BIT");
-    // TODO: when we can start to expect 20 and 24 bit audio modes coming from
-    // AF, we need to implement support to enumerate those modes.
+    reset_l();
 
-    // These names must match formats in android.media.AudioFormat
-    for (size_t i = 0; i < mModes.size(); ++i) {
-        switch (mModes[i].fmt) {
-            case kFmtAC3:
-                fmts.append("|AUDIO_FORMAT_AC3");
-                break;
-            case kFmtEAC3:
-                fmts.append("|AUDIO_FORMAT_E_AC3");
-                break;
-            default:
-                break;
+    if (ret) {
+        mBasicAudioSupported = true;
+        mSpeakerAlloc = speakerAlloc;
+        mModes = modes;
+        mCurrentKey = key;
+        mCapsSource = src;
+        mSinkAVSyncDelayMs = avSyncDelayMs;
+
+        // Caps parsed from the ELD/EDID are cheap enough to re-read that they
+        // don't go through the cache.
+        if ((src == kSrcMixer) && hit) {
+            mCacheHits++;
+            if (mVerifyThread == NULL) {
+                mVerifyThread = new VerifyThread(*this, ALSADeviceID, key);
+                if (mVerifyThread->run("HDMICapsVerify") != NO_ERROR) {
+                    ALOGW("%s: unable to start caps verification", __func__);
+                    mVerifyThread.clear();
+                }
+            } else {
+                // Still busy with an earlier hit; this one goes next.
+                mVerifyQueued = true;
+                mVerifyQueuedDevice = ALSADeviceID;
+                mVerifyQueuedKey = key;
+            }
+        } else if (src == kSrcMixer) {
+            // Looks like we managed to enumerate all of the modes before
+            // someone unplugged the HDMI cable.  Remember what we found.
+            mCacheMisses++;
+            mLastEnumTime = enumTime;
+            storeCacheEntry_l(key);
         }
     }
 
-#if ALSA_UTILS_PRINT_FORMATS
-    ALOGI("ALSAFORMATS: formats = %s", fmts.string());
+    publishTable_l();
+    mLoadsCompleted++;
+    mLastLoadTime = systemTime() - start;
 
-    for (size_t i = 0; i < mModes.size(); ++i) {
-        ALOGI("ALSAFORMATS: ------- fmt[%d] = 0x%08X = %s",
-            i, mModes[i].fmt, fmtToString(mModes[i].fmt));
-        ALOGI("ALSAFORMATS:   comp_bitrate[%d] = 0x%08X = %d",
-            i, mModes[i].comp_bitrate, mModes[i].comp_bitrate);
-        ALOGI("ALSAFORMATS:   max_ch[%d] = 0x%08X = %d",
-            i, mModes[i].max_ch, mModes[i].max_ch);
-        ALOGI("ALSAFORMATS:   bps_bitmask[%d] = 0x%08X", i, mModes[i].bps_bitmask);
-        uint32_t bpsm = mModes[i].bps_bitmask;
-        while(bpsm) {
-            uint32_t bpsm_next = bpsm & (bpsm - 1);
-            uint32_t bpsm_single = bpsm ^ bpsm_next;
-            if (bpsm_single) {
-                ALOGI("ALSAFORMATS:      bits  = %d", bpsMaskToBPS(bpsm_single));
+    {
+        Mutex::Autolock _r(mLoadLock);
+        mCommittedSeq = seq;
+        mLoadDoneCond.broadcast();
+    }
+
+    *basicAudioSupported = ret;
+    return true;
+}
+
+HDMIAudioCaps::CacheEntry* HDMIAudioCaps::findCacheEntry_l(uint32_t key) {
+    for (size_t i = 0; i < kCacheEntries; ++i) {
+        if (mCache[i].valid && (mCache[i].key == key))
+            return &mCache[i];
+    }
+
+    return NULL;
+}
+
+void HDMIAudioCaps::storeCacheEntry_l(uint32_t key) {
+    CacheEntry* entry = findCacheEntry_l(key);
+
+    // Evict the least recently used entry if this sink is not already known.
+    if (NULL == entry) {
+        entry = &mCache[0];
+        for (size_t i = 0; i < kCacheEntries; ++i) {
+            if (!mCache[i].valid) {
+                entry = &mCache[i];
+                break;
             }
-            bpsm = bpsm_next;
+            if (mCache[i].lastUsed < entry->lastUsed)
+                entry = &mCache[i];
         }
-        ALOGI("ALSAFORMATS:   sr_bitmask[%d] = 0x%08X", i, mModes[i].sr_bitmask);
-        uint32_t srs = mModes[i].sr_bitmask;
-        while(srs) {
-            uint32_t srs_next = srs & (srs - 1);
-            uint32_t srs_single = srs ^ srs_next;
-            if (srs_single) {
-                ALOGI("ALSAFORMATS:      srate = %d", srMaskToSR(srs_single));
+    }
+
+    entry->valid = true;
+    entry->key = key;
+    entry->lastUsed = ++mCacheClock;
+    entry->speakerAlloc = mSpeakerAlloc;
+    entry->modes = mModes;
+}
+
+static bool modesMatch(const Vector<HDMIAudioCaps::Mode>& a,
+                       const Vector<HDMIAudioCaps::Mode>& b) {
+    if (a.size() != b.size())
+        return false;
+
+    for (size_t i = 0; i < a.size(); ++i) {
+        if ((a[i].fmt != b[i].fmt) ||
+            (a[i].max_ch != b[i].max_ch) ||
+            (a[i].sr_bitmask != b[i].sr_bitmask) ||
+            (a[i].bps_bitmask != b[i].bps_bitmask) ||
+            (a[i].comp_bitrate != b[i].comp_bitrate))
+            return false;
+    }
+
+    return true;
+}
+
+// Returns true, with the sink to verify next in *nextDevice and *nextKey, if
+// another cache hit was queued while this verification was running.
+bool HDMIAudioCaps::onVerifyComplete(uint32_t key, bool ok,
+                                     uint16_t speakerAlloc,
+                                     const Vector<Mode>& modes,
+                                     nsecs_t enumTime,
+                                     int* nextDevice, uint32_t* nextKey) {
+    Mutex::Autolock _l(mLock);
+    bool more = mVerifyQueued;
+
+    if (more) {
+        mVerifyQueued = false;
+        *nextDevice = mVerifyQueuedDevice;
+        *nextKey = mVerifyQueuedKey;
+    } else {
+        mVerifyThread.clear();
+    }
+
+    // If the enumeration failed, the sink probably went away while we were
+    // talking to it.  There is nothing useful we can say about the cache.
+    if (!ok)
+        return more;
+
+    mLastEnumTime = enumTime;
+
+    CacheEntry* entry = findCacheEntry_l(key);
+    if ((NULL == entry) ||
+        ((entry->speakerAlloc == speakerAlloc) && modesMatch(entry->modes, modes)))
+        return more;
+
+    ALOGW("%s: cached caps for sink 0x%08x were stale, updating", __func__, key);
+    mVerifyMismatches++;
+    entry->speakerAlloc = speakerAlloc;
+    entry->modes = modes;
+
+    // Only touch the live caps if the sink we verified is still the one which
+    // is attached.
+    if (mBasicAudioSupported && (mCurrentKey == key)) {
+        mSpeakerAlloc = speakerAlloc;
+        mModes = modes;
+        publishTable_l();
+    }
+
+    return more;
+}
+
+bool HDMIAudioCaps::VerifyThread::threadLoop() {
+    Vector<Mode> modes;
+    uint16_t speakerAlloc = 0;
+    bool ok = false;
+    nsecs_t enumTime = 0;
+
+    {
+        Mutex::Autolock _e(mOwner.mEnumLock);
+        HDMICapsMixer* mixer = HDMICapsMixer::open(mALSADeviceID);
+
+        if ((NULL != mixer) && mixer->hasQueryCtrls()) {
+            // Make sure we are still looking at the same sink before spending
+            // the time to walk its mode table.
+            if (!exitPending() &&
+                (mixer->getValue(HDMICapsMixer::kCtrlBasicAudio) > 0) &&
+                (computeSinkKey(mixer) == mKey)) {
+                nsecs_t start = systemTime();
+                ok = enumerateModes(mixer, &speakerAlloc, &modes);
+                enumTime = systemTime() - start;
             }
-            srs = srs_next;
         }
+
+        delete mixer;
     }
-#endif /* ALSA_UTILS_PRINT_FORMATS */
+
+    // Keep going (with the sink queued since) until nothing is left.
+    return mOwner.onVerifyComplete(mKey, ok, speakerAlloc, modes, enumTime,
+                                   &mALSADeviceID, &mKey);
 }
 
-void HDMIAudioCaps::getChannelMasksForAF(String8& masks, bool skipStereo) {
+void HDMIAudioCaps::reset() {
     Mutex::Autolock _l(mLock);
-    masks.clear();
+    uint32_t seq;
+
+    // Cancel any pending load, and make sure one which is already talking to
+    // the mixer does not publish its results once it is done.
+    {
+        Mutex::Autolock _r(mLoadLock);
+        seq = ++mRequestSeq;
+        mLoadPending = false;
+    }
+
+    reset_l();
+    publishTable_l();
+
+    {
+        Mutex::Autolock _r(mLoadLock);
+        mCommittedSeq = seq;
+        mLoadDoneCond.broadcast();
+    }
+}
+
+void HDMIAudioCaps::reset_l() {
+    mBasicAudioSupported = false;
+    mCapsSource = kSrcNone;
+    mSinkAVSyncDelayMs = EDIDAudioInfo::kLatencyUnknown;
+    mSpeakerAlloc = 0;
+    mModes.clear();
+    mCurrentKey = 0;
+}
+
+int HDMIAudioCaps::srMaskToTableNdx(uint32_t mask) {
+    switch (mask) {
+        case kSR_32000:  return 0;
+        case kSR_44100:  return 1;
+        case kSR_48000:  return 2;
+        case kSR_88200:  return 3;
+        case kSR_96000:  return 4;
+        case kSR_176400: return 5;
+        case kSR_192000: return 6;
+        default: return -1;
+    }
+}
+
+void HDMIAudioCaps::publishTable_l() {
+    // Always a fresh table; the current one may still be in use by readers.
+    std::shared_ptr<CapsTable> t = std::make_shared<CapsTable>();
+
+    t->generation = ++mTableGeneration;
+    t->basicAudioSupported = mBasicAudioSupported;
+    t->sinkAVSyncDelayMs = mSinkAVSyncDelayMs;
+    t->maxPCMChannels = 0;
+    t->pcmSRMask = 0;
+    for (size_t i = 0; i < kTableFmtCount; ++i)
+        t->supported[i] = 0;
 
     // If the sink does not support basic audio, then it supports no audio.
-    if (!mBasicAudioSupported)
-        return;
+    if (mBasicAudioSupported) {
+        // Basic audio is always stereo 16 bit PCM at 32k through 48k.
+        static const uint32_t kBasicRates[] = { kSR_32000, kSR_44100, kSR_48000 };
+        for (size_t i = 0; i < NELEM(kBasicRates); ++i) {
+            int sr = srMaskToTableNdx(kBasicRates[i]);
+            t->supported[kTableFmtPCM16] |=
+                1ULL << ((sr * kTableChSlots) + 2);
+        }
+        t->pcmSRMask = kSR_32000 | kSR_44100 | kSR_48000;
 
-    // Don't list stereo modes if the caller requests it.  This is mostly to
-    // support the hack which ends up routing multichannel audio to the special
-    // multichannel audio stream out, but not native stereo tracks.
-    if (!skipStereo)
-        masks.append("AUDIO_CHANNEL_OUT_STEREO");
+        for (size_t i = 0; i < mModes.size(); ++i) {
+            const Mode& m = mModes[i];
+            int fmt;
+
+            switch (m.fmt) {
+                case kFmtLPCM:
+                    // Only 16 bit PCM is ever requested by AF.
+                    if (!(m.bps_bitmask & kBPS_16bit))
+                        continue;
+                    fmt = kTableFmtPCM16;
+                    break;
+                case kFmtAC3:  fmt = kTableFmtAC3;  break;
+                case kFmtEAC3: fmt = kTableFmtEAC3; break;
+                default: continue;
+            }
 
-    // To keep things simple, only report mode information for the PCM mode
-    // which supports the maximum number of channels.
-    ssize_t ndx = getMaxChModeNdx_l();
-    if (ndx < 0)
-        return;
+            uint32_t maxCh = (m.max_ch < kTableChSlots) ? m.max_ch
+                                                        : (kTableChSlots - 1);
+            for (uint32_t srBits = m.sr_bitmask; srBits; srBits &= srBits - 1) {
+                int sr = srMaskToTableNdx(srBits & ~(srBits - 1));
+                if (sr < 0)
+                    continue;
+                for (uint32_t ch = 1; ch <= maxCh; ++ch)
+                    t->supported[fmt] |= 1ULL << ((sr * kTableChSlots) + ch);
+            }
+        }
 
-    if (mModes[ndx].max_ch >= 6) {
-        if (masks.length())
-            masks.append("|");
+        // To keep things simple, only report rate and channel information to
+        // AF for the PCM mode which supports the maximum number of channels.
+        ssize_t ndx = getMaxChModeNdx_l();
+        if (ndx >= 0) {
+            t->pcmSRMask |= mModes[ndx].sr_bitmask;
+            t->maxPCMChannels = mModes[ndx].max_ch;
+        }
+
+        // Now render the strings handed to AF.
+        bool first = true;
+        for (uint32_t tmp = t->pcmSRMask, i = 1; tmp; i <<= 1) {
+            if (i & tmp) {
+                t->afRates.appendFormat(first ? "%d" : "|%d", srMaskToSR(i));
+                first = false;
+                tmp &= ~i;
+            }
+        }
 
-        masks.append((mModes[ndx].max_ch >= 8)
+        // These names must match formats in android.media.AudioFormat
+        // TODO: when we can start to expect 20 and 24 bit audio modes coming
+        // from AF, we need to implement support to enumerate those modes.
+        t->afFmts.append("AUDIO_FORMAT_PCM_16_BIT");
+        if (t->supported[kTableFmtAC3])
+            t->afFmts.append("|AUDIO_FORMAT_AC3");
+        if (t->supported[kTableFmtEAC3])
+            t->afFmts.append("|AUDIO_FORMAT_E_AC3");
+
+        if (t->maxPCMChannels >= 6) {
+            t->afChMasksNoStereo = (t->maxPCMChannels >= 8)
                 ? "AUDIO_CHANNEL_OUT_5POINT1|AUDIO_CHANNEL_OUT_7POINT1"
-                : "AUDIO_CHANNEL_OUT_5POINT1");
+                : "AUDIO_CHANNEL_OUT_5POINT1";
+        }
+
+        t->afChMasks = "AUDIO_CHANNEL_OUT_STEREO";
+        if (t->afChMasksNoStereo.length()) {
+            t->afChMasks.append("|");
+            t->afChMasks.append(t->afChMasksNoStereo);
+        }
+    }
+
+#if ALSA_UTILS_PRINT_FORMATS
+    ALOGI("ALSAFORMATS: generation %u, formats = %s, rates = %s, masks = %s",
+          t->generation, t->afFmts.string(), t->afRates.string(),
+          t->afChMasks.string());
+
+    for (size_t i = 0; i < mModes.size(); ++i) {
+        ALOGI("ALSAFORMATS: fmt[%zu] = %s, max_ch = %u, sr_bitmask = 0x%08X,"
+              " bps_bitmask = 0x%08X, comp_bitrate = %u",
+              i, fmtToString(mModes[i].fmt), mModes[i].max_ch,
+              mModes[i].sr_bitmask, mModes[i].bps_bitmask,
+              mModes[i].comp_bitrate);
     }
+#endif /* ALSA_UTILS_PRINT_FORMATS */
+
+    // The previous table goes away once its last reader is done with it.
+    std::atomic_store(&mTable, std::shared_ptr<const CapsTable>(t));
+}
+
+std::shared_ptr<const HDMIAudioCaps::CapsTable> HDMIAudioCaps::getTable() const {
+    return std::atomic_load(&mTable);
+}
+
+void HDMIAudioCaps::getRatesForAF(String8& rates) {
+    // If the sink does not support basic audio, then it supports no audio and
+    // all of the pre-rendered strings are empty.
+    rates = getTable()->afRates;
+}
+
+void HDMIAudioCaps::getFmtsForAF(String8& fmts) {
+    fmts = getTable()->afFmts;
+}
+
+void HDMIAudioCaps::getChannelMasksForAF(String8& masks, bool skipStereo) {
+    std::shared_ptr<const CapsTable> t = getTable();
+
+    // Don't list stereo modes if the caller requests it.  This is mostly to
+    // support the hack which ends up routing multichannel audio to the special
+    // multichannel audio stream out, but not native stereo tracks.
+    masks = skipStereo ? t->afChMasksNoStereo : t->afChMasks;
 }
 
 ssize_t HDMIAudioCaps::getMaxChModeNdx_l() {
@@ -343,7 +871,7 @@ ssize_t HDMIAudioCaps::getMaxChModeNdx_l() {
 
     for (size_t i = 0; i < mModes.size(); ++i) {
         if ((mModes[i].fmt == kFmtLPCM) && (max_ch < mModes[i].max_ch)) {
-            max_ch < mModes[i].max_ch;
+            max_ch = mModes[i].max_ch;
             max_ch_ndx = i;
         }
     }
@@ -354,85 +882,64 @@ ssize_t HDMIAudioCaps::getMaxChModeNdx_l() {
 bool HDMIAudioCaps::supportsFormat(audio_format_t format,
                                       uint32_t sampleRate,
                                       uint32_t channelCount) {
-    Mutex::Autolock _l(mLock);
-
-    // If the sink does not support basic audio, then it supports no audio.
-    if (!mBasicAudioSupported)
-        return false;
+    std::shared_ptr<const CapsTable> t = getTable();
+    int fmt;
 
-    AudFormat alsaFormat;
     switch (format & AUDIO_FORMAT_MAIN_MASK) {
-        case AUDIO_FORMAT_PCM: alsaFormat = kFmtLPCM; break;
-        case AUDIO_FORMAT_AC3: alsaFormat = kFmtAC3; break;
-        case AUDIO_FORMAT_E_AC3: alsaFormat = kFmtAC3; break;
+        case AUDIO_FORMAT_PCM:
+            // Only 16 bit PCM is supported.
+            if ((format & AUDIO_FORMAT_SUB_MASK) != AUDIO_FORMAT_PCM_SUB_16_BIT)
+                return false;
+            fmt = kTableFmtPCM16;
+            break;
+        case AUDIO_FORMAT_AC3:   fmt = kTableFmtAC3;  break;
+        case AUDIO_FORMAT_E_AC3: fmt = kTableFmtEAC3; break;
         default: return false;
     }
 
-    SRMask srMask;
+    int sr;
     switch (sampleRate) {
-        case 32000:  srMask = kSR_32000;  break;
-        case 44100:  srMask = kSR_44100;  break;
-        case 48000:  srMask = kSR_48000;  break;
-        case 88200:  srMask = kSR_88200;  break;
-        case 96000:  srMask = kSR_96000;  break;
-        case 176400: srMask = kSR_176400; break;
-        case 192000: srMask = kSR_192000; break;
+        case 32000:  sr = 0; break;
+        case 44100:  sr = 1; break;
+        case 48000:  sr = 2; break;
+        case 88200:  sr = 3; break;
+        case 96000:  sr = 4; break;
+        case 176400: sr = 5; break;
+        case 192000: sr = 6; break;
         default: return false;
     }
 
-    // if PCM then determine actual bits per sample.
-    if (alsaFormat == kFmtLPCM) {
-        uint32_t subFormat = format & AUDIO_FORMAT_SUB_MASK;
-        BPSMask bpsMask;
-        switch (subFormat) {
-            case AUDIO_FORMAT_PCM_SUB_16_BIT: bpsMask = kBPS_16bit; break;
-            default: return false;
-        }
-
-        // Is the caller requesting basic audio?  If so, we should be good to go.
-        // Otherwise, we need to check the mode table.
-        if ((2 == channelCount) && (sampleRate <= 48000))
-            return true;
-
-        // Check the modes in the table to see if there is one which
-        // supports the caller's format.
-        for (size_t i = 0; i < mModes.size(); ++i) {
-            const Mode& m = mModes[i];
-            if ((m.fmt == kFmtLPCM) &&
-                (m.max_ch >= channelCount) &&
-                (m.sr_bitmask & srMask) &&
-                (m.bps_bitmask & bpsMask))
-                return true;
-        }
-    } else {
-        // Check the modes in the table to see if there is one which
-        // supports the caller's format.
-        for (size_t i = 0; i < mModes.size(); ++i) {
-            const Mode& m = mModes[i];
-            // ignore bps_bitmask
-            if ((m.fmt == alsaFormat) &&
-                (m.max_ch >= channelCount) &&
-                (m.sr_bitmask & srMask))
-                return true;
-        }
-    }
+    if (channelCount >= kTableChSlots)
+        return false;
 
-    // Looks like no compatible modes were found.
-    return false;
+    return (t->supported[fmt] >> ((sr * kTableChSlots) + channelCount)) & 1;
 }
 
 bool HDMIAudioCaps::sanityCheckMode(const Mode& m) {
+    static const uint32_t kAllSR = kSR_32000 | kSR_44100 | kSR_48000 |
+                                   kSR_88200 | kSR_96000 | kSR_176400 |
+                                   kSR_192000;
+    static const uint32_t kAllBPS = kBPS_16bit | kBPS_20bit | kBPS_24bit;
+
     if ((m.fmt < kFmtLPCM) || (m.fmt > kFmtMPGSUR))
         return false;
 
-    if (m.max_ch > 8)
+    if ((m.max_ch < 1) || (m.max_ch > 8))
+        return false;
+
+    // A mode with no sample rates is no mode at all.
+    if (!m.sr_bitmask || (m.sr_bitmask & ~kAllSR))
         return false;
 
-    if (m.sr_bitmask & ~(kSR_32000 | kSR_44100 | kSR_48000 | kSR_88200 |
-                         kSR_96000 | kSR_176400 | kSR_192000))
+    // LPCM has to list at least one sample size, and is the only format which
+    // may list any.
+    if (m.bps_bitmask & ~kAllBPS)
+        return false;
+    if ((m.fmt == kFmtLPCM) != (m.bps_bitmask != 0))
         return false;
 
-    if (m.bps_bitmask & ~(kBPS_16bit | kBPS_20bit | kBPS_24bit))
+    // Likewise, only AC3 through ATRAC carry a max compressed bitrate.
+    if (m.comp_bitrate && ((m.fmt < kFmtAC3) || (m.fmt > kFmtATRAC)))
         return false;
 
     return true;
@@ -489,5 +996,59 @@ const char* HDMIAudioCaps::saMaskToString(uint32_t mask) {
     }
 }
 
+void HDMIAudioCaps::dump(String8& result) {
+    static const char* kSrcNames[] = { "none", "ELD", "EDID", "mixer" };
+    Mutex::Autolock _l(mLock);
+
+    result.appendFormat("\tHDMI Sink Caps\n");
+    result.appendFormat("\t\tBasic Audio       : %s\n",
+                        mBasicAudioSupported ? "true" : "false");
+    result.appendFormat("\t\tSpeaker Alloc     : 0x%04hx\n", mSpeakerAlloc);
+    result.appendFormat("\t\tMode Count        : %zu\n", mModes.size());
+    result.appendFormat("\t\tCaps Source       : %s\n", kSrcNames[mCapsSource]);
+    result.appendFormat("\t\tSink AV Delay     : %d mSec\n", mSinkAVSyncDelayMs);
+    result.appendFormat("\t\tSink Key          : 0x%08x\n", mCurrentKey);
+    result.appendFormat("\t\tCaps Table Gen    : %u\n",
+                        getTable()->generation);
+    result.appendFormat("\t\tCaps Loads        : %u (%u superseded)\n",
+                        mLoadsCompleted, mLoadsSuperseded);
+    result.appendFormat("\t\tCache Hits        : %u\n", mCacheHits);
+    result.appendFormat("\t\tCache Misses      : %u\n", mCacheMisses);
+    result.appendFormat("\t\tStale Cache Fixups: %u\n", mVerifyMismatches);
+    result.appendFormat("\t\tLast Load Time    : %lld uSec\n",
+                        static_cast<long long>(ns2us(mLastLoadTime)));
+    result.appendFormat("\t\tLast Enum Time    : %lld uSec\n",
+                        static_cast<long long>(ns2us(mLastEnumTime)));
+}
+
+void HDMIAudioCaps::exportState(HALStateWriter& w) {
+    Mutex::Autolock _l(mLock);
+
+    w.beginObject("hdmiCaps");
+    w.addBool("basicAudio", mBasicAudioSupported);
+    w.addInt("speakerAlloc", mSpeakerAlloc);
+    w.addInt("sinkKey", mCurrentKey);
+    w.addInt("capsSource", mCapsSource);
+    w.addInt("sinkAVSyncDelayMs", mSinkAVSyncDelayMs);
+    w.beginArray("modes");
+    for (size_t i = 0; i < mModes.size(); ++i) {
+        const Mode& m = mModes[i];
+        w.beginObject(NULL);
+        w.addString("fmt", fmtToString(m.fmt));
+        w.addInt("maxCh", m.max_ch);
+        w.addInt("srMask", m.sr_bitmask);
+        w.addInt("bpsMask", m.bps_bitmask);
+        w.addInt("compBitrate", m.comp_bitrate);
+        w.endObject();
+    }
+    w.endArray();
+    w.addInt("cacheHits", mCacheHits);
+    w.addInt("cacheMisses", mCacheMisses);
+    w.addInt("cacheFixups", mVerifyMismatches);
+    w.addInt("lastLoadUsec", ns2us(mLastLoadTime));
+    w.addInt("lastEnumUsec", ns2us(mLastEnumTime));
+    w.endObject();
+}
+
 }  // namespace android
 #endif  // __cplusplus
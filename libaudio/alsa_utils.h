@@ -19,23 +19,80 @@
 #define ANDROID_ALSA_UTILS_H
 
 #include <fcntl.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <hardware/audio.h>
 
 #define kHDMI_ALSADeviceName    "IntelHDMI"
+#define kDRM_ClassDir           "/sys/class/drm"
 
 #ifdef __cplusplus
-extern "C"
+extern "C" {
 #endif
 int find_alsa_card_by_name(const char* name);
 
+// Find the HDMI connector among the DRM connectors in drm_dir (normally
+// kDRM_ClassDir), which are named "card<N>-HDMI-A-<M>", and write the path of
+// its attr node (e.g. "status" or "edid") to path.  If there is more than one,
+// the lowest numbered card and connector wins.  Returns 0 on success, or -1 if
+// there is no HDMI connector or path is too short.
+int find_hdmi_connector_attr(const char* drm_dir, const char* attr,
+                             char* path, size_t len);
 #ifdef __cplusplus
+}
+#endif
+
+#ifdef __cplusplus
+#include <memory>
+
 #include <utils/Vector.h>
 #include <utils/Mutex.h>
+#include <utils/RefBase.h>
 #include <utils/String8.h>
+#include <utils/threads.h>
+#include <utils/Timers.h>
 
 namespace android {
 
+class HALStateWriter;
+
+// The controls through which the HDMI audio driver describes the attached
+// sink.  HDMIAudioCaps only ever talks to the driver through this interface;
+// the tinyalsa backed implementation (and HDMICapsMixer::open) lives in
+// alsa_caps_mixer.cpp, so the caps logic can be linked against another
+// backend without dragging in tinyalsa.
+class HDMICapsMixer {
+  public:
+    enum Ctrl {
+        kCtrlBasicAudio = 0,
+        kCtrlSpeakerAlloc,
+        kCtrlModeCount,
+        kCtrlModeSelect,
+        kCtrlFormat,
+        kCtrlMaxChCount,
+        kCtrlSampleRates,
+        kCtrlBPS,
+        kCtrlMaxCompBitrate,
+        kCtrlCount
+    };
+
+    // Returns NULL if the mixer of the given card cannot be opened.
+    static HDMICapsMixer* open(int ALSADeviceID);
+
+    virtual ~HDMICapsMixer() {}
+
+    // True if all of the controls above are present.
+    virtual bool hasQueryCtrls() = 0;
+    // Both return a negative error code on failure.
+    virtual int getValue(Ctrl ctrl) = 0;
+    virtual int setValue(Ctrl ctrl, int value) = 0;
+    // Fetch the raw ELD (from the driver) or EDID (from the connector) of the
+    // sink.  Return the number of bytes read, or a negative error code if the
+    // blob is not available.
+    virtual ssize_t readELD(uint8_t* buf, size_t len) = 0;
+    virtual ssize_t readEDID(uint8_t* buf, size_t len) = 0;
+};
+
 class HDMIAudioCaps {
   public:
     enum AudFormat {
@@ -98,11 +155,32 @@ class HDMIAudioCaps {
         uint32_t  comp_bitrate;
     } Mode;
 
+    // Notified (from the caps loading thread, with no HDMIAudioCaps locks
+    // held) after a caps load requested through loadCapsAsync has been
+    // published.
+    class Callback {
+      public:
+        virtual ~Callback() {}
+        virtual void onCapsLoaded(bool basicAudioSupported) = 0;
+    };
+
     HDMIAudioCaps();
-    ~HDMIAudioCaps() { reset(); }
+    ~HDMIAudioCaps();
+
+    void setCallback(Callback* callback);
 
-    bool loadCaps(int ALSADeviceID);
+    // Load the caps of the sink attached to the given card in the background.
+    // Queries continue to be answered from the current generation until the
+    // new one is published.  A newer request (or a reset) supersedes any load
+    // which is still in flight.
+    void loadCapsAsync(int ALSADeviceID);
+    // Wait up to timeout for the most recent loadCapsAsync to be published
+    // (or superseded by a reset).  Returns false on timeout.  Must not be
+    // called from the callback.
+    bool waitForLoad(nsecs_t timeout);
     void reset();
+    void dump(String8& result);
+    void exportState(HALStateWriter& w);
     void getRatesForAF(String8& rates);
     void getFmtsForAF(String8& fmts);
     void getChannelMasksForAF(String8& masks, bool skipStereo);
@@ -110,8 +188,19 @@ class HDMIAudioCaps {
                                       uint32_t sampleRate,
                                       uint32_t channelCount);
 
+    // Where the current caps came from.
+    enum CapsSource {
+        kSrcNone = 0,
+        kSrcELD,
+        kSrcEDID,
+        kSrcMixer,
+    };
+
     bool basicAudioSupport() const { return mBasicAudioSupported; }
     uint16_t speakerAllocation() const { return mSpeakerAlloc; }
+    // How much later than audio the current sink presents video, or
+    // EDIDAudioInfo::kLatencyUnknown.  Lock free, like the table queries.
+    int sinkAVSyncDelayMs() const { return getTable()->sinkAVSyncDelayMs; }
     size_t modeCnt() const { return mModes.size(); }
     const Mode& getMode(size_t ndx) const { return mModes[ndx]; }
 
@@ -121,13 +210,145 @@ class HDMIAudioCaps {
     static const char* saMaskToString(uint32_t mask);
 
   private:
+    // Immutable lookup table built from the live caps every time they change.
+    // All of the query paths (supportsFormat and the get*ForAF helpers) load
+    // a reference to the current table atomically and answer from it without
+    // taking any lock, so they always agree with each other and are never
+    // held up by a load.  supported[] has one 64 bit word per format with bit
+    // ((srNdx * kTableChSlots) + channelCount) set when the sink accepts that
+    // combination.
+    enum TableFmt {
+        kTableFmtPCM16 = 0,
+        kTableFmtAC3,
+        kTableFmtEAC3,
+        kTableFmtCount
+    };
+    static const uint32_t kTableSRCount = 7;
+    static const uint32_t kTableChSlots = 9;   // channel counts 0 - 8
+
+    // The strings handed to AF are rendered once per generation as well.  A
+    // table is never modified once published; each generation is a new one,
+    // freed when the last reader lets go of it.
+    struct CapsTable {
+        uint32_t generation;
+        bool     basicAudioSupported;
+        int      sinkAVSyncDelayMs;
+        uint32_t maxPCMChannels;
+        uint32_t pcmSRMask;
+        uint64_t supported[kTableFmtCount];
+        String8  afRates;
+        String8  afFmts;
+        String8  afChMasks;
+        String8  afChMasksNoStereo;
+    };
+
+    // Capabilities previously enumerated for a given sink, keyed by a hash of
+    // the sink's ELD (or of the mode table header when no ELD is exposed).
+    struct CacheEntry {
+        bool         valid;
+        uint32_t     key;
+        uint32_t     lastUsed;
+        uint16_t     speakerAlloc;
+        Vector<Mode> modes;
+    };
+
+    // Thread which re-enumerates the sink after a cache hit and corrects the
+    // cache (and the live caps) if the sink has changed.  A hit which comes
+    // in while a verification is still running is queued behind it (only
+    // the latest one; an older queued sink is no longer the attached one),
+    // and the thread exits once there is nothing left to verify.
+    class VerifyThread : public Thread {
+      public:
+        VerifyThread(HDMIAudioCaps& owner, int ALSADeviceID, uint32_t key)
+            : Thread(false), mOwner(owner), mALSADeviceID(ALSADeviceID), mKey(key) {}
+      private:
+        virtual bool threadLoop();
+        HDMIAudioCaps& mOwner;
+        int            mALSADeviceID;
+        uint32_t       mKey;
+    };
+
+    // Long lived thread which services loadCapsAsync requests.
+    class LoadThread : public Thread {
+      public:
+        explicit LoadThread(HDMIAudioCaps& owner)
+            : Thread(false), mOwner(owner) {}
+      private:
+        virtual bool threadLoop();
+        HDMIAudioCaps& mOwner;
+    };
+
+    static const size_t kCacheEntries = 4;
+
     Mutex mLock;
     bool mBasicAudioSupported;
     uint16_t mSpeakerAlloc;
     Vector<Mode> mModes;
+    CapsSource mCapsSource;
+    // Video minus audio latency of the sink, from its ELD/EDID (-1 if unknown)
+    int mSinkAVSyncDelayMs;
+
+    // Serializes use of the "Audio Mode To Query" selector, which is shared
+    // state in the driver.  Mixer I/O happens with only this lock held; mLock
+    // may be taken briefly while holding it, never the other way around.
+    Mutex mEnumLock;
+
+    // Load requests.  mRequestSeq is bumped by every loadCapsAsync and reset
+    // so that a load which finishes after being superseded is discarded.
+    // mCommittedSeq is the request whose results (or reset) were published
+    // last; waitForLoad waits on mLoadDoneCond for the two to match.  Lock
+    // order is mLock, then mLoadLock.
+    Mutex mLoadLock;
+    Condition mLoadCond;
+    Condition mLoadDoneCond;
+    uint32_t mRequestSeq;
+    uint32_t mCommittedSeq;
+    int mRequestDevice;
+    bool mLoadPending;
+    sp<LoadThread> mLoadThread;
+    Callback* mCallback;
 
+    CacheEntry mCache[kCacheEntries];
+    uint32_t mCacheClock;
+    uint32_t mCurrentKey;
+
+    // Only ever accessed through std::atomic_load/std::atomic_store.
+    // Published under mLock, so writers are serialized.
+    uint32_t mTableGeneration;
+    std::shared_ptr<const CapsTable> mTable;
+    sp<VerifyThread> mVerifyThread;
+    bool mVerifyQueued;
+    int mVerifyQueuedDevice;
+    uint32_t mVerifyQueuedKey;
+
+    // Statistics reported by dump()
+    uint32_t mCacheHits;
+    uint32_t mCacheMisses;
+    uint32_t mVerifyMismatches;
+    uint32_t mLoadsCompleted;
+    uint32_t mLoadsSuperseded;
+    nsecs_t  mLastLoadTime;
+    nsecs_t  mLastEnumTime;
+
+    bool loadCaps(int ALSADeviceID, uint32_t seq, bool* basicAudioSupported);
     void reset_l();
+    void publishTable_l();
+    std::shared_ptr<const CapsTable> getTable() const;
     ssize_t getMaxChModeNdx_l();
+    static int srMaskToTableNdx(uint32_t mask);
+    CacheEntry* findCacheEntry_l(uint32_t key);
+    void storeCacheEntry_l(uint32_t key);
+    bool onVerifyComplete(uint32_t key, bool ok, uint16_t speakerAlloc,
+                          const Vector<Mode>& modes, nsecs_t enumTime,
+                          int* nextDevice, uint32_t* nextKey);
+
+    static bool readCapsBlob(HDMICapsMixer* mixer, CapsSource* src,
+                             uint16_t* speakerAlloc, Vector<Mode>* modes,
+                             int* avSyncDelayMs);
+    static uint32_t computeSinkKey(HDMICapsMixer* mixer);
+    static bool enumerateModes(HDMICapsMixer* mixer,
+                               uint16_t* speakerAlloc,
+                               Vector<Mode>* modes);
     static bool sanityCheckMode(const Mode& m);
 };
 }  // namespace android
@@ -0,0 +1,263 @@
+/*
+**
+** Copyright 2014, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#define LOG_TAG "AudioHAL:PreprocessProxy"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cutils/log.h>
+#include <hardware/audio_effect.h>
+#include <system/audio.h>
+
+#include "atv_preprocess_proxy.h"
+
+// Pass-through AGC and NS effects; see atv_preprocess_proxy.h.
+
+static const effect_descriptor_t proxy_descriptors[] = {
+    {
+        // FX_IID_AGC
+        { 0x0a8abfe0, 0x654c, 0x11e0, 0xba26, { 0x00, 0x02, 0xa5, 0xd5, 0xc5, 0x1b } },
+        atv_preprocess_agc_uuid,
+        EFFECT_CONTROL_API_VERSION,
+        (EFFECT_FLAG_TYPE_PRE_PROC | EFFECT_FLAG_DEVICE_IND),
+        0,
+        0,
+        "Automatic Gain Control (audio HAL)",
+        "The Android Open Source Project"
+    },
+    {
+        // FX_IID_NS
+        { 0x58b4b260, 0x8e06, 0x11e0, 0xaa8e, { 0x00, 0x02, 0xa5, 0xd5, 0xc5, 0x1b } },
+        atv_preprocess_ns_uuid,
+        EFFECT_CONTROL_API_VERSION,
+        (EFFECT_FLAG_TYPE_PRE_PROC | EFFECT_FLAG_DEVICE_IND),
+        0,
+        0,
+        "Noise Suppression (audio HAL)",
+        "The Android Open Source Project"
+    },
+};
+
+#define NUM_PROXY_EFFECTS \
+    (sizeof(proxy_descriptors) / sizeof(proxy_descriptors[0]))
+
+struct proxy_effect {
+    const struct effect_interface_s* itfe;  // must be first
+    const effect_descriptor_t* desc;
+    effect_config_t config;
+    int enabled;
+};
+
+static const effect_descriptor_t* find_descriptor(const effect_uuid_t* uuid)
+{
+    size_t i;
+
+    if (uuid == NULL)
+        return NULL;
+
+    for (i = 0; i < NUM_PROXY_EFFECTS; i++) {
+        if (!memcmp(uuid, &proxy_descriptors[i].uuid, sizeof(*uuid)))
+            return &proxy_descriptors[i];
+    }
+
+    return NULL;
+}
+
+/*
+ * Effect control interface
+ */
+
+static int32_t proxy_process(effect_handle_t self, audio_buffer_t* in,
+                             audio_buffer_t* out)
+{
+    struct proxy_effect* effect = (struct proxy_effect*)self;
+
+    if ((effect == NULL) || (in == NULL) || (out == NULL) ||
+        (in->raw == NULL) || (out->raw == NULL))
+        return -EINVAL;
+
+    if (!effect->enabled)
+        return -ENODATA;
+
+    // Pre-processing runs in place in practice; copy otherwise.
+    if (in->raw != out->raw) {
+        size_t frame_size = sizeof(int16_t) *
+                audio_channel_count_from_in_mask(effect->config.inputCfg.channels);
+        size_t frames = (in->frameCount < out->frameCount) ? in->frameCount
+                                                           : out->frameCount;
+        memcpy(out->raw, in->raw, frames * frame_size);
+    }
+
+    return 0;
+}
+
+static int32_t proxy_command(effect_handle_t self, uint32_t cmd_code,
+                             uint32_t cmd_size, void* cmd_data,
+                             uint32_t* reply_size, void* reply_data)
+{
+    struct proxy_effect* effect = (struct proxy_effect*)self;
+
+    if (effect == NULL)
+        return -EINVAL;
+
+    switch (cmd_code) {
+        case EFFECT_CMD_SET_CONFIG:
+            if ((cmd_data == NULL) || (cmd_size != sizeof(effect_config_t)))
+                return -EINVAL;
+            memcpy(&effect->config, cmd_data, sizeof(effect_config_t));
+            break;
+
+        case EFFECT_CMD_GET_CONFIG:
+            if ((reply_data == NULL) || (reply_size == NULL) ||
+                (*reply_size != sizeof(effect_config_t)))
+                return -EINVAL;
+            memcpy(reply_data, &effect->config, sizeof(effect_config_t));
+            return 0;
+
+        case EFFECT_CMD_ENABLE:
+            effect->enabled = 1;
+            break;
+
+        case EFFECT_CMD_DISABLE:
+            effect->enabled = 0;
+            break;
+
+        case EFFECT_CMD_GET_PARAM: {
+            // The HAL's stages have no tunable parameters.
+            effect_param_t* p = (effect_param_t*)cmd_data;
+            if ((p == NULL) || (cmd_size < sizeof(effect_param_t)) ||
+                (reply_data == NULL) || (reply_size == NULL) ||
+                (*reply_size < (sizeof(effect_param_t) + p->psize)))
+                return -EINVAL;
+            memcpy(reply_data, p, sizeof(effect_param_t) + p->psize);
+            p = (effect_param_t*)reply_data;
+            p->status = -EINVAL;
+            p->vsize = 0;
+            *reply_size = sizeof(effect_param_t) + p->psize;
+            return 0;
+        }
+
+        case EFFECT_CMD_SET_PARAM:
+            if ((reply_data == NULL) || (reply_size == NULL) ||
+                (*reply_size != sizeof(int32_t)))
+                return -EINVAL;
+            *(int32_t*)reply_data = -EINVAL;
+            return 0;
+
+        case EFFECT_CMD_INIT:
+        case EFFECT_CMD_RESET:
+        case EFFECT_CMD_SET_DEVICE:
+        case EFFECT_CMD_SET_INPUT_DEVICE:
+        case EFFECT_CMD_SET_AUDIO_MODE:
+        case EFFECT_CMD_SET_AUDIO_SOURCE:
+        case EFFECT_CMD_SET_CONFIG_REVERSE:
+            break;
+
+        default:
+            return -EINVAL;
+    }
+
+    // Everything which gets here answers with a plain status, if asked.
+    if ((reply_data != NULL) && (reply_size != NULL) &&
+        (*reply_size >= sizeof(int32_t))) {
+        *(int32_t*)reply_data = 0;
+        *reply_size = sizeof(int32_t);
+    }
+
+    return 0;
+}
+
+static int32_t proxy_get_descriptor(effect_handle_t self,
+                                    effect_descriptor_t* desc)
+{
+    struct proxy_effect* effect = (struct proxy_effect*)self;
+
+    if ((effect == NULL) || (desc == NULL))
+        return -EINVAL;
+
+    *desc = *effect->desc;
+    return 0;
+}
+
+static const struct effect_interface_s proxy_interface = {
+    proxy_process,
+    proxy_command,
+    proxy_get_descriptor,
+    NULL
+};
+
+/*
+ * Effect library interface
+ */
+
+static int32_t proxy_lib_create(const effect_uuid_t* uuid, int32_t session_id,
+                                int32_t io_id, effect_handle_t* handle)
+{
+    const effect_descriptor_t* desc = find_descriptor(uuid);
+    struct proxy_effect* effect;
+
+    (void)session_id;
+    (void)io_id;
+
+    if ((desc == NULL) || (handle == NULL))
+        return -EINVAL;
+
+    effect = (struct proxy_effect*)calloc(1, sizeof(*effect));
+    if (effect == NULL)
+        return -ENOMEM;
+
+    effect->itfe = &proxy_interface;
+    effect->desc = desc;
+    *handle = (effect_handle_t)effect;
+
+    ALOGV("%s: created %s", __func__, desc->name);
+    return 0;
+}
+
+static int32_t proxy_lib_release(effect_handle_t handle)
+{
+    if (handle == NULL)
+        return -EINVAL;
+
+    free(handle);
+    return 0;
+}
+
+static int32_t proxy_lib_get_descriptor(const effect_uuid_t* uuid,
+                                        effect_descriptor_t* desc)
+{
+    const effect_descriptor_t* d = find_descriptor(uuid);
+
+    if ((d == NULL) || (desc == NULL))
+        return -EINVAL;
+
+    *desc = *d;
+    return 0;
+}
+
+__attribute__ ((visibility ("default")))
+audio_effect_library_t AUDIO_EFFECT_LIBRARY_INFO_SYM = {
+    .tag = AUDIO_EFFECT_LIBRARY_TAG,
+    .version = EFFECT_LIBRARY_API_VERSION,
+    .name = "ATV Audio HAL Pre-processing Proxy",
+    .implementor = "The Android Open Source Project",
+    .create_effect = proxy_lib_create,
+    .release_effect = proxy_lib_release,
+    .get_descriptor = proxy_lib_get_descriptor,
+};
@@ -0,0 +1,38 @@
+/*
+**
+** Copyright 2014, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#ifndef ANDROID_ATV_PREPROCESS_PROXY_H
+#define ANDROID_ATV_PREPROCESS_PROXY_H
+
+#include <hardware/audio_effect.h>
+
+// The AGC and NS effects listed for this device in audio_effects.conf are
+// pass-through proxies (atv_preprocess_proxy.c).  AudioFlinger attaches them
+// to the input stream through add_audio_effect, and the HAL runs its own
+// PreprocessChain stages in their place (see AudioStreamIn::addAudioEffect),
+// so the audio is only processed once.  These are their implementation
+// UUIDs; the type UUIDs are the standard FX_IID_AGC and FX_IID_NS.
+
+// 741fe5af-8009-478a-a9ab-ba1a8344909c
+static const effect_uuid_t atv_preprocess_agc_uuid =
+    { 0x741fe5af, 0x8009, 0x478a, 0xa9ab, { 0xba, 0x1a, 0x83, 0x44, 0x90, 0x9c } };
+
+// 683fa258-8ea3-48d9-9dc8-34f892a776cc
+static const effect_uuid_t atv_preprocess_ns_uuid =
+    { 0x683fa258, 0x8ea3, 0x48d9, 0x9dc8, { 0x34, 0xf8, 0x92, 0xa7, 0x76, 0xcc } };
+
+#endif  // ANDROID_ATV_PREPROCESS_PROXY_H
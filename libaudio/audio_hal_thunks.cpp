@@ -328,6 +328,15 @@ static uint32_t in_get_input_frames_lost(struct audio_stream_in *stream)
     return tstream->impl->getInputFramesLost();
 }
 
+static int in_get_capture_position(const struct audio_stream_in *stream,
+                                   int64_t *frames, int64_t *time)
+{
+    const struct atv_stream_in* tstream =
+        reinterpret_cast<const struct atv_stream_in*>(stream);
+
+    return tstream->impl->getCapturePosition(frames, time);
+}
+
 static int in_add_audio_effect(const struct audio_stream *stream,
                                effect_handle_t effect)
 {
@@ -416,7 +425,7 @@ static int adev_open_input_stream(struct audio_hw_device *dev,
                                   struct audio_stream_in **stream_in,
                                   audio_input_flags_t flags,
                                   const char *address __unused,
-                                  audio_source_t source __unused)
+                                  audio_source_t source)
 {
     (void) handle;
     (void) flags;
@@ -449,8 +458,10 @@ static int adev_open_input_stream(struct audio_hw_device *dev,
     in->stream.set_gain = in_set_gain;
     in->stream.read = in_read;
     in->stream.get_input_frames_lost = in_get_input_frames_lost;
+    in->stream.get_capture_position = in_get_capture_position;
 
     in->impl = adev->input->openInputStream(devices,
+                                            source,
                                             &config->format,
                                             &config->channel_mask,
                                             &config->sample_rate,
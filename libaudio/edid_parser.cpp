@@ -0,0 +1,233 @@
+/*
+**
+** Copyright 2014, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#define LOG_TAG "AudioHAL:edid_parser"
+
+#include <utils/Log.h>
+
+#include <string.h>
+
+#include "edid_parser.h"
+
+namespace android {
+
+// ELD (HDA spec, section 7.3.3.34.1)
+static const size_t  kELDHeaderSize       = 4;
+static const size_t  kELDFixedBaseline    = 16;
+static const uint8_t kELDVersion2         = 2;
+static const size_t  kELDMaxMNL           = 16;
+static const size_t  kELDMaxSADs          = 15;
+
+// EDID / CEA-861
+static const size_t  kEDIDBlockSize       = 128;
+static const uint8_t kCEAExtensionTag     = 0x02;
+static const uint8_t kCEABasicAudio       = 0x40;
+static const uint8_t kCEATagAudio         = 1;
+static const uint8_t kCEATagVendor        = 3;
+static const uint8_t kCEATagSpeakerAlloc  = 4;
+static const uint8_t kHDMIOUI[3]          = { 0x03, 0x0C, 0x00 };
+static const uint8_t kVSDBLatencyPresent  = 0x80;
+static const size_t  kSADSize             = 3;
+
+void EDIDAudioInfo::clear()
+{
+    basicAudio = false;
+    speakerAlloc = 0;
+    sadCount = 0;
+    videoLatencyMs = kLatencyUnknown;
+    audioLatencyMs = kLatencyUnknown;
+    avSyncDelayMs = kLatencyUnknown;
+}
+
+static void decodeSAD(const uint8_t* p, EDIDAudioInfo* info)
+{
+    if (info->sadCount >= EDIDAudioInfo::kMaxSADs)
+        return;
+
+    EDIDAudioInfo::SAD& sad = info->sads[info->sadCount];
+    sad.fmt = (p[0] >> 3) & 0x0F;
+    sad.maxCh = (p[0] & 0x07) + 1;
+    sad.srMask = p[1] & 0x7F;
+    sad.bpsMask = 0;
+    sad.maxBitrate = 0;
+
+    // Format code 0 is reserved.
+    if (!sad.fmt)
+        return;
+
+    // Byte 3 is the supported sample sizes for LPCM, the max bitrate (in
+    // units of 8kHz) for AC-3 through ATRAC, and format specific otherwise.
+    if (sad.fmt == 1)
+        sad.bpsMask = p[2] & 0x07;
+    else if (sad.fmt <= 8)
+        sad.maxBitrate = static_cast<uint32_t>(p[2]) * 8000;
+
+    info->sadCount++;
+}
+
+static int decodeLatency(uint8_t val)
+{
+    // 0 is unknown, 255 means the sink doesn't output this type of content.
+    if (!val || (val == 255))
+        return EDIDAudioInfo::kLatencyUnknown;
+
+    return (static_cast<int>(val) - 1) * 2;
+}
+
+bool parseELD(const uint8_t* eld, size_t len, EDIDAudioInfo* info)
+{
+    info->clear();
+
+    if ((eld == NULL) || (len < (kELDHeaderSize + kELDFixedBaseline)))
+        return false;
+
+    if ((eld[0] >> 3) != kELDVersion2)
+        return false;
+
+    size_t baselineLen = static_cast<size_t>(eld[2]) * 4;
+    size_t end = kELDHeaderSize + baselineLen;
+    if (end > len)
+        end = len;
+
+    const uint8_t* b = eld + kELDHeaderSize;
+    size_t mnl = b[0] & 0x1F;
+    size_t sadCnt = b[1] >> 4;
+
+    if ((mnl > kELDMaxMNL) || (sadCnt > kELDMaxSADs))
+        return false;
+
+    size_t sadOffset = kELDHeaderSize + kELDFixedBaseline + mnl;
+    if ((sadOffset + (sadCnt * kSADSize)) > end)
+        return false;
+
+    if (b[2])
+        info->avSyncDelayMs = static_cast<int>(b[2]) * 2;
+
+    info->speakerAlloc = b[3] & 0x7F;
+
+    for (size_t i = 0; i < sadCnt; ++i)
+        decodeSAD(eld + sadOffset + (i * kSADSize), info);
+
+    // A sink which supports audio at all has to list at least one SAD.
+    info->basicAudio = (info->sadCount > 0);
+    return true;
+}
+
+static void parseVSDB(const uint8_t* p, size_t len, EDIDAudioInfo* info)
+{
+    // OUI (3 bytes, LSB first), physical address (2 bytes), then optional
+    // fields which are only present if the block is long enough.
+    if ((len < 3) || memcmp(p, kHDMIOUI, sizeof(kHDMIOUI)))
+        return;
+
+    if (len < 8)
+        return;
+
+    // The interlaced latencies which may follow are of no interest here.
+    if (!(p[7] & kVSDBLatencyPresent) || (len < 10))
+        return;
+
+    info->videoLatencyMs = decodeLatency(p[8]);
+    info->audioLatencyMs = decodeLatency(p[9]);
+
+    if ((info->videoLatencyMs != EDIDAudioInfo::kLatencyUnknown) &&
+        (info->audioLatencyMs != EDIDAudioInfo::kLatencyUnknown))
+        info->avSyncDelayMs = info->videoLatencyMs - info->audioLatencyMs;
+}
+
+static bool parseCEABlock(const uint8_t* blk, EDIDAudioInfo* info)
+{
+    if (blk[0] != kCEAExtensionTag)
+        return false;
+
+    // Revision 1 blocks carry no data block collection.
+    if (blk[1] >= 2)
+        info->basicAudio = info->basicAudio || (blk[3] & kCEABasicAudio);
+
+    size_t dtdOffset = blk[2];
+    if ((blk[1] < 3) || (dtdOffset < 4))
+        return true;
+    if (dtdOffset > kEDIDBlockSize)
+        return false;
+
+    for (size_t ndx = 4; ndx < dtdOffset; ) {
+        uint8_t tag = blk[ndx] >> 5;
+        size_t len = blk[ndx] & 0x1F;
+        const uint8_t* p = blk + ndx + 1;
+
+        if ((ndx + 1 + len) > dtdOffset)
+            return false;
+
+        switch (tag) {
+            case kCEATagAudio:
+                for (size_t i = 0; (i + kSADSize) <= len; i += kSADSize)
+                    decodeSAD(p + i, info);
+                break;
+
+            case kCEATagSpeakerAlloc:
+                if (len >= 2)
+                    info->speakerAlloc = p[0] | ((p[1] & 0x07) << 8);
+                break;
+
+            case kCEATagVendor:
+                parseVSDB(p, len, info);
+                break;
+
+            default:
+                break;
+        }
+
+        ndx += 1 + len;
+    }
+
+    return true;
+}
+
+bool parseEDID(const uint8_t* edid, size_t len, EDIDAudioInfo* info)
+{
+    static const uint8_t kEDIDHeader[8] =
+        { 0x00, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x00 };
+    bool foundCEA = false;
+
+    info->clear();
+
+    if ((edid == NULL) || (len < kEDIDBlockSize) ||
+        memcmp(edid, kEDIDHeader, sizeof(kEDIDHeader)))
+        return false;
+
+    size_t extCount = edid[126];
+    for (size_t i = 1; i <= extCount; ++i) {
+        size_t offset = i * kEDIDBlockSize;
+        if ((offset + kEDIDBlockSize) > len)
+            break;
+
+        const uint8_t* blk = edid + offset;
+        if (blk[0] != kCEAExtensionTag)
+            continue;
+
+        if (!parseCEABlock(blk, info)) {
+            ALOGW("%s: malformed CEA-861 block in extension %zu", __func__, i);
+            return false;
+        }
+
+        foundCEA = true;
+    }
+
+    return foundCEA;
+}
+
+}  // namespace android
@@ -0,0 +1,72 @@
+/*
+**
+** Copyright 2014, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#ifndef ANDROID_EDID_PARSER_H
+#define ANDROID_EDID_PARSER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace android {
+
+// Audio related information extracted from a sink's ELD (as exposed by the
+// HDA/HDMI audio driver) or from its raw EDID (CEA-861 extension blocks).
+// Parsing never allocates; everything lands in the fixed size arrays below.
+struct EDIDAudioInfo {
+    // Short Audio Descriptor, decoded.
+    struct SAD {
+        uint8_t  fmt;           // CEA-861 audio format code (1 == LPCM)
+        uint8_t  maxCh;         // 1 - 8
+        uint8_t  srMask;        // CEA bits; 0:32k 1:44.1k 2:48k ... 6:192k
+        uint8_t  bpsMask;       // LPCM only; 0:16 bit 1:20 bit 2:24 bit
+        uint32_t maxBitrate;    // formats 2 - 8 only, bits per second
+    };
+
+    // An ELD holds at most 15 SADs; an EDID may carry several audio data
+    // blocks of up to 10 SADs each.
+    static const size_t kMaxSADs = 32;
+
+    // Latency values of this are "unknown".  CEA encodes latency as
+    // (ms / 2) + 1, with 0 meaning unknown and 255 meaning "no output".
+    static const int kLatencyUnknown = -1;
+
+    bool     basicAudio;
+    uint16_t speakerAlloc;      // CEA Speaker Allocation bits 0 - 10
+    size_t   sadCount;
+    SAD      sads[kMaxSADs];
+
+    // Progressive latencies from the HDMI VSDB (EDID only).
+    int      videoLatencyMs;
+    int      audioLatencyMs;
+
+    // How much later than audio the sink presents video; Aud_Synch_Delay in
+    // an ELD, video minus audio latency from an EDID.
+    int      avSyncDelayMs;
+
+    void     clear();
+};
+
+// Parse a HDA style ELD (version 2).  Returns false if the blob is malformed.
+bool parseELD(const uint8_t* eld, size_t len, EDIDAudioInfo* info);
+
+// Parse a raw EDID (base block plus extensions).  Only the CEA-861 extension
+// blocks are examined.  Returns false if the blob is malformed or carries no
+// CEA-861 extension.
+bool parseEDID(const uint8_t* edid, size_t len, EDIDAudioInfo* info);
+
+}  // namespace android
+#endif  // ANDROID_EDID_PARSER_H
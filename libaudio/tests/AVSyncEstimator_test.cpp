@@ -0,0 +1,227 @@
+/*
+**
+** Copyright 2014, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#include <stdlib.h>
+#include <time.h>
+
+#include <gtest/gtest.h>
+
+#include "AVSyncEstimator.h"
+
+namespace android {
+
+static const nsecs_t kPeriod60Hz = 16666666;
+
+static struct timespec toTimespec(nsecs_t t)
+{
+    struct timespec ts;
+    ts.tv_sec = t / 1000000000LL;
+    ts.tv_nsec = t % 1000000000LL;
+    return ts;
+}
+
+// Vsyncs at an exact period, paced against the real clock so that the
+// estimate never looks stale.  Driven by AVSyncEstimator's own thread.
+class SimulatedVsyncSource : public VsyncSource {
+  public:
+    SimulatedVsyncSource(nsecs_t period, nsecs_t jitter)
+        : mPeriod(period), mJitter(jitter), mNext(systemTime()), mCount(0) {}
+
+    virtual status_t initCheck() { return OK; }
+
+    virtual status_t waitForVsync(nsecs_t* timestamp)
+    {
+        mNext += mPeriod;
+        struct timespec ts = toTimespec(mNext);
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+
+        // Alternate early and late, so the average stays on the grid.
+        *timestamp = mNext + (((mCount++ & 1) ? mJitter : -mJitter));
+        return OK;
+    }
+
+  private:
+    const nsecs_t mPeriod;
+    const nsecs_t mJitter;
+    nsecs_t mNext;
+    uint32_t mCount;
+};
+
+// Feed count vsyncs ending now, period apart.  Returns the last one.
+static nsecs_t feedVsyncs(AVSyncEstimator* est, nsecs_t period, int count,
+                          int skipEvery = 0)
+{
+    nsecs_t t = systemTime() - (period * count);
+    for (int i = 0; i < count; ++i) {
+        t += period;
+        if (skipEvery && (i % skipEvery) == (skipEvery - 1))
+            continue;
+        est->onVsync(t);
+    }
+    return t;
+}
+
+TEST(AVSyncEstimatorTest, NotValidUntilWarmedUp)
+{
+    sp<AVSyncEstimator> est = new AVSyncEstimator();
+    uint32_t delay;
+
+    EXPECT_FALSE(est->getVideoDelayUsec(&delay));
+
+    nsecs_t last = feedVsyncs(est.get(), kPeriod60Hz, 32);
+    EXPECT_FALSE(est->getVideoDelayUsec(&delay));
+
+    for (int i = 0; i < 7; ++i)
+        est->onAudioPresented(toTimespec(last + ms2ns(4)));
+    EXPECT_FALSE(est->getVideoDelayUsec(&delay));
+
+    est->onAudioPresented(toTimespec(last + ms2ns(4)));
+    EXPECT_TRUE(est->getVideoDelayUsec(&delay));
+}
+
+TEST(AVSyncEstimatorTest, DelayIsWaitForNextVsyncPlusPipeline)
+{
+    sp<AVSyncEstimator> est = new AVSyncEstimator();
+    uint32_t delay;
+
+    nsecs_t last = feedVsyncs(est.get(), kPeriod60Hz, 32);
+    for (int i = 0; i < 16; ++i)
+        est->onAudioPresented(toTimespec(last + ms2ns(4) + (i * kPeriod60Hz)));
+
+    ASSERT_TRUE(est->getVideoDelayUsec(&delay));
+    EXPECT_NEAR(ns2us(kPeriod60Hz - ms2ns(4)), delay, 1);
+
+    est->setPipelineDepth(2);
+    ASSERT_TRUE(est->getVideoDelayUsec(&delay));
+    EXPECT_NEAR(ns2us((3 * kPeriod60Hz) - ms2ns(4)), delay, 1);
+}
+
+TEST(AVSyncEstimatorTest, MissedVsyncsDoNotStretchThePeriod)
+{
+    sp<AVSyncEstimator> est = new AVSyncEstimator();
+    uint32_t delay;
+
+    // Establish the period, then drop every third vsync.
+    feedVsyncs(est.get(), kPeriod60Hz, 8);
+    nsecs_t last = feedVsyncs(est.get(), kPeriod60Hz, 60, 3);
+    for (int i = 0; i < 16; ++i)
+        est->onAudioPresented(toTimespec(last + ms2ns(10)));
+
+    ASSERT_TRUE(est->getVideoDelayUsec(&delay));
+    EXPECT_NEAR(ns2us(kPeriod60Hz - ms2ns(10)), delay, 50);
+}
+
+TEST(AVSyncEstimatorTest, WaitAveragesAcrossTheVsync)
+{
+    sp<AVSyncEstimator> est = new AVSyncEstimator();
+    uint32_t delay;
+
+    // Audio presented half a mSec either side of the vsync waits either
+    // almost nothing or almost a whole period; the two are the same phase
+    // and must not average out to half a period.
+    nsecs_t last = feedVsyncs(est.get(), kPeriod60Hz, 32);
+    for (int i = 0; i < 64; ++i) {
+        nsecs_t offset = (i & 1) ? us2ns(500) : -us2ns(500);
+        est->onAudioPresented(toTimespec(last + offset));
+    }
+
+    ASSERT_TRUE(est->getVideoDelayUsec(&delay));
+    int64_t period = ns2us(kPeriod60Hz);
+    int64_t fromVsync = delay % period;
+    if (fromVsync > (period / 2))
+        fromVsync -= period;
+    EXPECT_LT(llabs(fromVsync), 1000) << delay;
+    EXPECT_LE(delay, period);
+}
+
+TEST(AVSyncEstimatorTest, OutOfRangeIntervalsAreIgnored)
+{
+    sp<AVSyncEstimator> est = new AVSyncEstimator();
+    uint32_t delay;
+
+    // A 200Hz burst (too fast to be a display) between two vsyncs must not
+    // pull the estimate.
+    nsecs_t t = systemTime() - (24 * kPeriod60Hz);
+    for (int i = 0; i < 20; ++i)
+        est->onVsync(t += kPeriod60Hz);
+    nsecs_t burst = t;
+    for (int i = 0; i < 3; ++i)
+        est->onVsync(burst += ms2ns(5));
+    est->onVsync(t += kPeriod60Hz);
+    nsecs_t last = t;
+    for (int i = 0; i < 16; ++i)
+        est->onAudioPresented(toTimespec(last + ms2ns(4)));
+
+    ASSERT_TRUE(est->getVideoDelayUsec(&delay));
+    EXPECT_NEAR(ns2us(kPeriod60Hz - ms2ns(4)), delay, 50);
+}
+
+TEST(AVSyncEstimatorTest, StaleEstimateIsRejected)
+{
+    sp<AVSyncEstimator> est = new AVSyncEstimator();
+    uint32_t delay;
+
+    // A vsync stream which stopped a second ago.
+    nsecs_t t = systemTime() - ms2ns(1000) - (32 * kPeriod60Hz);
+    for (int i = 0; i < 32; ++i)
+        est->onVsync(t += kPeriod60Hz);
+    for (int i = 0; i < 16; ++i)
+        est->onAudioPresented(toTimespec(t + ms2ns(4)));
+
+    EXPECT_FALSE(est->getVideoDelayUsec(&delay));
+}
+
+// End to end through the estimator's vsync thread, with a simulated 50Hz
+// source jittering by +-1 mSec.
+TEST(AVSyncEstimatorTest, SimulatedSourceThroughThread)
+{
+    static const nsecs_t kPeriod50Hz = ms2ns(20);
+    sp<AVSyncEstimator> est = new AVSyncEstimator();
+    sp<SimulatedVsyncSource> src = new SimulatedVsyncSource(kPeriod50Hz, ms2ns(1));
+    uint32_t delay;
+
+    ASSERT_EQ(OK, est->start(src));
+
+    // Present audio 5 mSec after each (nominal) vsync for ~1.2 seconds.
+    nsecs_t start = systemTime();
+    for (int i = 0; i < 60; ++i) {
+        struct timespec ts = toTimespec(start + (i * kPeriod50Hz) + ms2ns(5));
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+        est->onAudioPresented(ts);
+    }
+
+    ASSERT_TRUE(est->getVideoDelayUsec(&delay));
+    // Scheduling noise on a loaded host is the main source of error here.
+    EXPECT_NEAR(ns2us(kPeriod50Hz - ms2ns(5)), delay, 3000);
+
+    est->stop();
+}
+
+TEST(AVSyncEstimatorTest, StartRequiresAWorkingSource)
+{
+    class DeadSource : public VsyncSource {
+      public:
+        virtual status_t initCheck() { return NO_INIT; }
+        virtual status_t waitForVsync(nsecs_t*) { return NO_INIT; }
+    };
+
+    sp<AVSyncEstimator> est = new AVSyncEstimator();
+    EXPECT_EQ(NO_INIT, est->start(NULL));
+    EXPECT_EQ(NO_INIT, est->start(new DeadSource()));
+}
+
+}  // namespace android
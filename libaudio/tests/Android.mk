@@ -0,0 +1,96 @@
+# Copyright (C) 2014 The Android Open Source Project
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+LOCAL_PATH := $(call my-dir)
+
+##################################
+# Host unit tests for the audio HAL
+##################################
+# Only the parts of the HAL which do not need ALSA or the framework are
+# built here, straight from their sources.  HDMIAudioCaps runs against
+# FakeHDMICapsMixer in place of alsa_caps_mixer.cpp, and RemoteControlState
+# against a stand-in service (there is no binder on the host).
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := atv_audio_host_tests
+LOCAL_MODULE_TAGS := tests
+
+LOCAL_SRC_FILES := \
+    ../AVSyncEstimator.cpp \
+    ../CaptureDSP.cpp \
+    ../CaptureRing.cpp \
+    ../alsa_utils.cpp \
+    ../edid_parser.cpp \
+    ../HALStateWriter.cpp \
+    ../RemoteControlState.cpp \
+    ../SilenceClock.cpp \
+    ../SoundUevent.cpp \
+    FakeHDMICapsMixer.cpp \
+    AVSyncEstimator_test.cpp \
+    CaptureDSP_test.cpp \
+    CaptureRing_test.cpp \
+    EDIDParser_test.cpp \
+    HALStateWriter_test.cpp \
+    HDMIAudioCaps_test.cpp \
+    RemoteControlState_test.cpp \
+    SilenceClock_test.cpp \
+    SoundUevent_test.cpp
+
+LOCAL_C_INCLUDES := \
+    $(LOCAL_PATH)/.. \
+    external/libdrm/include/drm \
+    $(LOCAL_PATH)/../../kernel-headers
+
+LOCAL_STATIC_LIBRARIES := \
+    libutils \
+    libcutils \
+    liblog
+
+LOCAL_CFLAGS := -Wall -Werror
+LOCAL_LDLIBS := -lpthread -lm
+
+include $(BUILD_HOST_NATIVE_TEST)
+
+##################################
+# Fuzz target for HDMI caps negotiation
+##################################
+# Built as a host test which replays a fixed, seeded set of inputs through
+# the fuzz target, so it is compiled and run everywhere.  For open ended
+# fuzzing, link HDMIAudioCaps_fuzzer.cpp (without the replay driver) with
+# libFuzzer.
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := atv_audio_hdmi_caps_fuzzer
+LOCAL_MODULE_TAGS := tests
+
+LOCAL_SRC_FILES := \
+    ../alsa_utils.cpp \
+    ../edid_parser.cpp \
+    ../HALStateWriter.cpp \
+    FakeHDMICapsMixer.cpp \
+    HDMIAudioCaps_fuzzer.cpp \
+    HDMIAudioCaps_fuzzer_replay.cpp
+
+LOCAL_C_INCLUDES := \
+    $(LOCAL_PATH)/..
+
+LOCAL_STATIC_LIBRARIES := \
+    libutils \
+    libcutils \
+    liblog
+
+LOCAL_CFLAGS := -Wall -Werror
+LOCAL_LDLIBS := -lpthread
+
+include $(BUILD_HOST_NATIVE_TEST)
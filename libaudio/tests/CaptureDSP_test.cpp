@@ -0,0 +1,442 @@
+/*
+**
+** Copyright 2014, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#include <math.h>
+#include <stdio.h>
+
+#include <gtest/gtest.h>
+#include <utils/misc.h>
+#include <utils/Timers.h>
+#include <utils/Vector.h>
+
+#include "CaptureDSP.h"
+
+namespace android {
+
+struct Ratio {
+    uint32_t inRate;
+    uint32_t outRate;
+};
+
+// The conversions the capture path actually sees.
+static const Ratio kRatios[] = {
+    { 16000, 48000 },
+    { 48000, 16000 },
+    {  8000, 16000 },
+    { 16000,  8000 },
+    { 44100, 48000 },
+    { 48000, 44100 },
+};
+
+static void makeTone(Vector<int16_t>* buf, size_t frames, double freq,
+                     uint32_t rate, double amplitude)
+{
+    buf->clear();
+    buf->insertAt(0, 0, frames);
+    for (size_t i = 0; i < frames; ++i)
+        buf->editItemAt(i) = static_cast<int16_t>(
+                lrint(amplitude * sin((2 * M_PI * freq * i) / rate)));
+}
+
+// Run in through a resampler in 10 mSec reads, the way the stream does.
+static void resample(PolyphaseResampler& rs, const Vector<int16_t>& in,
+                     uint32_t inRate, Vector<int16_t>* out)
+{
+    size_t chunk = inRate / 100;
+    int16_t tmp[4096];
+
+    out->clear();
+    for (size_t pos = 0; pos < in.size(); ) {
+        size_t len = in.size() - pos;
+        if (len > chunk)
+            len = chunk;
+
+        size_t used = 0;
+        while (used < len) {
+            size_t consumed;
+            size_t made = rs.process(in.array() + pos + used, len - used,
+                                     &consumed, tmp, NELEM(tmp));
+            out->appendArray(tmp, made);
+            used += consumed;
+        }
+        pos += len;
+    }
+}
+
+// Least squares fit of a tone at freq to buf[start...], whatever its phase.
+// Returns the amplitude of the fit and the SNR of buf against it, in dB.
+static void fitTone(const Vector<int16_t>& buf, size_t start, double freq,
+                    uint32_t rate, double* amplitude, double* snr)
+{
+    double ss = 0, cc = 0, sc = 0, xs = 0, xc = 0;
+    for (size_t i = start; i < buf.size(); ++i) {
+        double s = sin((2 * M_PI * freq * i) / rate);
+        double c = cos((2 * M_PI * freq * i) / rate);
+        ss += s * s; cc += c * c; sc += s * c;
+        xs += buf[i] * s; xc += buf[i] * c;
+    }
+    double det = (ss * cc) - (sc * sc);
+    double a = ((xs * cc) - (xc * sc)) / det;
+    double b = ((xc * ss) - (xs * sc)) / det;
+
+    double sig = 0, err = 0;
+    for (size_t i = start; i < buf.size(); ++i) {
+        double fit = (a * sin((2 * M_PI * freq * i) / rate)) +
+                     (b * cos((2 * M_PI * freq * i) / rate));
+        sig += fit * fit;
+        err += (buf[i] - fit) * (buf[i] - fit);
+    }
+
+    *amplitude = sqrt((a * a) + (b * b));
+    *snr = 10 * log10(sig / (err ? err : 1e-9));
+}
+
+/*
+ * Downmix
+ */
+
+TEST(CaptureDSPTest, DownmixMatchesScalarReference)
+{
+    static const size_t kFrames = 1027;   // not a multiple of the SIMD width
+    int16_t src[kFrames * 2];
+    int16_t dst[kFrames];
+    int16_t inPlace[kFrames * 2];
+    uint32_t seed = 1;
+
+    for (size_t i = 0; i < (kFrames * 2); ++i) {
+        seed = (seed * 1103515245u) + 12345u;
+        src[i] = static_cast<int16_t>(seed >> 16);
+    }
+    // Full scale corners, where a 16 bit (L + R) would overflow.
+    src[0] = src[1] = 32767;
+    src[2] = src[3] = -32768;
+
+    for (int m = 0; m < 3; ++m) {
+        CaptureDSP::DownmixMode mode = static_cast<CaptureDSP::DownmixMode>(m);
+        CaptureDSP::downmixStereo(dst, src, kFrames, mode);
+        memcpy(inPlace, src, sizeof(src));
+        CaptureDSP::downmixStereo(inPlace, inPlace, kFrames, mode);
+
+        for (size_t i = 0; i < kFrames; ++i) {
+            int32_t l = src[i * 2], r = src[(i * 2) + 1];
+            int16_t expected = (mode == CaptureDSP::kDownmixLeft) ? l :
+                               (mode == CaptureDSP::kDownmixRight) ? r : ((l + r) >> 1);
+            ASSERT_EQ(expected, dst[i]) << CaptureDSP::downmixModeToString(mode) << " " << i;
+            ASSERT_EQ(expected, inPlace[i]) << CaptureDSP::downmixModeToString(mode) << " " << i;
+        }
+    }
+}
+
+// Against the loop it replaced, which simply dropped the right channel.
+TEST(CaptureDSPTest, DownmixBenchmark)
+{
+    static const size_t kFrames = 480;
+    static const int kIterations = 20000;
+    int16_t src[kFrames * 2];
+    int16_t dst[kFrames];
+    int64_t check = 0;
+
+    for (size_t i = 0; i < (kFrames * 2); ++i)
+        src[i] = static_cast<int16_t>(i * 37);
+
+    nsecs_t start = systemTime(SYSTEM_TIME_THREAD);
+    for (int n = 0; n < kIterations; ++n) {
+        for (size_t i = 0; i < kFrames; ++i)
+            dst[i] = src[i * 2];
+        check += dst[n % kFrames];
+    }
+    nsecs_t dropRight = systemTime(SYSTEM_TIME_THREAD) - start;
+
+    start = systemTime(SYSTEM_TIME_THREAD);
+    for (int n = 0; n < kIterations; ++n) {
+        CaptureDSP::downmixStereo(dst, src, kFrames, CaptureDSP::kDownmixAverage);
+        check += dst[n % kFrames];
+    }
+    nsecs_t average = systemTime(SYSTEM_TIME_THREAD) - start;
+
+    double frames = static_cast<double>(kFrames) * kIterations;
+    printf("[   BENCH  ] downmix: drop right %.2f nSec/frame, average %.2f nSec/frame"
+           " (check %lld)\n", dropRight / frames, average / frames,
+           static_cast<long long>(check));
+
+    // Averaging both channels must not cost meaningfully more than throwing
+    // one of them away did.
+    EXPECT_LT(average, (dropRight * 2) + ms2ns(1));
+}
+
+/*
+ * Resampler
+ */
+
+TEST(CaptureDSPTest, ResamplerSupportsTheCaptureRatios)
+{
+    for (int i = 0; i < NELEM(kRatios); ++i)
+        EXPECT_TRUE(PolyphaseResampler::supports(kRatios[i].inRate, kRatios[i].outRate))
+                << kRatios[i].inRate << " -> " << kRatios[i].outRate;
+
+    // Decimation beyond what the filter is designed for.
+    EXPECT_FALSE(PolyphaseResampler::supports(48000, 4000));
+}
+
+// A 1 kHz tone at -6 dBFS through each ratio: the output is the same tone at
+// the same level, with everything else at least 70 dB down.
+TEST(CaptureDSPTest, ResamplerAccuracy)
+{
+    for (int i = 0; i < NELEM(kRatios); ++i) {
+        const Ratio& r = kRatios[i];
+        PolyphaseResampler rs(r.inRate, r.outRate);
+        Vector<int16_t> in, out;
+        double amplitude, snr;
+
+        makeTone(&in, r.inRate, 1000, r.inRate, 16384);
+        resample(rs, in, r.inRate, &out);
+
+        // All of the input comes out, less what is still in the filter.
+        EXPECT_NEAR(static_cast<double>(r.outRate), static_cast<double>(out.size()),
+                    rs.tapsPerPhase() * 2);
+
+        // Skip the filter's warm up.
+        fitTone(out, r.outRate / 10, 1000, r.outRate, &amplitude, &snr);
+        printf("[   BENCH  ] %5u -> %5u: %2u taps/phase, SNR %.1f dB, gain %+.3f dB\n",
+               r.inRate, r.outRate, rs.tapsPerPhase(), snr,
+               20 * log10(amplitude / 16384));
+
+        EXPECT_GT(snr, 70) << r.inRate << " -> " << r.outRate;
+        EXPECT_NEAR(16384, amplitude, 16384 * 0.06) << r.inRate << " -> " << r.outRate;
+    }
+}
+
+// Content above the output Nyquist must not fold back into the voice band.
+TEST(CaptureDSPTest, ResamplerRejectsAliases)
+{
+    static const Ratio kDecimating[] = { { 48000, 16000 }, { 16000, 8000 } };
+
+    for (int i = 0; i < NELEM(kDecimating); ++i) {
+        const Ratio& r = kDecimating[i];
+        PolyphaseResampler rs(r.inRate, r.outRate);
+        Vector<int16_t> in, out;
+        double amplitude, snr;
+
+        // 3/4 of the input Nyquist would alias to outRate - f.
+        double f = r.inRate * 0.375;
+        makeTone(&in, r.inRate, f, r.inRate, 16384);
+        resample(rs, in, r.inRate, &out);
+        fitTone(out, r.outRate / 10, r.outRate - f, r.outRate, &amplitude, &snr);
+
+        EXPECT_LT(20 * log10((amplitude + 1) / 16384), -50)
+                << r.inRate << " -> " << r.outRate;
+    }
+}
+
+TEST(CaptureDSPTest, ResamplerBenchmark)
+{
+    static const int kSeconds = 20;
+
+    for (int i = 0; i < NELEM(kRatios); ++i) {
+        const Ratio& r = kRatios[i];
+        PolyphaseResampler rs(r.inRate, r.outRate);
+        Vector<int16_t> in, out;
+
+        makeTone(&in, r.inRate * kSeconds, 440, r.inRate, 8000);
+        nsecs_t start = systemTime(SYSTEM_TIME_THREAD);
+        resample(rs, in, r.inRate, &out);
+        nsecs_t elapsed = systemTime(SYSTEM_TIME_THREAD) - start;
+
+        double realtime = (kSeconds * 1e9) / (elapsed ? elapsed : 1);
+        printf("[   BENCH  ] %5u -> %5u: %.1f nSec/output frame, %.0fx real time\n",
+               r.inRate, r.outRate, static_cast<double>(elapsed) / out.size(), realtime);
+
+        // A capture stream must cost a small fraction of a core.
+        EXPECT_GT(realtime, 50) << r.inRate << " -> " << r.outRate;
+    }
+}
+
+/*
+ * Pre-processing
+ */
+
+// Run buf through the chain in place, in 10 mSec reads.
+static void preprocess(PreprocessChain& chain, Vector<int16_t>* buf)
+{
+    size_t chunk = chain.sampleRate() / 100;
+    for (size_t pos = 0; pos < buf->size(); pos += chunk) {
+        size_t len = buf->size() - pos;
+        chain.process(buf->editArray() + pos, (len < chunk) ? len : chunk);
+    }
+}
+
+static double rms(const Vector<int16_t>& buf, size_t start, size_t end)
+{
+    double energy = 0;
+    for (size_t i = start; i < end; ++i)
+        energy += static_cast<double>(buf[i]) * buf[i];
+    return sqrt(energy / (end - start));
+}
+
+static double dB(double ratio)
+{
+    return 20 * log10(ratio);
+}
+
+TEST(CaptureDSPTest, PreprocessRemovesDCAndRumble)
+{
+    static const uint32_t kRate = 16000;
+    static const size_t kFrames = kRate * 3;
+    PreprocessChain chain;
+    Vector<int16_t> tone, rumble, buf;
+
+    // A 1 kHz tone riding on DC and 25 Hz rumble (handling noise, a fan).
+    makeTone(&tone, kFrames, 1000, kRate, 6000);
+    makeTone(&rumble, kFrames, 25, kRate, 6000);
+    buf.insertAt(0, 0, kFrames);
+    for (size_t i = 0; i < kFrames; ++i)
+        buf.editItemAt(i) = tone[i] + rumble[i] + 3000;
+
+    chain.configure(kRate);
+    chain.setStages(PreprocessChain::stageBit(PreprocessChain::kStageDCRemoval) |
+                    PreprocessChain::stageBit(PreprocessChain::kStageHighPass));
+    preprocess(chain, &buf);
+
+    // Judge the last second, once the DC estimate has settled.
+    size_t start = kFrames - kRate;
+    double mean = 0;
+    for (size_t i = start; i < kFrames; ++i)
+        mean += buf[i];
+    mean /= kRate;
+
+    double toneAmp, rumbleAmp, snr;
+    fitTone(buf, start, 1000, kRate, &toneAmp, &snr);
+    fitTone(buf, start, 25, kRate, &rumbleAmp, &snr);
+
+    printf("[   BENCH  ] dc+hpf: DC %.1f, 25 Hz %.1f dB, 1 kHz %.2f dB\n",
+           mean, dB(rumbleAmp / 6000), dB(toneAmp / 6000));
+    EXPECT_LT(fabs(mean), 30);
+    EXPECT_LT(dB(rumbleAmp / 6000), -15);
+    EXPECT_NEAR(0, dB(toneAmp / 6000), 0.5);
+}
+
+TEST(CaptureDSPTest, PreprocessGateAttenuatesFloor)
+{
+    static const uint32_t kRate = 16000;
+    static const size_t kSecond = kRate;
+    PreprocessChain chain;
+    Vector<int16_t> in, out;
+    uint32_t seed = 1;
+
+    // One second of a -60 dBFS noise floor, a second of -20 dBFS speech-ish
+    // tone over it, then the floor again.
+    in.insertAt(0, 0, kSecond * 3);
+    for (size_t i = 0; i < in.size(); ++i) {
+        seed = (seed * 1103515245u) + 12345u;
+        int32_t noise = (static_cast<int32_t>((seed >> 16) & 0x7F) - 64);
+        int32_t voice = ((i >= kSecond) && (i < (kSecond * 2))) ?
+                lrint(4634 * sin((2 * M_PI * 300 * i) / kRate)) : 0;
+        in.editItemAt(i) = static_cast<int16_t>(noise + voice);
+    }
+    out = in;
+
+    chain.configure(kRate);
+    chain.setStages(PreprocessChain::stageBit(PreprocessChain::kStageNoiseGate));
+    preprocess(chain, &out);
+
+    // Skip the close ramp (50 mSec time constant) and, after speech, the
+    // hold time as well.
+    size_t settle = kRate / 2;
+    double floor1 = dB(rms(out, settle, kSecond) / rms(in, settle, kSecond));
+    double speech = dB(rms(out, kSecond + (kRate / 100), kSecond * 2) /
+                       rms(in, kSecond + (kRate / 100), kSecond * 2));
+    double floor2 = dB(rms(out, (kSecond * 2) + settle, kSecond * 3) /
+                       rms(in, (kSecond * 2) + settle, kSecond * 3));
+
+    printf("[   BENCH  ] gate: floor %.1f dB, speech %.2f dB, floor after %.1f dB\n",
+           floor1, speech, floor2);
+    EXPECT_NEAR(-18, floor1, 1);
+    EXPECT_NEAR(0, speech, 0.1);
+    EXPECT_NEAR(-18, floor2, 1);
+}
+
+TEST(CaptureDSPTest, PreprocessAGCConvergesToTarget)
+{
+    static const uint32_t kRate = 16000;
+    static const size_t kFrames = kRate * 5;
+    static const double kTargetDBFS = -20;
+    // Quiet enough to need boost, and loud enough to need cut without
+    // hitting the AGC's -6 dB limit.
+    static const double kLevelsDBFS[] = { -35, -16 };
+
+    for (size_t l = 0; l < NELEM(kLevelsDBFS); ++l) {
+        PreprocessChain chain;
+        Vector<int16_t> buf;
+        double amplitude = 32768 * M_SQRT2 * pow(10, kLevelsDBFS[l] / 20);
+
+        makeTone(&buf, kFrames, 440, kRate, amplitude);
+        chain.configure(kRate);
+        chain.setStages(PreprocessChain::stageBit(PreprocessChain::kStageAGC));
+        preprocess(chain, &buf);
+
+        // Release is 500 mSec, so the last second is well settled.
+        double level = dB(rms(buf, kFrames - kRate, kFrames) / 32768);
+        printf("[   BENCH  ] agc: %.0f dBFS in -> %.2f dBFS out\n",
+               kLevelsDBFS[l], level);
+        EXPECT_NEAR(kTargetDBFS, level, 0.5) << kLevelsDBFS[l] << " dBFS";
+    }
+}
+
+TEST(CaptureDSPTest, PreprocessBenchmark)
+{
+    static const uint32_t kRate = 16000;
+    static const size_t kFrames = kRate / 100;
+    static const int kReads = 100 * 60;         // a minute of 10 mSec reads
+    PreprocessChain chain;
+    int16_t buf[kFrames];
+    uint32_t seed = 1;
+
+    chain.configure(kRate);
+    uint32_t all = 0;
+    for (int s = 0; s < PreprocessChain::kStageCount; ++s)
+        all |= PreprocessChain::stageBit(static_cast<PreprocessChain::Stage>(s));
+    chain.setStages(all);
+
+    nsecs_t start = systemTime(SYSTEM_TIME_THREAD);
+    for (int n = 0; n < kReads; ++n) {
+        // Speech-ish bursts over a noise floor with some DC on it.
+        bool talking = ((n / 50) & 1);
+        for (size_t i = 0; i < kFrames; ++i) {
+            seed = (seed * 1103515245u) + 12345u;
+            int32_t noise = static_cast<int32_t>((seed >> 16) & 0x1FF) - 256;
+            int32_t voice = talking ?
+                    lrint(6000 * sin((2 * M_PI * 300 * ((n * kFrames) + i)) / kRate)) : 0;
+            buf[i] = static_cast<int16_t>(500 + noise + voice);
+        }
+        chain.process(buf, kFrames);
+    }
+    nsecs_t elapsed = systemTime(SYSTEM_TIME_THREAD) - start;
+
+    EXPECT_EQ(static_cast<uint64_t>(kReads) * kFrames, chain.framesProcessed());
+    for (int s = 0; s < PreprocessChain::kStageCount; ++s) {
+        PreprocessChain::Stage stage = static_cast<PreprocessChain::Stage>(s);
+        printf("[   BENCH  ] preprocess %-10s: %.2f nSec/frame\n",
+               PreprocessChain::stageName(stage),
+               static_cast<double>(chain.stageCpuNsec(stage)) / chain.framesProcessed());
+    }
+
+    // The whole chain, generation included, for a minute of audio.
+    printf("[   BENCH  ] preprocess: %.3f%% of real time\n", elapsed / (60 * 1e9) * 100);
+    EXPECT_LT(elapsed, ms2ns(600));
+}
+
+}  // namespace android
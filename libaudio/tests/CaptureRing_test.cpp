@@ -0,0 +1,275 @@
+/*
+**
+** Copyright 2014, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+#include <utils/threads.h>
+#include <utils/Timers.h>
+
+#include "CaptureRing.h"
+
+namespace android {
+
+static const uint32_t kSlots = 4;
+static const uint32_t kPeriod = 16;
+static const uint32_t kChannels = 2;
+
+// Every frame carries its own index in the stream, low half on the left
+// channel and high half on the right, so a reader can tell exactly which
+// frames it was given.
+static void writePeriod(CaptureRing& ring)
+{
+    uint32_t first = ring.writeSeq() * ring.periodFrames();
+    int16_t* dst = ring.beginWrite();
+
+    for (uint32_t i = 0; i < ring.periodFrames(); ++i) {
+        uint32_t index = first + i;
+        dst[i * kChannels] = static_cast<int16_t>(index & 0xFFFF);
+        dst[(i * kChannels) + 1] = static_cast<int16_t>(index >> 16);
+    }
+    ring.endWrite();
+}
+
+static uint32_t frameIndex(const int16_t* frame)
+{
+    return static_cast<uint16_t>(frame[0]) |
+           (static_cast<uint32_t>(static_cast<uint16_t>(frame[1])) << 16);
+}
+
+// Reads frames and checks that what comes out is always a run of the
+// stream in order, with every gap accounted for as lost.
+class CheckedReader {
+  public:
+    explicit CheckedReader(CaptureRing& ring)
+        : mRing(ring), mNext(0), mDelivered(0), mErrors(0) {}
+
+    size_t read(size_t frames)
+    {
+        int16_t buf[256 * kChannels];
+        uint32_t lostBefore = mCursor.framesLost;
+        size_t n = mRing.read(&mCursor, buf, (frames < 256) ? frames : 256);
+
+        // The call may have skipped ahead anywhere along the way, but only
+        // ever forwards, and by exactly what it counted as lost.
+        uint32_t skipped = 0;
+        for (size_t i = 0; i < n; ++i) {
+            uint32_t index = frameIndex(buf + (i * kChannels));
+            if (index < mNext) {
+                mErrors++;
+                continue;
+            }
+            skipped += index - mNext;
+            mNext = index + 1;
+        }
+        uint32_t lost = mCursor.framesLost - lostBefore;
+        if (skipped > lost)
+            mErrors++;
+        // Anything skipped after the last frame returned shows up next time.
+        mNext += lost - skipped;
+        mDelivered += n;
+        return n;
+    }
+
+    CaptureRing::Cursor mCursor;
+    CaptureRing& mRing;
+    uint32_t mNext;         // index of the next frame we should see
+    uint64_t mDelivered;
+    uint32_t mErrors;
+};
+
+TEST(CaptureRingTest, ReadsAcrossPeriods)
+{
+    CaptureRing ring(kSlots, kPeriod, kChannels);
+    CheckedReader r(ring);
+
+    EXPECT_EQ(0u, r.read(kPeriod));
+
+    writePeriod(ring);
+    writePeriod(ring);
+    EXPECT_EQ(2 * kPeriod, ring.framesAvailable(r.mCursor));
+
+    // Odd sizes, so reads straddle the slot boundary.
+    EXPECT_EQ(5u, r.read(5));
+    EXPECT_EQ(20u, r.read(20));
+    EXPECT_EQ(7u, r.read(100));
+    EXPECT_EQ(0u, ring.framesAvailable(r.mCursor));
+
+    EXPECT_EQ(0u, r.mErrors);
+    EXPECT_EQ(0u, r.mCursor.framesLost);
+    EXPECT_EQ(0u, r.mCursor.overruns);
+}
+
+TEST(CaptureRingTest, OverrunSkipsAheadAndCountsLoss)
+{
+    CaptureRing ring(kSlots, kPeriod, kChannels);
+    CheckedReader r(ring);
+
+    writePeriod(ring);
+    EXPECT_EQ(3u, r.read(3));
+
+    // The writer laps the reader; only the newest kSlots - 1 periods are
+    // still intact.
+    for (int i = 0; i < 9; ++i)
+        writePeriod(ring);
+
+    EXPECT_EQ((kSlots - 1) * kPeriod, r.read(1000));
+    EXPECT_EQ(0u, r.mErrors);
+    EXPECT_EQ(1u, r.mCursor.overruns);
+    EXPECT_EQ(0u, r.mCursor.tornReads);
+    EXPECT_EQ(((10 - (kSlots - 1)) * kPeriod) - 3, r.mCursor.framesLost);
+    EXPECT_EQ(10 * kPeriod, r.mNext);
+}
+
+TEST(CaptureRingTest, ReadersAreIndependent)
+{
+    CaptureRing ring(kSlots, kPeriod, kChannels);
+    CheckedReader fast(ring), slow(ring), late(ring);
+
+    for (int i = 0; i < 2; ++i)
+        writePeriod(ring);
+    ring.seekToLive(&late.mCursor);
+    late.mNext = ring.writeSeq() * kPeriod;
+
+    for (int i = 0; i < 20; ++i) {
+        writePeriod(ring);
+        EXPECT_EQ(kPeriod * ((i == 0) ? 3 : 1), fast.read(1000));
+        if ((i % 5) == 4)
+            slow.read(1000);
+    }
+    EXPECT_EQ(kPeriod * 20, late.read(1000) + late.mCursor.framesLost);
+
+    EXPECT_EQ(0u, fast.mCursor.framesLost);
+    EXPECT_EQ(0u, fast.mCursor.overruns);
+    EXPECT_GT(slow.mCursor.overruns, 0u);
+    EXPECT_EQ(22 * kPeriod, slow.mDelivered + slow.mCursor.framesLost);
+    EXPECT_EQ(0u, fast.mErrors + slow.mErrors + late.mErrors);
+}
+
+TEST(CaptureRingTest, TornCopyJumpsAhead)
+{
+    CaptureRing ring(kSlots, kPeriod, kChannels);
+    CaptureRing::Cursor c;
+    int16_t buf[kPeriod * kChannels];
+
+    for (uint32_t i = 0; i < (kSlots - 1); ++i)
+        writePeriod(ring);
+
+    // The oldest period is intact when the copy starts...
+    size_t n = kPeriod;
+    const int16_t* src = ring.peek(&c, &n);
+    ASSERT_TRUE(src != NULL);
+    ASSERT_EQ(kPeriod, n);
+    memcpy(buf, src, sizeof(buf));
+
+    // ...but the writer laps it before the copy is checked, and is part way
+    // into the period after.
+    writePeriod(ring);
+    writePeriod(ring);
+    ring.beginWrite();
+
+    EXPECT_FALSE(ring.commitRead(&c, n));
+    EXPECT_EQ(1u, c.tornReads);
+    EXPECT_EQ(1u, c.overruns);
+
+    // On to the oldest period the writer is not in (it is in period 5, in
+    // the slot of period 1), without waiting for it to finish, and
+    // everything before that counted as lost.
+    uint32_t oldest = 5 - (kSlots - 1) + 1;
+    EXPECT_EQ(oldest, c.seq);
+    EXPECT_EQ(0u, c.offset);
+    EXPECT_EQ(oldest * kPeriod, c.framesLost);
+
+    n = kPeriod;
+    src = ring.peek(&c, &n);
+    ASSERT_TRUE(src != NULL);
+    EXPECT_EQ(oldest * kPeriod, frameIndex(src));
+    EXPECT_TRUE(ring.commitRead(&c, n));
+}
+
+// A writer racing readers which keep falling behind, so that it laps them
+// and, when preempted mid-copy, overtakes a copy in progress.  Whatever a
+// reader is handed must be an intact, in order run of the stream, and the
+// frames it never saw must all be counted as lost.
+class RingWriter : public Thread {
+  public:
+    RingWriter(CaptureRing& ring, nsecs_t runTime)
+        : Thread(false), mRing(ring), mEnd(systemTime() + runTime) {}
+  private:
+    virtual bool threadLoop()
+    {
+        writePeriod(mRing);
+        return systemTime() < mEnd;
+    }
+    CaptureRing& mRing;
+    const nsecs_t mEnd;
+};
+
+class RingReader : public Thread {
+  public:
+    RingReader(CaptureRing& ring, uint32_t seed)
+        : Thread(false), mReader(ring), mSeed(seed) {}
+    CheckedReader mReader;
+  private:
+    virtual bool threadLoop()
+    {
+        mSeed = (mSeed * 1103515245u) + 12345u;
+        mReader.read(1 + ((mSeed >> 16) % (kPeriod * 2)));
+        if (!((mSeed >> 8) & 0xF))
+            usleep(10);
+        return true;
+    }
+    uint32_t mSeed;
+};
+
+TEST(CaptureRingTest, ConcurrentReadersOnlySeeIntactFrames)
+{
+    static const int kReaders = 3;
+    CaptureRing ring(kSlots, kPeriod, kChannels);
+    sp<RingWriter> writer = new RingWriter(ring, ms2ns(300));
+    sp<RingReader> readers[kReaders];
+
+    for (int i = 0; i < kReaders; ++i) {
+        readers[i] = new RingReader(ring, i + 1);
+        ASSERT_EQ(NO_ERROR, readers[i]->run("RingReader"));
+    }
+    ASSERT_EQ(NO_ERROR, writer->run("RingWriter"));
+    writer->join();
+
+    uint32_t torn = 0, overruns = 0;
+    for (int i = 0; i < kReaders; ++i) {
+        readers[i]->requestExitAndWait();
+
+        CheckedReader& r = readers[i]->mReader;
+        // Drain what is left, so the accounting covers the whole stream.
+        while (r.read(kPeriod))
+            ;
+        EXPECT_EQ(0u, r.mErrors) << "reader " << i;
+        EXPECT_EQ(static_cast<uint64_t>(ring.writeSeq()) * kPeriod,
+                  r.mDelivered + r.mCursor.framesLost) << "reader " << i;
+        torn += r.mCursor.tornReads;
+        overruns += r.mCursor.overruns;
+    }
+
+    printf("[   BENCH  ] ring: %u periods written, %u overruns, %u torn reads"
+           " caught\n", ring.writeSeq(), overruns, torn);
+    EXPECT_GT(overruns, 0u);
+}
+
+}  // namespace android
@@ -0,0 +1,655 @@
+/*
+**
+** Copyright 2014, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include <gtest/gtest.h>
+#include <utils/misc.h>
+#include <utils/Timers.h>
+#include <utils/Vector.h>
+
+#include "edid_parser.h"
+
+namespace android {
+
+typedef EDIDAudioInfo Info;
+
+static const int kUnknown = EDIDAudioInfo::kLatencyUnknown;
+
+// SAD bytes for the formats the corpus uses.
+#define SAD_LPCM(ch, sr, bps)   (uint8_t)((1 << 3) | ((ch) - 1)), (uint8_t)(sr), (uint8_t)(bps)
+#define SAD_COMP(fmt, ch, sr, kbps) \
+    (uint8_t)(((fmt) << 3) | ((ch) - 1)), (uint8_t)(sr), (uint8_t)((kbps) / 8)
+
+// Builds an EDID: a base block followed by one CEA-861 extension per call to
+// addCEA().  The parser ignores checksums, but they are filled in anyway so
+// the blobs are what a real sink would send.
+class EDIDBuilder {
+  public:
+    EDIDBuilder()
+    {
+        static const uint8_t kHeader[8] =
+            { 0x00, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x00 };
+        mBlob.insertAt(0, 0, 128);
+        for (size_t i = 0; i < sizeof(kHeader); ++i)
+            mBlob.editItemAt(i) = kHeader[i];
+        mBlob.editItemAt(18) = 1;   // EDID 1.3
+        mBlob.editItemAt(19) = 3;
+        checksum(0);
+    }
+
+    // A CEA extension of the given revision with flags in byte 3 and the
+    // data block collection given, followed immediately by the DTDs.
+    EDIDBuilder& addCEA(uint8_t revision, uint8_t flags,
+                        const uint8_t* blocks, size_t len)
+    {
+        size_t base = mBlob.size();
+        mBlob.insertAt(0, base, 128);
+        mBlob.editItemAt(base + 0) = 0x02;
+        mBlob.editItemAt(base + 1) = revision;
+        mBlob.editItemAt(base + 2) = static_cast<uint8_t>(4 + len);
+        mBlob.editItemAt(base + 3) = flags;
+        for (size_t i = 0; i < len; ++i)
+            mBlob.editItemAt(base + 4 + i) = blocks[i];
+        checksum(base);
+
+        mBlob.editItemAt(126)++;
+        checksum(0);
+        return *this;
+    }
+
+    // Access to the raw bytes, for corrupting them.
+    uint8_t& operator[](size_t ndx) { return mBlob.editItemAt(ndx); }
+    const uint8_t* data() const { return mBlob.array(); }
+    size_t size() const { return mBlob.size(); }
+
+  private:
+    void checksum(size_t base)
+    {
+        uint8_t sum = 0;
+        for (size_t i = 0; i < 127; ++i)
+            sum += mBlob[base + i];
+        mBlob.editItemAt(base + 127) = static_cast<uint8_t>(0x100 - sum);
+    }
+
+    Vector<uint8_t> mBlob;
+};
+
+/*
+ * ELD corpus
+ */
+
+// ELD v2 headers: version, reserved, baseline length in dwords, reserved.
+// Baseline: CEA_EDID_ver/MNL, SAD_Count/Conn_Type/S_AI/HDCP,
+// Aud_Synch_Delay, Speaker_Allocation, Port_ID (8), ManufacturerName (2),
+// ProductCode (2), then the monitor name and SADs.
+
+// Stereo TV, named "TV", no lip sync info.
+static const uint8_t kELDStereoTV[] = {
+    0x10, 0x00, 0x06, 0x00,
+    0x22, 0x10, 0x00, 0x01,  0, 0, 0, 0, 0, 0, 0, 0,  0x4C, 0x2D, 0x01, 0x02,
+    'T', 'V',
+    SAD_LPCM(2, 0x07, 0x07),
+};
+
+// 7.1 receiver: LPCM up to 192k, AC-3, DTS and E-AC-3; 5.1 + rear speakers,
+// video 40 mSec behind audio.
+static const uint8_t kELDReceiver[] = {
+    0x10, 0x00, 0x07, 0x00,
+    0x20, 0x40, 0x14, 0x4F,  0, 0, 0, 0, 0, 0, 0, 0,  0x4C, 0x2D, 0x01, 0x02,
+    SAD_LPCM(8, 0x7F, 0x07),
+    SAD_COMP(2, 6, 0x07, 640),
+    SAD_COMP(7, 6, 0x06, 1536),
+    (10 << 3) | 7, 0x07, 0x01,
+};
+
+// Supports no audio at all.
+static const uint8_t kELDNoSADs[] = {
+    0x10, 0x00, 0x04, 0x00,
+    0x20, 0x00, 0x00, 0x00,  0, 0, 0, 0, 0, 0, 0, 0,  0, 0, 0, 0,
+};
+
+// ELD version 1 (pre HDA 1.0a), which we do not understand.
+static const uint8_t kELDVersion1[] = {
+    0x08, 0x00, 0x05, 0x00,
+    0x20, 0x10, 0x00, 0x01,  0, 0, 0, 0, 0, 0, 0, 0,  0, 0, 0, 0,
+    SAD_LPCM(2, 0x07, 0x07),
+};
+
+// Claims 3 SADs but the baseline only has room for one.
+static const uint8_t kELDTruncated[] = {
+    0x10, 0x00, 0x05, 0x00,
+    0x20, 0x30, 0x00, 0x01,  0, 0, 0, 0, 0, 0, 0, 0,  0, 0, 0, 0,
+    SAD_LPCM(2, 0x07, 0x07), 0,
+};
+
+// Monitor name longer than the 16 bytes the spec allows.
+static const uint8_t kELDLongName[] = {
+    0x10, 0x00, 0x0A, 0x00,
+    0x31, 0x00, 0x00, 0x01,  0, 0, 0, 0, 0, 0, 0, 0,  0, 0, 0, 0,
+    'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H', 'I', 'J', 'K', 'L', 'M', 'N', 'O', 'P',
+    'Q', 0, 0, 0,
+};
+
+TEST(EDIDParserTest, ELDStereoTV)
+{
+    Info info;
+    ASSERT_TRUE(parseELD(kELDStereoTV, sizeof(kELDStereoTV), &info));
+
+    EXPECT_TRUE(info.basicAudio);
+    EXPECT_EQ(0x01, info.speakerAlloc);
+    EXPECT_EQ(kUnknown, info.avSyncDelayMs);
+    ASSERT_EQ(1U, info.sadCount);
+    EXPECT_EQ(1, info.sads[0].fmt);
+    EXPECT_EQ(2, info.sads[0].maxCh);
+    EXPECT_EQ(0x07, info.sads[0].srMask);
+    EXPECT_EQ(0x07, info.sads[0].bpsMask);
+}
+
+TEST(EDIDParserTest, ELDReceiver)
+{
+    Info info;
+    ASSERT_TRUE(parseELD(kELDReceiver, sizeof(kELDReceiver), &info));
+
+    EXPECT_TRUE(info.basicAudio);
+    EXPECT_EQ(0x4F, info.speakerAlloc);
+    EXPECT_EQ(40, info.avSyncDelayMs);
+    ASSERT_EQ(4U, info.sadCount);
+
+    EXPECT_EQ(8, info.sads[0].maxCh);
+    EXPECT_EQ(0x7F, info.sads[0].srMask);
+    EXPECT_EQ(0U, info.sads[0].maxBitrate);
+
+    EXPECT_EQ(2, info.sads[1].fmt);
+    EXPECT_EQ(6, info.sads[1].maxCh);
+    EXPECT_EQ(0, info.sads[1].bpsMask);
+    EXPECT_EQ(640000U, info.sads[1].maxBitrate);
+
+    EXPECT_EQ(7, info.sads[2].fmt);
+    EXPECT_EQ(1536000U, info.sads[2].maxBitrate);
+
+    // E-AC-3: byte 3 is format specific, not a bitrate.
+    EXPECT_EQ(10, info.sads[3].fmt);
+    EXPECT_EQ(8, info.sads[3].maxCh);
+    EXPECT_EQ(0U, info.sads[3].maxBitrate);
+}
+
+TEST(EDIDParserTest, ELDWithoutSADsHasNoAudio)
+{
+    Info info;
+    ASSERT_TRUE(parseELD(kELDNoSADs, sizeof(kELDNoSADs), &info));
+    EXPECT_FALSE(info.basicAudio);
+    EXPECT_EQ(0U, info.sadCount);
+}
+
+TEST(EDIDParserTest, MalformedELDsAreRejected)
+{
+    Info info;
+
+    EXPECT_FALSE(parseELD(kELDVersion1, sizeof(kELDVersion1), &info));
+    EXPECT_FALSE(parseELD(kELDTruncated, sizeof(kELDTruncated), &info));
+    EXPECT_FALSE(parseELD(kELDLongName, sizeof(kELDLongName), &info));
+    EXPECT_FALSE(parseELD(NULL, 0, &info));
+
+    // A good ELD cut short.
+    EXPECT_FALSE(parseELD(kELDReceiver, sizeof(kELDReceiver) - 1, &info));
+    EXPECT_FALSE(parseELD(kELDReceiver, 19, &info));
+
+    // Nothing is left over from a failed parse.
+    EXPECT_FALSE(info.basicAudio);
+    EXPECT_EQ(0U, info.sadCount);
+}
+
+/*
+ * EDID corpus
+ */
+
+// A HDMI TV: stereo LPCM, 2.0 speakers, and an HDMI VSDB with progressive
+// latencies of 40 mSec video and 20 mSec audio.
+static EDIDBuilder makeHDMITV()
+{
+    static const uint8_t kBlocks[] = {
+        (1 << 5) | 3, SAD_LPCM(2, 0x07, 0x07),
+        (4 << 5) | 3, 0x01, 0x00, 0x00,
+        (3 << 5) | 10, 0x03, 0x0C, 0x00, 0x10, 0x00, 0x00, 0x00, 0x80, 21, 11,
+    };
+    EDIDBuilder b;
+    b.addCEA(3, 0x40, kBlocks, sizeof(kBlocks));
+    return b;
+}
+
+// A receiver with its SADs split over two audio blocks, and a speaker
+// allocation using the upper (FLH/TC/FCH) bits.
+static EDIDBuilder makeReceiver()
+{
+    static const uint8_t kBlocks[] = {
+        (1 << 5) | 6, SAD_LPCM(8, 0x7F, 0x07), SAD_COMP(2, 6, 0x07, 640),
+        (1 << 5) | 3, SAD_COMP(7, 6, 0x06, 1536),
+        (4 << 5) | 3, 0x4F, 0x05, 0x00,
+    };
+    EDIDBuilder b;
+    b.addCEA(3, 0x70, kBlocks, sizeof(kBlocks));
+    return b;
+}
+
+TEST(EDIDParserTest, EDIDHDMITV)
+{
+    EDIDBuilder edid = makeHDMITV();
+    Info info;
+    ASSERT_TRUE(parseEDID(edid.data(), edid.size(), &info));
+
+    EXPECT_TRUE(info.basicAudio);
+    EXPECT_EQ(0x01, info.speakerAlloc);
+    ASSERT_EQ(1U, info.sadCount);
+    EXPECT_EQ(2, info.sads[0].maxCh);
+    EXPECT_EQ(40, info.videoLatencyMs);
+    EXPECT_EQ(20, info.audioLatencyMs);
+    EXPECT_EQ(20, info.avSyncDelayMs);
+}
+
+TEST(EDIDParserTest, EDIDReceiver)
+{
+    EDIDBuilder edid = makeReceiver();
+    Info info;
+    ASSERT_TRUE(parseEDID(edid.data(), edid.size(), &info));
+
+    EXPECT_TRUE(info.basicAudio);
+    EXPECT_EQ(0x54F, info.speakerAlloc);
+    ASSERT_EQ(3U, info.sadCount);
+    EXPECT_EQ(8, info.sads[0].maxCh);
+    EXPECT_EQ(640000U, info.sads[1].maxBitrate);
+    EXPECT_EQ(7, info.sads[2].fmt);
+    EXPECT_EQ(kUnknown, info.avSyncDelayMs);
+}
+
+TEST(EDIDParserTest, EDIDLatencyEdgeCases)
+{
+    Info info;
+
+    // Video latency of 255: the sink does not output video.
+    EDIDBuilder noVideo = makeHDMITV();
+    noVideo[128 + 4 + 4 + 4 + 9] = 255;
+    ASSERT_TRUE(parseEDID(noVideo.data(), noVideo.size(), &info));
+    EXPECT_EQ(kUnknown, info.videoLatencyMs);
+    EXPECT_EQ(20, info.audioLatencyMs);
+    EXPECT_EQ(kUnknown, info.avSyncDelayMs);
+
+    // Latency_Fields_Present clear: the latencies are not there.
+    EDIDBuilder noLatency = makeHDMITV();
+    noLatency[128 + 4 + 4 + 4 + 8] = 0;
+    ASSERT_TRUE(parseEDID(noLatency.data(), noLatency.size(), &info));
+    EXPECT_EQ(kUnknown, info.videoLatencyMs);
+    EXPECT_EQ(kUnknown, info.avSyncDelayMs);
+
+    // A vendor block with somebody else's OUI is ignored.
+    EDIDBuilder otherOUI = makeHDMITV();
+    otherOUI[128 + 4 + 4 + 4 + 1] = 0xD8;
+    ASSERT_TRUE(parseEDID(otherOUI.data(), otherOUI.size(), &info));
+    EXPECT_EQ(kUnknown, info.videoLatencyMs);
+    EXPECT_TRUE(info.basicAudio);
+}
+
+TEST(EDIDParserTest, EDIDAcrossTwoExtensions)
+{
+    static const uint8_t kFirst[] = { (1 << 5) | 3, SAD_LPCM(2, 0x07, 0x01) };
+    static const uint8_t kSecond[] = { (1 << 5) | 3, SAD_COMP(2, 6, 0x04, 448) };
+    EDIDBuilder edid;
+    edid.addCEA(3, 0x40, kFirst, sizeof(kFirst));
+    edid.addCEA(3, 0x00, kSecond, sizeof(kSecond));
+
+    Info info;
+    ASSERT_TRUE(parseEDID(edid.data(), edid.size(), &info));
+    EXPECT_TRUE(info.basicAudio);
+    ASSERT_EQ(2U, info.sadCount);
+    EXPECT_EQ(1, info.sads[0].fmt);
+    EXPECT_EQ(2, info.sads[1].fmt);
+
+    // With the second extension missing from the blob, only the first counts.
+    ASSERT_TRUE(parseEDID(edid.data(), edid.size() - 128, &info));
+    EXPECT_EQ(1U, info.sadCount);
+}
+
+TEST(EDIDParserTest, EDIDRevision1HasNoDataBlocks)
+{
+    static const uint8_t kBlocks[] = { (1 << 5) | 3, SAD_LPCM(2, 0x07, 0x07) };
+    EDIDBuilder edid;
+    edid.addCEA(1, 0x40, kBlocks, sizeof(kBlocks));
+
+    Info info;
+    ASSERT_TRUE(parseEDID(edid.data(), edid.size(), &info));
+    EXPECT_FALSE(info.basicAudio);
+    EXPECT_EQ(0U, info.sadCount);
+}
+
+// Complete EDIDs in the layout TVs and receivers actually send: a full base
+// block (vendor, DTDs, range limits and name descriptors), and CEA blocks
+// carrying video, extended tag and HDMI Forum blocks the parser has to step
+// over, DTDs after the data block collection and valid checksums.
+
+// A HDMI TV.  CEA block: VDB, stereo LPCM, 2.0 speakers, HDMI VSDB with
+// progressive (60/20 mSec) and interlaced latencies plus HDMI VICs, HF-VSDB,
+// colorimetry and video capability blocks, two DTDs.
+static const uint8_t kEDIDRawTV[] = {
+    // Base block
+    0x00, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x00,
+    0x52, 0xC1, 0x31, 0x0A, 0x01, 0x01, 0x01, 0x01,
+    0x16, 0x17, 0x01, 0x03, 0x80, 0xA0, 0x5A, 0x78,
+    0x0A, 0xEE, 0x91, 0xA3, 0x54, 0x4C, 0x99, 0x26,
+    0x0F, 0x50, 0x54, 0x21, 0x08, 0x00, 0x81, 0xC0,
+    0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+    0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x02, 0x3A,
+    0x80, 0x18, 0x71, 0x38, 0x2D, 0x40, 0x58, 0x2C,
+    0x45, 0x00, 0xC4, 0x8E, 0x21, 0x00, 0x00, 0x1E,
+    0x01, 0x1D, 0x00, 0x72, 0x51, 0xD0, 0x1E, 0x20,
+    0x6E, 0x28, 0x55, 0x00, 0xC4, 0x8E, 0x21, 0x00,
+    0x00, 0x1E, 0x00, 0x00, 0x00, 0xFD, 0x00, 0x17,
+    0x3D, 0x0F, 0x44, 0x0F, 0x00, 0x0A, 0x20, 0x20,
+    0x20, 0x20, 0x20, 0x20, 0x00, 0x00, 0x00, 0xFC,
+    0x00, 0x48, 0x44, 0x4D, 0x49, 0x20, 0x54, 0x56,
+    0x0A, 0x20, 0x20, 0x20, 0x20, 0x20, 0x01, 0x1C,
+    // Extension 1: CEA-861
+    0x02, 0x03, 0x39, 0xF1, 0x4C, 0x90, 0x04, 0x03,
+    0x05, 0x1F, 0x13, 0x14, 0x22, 0x20, 0x01, 0x02,
+    0x11, 0x23, 0x09, 0x07, 0x07, 0x83, 0x01, 0x00,
+    0x00, 0x70, 0x03, 0x0C, 0x00, 0x10, 0x00, 0xB8,
+    0x3C, 0xE0, 0x1F, 0x0B, 0x29, 0x0B, 0x80, 0x40,
+    0x01, 0x02, 0x67, 0xD8, 0x5D, 0xC4, 0x01, 0x78,
+    0x00, 0x00, 0xE3, 0x05, 0x03, 0x01, 0xE2, 0x00,
+    0x0B, 0x01, 0x1D, 0x80, 0x18, 0x71, 0x1C, 0x16,
+    0x20, 0x58, 0x2C, 0x25, 0x00, 0xC4, 0x8E, 0x21,
+    0x00, 0x00, 0x9E, 0x8C, 0x0A, 0xD0, 0x90, 0x20,
+    0x40, 0x31, 0x20, 0x0C, 0x40, 0x55, 0x00, 0xC4,
+    0x8E, 0x21, 0x00, 0x00, 0x18, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x53,
+};
+
+// An AV receiver with four blocks: base, a block map, and two CEA blocks.
+// The first carries 8ch LPCM, AC-3, DTS, E-AC-3, DTS-HD and MLP, 7.1
+// speakers and a VSDB whose audio latency (28 mSec) exceeds its video
+// latency (20 mSec); the second only more video modes.
+static const uint8_t kEDIDRawAVR[] = {
+    // Base block
+    0x00, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x00,
+    0x06, 0xD2, 0x02, 0x01, 0x00, 0x00, 0x00, 0x00,
+    0x28, 0x16, 0x01, 0x03, 0x80, 0xA0, 0x5A, 0x78,
+    0x0A, 0xEE, 0x91, 0xA3, 0x54, 0x4C, 0x99, 0x26,
+    0x0F, 0x50, 0x54, 0x21, 0x08, 0x00, 0x81, 0xC0,
+    0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+    0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x02, 0x3A,
+    0x80, 0x18, 0x71, 0x38, 0x2D, 0x40, 0x58, 0x2C,
+    0x45, 0x00, 0xC4, 0x8E, 0x21, 0x00, 0x00, 0x1E,
+    0x01, 0x1D, 0x00, 0x72, 0x51, 0xD0, 0x1E, 0x20,
+    0x6E, 0x28, 0x55, 0x00, 0xC4, 0x8E, 0x21, 0x00,
+    0x00, 0x1E, 0x00, 0x00, 0x00, 0xFD, 0x00, 0x17,
+    0x3D, 0x0F, 0x44, 0x0F, 0x00, 0x0A, 0x20, 0x20,
+    0x20, 0x20, 0x20, 0x20, 0x00, 0x00, 0x00, 0xFC,
+    0x00, 0x41, 0x56, 0x20, 0x52, 0x45, 0x43, 0x45,
+    0x49, 0x56, 0x45, 0x52, 0x0A, 0x20, 0x03, 0xE0,
+    // Extension 1: Block map
+    0xF0, 0x02, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x0C,
+    // Extension 2: CEA-861
+    0x02, 0x03, 0x33, 0xF0, 0x49, 0x90, 0x04, 0x03,
+    0x05, 0x1F, 0x13, 0x14, 0x22, 0x20, 0x32, 0x0F,
+    0x7F, 0x07, 0x15, 0x07, 0x50, 0x3D, 0x06, 0xC0,
+    0x57, 0x07, 0x01, 0x5F, 0x7E, 0x01, 0x67, 0x7E,
+    0x00, 0x83, 0x4F, 0x00, 0x00, 0x6A, 0x03, 0x0C,
+    0x00, 0x10, 0x00, 0xB8, 0x2D, 0x80, 0x0B, 0x0F,
+    0xE2, 0x00, 0x0B, 0x01, 0x1D, 0x80, 0x18, 0x71,
+    0x1C, 0x16, 0x20, 0x58, 0x2C, 0x25, 0x00, 0xC4,
+    0x8E, 0x21, 0x00, 0x00, 0x9E, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x19,
+    // Extension 3: CEA-861
+    0x02, 0x03, 0x09, 0x00, 0x44, 0x06, 0x07, 0x15,
+    0x16, 0x8C, 0x0A, 0xD0, 0x90, 0x20, 0x40, 0x31,
+    0x20, 0x0C, 0x40, 0x55, 0x00, 0xC4, 0x8E, 0x21,
+    0x00, 0x00, 0x18, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xA3,
+};
+
+// A HDMI monitor with no audio: basic audio clear in the CEA block, no
+// audio data block, and a VSDB without latency fields.
+static const uint8_t kEDIDRawMonitor[] = {
+    // Base block
+    0x00, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x00,
+    0x35, 0xEE, 0x21, 0x5A, 0xB2, 0xA1, 0x00, 0x00,
+    0x0A, 0x18, 0x01, 0x03, 0x80, 0xA0, 0x5A, 0x78,
+    0x2A, 0xEE, 0x91, 0xA3, 0x54, 0x4C, 0x99, 0x26,
+    0x0F, 0x50, 0x54, 0x21, 0x08, 0x00, 0x81, 0xC0,
+    0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+    0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x02, 0x3A,
+    0x80, 0x18, 0x71, 0x38, 0x2D, 0x40, 0x58, 0x2C,
+    0x45, 0x00, 0xC4, 0x8E, 0x21, 0x00, 0x00, 0x1E,
+    0x01, 0x1D, 0x00, 0x72, 0x51, 0xD0, 0x1E, 0x20,
+    0x6E, 0x28, 0x55, 0x00, 0xC4, 0x8E, 0x21, 0x00,
+    0x00, 0x1E, 0x00, 0x00, 0x00, 0xFD, 0x00, 0x17,
+    0x3D, 0x0F, 0x44, 0x0F, 0x00, 0x0A, 0x20, 0x20,
+    0x20, 0x20, 0x20, 0x20, 0x00, 0x00, 0x00, 0xFC,
+    0x00, 0x48, 0x44, 0x4D, 0x49, 0x20, 0x4D, 0x4F,
+    0x4E, 0x49, 0x54, 0x4F, 0x52, 0x0A, 0x01, 0x8A,
+    // Extension 1: CEA-861
+    0x02, 0x03, 0x12, 0x81, 0x45, 0x90, 0x04, 0x03,
+    0x05, 0x01, 0x67, 0x03, 0x0C, 0x00, 0x10, 0x00,
+    0x00, 0x2D, 0x01, 0x1D, 0x00, 0x72, 0x51, 0xD0,
+    0x1E, 0x20, 0x6E, 0x28, 0x55, 0x00, 0xC4, 0x8E,
+    0x21, 0x00, 0x00, 0x1E, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x68,
+};
+
+TEST(EDIDParserTest, RawEDIDHDMITV)
+{
+    Info info;
+    ASSERT_TRUE(parseEDID(kEDIDRawTV, sizeof(kEDIDRawTV), &info));
+
+    EXPECT_TRUE(info.basicAudio);
+    EXPECT_EQ(0x01, info.speakerAlloc);
+    ASSERT_EQ(1U, info.sadCount);
+    EXPECT_EQ(1, info.sads[0].fmt);
+    EXPECT_EQ(2, info.sads[0].maxCh);
+    EXPECT_EQ(0x07, info.sads[0].srMask);
+    EXPECT_EQ(0x07, info.sads[0].bpsMask);
+    EXPECT_EQ(60, info.videoLatencyMs);
+    EXPECT_EQ(20, info.audioLatencyMs);
+    EXPECT_EQ(40, info.avSyncDelayMs);
+}
+
+TEST(EDIDParserTest, RawEDIDReceiver)
+{
+    Info info;
+    ASSERT_TRUE(parseEDID(kEDIDRawAVR, sizeof(kEDIDRawAVR), &info));
+
+    EXPECT_TRUE(info.basicAudio);
+    EXPECT_EQ(0x4F, info.speakerAlloc);
+    ASSERT_EQ(6U, info.sadCount);
+    static const uint8_t kFmts[] = { 1, 2, 7, 10, 11, 12 };
+    for (size_t i = 0; i < NELEM(kFmts); ++i)
+        EXPECT_EQ(kFmts[i], info.sads[i].fmt);
+    EXPECT_EQ(8, info.sads[0].maxCh);
+    EXPECT_EQ(0x7F, info.sads[0].srMask);
+    EXPECT_EQ(640000U, info.sads[1].maxBitrate);
+    EXPECT_EQ(6, info.sads[2].maxCh);
+    EXPECT_EQ(1536000U, info.sads[2].maxBitrate);
+    EXPECT_EQ(0U, info.sads[3].maxBitrate);
+    EXPECT_EQ(20, info.videoLatencyMs);
+    EXPECT_EQ(28, info.audioLatencyMs);
+    EXPECT_EQ(-8, info.avSyncDelayMs);
+
+    // Without the final CEA block nothing audio related is lost.
+    ASSERT_TRUE(parseEDID(kEDIDRawAVR, sizeof(kEDIDRawAVR) - 128, &info));
+    EXPECT_EQ(6U, info.sadCount);
+}
+
+TEST(EDIDParserTest, RawEDIDMonitorHasNoAudio)
+{
+    Info info;
+    ASSERT_TRUE(parseEDID(kEDIDRawMonitor, sizeof(kEDIDRawMonitor), &info));
+
+    EXPECT_FALSE(info.basicAudio);
+    EXPECT_EQ(0U, info.sadCount);
+    EXPECT_EQ(kUnknown, info.videoLatencyMs);
+    EXPECT_EQ(kUnknown, info.avSyncDelayMs);
+}
+
+TEST(EDIDParserTest, RawEDIDChecksums)
+{
+    const struct {
+        const uint8_t* data;
+        size_t len;
+    } kRaw[] = {
+        { kEDIDRawTV, sizeof(kEDIDRawTV) },
+        { kEDIDRawAVR, sizeof(kEDIDRawAVR) },
+        { kEDIDRawMonitor, sizeof(kEDIDRawMonitor) },
+    };
+
+    for (size_t i = 0; i < NELEM(kRaw); ++i) {
+        ASSERT_EQ(0U, kRaw[i].len % 128);
+        EXPECT_EQ(kRaw[i].len / 128, 1U + kRaw[i].data[126]);
+        for (size_t blk = 0; blk < kRaw[i].len; blk += 128) {
+            uint8_t sum = 0;
+            for (size_t j = 0; j < 128; ++j)
+                sum += kRaw[i].data[blk + j];
+            EXPECT_EQ(0, sum) << "blob " << i << " block " << (blk / 128);
+        }
+    }
+}
+
+TEST(EDIDParserTest, MalformedEDIDsAreRejected)
+{
+    Info info;
+
+    // DVI monitor: no extension at all.
+    EDIDBuilder dvi;
+    EXPECT_FALSE(parseEDID(dvi.data(), dvi.size(), &info));
+
+    // Bad header.
+    EDIDBuilder badHeader = makeHDMITV();
+    badHeader[0] = 0xFF;
+    EXPECT_FALSE(parseEDID(badHeader.data(), badHeader.size(), &info));
+
+    // A data block running past the DTD offset.
+    EDIDBuilder overrun = makeHDMITV();
+    overrun[128 + 4] = (1 << 5) | 30;
+    EXPECT_FALSE(parseEDID(overrun.data(), overrun.size(), &info));
+
+    // A DTD offset past the end of the block.
+    EDIDBuilder badOffset = makeHDMITV();
+    badOffset[128 + 2] = 200;
+    EXPECT_FALSE(parseEDID(badOffset.data(), badOffset.size(), &info));
+
+    // An extension which is not there.
+    EDIDBuilder tv = makeHDMITV();
+    EXPECT_FALSE(parseEDID(tv.data(), 128, &info));
+    EXPECT_FALSE(parseEDID(tv.data(), 127, &info));
+    EXPECT_FALSE(parseEDID(NULL, 0, &info));
+}
+
+// Parses the whole corpus over and over.  Caps loads parse one blob per
+// hotplug, so anything in the uSec range is plenty.  Report only; timing on
+// a shared build host is too noisy to fail on.
+TEST(EDIDParserTest, ThroughputBenchmark)
+{
+    static const int kIterations = 20000;
+    struct Blob {
+        const uint8_t* data;
+        size_t len;
+        bool isELD;
+    };
+
+    EDIDBuilder tv = makeHDMITV();
+    EDIDBuilder receiver = makeReceiver();
+    const Blob kCorpus[] = {
+        { kELDStereoTV, sizeof(kELDStereoTV), true },
+        { kELDReceiver, sizeof(kELDReceiver), true },
+        { kELDNoSADs, sizeof(kELDNoSADs), true },
+        { kELDTruncated, sizeof(kELDTruncated), true },
+        { tv.data(), tv.size(), false },
+        { receiver.data(), receiver.size(), false },
+        { kEDIDRawTV, sizeof(kEDIDRawTV), false },
+        { kEDIDRawAVR, sizeof(kEDIDRawAVR), false },
+        { kEDIDRawMonitor, sizeof(kEDIDRawMonitor), false },
+    };
+
+    Info info;
+    size_t bytes = 0;
+    uint32_t sads = 0;
+    nsecs_t start = systemTime();
+    for (int i = 0; i < kIterations; ++i) {
+        for (int j = 0; j < NELEM(kCorpus); ++j) {
+            const Blob& b = kCorpus[j];
+            if (b.isELD)
+                parseELD(b.data, b.len, &info);
+            else
+                parseEDID(b.data, b.len, &info);
+            sads += info.sadCount;
+            bytes += b.len;
+        }
+    }
+    nsecs_t elapsed = systemTime() - start;
+    nsecs_t perParse = elapsed / (kIterations * NELEM(kCorpus));
+
+    printf("[   BENCH  ] parse: %lld nSec per blob, %.1f MB/Sec (%u SADs)\n",
+           static_cast<long long>(perParse),
+           (static_cast<double>(bytes) * 1000.0) / static_cast<double>(elapsed),
+           sads);
+}
+
+}  // namespace android
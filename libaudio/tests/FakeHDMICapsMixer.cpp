@@ -0,0 +1,165 @@
+/*
+**
+** Copyright 2014, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+#include <utils/Mutex.h>
+
+#include "FakeHDMICapsMixer.h"
+
+namespace android {
+
+static Mutex gSinkLock;
+static FakeHDMISink gSink;
+static bool gSinkSet = false;
+static uint32_t gOpenCount = 0;
+static uint32_t gCtrlAccessCount = 0;
+
+FakeHDMISink::FakeHDMISink()
+    : hasQueryCtrls(true)
+    , basicAudio(1)
+    , speakerAlloc(0)
+    , modeCountOverride(-1)
+    , failAfter(-1)
+    , ctrlLatency(0)
+{
+}
+
+void FakeHDMICapsMixer::setSink(const FakeHDMISink* sink) {
+    Mutex::Autolock _l(gSinkLock);
+    gSinkSet = (NULL != sink);
+    if (gSinkSet)
+        gSink = *sink;
+}
+
+uint32_t FakeHDMICapsMixer::openCount() {
+    Mutex::Autolock _l(gSinkLock);
+    return gOpenCount;
+}
+
+uint32_t FakeHDMICapsMixer::ctrlAccessCount() {
+    Mutex::Autolock _l(gSinkLock);
+    return gCtrlAccessCount;
+}
+
+HDMICapsMixer* HDMICapsMixer::open(int /*ALSADeviceID*/) {
+    Mutex::Autolock _l(gSinkLock);
+
+    if (!gSinkSet)
+        return NULL;
+
+    gOpenCount++;
+    return new FakeHDMICapsMixer(gSink);
+}
+
+FakeHDMICapsMixer::FakeHDMICapsMixer(const FakeHDMISink& sink)
+    : mSink(sink)
+    , mSelected(-1)
+    , mAccesses(0)
+{
+}
+
+bool FakeHDMICapsMixer::access() {
+    {
+        Mutex::Autolock _l(gSinkLock);
+        gCtrlAccessCount++;
+    }
+
+    if (mSink.ctrlLatency > 0) {
+        struct timespec ts;
+        ts.tv_sec = mSink.ctrlLatency / 1000000000LL;
+        ts.tv_nsec = mSink.ctrlLatency % 1000000000LL;
+        nanosleep(&ts, NULL);
+    }
+
+    return (mSink.failAfter < 0) || (mAccesses++ < mSink.failAfter);
+}
+
+bool FakeHDMICapsMixer::hasQueryCtrls() {
+    return mSink.hasQueryCtrls;
+}
+
+int FakeHDMICapsMixer::getValue(Ctrl ctrl) {
+    if (!mSink.hasQueryCtrls)
+        return -ENODEV;
+
+    if (!access())
+        return -EIO;
+
+    const FakeHDMISink::Mode* m = NULL;
+    if ((mSelected >= 0) && (static_cast<size_t>(mSelected) < mSink.modes.size()))
+        m = &mSink.modes[mSelected];
+
+    switch (ctrl) {
+        case kCtrlBasicAudio:   return mSink.basicAudio;
+        case kCtrlSpeakerAlloc: return mSink.speakerAlloc;
+        case kCtrlModeCount:
+            return (mSink.modeCountOverride >= 0) ? mSink.modeCountOverride
+                                                  : static_cast<int>(mSink.modes.size());
+        case kCtrlModeSelect:   return mSelected;
+        default: break;
+    }
+
+    // The driver answers queries for a mode it does not have with zeros.
+    if (NULL == m)
+        return 0;
+
+    switch (ctrl) {
+        case kCtrlFormat:         return m->fmt;
+        case kCtrlMaxChCount:     return m->maxCh;
+        case kCtrlSampleRates:    return m->srMask;
+        case kCtrlBPS:            return m->bpsMask;
+        case kCtrlMaxCompBitrate: return m->compBitrate;
+        default:                  return -EINVAL;
+    }
+}
+
+int FakeHDMICapsMixer::setValue(Ctrl ctrl, int value) {
+    if (!mSink.hasQueryCtrls)
+        return -ENODEV;
+
+    if (!access())
+        return -EIO;
+
+    if (ctrl != kCtrlModeSelect)
+        return -EPERM;
+
+    mSelected = value;
+    return 0;
+}
+
+ssize_t FakeHDMICapsMixer::readBlob(const Vector<uint8_t>& blob,
+                                    uint8_t* buf, size_t len) {
+    if (blob.isEmpty())
+        return -ENODEV;
+
+    size_t cnt = (blob.size() < len) ? blob.size() : len;
+    memcpy(buf, blob.array(), cnt);
+    return cnt;
+}
+
+ssize_t FakeHDMICapsMixer::readELD(uint8_t* buf, size_t len) {
+    return readBlob(mSink.eld, buf, len);
+}
+
+ssize_t FakeHDMICapsMixer::readEDID(uint8_t* buf, size_t len) {
+    return readBlob(mSink.edid, buf, len);
+}
+
+}  // namespace android
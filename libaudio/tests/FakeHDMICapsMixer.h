@@ -0,0 +1,85 @@
+/*
+**
+** Copyright 2014, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#ifndef ANDROID_FAKE_HDMI_CAPS_MIXER_H
+#define ANDROID_FAKE_HDMI_CAPS_MIXER_H
+
+#include <utils/Timers.h>
+#include <utils/Vector.h>
+
+#include "alsa_utils.h"
+
+namespace android {
+
+// What a sink looks like through the HDMI audio driver's controls.  Mode
+// fields are the raw values the driver would report, so they may be garbage.
+struct FakeHDMISink {
+    struct Mode {
+        int fmt;
+        int maxCh;
+        int srMask;
+        int bpsMask;
+        int compBitrate;
+    };
+
+    FakeHDMISink();
+
+    bool            hasQueryCtrls;
+    int             basicAudio;
+    int             speakerAlloc;
+    Vector<Mode>    modes;
+    // Reported as the mode count instead of modes.size() if >= 0.
+    int             modeCountOverride;
+    // Empty if the driver (or connector) does not expose the blob.
+    Vector<uint8_t> eld;
+    Vector<uint8_t> edid;
+    // Every control access after this many fails with -EIO (-1: never), as
+    // if the cable had been pulled mid enumeration.
+    int             failAfter;
+    // Time every control access takes; the real driver goes out over HDMI
+    // for each of them.
+    nsecs_t         ctrlLatency;
+};
+
+// HDMICapsMixer backend for host tests.  HDMICapsMixer::open (defined along
+// with this class) hands out a snapshot of whatever sink was last set with
+// setSink, or fails if there is none.
+class FakeHDMICapsMixer : public HDMICapsMixer {
+  public:
+    static void setSink(const FakeHDMISink* sink);
+    static uint32_t openCount();
+    static uint32_t ctrlAccessCount();
+
+    explicit FakeHDMICapsMixer(const FakeHDMISink& sink);
+
+    virtual bool hasQueryCtrls();
+    virtual int getValue(Ctrl ctrl);
+    virtual int setValue(Ctrl ctrl, int value);
+    virtual ssize_t readELD(uint8_t* buf, size_t len);
+    virtual ssize_t readEDID(uint8_t* buf, size_t len);
+
+  private:
+    bool access();
+    static ssize_t readBlob(const Vector<uint8_t>& blob, uint8_t* buf, size_t len);
+
+    FakeHDMISink mSink;
+    int          mSelected;
+    int          mAccesses;
+};
+
+}  // namespace android
+#endif  // ANDROID_FAKE_HDMI_CAPS_MIXER_H
@@ -0,0 +1,147 @@
+/*
+**
+** Copyright 2014, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#include <string.h>
+
+#include <gtest/gtest.h>
+
+#include "HALStateWriter.h"
+
+namespace android {
+
+// Undo the base64 armour on the binary format.
+static Vector<uint8_t> decodeBinary(const String8& b64)
+{
+    static const char kB64[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    Vector<uint8_t> out;
+    uint32_t acc = 0;
+    int bits = 0;
+
+    for (const char* p = b64.string(); *p && (*p != '='); ++p) {
+        acc = (acc << 6) | static_cast<uint32_t>(strchr(kB64, *p) - kB64);
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            out.add(static_cast<uint8_t>(acc >> bits));
+        }
+    }
+
+    return out;
+}
+
+// Open levels containers, alternating objects and arrays, each holding its
+// own depth, then close them all again.
+static void nest(HALStateWriter& w, int levels)
+{
+    for (int i = 0; i < levels; ++i) {
+        bool inArray = (i > 0) && ((i - 1) & 1);
+        if (i & 1)
+            w.beginArray(inArray ? NULL : "a");
+        else
+            w.beginObject(inArray ? NULL : "o");
+        w.addInt((i & 1) ? NULL : "depth", i);
+    }
+    for (int i = levels - 1; i >= 0; --i) {
+        if (i & 1)
+            w.endArray();
+        else
+            w.endObject();
+    }
+}
+
+TEST(HALStateWriterTest, JSONValues)
+{
+    HALStateWriter w(HALStateWriter::kFormatJSON);
+    w.beginObject(NULL);
+    w.addBool("b", true);
+    w.addInt("i", -3);
+    w.addFloat("f", 1.5f);
+    w.addString("s", "a\"b\n");
+    w.beginArray("l");
+    w.addInt(NULL, 1);
+    w.addInt(NULL, 2);
+    w.endArray();
+    w.endObject();
+
+    EXPECT_STREQ("{\"b\":true,\"i\":-3,\"f\":1.500,\"s\":\"a\\\"b\\n\",\"l\":[1,2]}",
+                 w.result().string());
+}
+
+TEST(HALStateWriterTest, JSONTooDeepIsDroppedWhole)
+{
+    HALStateWriter w(HALStateWriter::kFormatJSON);
+    w.beginObject(NULL);
+    nest(w, 40);
+    w.addInt("after", 1);
+    w.endObject();
+
+    String8 json = w.result();
+    int depth = 0, maxDepth = 0;
+    for (const char* p = json.string(); *p; ++p) {
+        if ((*p == '{') || (*p == '[')) {
+            maxDepth = (++depth > maxDepth) ? depth : maxDepth;
+        } else if ((*p == '}') || (*p == ']')) {
+            ASSERT_LE(0, --depth);
+        }
+    }
+
+    // Balanced, cut off at the limit (the root plus 14 levels), and the root
+    // carries on afterwards.
+    EXPECT_EQ(0, depth);
+    EXPECT_EQ(15, maxDepth);
+    EXPECT_TRUE(strstr(json.string(), "\"depth\":12") != NULL);
+    EXPECT_TRUE(strstr(json.string(), "\"depth\":14") == NULL);
+    EXPECT_TRUE(strstr(json.string(), "},\"after\":1}") != NULL);
+}
+
+TEST(HALStateWriterTest, BinaryTooDeepIsDroppedWhole)
+{
+    HALStateWriter w(HALStateWriter::kFormatBinary);
+    w.beginObject(NULL);
+    nest(w, 40);
+    w.addInt("after", 1);
+    w.endObject();
+
+    Vector<uint8_t> bin = decodeBinary(w.result());
+    ASSERT_LE(5U, bin.size());
+    EXPECT_EQ(0, memcmp(bin.array(), "ATVS", 4));
+    EXPECT_EQ(static_cast<int>(HALStateWriter::kVersion), bin[4]);
+
+    // The root object comes first and its end is the very last byte; the
+    // "after" member (tag, key, value) sits right before it.
+    EXPECT_EQ(1, bin[5]);
+    EXPECT_EQ(0, bin[bin.size() - 1]);
+    static const uint8_t kAfter[] = { 4, 5, 'a', 'f', 't', 'e', 'r', 2, 0 };
+    ASSERT_LE(sizeof(kAfter), bin.size());
+    EXPECT_EQ(0, memcmp(bin.array() + bin.size() - sizeof(kAfter), kAfter,
+                        sizeof(kAfter)));
+}
+
+TEST(HALStateWriterTest, UnbalancedEndsAreIgnored)
+{
+    HALStateWriter w(HALStateWriter::kFormatJSON);
+    w.endObject();
+    w.beginObject(NULL);
+    w.addInt("x", 1);
+    w.endObject();
+    w.endArray();
+
+    EXPECT_STREQ("{\"x\":1}", w.result().string());
+}
+
+}  // namespace android
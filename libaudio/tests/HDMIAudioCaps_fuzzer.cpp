@@ -0,0 +1,156 @@
+/*
+**
+** Copyright 2014, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+// libFuzzer target for HDMI caps negotiation.  Each input describes a sink
+// as the driver would report it (mode table, ELD and EDID) through the fake
+// mixer backend; the caps are loaded from it and every query AudioFlinger
+// can make is checked against the invariants the rest of the HAL relies on.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <utils/misc.h>
+
+#include "FakeHDMICapsMixer.h"
+#include "HALStateWriter.h"
+
+using namespace android;
+
+// Input layout:
+//   flags u8 | speaker alloc u16 | mode count u8 | eld len u8 | edid len u16
+//   | mode (5 x i32)* | eld | edid
+// Short inputs are padded with zeros.
+class InputReader {
+  public:
+    InputReader(const uint8_t* data, size_t size)
+        : mData(data), mSize(size), mPos(0) {}
+
+    uint32_t get(size_t bytes) {
+        uint32_t val = 0;
+        for (size_t i = 0; i < bytes; ++i)
+            val |= static_cast<uint32_t>(getByte()) << (i * 8);
+        return val;
+    }
+
+    void getBlob(Vector<uint8_t>* blob, size_t len) {
+        blob->clear();
+        for (size_t i = 0; (i < len) && (mPos < mSize); ++i)
+            blob->add(getByte());
+    }
+
+  private:
+    uint8_t getByte() { return (mPos < mSize) ? mData[mPos++] : 0; }
+
+    const uint8_t* mData;
+    size_t         mSize;
+    size_t         mPos;
+};
+
+static void check(bool cond, const char* what) {
+    if (!cond) {
+        fprintf(stderr, "HDMIAudioCaps invariant violated: %s\n", what);
+        abort();
+    }
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    static const uint32_t kRates[] = {
+        8000, 32000, 44100, 48000, 88200, 96000, 176400, 192000 };
+    static const audio_format_t kFormats[] = {
+        AUDIO_FORMAT_PCM_16_BIT, AUDIO_FORMAT_PCM_32_BIT,
+        AUDIO_FORMAT_AC3, AUDIO_FORMAT_E_AC3, AUDIO_FORMAT_MP3 };
+
+    // One instance for the whole run, so the capability cache and the
+    // verification thread get exercised across inputs as well.
+    static HDMIAudioCaps* caps = new HDMIAudioCaps();
+
+    InputReader in(data, size);
+    FakeHDMISink sink;
+    uint32_t flags = in.get(1);
+
+    sink.hasQueryCtrls = !(flags & 0x01);
+    sink.basicAudio = (flags & 0x02) ? 0 : 1;
+    if (flags & 0x04)
+        sink.failAfter = flags >> 3;
+    sink.speakerAlloc = in.get(2);
+
+    size_t modeCnt = in.get(1);
+    size_t eldLen = in.get(1);
+    size_t edidLen = in.get(2);
+    if (flags & 0x80)
+        sink.modeCountOverride = modeCnt * 1000;
+
+    for (size_t i = 0; i < modeCnt; ++i) {
+        FakeHDMISink::Mode m;
+        // Keep values non-negative; negative values are error codes, which
+        // the failAfter flag already covers.
+        m.fmt = in.get(4) & 0x7FFFFFFF;
+        m.maxCh = in.get(4) & 0x7FFFFFFF;
+        m.srMask = in.get(4) & 0x7FFFFFFF;
+        m.bpsMask = in.get(4) & 0x7FFFFFFF;
+        m.compBitrate = in.get(4) & 0x7FFFFFFF;
+        sink.modes.add(m);
+    }
+    in.getBlob(&sink.eld, eldLen);
+    in.getBlob(&sink.edid, edidLen);
+
+    FakeHDMICapsMixer::setSink(&sink);
+    caps->loadCapsAsync(0);
+    check(caps->waitForLoad(ms2ns(5000)), "load did not complete");
+
+    // Every mode which made it through has to be one the rest of the HAL
+    // can use as is.
+    bool basic = caps->basicAudioSupport();
+    for (size_t i = 0; i < caps->modeCnt(); ++i) {
+        const HDMIAudioCaps::Mode& m = caps->getMode(i);
+        check((m.max_ch >= 1) && (m.max_ch <= 8), "mode channel count");
+        check(m.sr_bitmask != 0, "mode without sample rates");
+        check(HDMIAudioCaps::fmtToString(m.fmt) != NULL, "mode format name");
+    }
+
+    for (int f = 0; f < NELEM(kFormats); ++f) {
+        for (int r = 0; r < NELEM(kRates); ++r) {
+            for (uint32_t ch = 0; ch <= 16; ++ch) {
+                bool ok = caps->supportsFormat(kFormats[f], kRates[r], ch);
+                check(!ok || basic, "format supported without basic audio");
+                check(!ok || ((ch >= 1) && (ch <= 8)), "bogus channel count");
+                check(!ok || (kRates[r] >= 32000), "bogus sample rate");
+                check(!ok || (kFormats[f] == AUDIO_FORMAT_PCM_16_BIT) ||
+                      (kFormats[f] == AUDIO_FORMAT_AC3) ||
+                      (kFormats[f] == AUDIO_FORMAT_E_AC3), "bogus format");
+            }
+        }
+    }
+
+    // Basic audio always means stereo 16 bit PCM at 48k.
+    check(basic == caps->supportsFormat(AUDIO_FORMAT_PCM_16_BIT, 48000, 2),
+          "basic audio without stereo PCM");
+
+    String8 str;
+    caps->getFmtsForAF(str);
+    check(basic != str.isEmpty(), "format list disagrees with basic audio");
+    caps->getRatesForAF(str);
+    caps->getChannelMasksForAF(str, true);
+    caps->getChannelMasksForAF(str, false);
+    caps->dump(str);
+
+    HALStateWriter w(HALStateWriter::kFormatJSON);
+    caps->exportState(w);
+    w.result();
+
+    return 0;
+}
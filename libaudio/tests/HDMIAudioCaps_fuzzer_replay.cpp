@@ -0,0 +1,115 @@
+/*
+**
+** Copyright 2014, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+// Runs the HDMI caps fuzz target over a fixed, seeded set of inputs so that
+// it is built and exercised on every tree, with or without libFuzzer.  To
+// fuzz for real, link HDMIAudioCaps_fuzzer.cpp on its own with libFuzzer
+// (-fsanitize=fuzzer) instead of this file.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <gtest/gtest.h>
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size);
+
+namespace android {
+
+static const int      kInputs = 2000;
+static const unsigned kSeed = 0x48444D49;   // "HDMI"
+
+// Header offsets, as laid out in HDMIAudioCaps_fuzzer.cpp.
+static const size_t kHdrFlags = 0;
+static const size_t kHdrModeCnt = 3;
+static const size_t kHdrELDLen = 4;
+static const size_t kHdrEDIDLen = 5;
+static const size_t kHdrSize = 7;
+static const size_t kModeSize = 20;
+
+// Fully random bytes rarely get past the header checks in the parsers, so
+// most inputs are shaped: a sane mode count, and an ELD or EDID which starts
+// the way a real one does with the rest left random.
+static size_t makeInput(unsigned* seed, uint8_t* buf, size_t size)
+{
+    size_t len = rand_r(seed) % size;
+    for (size_t i = 0; i < len; ++i)
+        buf[i] = rand_r(seed);
+
+    int shape = rand_r(seed) % 4;
+    if (!shape || (len < kHdrSize))
+        return len;
+
+    // Huge mode counts only slow the run down without finding anything new.
+    buf[kHdrFlags] &= 0x7F;
+    size_t modeCnt = rand_r(seed) % 12;
+    buf[kHdrModeCnt] = modeCnt;
+    buf[kHdrELDLen] = 0;
+    buf[kHdrEDIDLen] = 0;
+    buf[kHdrEDIDLen + 1] = 0;
+
+    size_t blob = kHdrSize + (modeCnt * kModeSize);
+    if (blob >= len)
+        return len;
+
+    size_t blobLen = len - blob;
+    if (shape == 1) {
+        // ELD v2 with a small MNL and SAD count.
+        blobLen = (blobLen < 255) ? blobLen : 255;
+        buf[kHdrELDLen] = blobLen;
+        buf[blob] = 0x10;
+        if (blobLen > 4)
+            buf[blob + 4] &= 0x0F;
+        if (blobLen > 5)
+            buf[blob + 5] &= 0x3F;
+    } else {
+        // EDID header, followed by one to three extensions of which the
+        // first is CEA-861.
+        static const uint8_t kEDIDHeader[8] =
+            { 0x00, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x00 };
+        buf[kHdrEDIDLen] = blobLen & 0xFF;
+        buf[kHdrEDIDLen + 1] = blobLen >> 8;
+        memcpy(buf + blob, kEDIDHeader,
+               (blobLen < sizeof(kEDIDHeader)) ? blobLen : sizeof(kEDIDHeader));
+        if (blobLen > 126)
+            buf[blob + 126] = 1 + (rand_r(seed) % 3);
+        if (blobLen > 129) {
+            buf[blob + 128] = 0x02;
+            buf[blob + 129] = 0x03;
+        }
+    }
+
+    return len;
+}
+
+TEST(HDMIAudioCapsFuzzTest, SeededInputsKeepTheInvariants)
+{
+    static uint8_t buf[1024];
+    unsigned seed = kSeed;
+
+    // The target aborts with a description of the broken invariant, which
+    // fails the run.
+    for (int i = 0; i < kInputs; ++i) {
+        size_t len = makeInput(&seed, buf, sizeof(buf));
+        EXPECT_EQ(0, LLVMFuzzerTestOneInput(buf, len));
+    }
+
+    // The empty input is the all zeros sink.
+    EXPECT_EQ(0, LLVMFuzzerTestOneInput(NULL, 0));
+}
+
+}  // namespace android
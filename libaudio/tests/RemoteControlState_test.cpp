@@ -0,0 +1,249 @@
+/*
+**
+** Copyright 2014, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include "RemoteControlState.h"
+
+namespace android {
+
+// A local stand-in for the RemoteControl service.  It can be stopped
+// (killing every connection to it, as the binder driver would) and started
+// again, with or without an active remote.
+class StandInRemoteControlService : public RemoteControlState::Connector {
+  public:
+    StandInRemoteControlService()
+        : mRunning(true), mActiveRemote(false), mMicEnabled(false)
+        , mConnects(0), mQueries(0) {}
+
+    virtual sp<RemoteControlState::Service> connect(RemoteControlState* owner)
+    {
+        Mutex::Autolock _l(mLock);
+        if (!mRunning)
+            return NULL;
+        mConnects++;
+        mConn = new Connection(*this, owner);
+        return mConn;
+    }
+
+    void start(bool activeRemote)
+    {
+        Mutex::Autolock _l(mLock);
+        mRunning = true;
+        mActiveRemote = activeRemote;
+    }
+
+    // Goes away, and tells whoever was connected.
+    void stop()
+    {
+        sp<Connection> conn;
+        {
+            Mutex::Autolock _l(mLock);
+            mRunning = false;
+            mActiveRemote = false;
+            conn = mConn;
+            mConn.clear();
+        }
+        if (conn != NULL)
+            conn->die();
+    }
+
+    void setActiveRemote(bool active)
+    {
+        Mutex::Autolock _l(mLock);
+        mActiveRemote = active;
+    }
+
+    bool micEnabled()      { Mutex::Autolock _l(mLock); return mMicEnabled; }
+    uint32_t connects()    { Mutex::Autolock _l(mLock); return mConnects; }
+    uint32_t queries()     { Mutex::Autolock _l(mLock); return mQueries; }
+
+  private:
+    class Connection : public RemoteControlState::Service {
+      public:
+        Connection(StandInRemoteControlService& service, RemoteControlState* owner)
+            : mService(service), mOwner(owner) {}
+
+        virtual bool hasActiveRemote()
+        {
+            Mutex::Autolock _l(mService.mLock);
+            mService.mQueries++;
+            return mService.mActiveRemote;
+        }
+
+        virtual void setMicEnabled(bool enabled)
+        {
+            Mutex::Autolock _l(mService.mLock);
+            mService.mMicEnabled = enabled;
+        }
+
+        void die()
+        {
+            sp<RemoteControlState> owner = mOwner.promote();
+            if (owner != NULL)
+                owner->onServiceDied(this);
+        }
+
+      private:
+        StandInRemoteControlService& mService;
+        const wp<RemoteControlState> mOwner;
+    };
+
+    Mutex mLock;
+    bool mRunning;
+    bool mActiveRemote;
+    bool mMicEnabled;
+    uint32_t mConnects;
+    uint32_t mQueries;
+    sp<Connection> mConn;
+};
+
+// Polls for the state to report an active remote.
+static bool waitForActiveRemote(const sp<RemoteControlState>& state, nsecs_t timeout)
+{
+    nsecs_t deadline = systemTime() + timeout;
+    while (!state->hasActiveRemote()) {
+        if (systemTime() >= deadline)
+            return false;
+        usleep(10000);
+    }
+    return true;
+}
+
+TEST(RemoteControlStateTest, NoServiceMeansNoRemote)
+{
+    StandInRemoteControlService service;
+    service.stop();
+    sp<RemoteControlState> state = new RemoteControlState(&service);
+
+    state->onConnectionChanged();
+    state->setMicEnabled(true);
+    EXPECT_FALSE(state->hasActiveRemote());
+    EXPECT_EQ(0u, service.connects());
+}
+
+TEST(RemoteControlStateTest, RefreshesOnlyOnConnectionChange)
+{
+    StandInRemoteControlService service;
+    service.start(true);
+    sp<RemoteControlState> state = new RemoteControlState(&service);
+
+    EXPECT_FALSE(state->hasActiveRemote());
+    state->onConnectionChanged();
+    EXPECT_TRUE(state->hasActiveRemote());
+
+    // Reads come from the cached copy.
+    uint32_t queries = service.queries();
+    for (int i = 0; i < 100; ++i)
+        EXPECT_TRUE(state->hasActiveRemote());
+    EXPECT_EQ(queries, service.queries());
+
+    service.setActiveRemote(false);
+    state->onConnectionChanged();
+    EXPECT_FALSE(state->hasActiveRemote());
+    EXPECT_EQ(1u, service.connects());
+}
+
+TEST(RemoteControlStateTest, MicControlReachesService)
+{
+    StandInRemoteControlService service;
+    sp<RemoteControlState> state = new RemoteControlState(&service);
+
+    state->setMicEnabled(true);
+    EXPECT_TRUE(service.micEnabled());
+    state->setMicEnabled(false);
+    EXPECT_FALSE(service.micEnabled());
+}
+
+TEST(RemoteControlStateTest, MicControlRefreshesTheState)
+{
+    StandInRemoteControlService service;
+    sp<RemoteControlState> state = new RemoteControlState(&service);
+
+    // A remote which connected since the last connection change is picked
+    // up when voice capture starts...
+    service.setActiveRemote(true);
+    state->setMicEnabled(true);
+    EXPECT_TRUE(state->hasActiveRemote());
+
+    // ...and one which went away when it stops.
+    service.setActiveRemote(false);
+    state->setMicEnabled(false);
+    EXPECT_FALSE(state->hasActiveRemote());
+    EXPECT_EQ(1u, service.connects());
+}
+
+TEST(RemoteControlStateTest, RestartedServiceIsPickedUpWithoutConnectionChange)
+{
+    StandInRemoteControlService service;
+    service.start(true);
+    sp<RemoteControlState> state = new RemoteControlState(&service);
+
+    state->onConnectionChanged();
+    ASSERT_TRUE(state->hasActiveRemote());
+
+    service.stop();
+    EXPECT_FALSE(state->hasActiveRemote());
+
+    service.start(true);
+    EXPECT_TRUE(waitForActiveRemote(state, ms2ns(3000)));
+    EXPECT_EQ(2u, service.connects());
+
+    // And the new connection is watched in turn.
+    service.stop();
+    EXPECT_FALSE(state->hasActiveRemote());
+    service.start(true);
+    EXPECT_TRUE(waitForActiveRemote(state, ms2ns(3000)));
+    EXPECT_EQ(3u, service.connects());
+}
+
+TEST(RemoteControlStateTest, ServiceWhichStaysDownIsRetried)
+{
+    StandInRemoteControlService service;
+    service.start(true);
+    sp<RemoteControlState> state = new RemoteControlState(&service);
+
+    state->onConnectionChanged();
+    service.stop();
+
+    // Long enough for several failed attempts.
+    usleep(1000000);
+    EXPECT_FALSE(state->hasActiveRemote());
+    EXPECT_EQ(1u, service.connects());
+
+    service.start(true);
+    EXPECT_TRUE(waitForActiveRemote(state, ms2ns(5000)));
+}
+
+TEST(RemoteControlStateTest, DestroyedWhileReconnecting)
+{
+    StandInRemoteControlService service;
+    {
+        sp<RemoteControlState> state = new RemoteControlState(&service);
+        state->onConnectionChanged();
+        service.stop();
+    }
+
+    // Nothing is left to connect.
+    service.start(true);
+    usleep(500000);
+    EXPECT_EQ(1u, service.connects());
+}
+
+}  // namespace android
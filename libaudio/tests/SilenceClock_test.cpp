@@ -0,0 +1,195 @@
+/*
+**
+** Copyright 2014, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#include <gtest/gtest.h>
+
+#include "SilenceClock.h"
+
+namespace android {
+
+static const nsecs_t kSecond = 1000000000LL;
+static const nsecs_t kStart = 1000 * kSecond;
+
+// A reader pulling silence the way AudioStreamIn does: advance the clock,
+// sleep until the deadline, return to the client, come back.  Time is
+// simulated, so minutes of reads run in milliseconds and every run is the
+// same.  Wakeups are late by a pseudo random amount up to maxOversleep, and
+// every stallEvery the reader is held up for stallTime on top.
+class SimulatedReader {
+  public:
+    SimulatedReader(uint32_t rate, size_t framesPerRead)
+        : mRate(rate), mFramesPerRead(framesPerRead), mNow(kStart)
+        , mMaxOversleep(0), mClientTime(0), mStallEvery(0), mStallTime(0)
+        , mSeed(1), mReads(0), mMaxEarly(0)
+    {
+        mClock.start(mNow, 0, rate);
+    }
+
+    void setOversleep(nsecs_t maxOversleep) { mMaxOversleep = maxOversleep; }
+    void setClientTime(nsecs_t clientTime) { mClientTime = clientTime; }
+    void setStalls(nsecs_t every, nsecs_t time) { mStallEvery = every; mStallTime = time; }
+
+    void run(nsecs_t duration)
+    {
+        nsecs_t end = mNow + duration;
+        nsecs_t nextStall = mStallEvery ? (mNow + mStallEvery) : 0;
+
+        while (mNow < end) {
+            nsecs_t deadline = mClock.advance(mNow, mFramesPerRead);
+
+            // How far ahead of schedule this read was handed out; a burst
+            // would show up as a deadline well in the past.
+            if ((mNow - deadline) > mMaxEarly)
+                mMaxEarly = mNow - deadline;
+
+            if (deadline > mNow)
+                mNow = deadline;
+            mNow += random(mMaxOversleep) + mClientTime;
+            if (nextStall && (mNow >= nextStall)) {
+                mNow += mStallTime;
+                nextStall += mStallEvery;
+            }
+            mReads++;
+        }
+    }
+
+    SilenceClock& clock() { return mClock; }
+    nsecs_t now() const { return mNow; }
+    uint32_t reads() const { return mReads; }
+    nsecs_t maxEarly() const { return mMaxEarly; }
+
+    // Frames a real device would have delivered between the start and now.
+    double expectedFrames() const
+    {
+        return (static_cast<double>(mNow - kStart) * mRate) / kSecond;
+    }
+
+  private:
+    nsecs_t random(nsecs_t max)
+    {
+        mSeed = (mSeed * 1103515245u) + 12345u;
+        return max ? static_cast<nsecs_t>((mSeed >> 8) % static_cast<uint32_t>(max)) : 0;
+    }
+
+    SilenceClock mClock;
+    const uint32_t mRate;
+    const size_t mFramesPerRead;
+    nsecs_t mNow;
+    nsecs_t mMaxOversleep;
+    nsecs_t mClientTime;
+    nsecs_t mStallEvery;
+    nsecs_t mStallTime;
+    uint32_t mSeed;
+    uint32_t mReads;
+    nsecs_t mMaxEarly;
+};
+
+// Late wakeups must not add up: after ten minutes of 10 mSec reads, each
+// woken up to 2 mSec late, the rate is still exact to within one read.
+TEST(SilenceClockTest, FrameRateHoldsOverTenMinutes)
+{
+    SimulatedReader reader(48000, 480);
+    reader.setOversleep(2000000);
+    reader.setClientTime(300000);
+    reader.run(600 * kSecond);
+
+    EXPECT_GE(reader.reads(), 59000U);
+    EXPECT_NEAR(reader.expectedFrames(),
+                static_cast<double>(reader.clock().frames()), 480);
+    EXPECT_LE(reader.maxEarly(), 2300000);
+}
+
+// 44.1k does not divide a second into whole nSecs.  Deadlines are computed
+// from the frame total, so an hour of odd sized reads ends up exactly where
+// it should, with no rounding error accumulated along the way.
+TEST(SilenceClockTest, NoRoundingDriftOverAnHour)
+{
+    SimulatedReader reader(44100, 1021);
+    reader.run(3600 * kSecond);
+
+    uint64_t frames = reader.clock().frames();
+    EXPECT_EQ(kStart + static_cast<nsecs_t>((frames * 1000000000ULL) / 44100),
+              reader.clock().position());
+    EXPECT_NEAR(44100.0 * 3600, static_cast<double>(frames), 1021);
+    EXPECT_EQ(reader.now(), reader.clock().position());
+}
+
+// A reader held up for longer than kMaxLag is re-anchored rather than
+// handed the backlog in one go.  Between stalls the rate is unaffected.
+TEST(SilenceClockTest, StallsAreNotRepaidWithABurst)
+{
+    SimulatedReader reader(16000, 160);
+    reader.setOversleep(1000000);
+    reader.setStalls(30 * kSecond, 500000000);
+    reader.run(300 * kSecond);
+
+    // Never more than kMaxLag (100 mSec) plus one wakeup behind.
+    EXPECT_LE(reader.maxEarly(), 100000000 + 1000000);
+
+    // Ten stalls, each of which costs the 500 mSec it lasted plus the late
+    // wakeup it came on top of, and the read in flight at the end.
+    double missing = reader.expectedFrames() - reader.clock().frames();
+    EXPECT_GT(missing, 10 * 0.5 * 16000);
+    EXPECT_LE(missing, (10 * 0.501 * 16000) + 160);
+
+    // And the next five minutes without stalls hold the rate again.
+    uint64_t frames = reader.clock().frames();
+    nsecs_t start = reader.now();
+    reader.setStalls(0, 0);
+    reader.run(300 * kSecond);
+    double expected = (static_cast<double>(reader.now() - start) * 16000) / kSecond;
+    EXPECT_NEAR(expected, static_cast<double>(reader.clock().frames() - frames), 160);
+}
+
+TEST(SilenceClockTest, ContinuesFromTheLastRealCapture)
+{
+    SilenceClock clock;
+
+    // The device went away 20 mSec ago: the first 10 mSec read is already
+    // due, 10 mSec in the past.
+    clock.start(kStart, kStart - 20000000, 48000);
+    EXPECT_EQ(kStart - 10000000, clock.advance(kStart, 480));
+
+    // Too long ago to be worth continuing from.
+    clock.start(kStart, kStart - 200000000, 48000);
+    EXPECT_EQ(kStart + 10000000, clock.advance(kStart, 480));
+
+    // No real capture at all, or a timestamp from the future.
+    clock.start(kStart, 0, 48000);
+    EXPECT_EQ(kStart + 10000000, clock.advance(kStart, 480));
+    clock.start(kStart, kStart + kSecond, 48000);
+    EXPECT_EQ(kStart + 10000000, clock.advance(kStart, 480));
+}
+
+TEST(SilenceClockTest, StopHandsBackTheFrames)
+{
+    SilenceClock clock;
+    EXPECT_FALSE(clock.active());
+
+    clock.start(kStart, 0, 48000);
+    EXPECT_TRUE(clock.active());
+    for (int i = 0; i < 100; ++i)
+        clock.advance(kStart, 480);
+    EXPECT_EQ(48000U, clock.frames());
+    EXPECT_EQ(kStart + kSecond, clock.position());
+
+    EXPECT_EQ(48000U, clock.stop());
+    EXPECT_FALSE(clock.active());
+    EXPECT_EQ(0U, clock.frames());
+}
+
+}  // namespace android
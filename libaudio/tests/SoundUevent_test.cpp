@@ -0,0 +1,235 @@
+/*
+**
+** Copyright 2014, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include <gtest/gtest.h>
+#include <utils/misc.h>
+#include <utils/Timers.h>
+
+#include "SoundUevent.h"
+
+namespace android {
+
+static const char* kCardPath = "/devices/pci0000:00/0000:00:14.0/usb1/1-2/1-2:1.0/sound/card2";
+
+// Build a uevent message the way the kernel sends it: a header, then
+// NUL separated KEY=value strings, ended by an empty one.
+class UeventMsg {
+  public:
+    UeventMsg(const char* action, const char* subsystem, const char* devpath,
+              const char* devname = NULL)
+        : mLen(0)
+    {
+        char buf[512];
+
+        snprintf(buf, sizeof(buf), "%s@%s", action, devpath);
+        append(buf);
+        snprintf(buf, sizeof(buf), "ACTION=%s", action);
+        append(buf);
+        snprintf(buf, sizeof(buf), "DEVPATH=%s", devpath);
+        append(buf);
+        snprintf(buf, sizeof(buf), "SUBSYSTEM=%s", subsystem);
+        append(buf);
+        if (devname) {
+            snprintf(buf, sizeof(buf), "DEVNAME=%s", devname);
+            append(buf);
+        }
+        append("SEQNUM=1234");
+        mMsg[mLen] = '\0';
+    }
+
+    void append(const char* kv)
+    {
+        size_t len = strlen(kv) + 1;
+        memcpy(mMsg + mLen, kv, len);
+        mLen += len;
+        mMsg[mLen] = '\0';
+    }
+
+    const char* msg() const { return mMsg; }
+
+  private:
+    char   mMsg[2048];
+    size_t mLen;
+};
+
+static UeventMsg soundNode(const char* action, const char* node)
+{
+    char devpath[256];
+    char devname[64];
+
+    snprintf(devpath, sizeof(devpath), "%s/%s", kCardPath, node);
+    snprintf(devname, sizeof(devname), "snd/%s", node);
+    return UeventMsg(action, "sound", devpath, devname);
+}
+
+TEST(SoundUeventTest, ParsesNodeNames)
+{
+    unsigned int card, device;
+    bool playback, control;
+
+    ASSERT_TRUE(SoundUevent::parseNodeName("pcmC2D1c", &card, &device, &playback, &control));
+    EXPECT_EQ(2u, card);
+    EXPECT_EQ(1u, device);
+    EXPECT_FALSE(playback);
+    EXPECT_FALSE(control);
+
+    ASSERT_TRUE(SoundUevent::parseNodeName("pcmC0D3p", &card, &device, &playback, &control));
+    EXPECT_EQ(0u, card);
+    EXPECT_EQ(3u, device);
+    EXPECT_TRUE(playback);
+
+    ASSERT_TRUE(SoundUevent::parseNodeName("controlC7", &card, &device, &playback, &control));
+    EXPECT_EQ(7u, card);
+    EXPECT_TRUE(control);
+
+    EXPECT_FALSE(SoundUevent::parseNodeName("pcmC0D0x", &card, &device, &playback, &control));
+    EXPECT_FALSE(SoundUevent::parseNodeName("controlC1x", &card, &device, &playback, &control));
+    EXPECT_FALSE(SoundUevent::parseNodeName("hwC0D0", &card, &device, &playback, &control));
+    EXPECT_FALSE(SoundUevent::parseNodeName("timer", &card, &device, &playback, &control));
+}
+
+TEST(SoundUeventTest, ClassifiesEvents)
+{
+    SoundUevent ev;
+
+    ASSERT_TRUE(ev.parse(soundNode("add", "pcmC2D0c").msg()));
+    EXPECT_EQ(SoundUevent::kPCMAdded, ev.type);
+    EXPECT_EQ(2u, ev.card);
+    EXPECT_EQ(0u, ev.device);
+    EXPECT_FALSE(ev.playback);
+    EXPECT_EQ(SoundUevent::kCardSettleTime, ev.scanDelay());
+
+    ASSERT_TRUE(ev.parse(soundNode("add", "controlC2").msg()));
+    EXPECT_EQ(SoundUevent::kCardReady, ev.type);
+    EXPECT_EQ(2u, ev.card);
+    EXPECT_EQ(0, ev.scanDelay());
+
+    ASSERT_TRUE(ev.parse(soundNode("remove", "pcmC2D0p").msg()));
+    EXPECT_EQ(SoundUevent::kPCMRemoved, ev.type);
+    EXPECT_TRUE(ev.playback);
+    EXPECT_EQ(-1, ev.scanDelay());
+
+    ASSERT_TRUE(ev.parse(soundNode("remove", "controlC2").msg()));
+    EXPECT_EQ(SoundUevent::kCardRemoved, ev.type);
+
+    ASSERT_TRUE(ev.parse(UeventMsg("remove", "sound", kCardPath).msg()));
+    EXPECT_EQ(SoundUevent::kCardRemoved, ev.type);
+    EXPECT_EQ(2u, ev.card);
+
+    UeventMsg hotplug("change", "drm", "/devices/pci0000:00/0000:00:02.0/drm/card0");
+    hotplug.append("HOTPLUG=1");
+    ASSERT_TRUE(ev.parse(hotplug.msg()));
+    EXPECT_EQ(SoundUevent::kHDMIHotplug, ev.type);
+
+    // Nothing to do for these.
+    EXPECT_FALSE(ev.parse(UeventMsg("add", "sound", kCardPath).msg()));
+    EXPECT_FALSE(ev.parse(UeventMsg("change", "sound", kCardPath).msg()));
+    EXPECT_FALSE(ev.parse(soundNode("add", "timer").msg()));
+    EXPECT_FALSE(ev.parse(UeventMsg("add", "input", "/devices/virtual/input/input3").msg()));
+    EXPECT_FALSE(ev.parse(UeventMsg("change", "drm", "/devices/pci0000:00/0000:00:02.0/drm/card0").msg()));
+    EXPECT_FALSE(ev.parse(""));
+}
+
+// A USB headset's card registering, as the kernel reports it: the card,
+// each PCM, then the control node last.  Times are offsets from the first
+// event, as seen on target.
+struct TimedEvent {
+    nsecs_t     at;
+    const char* action;
+    const char* node;   // NULL for the card itself
+};
+
+static const TimedEvent kHeadsetArrival[] = {
+    {      0, "add", NULL },
+    { 180000, "add", "pcmC2D0p" },
+    { 310000, "add", "pcmC2D0c" },
+    { 420000, "add", "controlC2" },
+};
+
+// When the hotplug thread would first probe the card, given the events
+// which reach it: the earliest of each event's time plus its scan delay,
+// as AudioHotplugThread::scheduleCardScan keeps it.
+static nsecs_t timeToProbe(const TimedEvent* events, size_t count)
+{
+    nsecs_t deadline = -1;
+
+    for (size_t i = 0; i < count; ++i) {
+        SoundUevent ev;
+        bool ok = events[i].node ?
+                ev.parse(soundNode(events[i].action, events[i].node).msg()) :
+                ev.parse(UeventMsg(events[i].action, "sound", kCardPath).msg());
+        if (!ok || (ev.scanDelay() < 0))
+            continue;
+
+        nsecs_t d = events[i].at + ev.scanDelay();
+        if ((deadline < 0) || (d < deadline))
+            deadline = d;
+    }
+
+    return deadline;
+}
+
+TEST(SoundUeventTest, CardAvailableWhenControlNodeAppears)
+{
+    nsecs_t t = timeToProbe(kHeadsetArrival, NELEM(kHeadsetArrival));
+
+    // Probed as soon as the control node is added.
+    EXPECT_EQ(kHeadsetArrival[NELEM(kHeadsetArrival) - 1].at, t);
+
+    // If that event is lost, the settle time after the first PCM still
+    // gets the card probed.
+    nsecs_t fallback = timeToProbe(kHeadsetArrival, NELEM(kHeadsetArrival) - 1);
+    EXPECT_EQ(kHeadsetArrival[1].at + SoundUevent::kCardSettleTime, fallback);
+}
+
+TEST(SoundUeventTest, TimeToAvailableBenchmark)
+{
+    static const int kIterations = 100000;
+    UeventMsg msgs[] = {
+        UeventMsg("add", "sound", kCardPath),
+        soundNode("add", "pcmC2D0p"),
+        soundNode("add", "pcmC2D0c"),
+        soundNode("add", "controlC2"),
+    };
+
+    // The cost of looking at each event, which the thread pays for every
+    // uevent in the system, not just sound ones.
+    nsecs_t start = systemTime(SYSTEM_TIME_THREAD);
+    int ready = 0;
+    for (int n = 0; n < kIterations; ++n) {
+        for (size_t i = 0; i < NELEM(msgs); ++i) {
+            SoundUevent ev;
+            if (ev.parse(msgs[i].msg()) && (ev.type == SoundUevent::kCardReady))
+                ready++;
+        }
+    }
+    nsecs_t elapsed = systemTime(SYSTEM_TIME_THREAD) - start;
+    EXPECT_EQ(kIterations, ready);
+
+    nsecs_t t = timeToProbe(kHeadsetArrival, NELEM(kHeadsetArrival));
+    nsecs_t settled = kHeadsetArrival[1].at + SoundUevent::kCardSettleTime;
+    printf("[   BENCH  ] uevent parse: %.0f nSec/event\n",
+           static_cast<double>(elapsed) / (kIterations * NELEM(msgs)));
+    printf("[   BENCH  ] card available %.2f mSec after it appeared"
+           " (%.2f mSec waiting out the settle time)\n", t / 1e6, settled / 1e6);
+    EXPECT_LT(t, SoundUevent::kCardSettleTime);
+}
+
+}  // namespace android
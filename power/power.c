@@ -15,14 +15,26 @@
  * limitations under the License.
  */
 
+#include <sys/eventfd.h>
+#include <sys/poll.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <unistd.h>
 
 //#define LOG_NDEBUG 0
 #define LOG_TAG "IntelPowerHAL"
 #include <utils/Log.h>
+#include <cutils/properties.h>
 
 #include <hardware/hardware.h>
 #include <hardware/power.h>
@@ -30,37 +42,232 @@
 #define BOOST_PULSE_SYSFS    "/sys/devices/system/cpu/cpufreq/interactive/boostpulse"
 #define BOOST_FREQ_SYSFS     "/sys/devices/system/cpu/cpufreq/interactive/hispeed_freq"
 #define BOOST_DURATION_SYSFS "/sys/devices/system/cpu/cpufreq/interactive/boostpulse_duration"
+#define TIMER_RATE_SYSFS     "/sys/devices/system/cpu/cpufreq/interactive/timer_rate"
+#define HISPEED_LOAD_SYSFS   "/sys/devices/system/cpu/cpufreq/interactive/go_hispeed_load"
+#define TARGET_LOADS_SYSFS   "/sys/devices/system/cpu/cpufreq/interactive/target_loads"
+#define MIN_SAMPLE_SYSFS     "/sys/devices/system/cpu/cpufreq/interactive/min_sample_time"
+#define HISPEED_DELAY_SYSFS  "/sys/devices/system/cpu/cpufreq/interactive/above_hispeed_delay"
+#define CPU_MAX_FREQ_SYSFS   "/sys/devices/system/cpu/cpu0/cpufreq/cpuinfo_max_freq"
+#define CPU_MIN_FREQ_SYSFS   "/sys/devices/system/cpu/cpu0/cpufreq/cpuinfo_min_freq"
+
+#define POWER_PROFILES_CONF "/system/etc/power_profiles.conf"
+
+#define NR_CPUS 4
+
+/*
+ * Settings a profile can carry.  The scaling_{min,max}_freq knobs live in
+ * their CPU's cpufreq directory, which goes away while the CPU is offline.
+ */
+enum {
+    KNOB_TIMER_RATE,
+    KNOB_GO_HISPEED_LOAD,
+    KNOB_BOOSTPULSE_DURATION,
+    KNOB_HISPEED_FREQ,
+    KNOB_TARGET_LOADS,
+    KNOB_MIN_SAMPLE_TIME,
+    KNOB_ABOVE_HISPEED_DELAY,
+    KNOB_MAX_FREQ_CPU0,
+    KNOB_MAX_FREQ_CPU1,
+    KNOB_MAX_FREQ_CPU2,
+    KNOB_MAX_FREQ_CPU3,
+    KNOB_MIN_FREQ_CPU0,
+    KNOB_MIN_FREQ_CPU1,
+    KNOB_MIN_FREQ_CPU2,
+    KNOB_MIN_FREQ_CPU3,
+    KNOB_COUNT
+};
+
+#define KNOB_VALUE_MAX 32
+
+static const struct {
+    const char *path;
+    const char *key;    /* name in power_profiles.conf */
+    int cpu;            /* owning CPU, -1 for governor wide settings */
+} knob_info[KNOB_COUNT] = {
+    [KNOB_TIMER_RATE]          = { TIMER_RATE_SYSFS, "timer_rate", -1 },
+    [KNOB_GO_HISPEED_LOAD]     = { HISPEED_LOAD_SYSFS, "go_hispeed_load", -1 },
+    [KNOB_BOOSTPULSE_DURATION] = { BOOST_DURATION_SYSFS, "boostpulse_duration", -1 },
+    [KNOB_HISPEED_FREQ]        = { BOOST_FREQ_SYSFS, "hispeed_freq", -1 },
+    [KNOB_TARGET_LOADS]        = { TARGET_LOADS_SYSFS, "target_loads", -1 },
+    [KNOB_MIN_SAMPLE_TIME]     = { MIN_SAMPLE_SYSFS, "min_sample_time", -1 },
+    [KNOB_ABOVE_HISPEED_DELAY] = { HISPEED_DELAY_SYSFS, "above_hispeed_delay", -1 },
+    [KNOB_MAX_FREQ_CPU0] = { "/sys/devices/system/cpu/cpu0/cpufreq/scaling_max_freq", "max_freq", 0 },
+    [KNOB_MAX_FREQ_CPU1] = { "/sys/devices/system/cpu/cpu1/cpufreq/scaling_max_freq", "max_freq", 1 },
+    [KNOB_MAX_FREQ_CPU2] = { "/sys/devices/system/cpu/cpu2/cpufreq/scaling_max_freq", "max_freq", 2 },
+    [KNOB_MAX_FREQ_CPU3] = { "/sys/devices/system/cpu/cpu3/cpufreq/scaling_max_freq", "max_freq", 3 },
+    [KNOB_MIN_FREQ_CPU0] = { "/sys/devices/system/cpu/cpu0/cpufreq/scaling_min_freq", "min_freq", 0 },
+    [KNOB_MIN_FREQ_CPU1] = { "/sys/devices/system/cpu/cpu1/cpufreq/scaling_min_freq", "min_freq", 1 },
+    [KNOB_MIN_FREQ_CPU2] = { "/sys/devices/system/cpu/cpu2/cpufreq/scaling_min_freq", "min_freq", 2 },
+    [KNOB_MIN_FREQ_CPU3] = { "/sys/devices/system/cpu/cpu3/cpufreq/scaling_min_freq", "min_freq", 3 },
+};
+
+static const char *const cpu_online_path[NR_CPUS] = {
+    "/sys/devices/system/cpu/cpu0/online",
+    "/sys/devices/system/cpu/cpu1/online",
+    "/sys/devices/system/cpu/cpu2/online",
+    "/sys/devices/system/cpu/cpu3/online",
+};
+
+/*
+ * Interactive governor settings while the screen is on.  These are the
+ * values init.fugu.rc writes at boot; keep the two in sync.
+ */
+#define INTERACTIVE_TIMER_RATE          "4000"
+#define INTERACTIVE_GO_HISPEED_LOAD     "90"
+#define INTERACTIVE_BOOSTPULSE_DURATION "800000"
+
+/*
+ * With the screen off nobody is waiting on a frame: sample the load less
+ * often and only jump to hispeed_freq when a core is really saturated.
+ */
+#define NONINTERACTIVE_TIMER_RATE       "20000"
+#define NONINTERACTIVE_GO_HISPEED_LOAD  "99"
+
+/*
+ * scaling_max_freq while the screen is off, in kHz.  Defaults to half of
+ * cpuinfo_max_freq; 0 leaves the frequency uncapped.
+ */
+#define PROP_IDLE_MAX_FREQ   "ro.fugu.power.idle_max_freq"
+/* CPUs kept online while the screen is off (cpu0 always is); default all. */
+#define PROP_IDLE_CPUS       "ro.fugu.power.idle_cpus"
+
+struct cpu_profile {
+    const char *name;
+    char value[KNOB_COUNT][KNOB_VALUE_MAX]; /* "" leaves the setting alone */
+    int online_cpus;                /* cpu0 .. online_cpus-1 are online */
+};
+
+enum {
+    PROFILE_INTERACTIVE,
+    PROFILE_NONINTERACTIVE,
+    PROFILE_COUNT
+};
+
+/*
+ * Hints newer than the power.h we build against.  The values are the ones
+ * later releases gave them.
+ */
+#define FUGU_POWER_HINT_SUSTAINED_PERFORMANCE 0x00000006
+#define FUGU_POWER_HINT_LAUNCH                0x00000008
+
+/*
+ * Profiles switched on and off by hints, layered over the interactive or
+ * non-interactive profile.  Each is a section of POWER_PROFILES_CONF;
+ * those missing from it are ignored.  Where active profiles set the same
+ * knob, the later one here wins.
+ */
+enum {
+    HINT_PROFILE_SUSTAINED,
+    HINT_PROFILE_VIDEO_DECODE,
+    HINT_PROFILE_LAUNCH,
+    HINT_PROFILE_COUNT
+};
+
+static const char *const hint_profile_name[HINT_PROFILE_COUNT] = {
+    [HINT_PROFILE_SUSTAINED]    = "sustained_performance",
+    [HINT_PROFILE_VIDEO_DECODE] = "video_decode",
+    [HINT_PROFILE_LAUNCH]       = "launch",
+};
+
+struct hint_profile {
+    struct cpu_profile profile;
+    int loaded;
+    int refcount;           /* outstanding starts */
+    uint32_t timeout_ms;    /* drop it if not ended by then, 0 for never */
+    uint64_t expires_us;
+};
+
+/*
+ * Work handed from powerHint() and setInteractive() to the worker thread.
+ * Each kind of work is a bit in intel_power_module.pending; hints which
+ * arrive while their bit is still set are coalesced into the one already
+ * queued.
+ */
+#define WORK_BOOST      (1u << 0)
+#define WORK_PROFILE    (1u << 1)   /* re-evaluate which profiles apply */
 
 struct intel_power_module {
     struct power_module container;
-    uint32_t pulse_duration;
+    atomic_uint pulse_duration;
     struct timespec last_boost_time; /* latest POWER_HINT_INTERACTION boost */
+
+    /* Control files, opened once at init.  -1 if unavailable. */
+    int boostpulse_fd;
+    int knob_fd[KNOB_COUNT];
+    int online_fd[NR_CPUS];         /* only opened if cores are offlined */
+
+    /*
+     * Profiles are built at init, so that switching is nothing but writes
+     * to files which are already open.  defaults holds what the knobs were
+     * set to at boot, for whenever no profile has an opinion.
+     */
+    struct cpu_profile defaults;
+    struct cpu_profile profiles[PROFILE_COUNT];
+    atomic_int interactive;
+
+    /* Protects the refcounts and deadlines of hint_profiles. */
+    pthread_mutex_t hint_lock;
+    struct hint_profile hint_profiles[HINT_PROFILE_COUNT];
+
+    /*
+     * Owned by whoever runs the work (see queue_work()), under work_lock.
+     * cpus_online counts the CPUs from cpu0 up which we believe to be
+     * online; written holds the last value written to each knob, "" if
+     * unknown.
+     */
+    pthread_mutex_t work_lock;
+    int cpus_online;
+    char written[KNOB_COUNT][KNOB_VALUE_MAX];
+
+    /*
+     * The worker sleeps on event_fd.  Callers set bits in pending and only
+     * kick event_fd when they set a bit which was clear.  boost_until_us is
+     * the end of the boost pulse last written (CLOCK_MONOTONIC), letting
+     * callers drop redundant boosts without involving the worker at all.
+     * event_fd is -1 when there is no worker; kicking counts the callers
+     * between reading event_fd and being done with it, so that a worker
+     * which gives up knows when it is safe to close it.
+     */
+    atomic_int event_fd;
+    atomic_int kicking;
+    atomic_uint pending;
+    atomic_uint_fast64_t boost_until_us;
 };
 
-static ssize_t sysfs_write(char *path, char *s)
+static int sysfs_open(const char *path)
 {
     char buf[80];
-    ssize_t len;
-    int fd = open(path, O_WRONLY);
+    int fd = open(path, O_WRONLY | O_CLOEXEC);
 
     if (fd < 0) {
         strerror_r(errno, buf, sizeof(buf));
         ALOGE("Error opening %s: %s\n", path, buf);
-        return -1;
     }
 
-    if ((len = write(fd, s, strlen(s))) < 0) {
+    return fd;
+}
+
+/* Write to a control file opened by sysfs_open; path is for logging only. */
+static ssize_t sysfs_write_fd(int fd, const char *path, const char *s)
+{
+    char buf[80];
+    ssize_t len;
+
+    if (fd < 0)
+        return -1;
+
+    /* Each write is a whole new value, always at the start of the file. */
+    if ((len = pwrite(fd, s, strlen(s), 0)) < 0) {
         strerror_r(errno, buf, sizeof(buf));
         ALOGE("Error writing to %s: %s\n", path, buf);
     }
 
-    close(fd);
     ALOGV("wrote '%s' to %s", s, path);
 
     return len;
 }
 
-static ssize_t sysfs_read(char *path, char *s, int num_bytes)
+static ssize_t sysfs_read(const char *path, char *s, int num_bytes)
 {
     char buf[80];
     ssize_t count;
@@ -89,12 +296,604 @@ static ssize_t sysfs_read(char *path, char *s, int num_bytes)
     return count;
 }
 
+static inline uint64_t now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void do_boost(struct intel_power_module *mod)
+{
+    struct timespec curr_time;
+
+    clock_gettime(CLOCK_MONOTONIC, &curr_time);
+    if (sysfs_write_fd(mod->boostpulse_fd, BOOST_PULSE_SYSFS, "1") < 0)
+        return;
+
+    mod->last_boost_time = curr_time;
+    atomic_store_explicit(&mod->boost_until_us,
+            (uint64_t) curr_time.tv_sec * 1000000 + curr_time.tv_nsec / 1000 +
+            atomic_load_explicit(&mod->pulse_duration, memory_order_relaxed),
+            memory_order_release);
+}
+
+static void overlay_profile(struct cpu_profile *dst,
+                            const struct cpu_profile *src)
+{
+    int i;
+
+    for (i = 0; i < KNOB_COUNT; i++) {
+        if (src->value[i][0])
+            memcpy(dst->value[i], src->value[i], KNOB_VALUE_MAX);
+    }
+
+    /* Any profile may ask for more cores; none gets to take them away. */
+    if (src->online_cpus > dst->online_cpus)
+        dst->online_cpus = src->online_cpus;
+}
+
+/*
+ * Build the settings which should be in force now: the boot defaults,
+ * under the profile for the screen state, under any active hint profiles.
+ */
+static void compose_profile(struct intel_power_module *mod,
+                            struct cpu_profile *out)
+{
+    int on = atomic_load_explicit(&mod->interactive, memory_order_acquire);
+    unsigned long min, max;
+    int i, cpu;
+
+    *out = mod->defaults;
+    overlay_profile(out,
+            &mod->profiles[on ? PROFILE_INTERACTIVE : PROFILE_NONINTERACTIVE]);
+    out->name = mod->profiles[on ? PROFILE_INTERACTIVE
+                                 : PROFILE_NONINTERACTIVE].name;
+
+    pthread_mutex_lock(&mod->hint_lock);
+    for (i = 0; i < HINT_PROFILE_COUNT; i++) {
+        if (mod->hint_profiles[i].refcount) {
+            overlay_profile(out, &mod->hint_profiles[i].profile);
+            out->name = mod->hint_profiles[i].profile.name;
+        }
+    }
+    pthread_mutex_unlock(&mod->hint_lock);
+
+    /* A floor from one profile must not poke through a cap from another. */
+    for (cpu = 0; cpu < NR_CPUS; cpu++) {
+        min = strtoul(out->value[KNOB_MIN_FREQ_CPU0 + cpu], NULL, 10);
+        max = strtoul(out->value[KNOB_MAX_FREQ_CPU0 + cpu], NULL, 10);
+        if (min && max && min > max)
+            memcpy(out->value[KNOB_MIN_FREQ_CPU0 + cpu],
+                   out->value[KNOB_MAX_FREQ_CPU0 + cpu], KNOB_VALUE_MAX);
+    }
+}
+
+static void write_knob(struct intel_power_module *mod, int i, const char *value)
+{
+    if (!value[0] || !strcmp(value, mod->written[i]))
+        return;
+
+    if (sysfs_write_fd(mod->knob_fd[i], knob_info[i].path, value) < 0) {
+        mod->written[i][0] = '\0';
+        return;
+    }
+    memcpy(mod->written[i], value, KNOB_VALUE_MAX);
+
+    if (i == KNOB_BOOSTPULSE_DURATION)
+        atomic_store_explicit(&mod->pulse_duration, atoi(value),
+                              memory_order_relaxed);
+}
+
+static void write_knobs(struct intel_power_module *mod,
+                        const struct cpu_profile *p)
+{
+    unsigned long new_max, cur_min;
+    int i, cpu, min, max;
+
+    for (i = 0; i < KNOB_MAX_FREQ_CPU0; i++)
+        write_knob(mod, i, p->value[i]);
+
+    /* An offline CPU has no cpufreq directory to write to. */
+    for (cpu = 0; cpu < mod->cpus_online; cpu++) {
+        min = KNOB_MIN_FREQ_CPU0 + cpu;
+        max = KNOB_MAX_FREQ_CPU0 + cpu;
+
+        /*
+         * The kernel refuses a max below the current min, so when the
+         * window moves down the floor has to go first.
+         */
+        new_max = strtoul(p->value[max], NULL, 10);
+        cur_min = strtoul(mod->written[min], NULL, 10);
+        if (new_max && new_max < cur_min) {
+            write_knob(mod, min, p->value[min]);
+            write_knob(mod, max, p->value[max]);
+        } else {
+            write_knob(mod, max, p->value[max]);
+            write_knob(mod, min, p->value[min]);
+        }
+    }
+}
+
+/*
+ * The cpufreq directory of a CPU is torn down when it goes offline and
+ * recreated when it comes back, leaving descriptors into the old one dead.
+ */
+static void reopen_cpu_knobs(struct intel_power_module *mod, int cpu)
+{
+    int i;
+
+    for (i = 0; i < KNOB_COUNT; i++) {
+        if (knob_info[i].cpu != cpu)
+            continue;
+        if (mod->knob_fd[i] >= 0)
+            close(mod->knob_fd[i]);
+        mod->knob_fd[i] = sysfs_open(knob_info[i].path);
+        mod->written[i][0] = '\0';
+    }
+}
+
+/*
+ * Bring CPUs up, or take them down from the top, until n are online.  Both
+ * take milliseconds per CPU; going down is abandoned as soon as the screen
+ * comes back on, since that work will only have to be undone.  Returns
+ * whether any CPU came up.
+ */
+static int set_cpus_online(struct intel_power_module *mod, int n)
+{
+    int woke = 0;
+    int cpu;
+
+    while (mod->cpus_online < n) {
+        cpu = mod->cpus_online;
+        if (sysfs_write_fd(mod->online_fd[cpu], cpu_online_path[cpu], "1") < 0)
+            break;
+        reopen_cpu_knobs(mod, cpu);
+        mod->cpus_online++;
+        woke = 1;
+    }
+
+    while (mod->cpus_online > n && mod->cpus_online > 1) {
+        if (atomic_load_explicit(&mod->interactive, memory_order_acquire))
+            break;
+        cpu = mod->cpus_online - 1;
+        if (sysfs_write_fd(mod->online_fd[cpu], cpu_online_path[cpu], "0") < 0)
+            break;
+        mod->cpus_online--;
+    }
+
+    return woke;
+}
+
+/*
+ * Profile switches come in two halves around any boost: the settings for
+ * the CPUs we have first, since that is all a waking keypress needs, then
+ * the slow part, CPU hotplug.  CPUs which came up get their settings last.
+ */
+static void do_work(struct intel_power_module *mod, unsigned int work)
+{
+    struct cpu_profile p;
+
+    pthread_mutex_lock(&mod->work_lock);
+
+    if (work & WORK_PROFILE) {
+        compose_profile(mod, &p);
+        ALOGV("applying %s profile", p.name);
+        write_knobs(mod, &p);
+    }
+
+    if (work & WORK_BOOST)
+        do_boost(mod);
+
+    if ((work & WORK_PROFILE) && p.online_cpus != mod->cpus_online) {
+        if (set_cpus_online(mod, p.online_cpus))
+            write_knobs(mod, &p);
+    }
+
+    pthread_mutex_unlock(&mod->work_lock);
+}
+
+/*
+ * Drop hint profiles which have outlived their timeout, presumably because
+ * whoever started them never ended them.  Returns the work that results,
+ * and the milliseconds until the next deadline in *timeout (-1 for none).
+ */
+static unsigned int expire_hint_profiles(struct intel_power_module *mod,
+                                         int *timeout)
+{
+    uint64_t now = now_us();
+    uint64_t next = UINT64_MAX;
+    unsigned int work = 0;
+    struct hint_profile *h;
+    int i;
+
+    pthread_mutex_lock(&mod->hint_lock);
+    for (i = 0; i < HINT_PROFILE_COUNT; i++) {
+        h = &mod->hint_profiles[i];
+        if (!h->refcount || !h->timeout_ms)
+            continue;
+        if (now >= h->expires_us) {
+            ALOGW("%s profile not ended after %ums, dropping it",
+                  h->profile.name, h->timeout_ms);
+            h->refcount = 0;
+            work |= WORK_PROFILE;
+        } else if (h->expires_us < next) {
+            next = h->expires_us;
+        }
+    }
+    pthread_mutex_unlock(&mod->hint_lock);
+
+    *timeout = (next == UINT64_MAX) ? -1 : (int) ((next - now + 999) / 1000);
+    return work;
+}
+
+/*
+ * The worker cannot go on.  Send callers back to doing their own work, wait
+ * for any which already have the fd to finish with it, pick up whatever they
+ * left pending, and only then close it.  Hint profile timeouts are no longer
+ * enforced from here on; they still end when their hints do.
+ */
+static void stop_worker(struct intel_power_module *mod)
+{
+    int fd = atomic_exchange(&mod->event_fd, -1);
+    unsigned int work;
+
+    while (atomic_load(&mod->kicking))
+        sched_yield();
+
+    work = atomic_exchange(&mod->pending, 0);
+    if (work)
+        do_work(mod, work);
+
+    close(fd);
+    ALOGW("power worker: stopped, hints are handled synchronously");
+}
+
+static void *fugu_power_worker(void *arg)
+{
+    struct intel_power_module *mod = (struct intel_power_module *) arg;
+    int fd = atomic_load(&mod->event_fd);
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    unsigned int work;
+    uint64_t count;
+    int timeout = -1;
+    int ret;
+
+    for (;;) {
+        ret = poll(&pfd, 1, timeout);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            ALOGE("power worker: poll failed: %s", strerror(errno));
+            break;
+        }
+
+        if (ret > 0 && read(fd, &count, sizeof(count)) < 0) {
+            if (errno == EINTR)
+                continue;
+            ALOGE("power worker: read failed: %s", strerror(errno));
+            break;
+        }
+
+        work = atomic_exchange_explicit(&mod->pending, 0, memory_order_acq_rel);
+        work |= expire_hint_profiles(mod, &timeout);
+        if (work)
+            do_work(mod, work);
+    }
+
+    stop_worker(mod);
+    return NULL;
+}
+
+/*
+ * Hand work to the worker.  Never blocks and never touches sysfs; at most
+ * one eventfd write.  Without a worker (it failed to start, or gave up) the
+ * work is done on the caller's thread, as it always used to be.
+ */
+static void queue_work(struct intel_power_module *mod, unsigned int work)
+{
+    unsigned int old;
+    uint64_t one = 1;
+    int fd;
+
+    atomic_fetch_add(&mod->kicking, 1);
+    fd = atomic_load(&mod->event_fd);
+    if (fd >= 0) {
+        old = atomic_fetch_or_explicit(&mod->pending, work,
+                                       memory_order_acq_rel);
+        if ((old & work) != work && write(fd, &one, sizeof(one)) < 0)
+            ALOGE("power worker: kick failed: %s", strerror(errno));
+    }
+    atomic_fetch_sub(&mod->kicking, 1);
+
+    if (fd < 0)
+        do_work(mod, work);
+}
+
+static void start_worker(struct intel_power_module *mod)
+{
+    pthread_attr_t attr;
+    pthread_t thread;
+    int fd;
+    int ret;
+
+    fd = eventfd(0, EFD_CLOEXEC);
+    if (fd < 0) {
+        ALOGE("power worker: eventfd failed: %s", strerror(errno));
+        return;
+    }
+    atomic_store(&mod->event_fd, fd);
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    ret = pthread_create(&thread, &attr, fugu_power_worker, mod);
+    pthread_attr_destroy(&attr);
+
+    if (ret) {
+        ALOGE("power worker: pthread_create failed: %s", strerror(ret));
+        atomic_store(&mod->event_fd, -1);
+        close(fd);
+        return;
+    }
+
+    pthread_setname_np(thread, "powerhint");
+}
+
+static unsigned long read_cpu_freq(const char *path)
+{
+    char buf[32];
+
+    if (sysfs_read(path, buf, sizeof(buf)) < 0)
+        return 0;
+    return strtoul(buf, NULL, 10);
+}
+
+/* Count the CPUs from cpu0 up which are online right now. */
+static int count_cpus_online(void)
+{
+    char buf[8];
+    int cpu;
+
+    /* cpu0 cannot be taken offline, and has no online file on some kernels. */
+    for (cpu = 1; cpu < NR_CPUS; cpu++) {
+        if (sysfs_read(cpu_online_path[cpu], buf, sizeof(buf)) < 0 ||
+                strcmp(buf, "1"))
+            break;
+    }
+
+    return cpu;
+}
+
+/*
+ * Record what every knob is set to now, both as the starting point for
+ * write_knobs() and as the value to return to once no profile sets it.
+ * The frequency limits return to the full range instead, in case we are
+ * being restarted with a cap or floor still in place.
+ */
+static void init_defaults(struct intel_power_module *mod,
+                          unsigned long min_freq, unsigned long max_freq)
+{
+    struct cpu_profile *d = &mod->defaults;
+    ssize_t len;
+    int i;
+
+    memset(d, 0, sizeof(*d));
+    d->name = "default";
+
+    for (i = 0; i < KNOB_COUNT; i++) {
+        mod->written[i][0] = '\0';
+        if (knob_info[i].cpu >= mod->cpus_online)
+            continue;
+
+        len = sysfs_read(knob_info[i].path, mod->written[i], KNOB_VALUE_MAX);
+        if (len < 0 || len >= KNOB_VALUE_MAX - 1) {
+            /* Possibly truncated; never write it back. */
+            ALOGW("can't restore %s once a profile changes it",
+                  knob_info[i].path);
+            mod->written[i][0] = '\0';
+            continue;
+        }
+        memcpy(d->value[i], mod->written[i], KNOB_VALUE_MAX);
+    }
+
+    for (i = 0; i < NR_CPUS; i++) {
+        if (min_freq)
+            snprintf(d->value[KNOB_MIN_FREQ_CPU0 + i], KNOB_VALUE_MAX,
+                     "%lu", min_freq);
+        if (max_freq)
+            snprintf(d->value[KNOB_MAX_FREQ_CPU0 + i], KNOB_VALUE_MAX,
+                     "%lu", max_freq);
+    }
+}
+
+static char *trim(char *s)
+{
+    char *end;
+
+    while (isspace((unsigned char) *s))
+        s++;
+    end = s + strlen(s);
+    while (end > s && isspace((unsigned char) end[-1]))
+        *--end = '\0';
+
+    return s;
+}
+
+/*
+ * Read the hint profiles from path, an ini style file: a [section] per
+ * profile, holding "knob = value" lines.  Knobs are named as in knob_info;
+ * min_freq and max_freq apply to every CPU.  online_cpus and timeout_ms
+ * are also understood.  Anything else is logged and skipped.
+ */
+static void load_hint_profiles(struct intel_power_module *mod,
+                               const char *path)
+{
+    struct hint_profile *h = NULL;
+    char line[128];
+    char *key, *value, *end;
+    int lineno = 0;
+    int i, found;
+    FILE *f;
+
+    for (i = 0; i < HINT_PROFILE_COUNT; i++)
+        mod->hint_profiles[i].profile.name = hint_profile_name[i];
+
+    f = fopen(path, "re");
+    if (!f) {
+        ALOGI("%s: %s; no hint profiles", path, strerror(errno));
+        return;
+    }
+
+    while (fgets(line, sizeof(line), f)) {
+        lineno++;
+        if ((end = strchr(line, '#')) != NULL)
+            *end = '\0';
+        key = trim(line);
+        if (!*key)
+            continue;
+
+        if (*key == '[') {
+            h = NULL;
+            if ((end = strchr(key, ']')) == NULL) {
+                ALOGW("%s:%d: malformed section", path, lineno);
+                continue;
+            }
+            *end = '\0';
+            for (i = 0; i < HINT_PROFILE_COUNT; i++) {
+                if (!strcmp(key + 1, hint_profile_name[i]))
+                    h = &mod->hint_profiles[i];
+            }
+            if (h)
+                h->loaded = 1;
+            else
+                ALOGW("%s:%d: unknown profile %s", path, lineno, key + 1);
+            continue;
+        }
+
+        /* Outside any section we know about. */
+        if (!h)
+            continue;
+
+        if ((value = strchr(key, '=')) == NULL) {
+            ALOGW("%s:%d: expected knob = value", path, lineno);
+            continue;
+        }
+        *value++ = '\0';
+        key = trim(key);
+        value = trim(value);
+
+        if (!strcmp(key, "online_cpus")) {
+            h->profile.online_cpus = atoi(value);
+            if (h->profile.online_cpus > NR_CPUS)
+                h->profile.online_cpus = NR_CPUS;
+            continue;
+        }
+        if (!strcmp(key, "timeout_ms")) {
+            h->timeout_ms = strtoul(value, NULL, 10);
+            continue;
+        }
+
+        if (strlen(value) >= KNOB_VALUE_MAX) {
+            ALOGW("%s:%d: value for %s too long", path, lineno, key);
+            continue;
+        }
+        found = 0;
+        for (i = 0; i < KNOB_COUNT; i++) {
+            if (!strcmp(key, knob_info[i].key)) {
+                strcpy(h->profile.value[i], value);
+                found = 1;
+            }
+        }
+        if (!found)
+            ALOGW("%s:%d: unknown knob %s", path, lineno, key);
+    }
+
+    fclose(f);
+
+    for (i = 0; i < HINT_PROFILE_COUNT; i++) {
+        if (mod->hint_profiles[i].loaded)
+            ALOGI("loaded %s profile", hint_profile_name[i]);
+    }
+}
+
+static void init_profiles(struct intel_power_module *mod)
+{
+    struct cpu_profile *on = &mod->profiles[PROFILE_INTERACTIVE];
+    struct cpu_profile *off = &mod->profiles[PROFILE_NONINTERACTIVE];
+    unsigned long max_freq = read_cpu_freq(CPU_MAX_FREQ_SYSFS);
+    unsigned long min_freq = read_cpu_freq(CPU_MIN_FREQ_SYSFS);
+    unsigned long idle_freq = max_freq / 2;
+    char prop[PROPERTY_VALUE_MAX];
+    int cpu, i;
+
+    memset(mod->profiles, 0, sizeof(mod->profiles));
+
+    on->name = "interactive";
+    strcpy(on->value[KNOB_TIMER_RATE], INTERACTIVE_TIMER_RATE);
+    strcpy(on->value[KNOB_GO_HISPEED_LOAD], INTERACTIVE_GO_HISPEED_LOAD);
+    strcpy(on->value[KNOB_BOOSTPULSE_DURATION], INTERACTIVE_BOOSTPULSE_DURATION);
+    on->online_cpus = NR_CPUS;
+
+    off->name = "non-interactive";
+    strcpy(off->value[KNOB_TIMER_RATE], NONINTERACTIVE_TIMER_RATE);
+    strcpy(off->value[KNOB_GO_HISPEED_LOAD], NONINTERACTIVE_GO_HISPEED_LOAD);
+
+    if (property_get(PROP_IDLE_MAX_FREQ, prop, NULL) > 0)
+        idle_freq = strtoul(prop, NULL, 10);
+    if (idle_freq && idle_freq < min_freq)
+        idle_freq = min_freq;
+
+    /* Without cpuinfo_max_freq there is nothing to restore a cap to. */
+    if (max_freq && idle_freq && idle_freq < max_freq) {
+        for (cpu = 0; cpu < NR_CPUS; cpu++) {
+            snprintf(on->value[KNOB_MAX_FREQ_CPU0 + cpu],
+                     sizeof(on->value[0]), "%lu", max_freq);
+            snprintf(off->value[KNOB_MAX_FREQ_CPU0 + cpu],
+                     sizeof(off->value[0]), "%lu", idle_freq);
+        }
+    }
+
+    off->online_cpus = property_get_int32(PROP_IDLE_CPUS, NR_CPUS);
+    if (off->online_cpus < 1 || off->online_cpus > NR_CPUS)
+        off->online_cpus = NR_CPUS;
+
+    for (i = 0; i < KNOB_COUNT; i++)
+        mod->knob_fd[i] = sysfs_open(knob_info[i].path);
+
+    for (cpu = 0; cpu < NR_CPUS; cpu++)
+        mod->online_fd[cpu] = -1;
+    mod->cpus_online = count_cpus_online();
+    init_defaults(mod, min_freq, max_freq);
+    if (off->online_cpus < NR_CPUS || mod->cpus_online < NR_CPUS) {
+        for (cpu = 1; cpu < NR_CPUS; cpu++)
+            mod->online_fd[cpu] = sysfs_open(cpu_online_path[cpu]);
+    }
+
+    ALOGI("screen off: max freq %s kHz, %d CPUs online",
+          off->value[KNOB_MAX_FREQ_CPU0][0] ? off->value[KNOB_MAX_FREQ_CPU0]
+                                            : "uncapped",
+          off->online_cpus);
+}
+
 static void fugu_power_init(struct power_module *module)
 {
     struct intel_power_module *mod = (struct intel_power_module *) module;
     char boost_freq[32];
     char boostpulse_duration[32];
 
+    mod->boostpulse_fd = sysfs_open(BOOST_PULSE_SYSFS);
+    atomic_init(&mod->event_fd, -1);
+    atomic_init(&mod->kicking, 0);
+    atomic_init(&mod->pending, 0);
+    atomic_init(&mod->boost_until_us, 0);
+    atomic_init(&mod->interactive, 1);
+    pthread_mutex_init(&mod->hint_lock, NULL);
+    pthread_mutex_init(&mod->work_lock, NULL);
+
+    init_profiles(mod);
+    load_hint_profiles(mod, POWER_PROFILES_CONF);
+
     /* Keep default boost_freq for fugu => max freq */
 
     if (sysfs_read(BOOST_FREQ_SYSFS, boost_freq, 32) < 0) {
@@ -104,61 +903,97 @@ static void fugu_power_init(struct power_module *module)
         /* above should not fail but just in case it does use an arbitrary 20ms value */
         snprintf(boostpulse_duration, 32, "%d", 20000);
     }
-    mod->pulse_duration = atoi(boostpulse_duration);
+    atomic_init(&mod->pulse_duration, atoi(boostpulse_duration));
     /* initialize last_boost_time */
     clock_gettime(CLOCK_MONOTONIC, &mod->last_boost_time);
 
-    ALOGI("init done: will boost CPU to %skHz for %dus on input events",
-            boost_freq, mod->pulse_duration);
+    start_worker(mod);
+
+    /*
+     * init.fugu.rc has set up the interactive profile already, but if we are
+     * being restarted the screen may have been off; make sure.
+     */
+    queue_work(mod, WORK_PROFILE);
+
+    ALOGI("init done: will boost CPU to %skHz for %uus on input events",
+            boost_freq, atomic_load(&mod->pulse_duration));
 }
 
 static void fugu_power_set_interactive(struct power_module *module, int on)
 {
-    struct dirent **device_list = NULL;
+    struct intel_power_module *mod = (struct intel_power_module *) module;
 
     ALOGI("setInteractive: on=%d", on);
-    (void) module; /* unused */
-    (void) on; /* unused */
+
+    atomic_store_explicit(&mod->interactive, !!on, memory_order_release);
+
+    /* Waking up is almost always followed by input; be ready for it. */
+    queue_work(mod, on ? WORK_PROFILE | WORK_BOOST : WORK_PROFILE);
 }
 
-static inline void timespec_sub(struct timespec *res, struct timespec *a, struct timespec *b)
+/*
+ * Take or drop a reference on a hint profile.  Only the first start and the
+ * last end change anything, so overlapping users (two decoders, say) are
+ * fine as long as every start is ended.
+ */
+static void update_hint_profile(struct intel_power_module *mod, int which,
+                                int start)
 {
-    res->tv_sec = a->tv_sec - b->tv_sec;
-    if (a->tv_sec >= b->tv_sec) {
-        res->tv_nsec = a->tv_nsec - b->tv_nsec;
+    struct hint_profile *h = &mod->hint_profiles[which];
+    int changed = 0;
+
+    pthread_mutex_lock(&mod->hint_lock);
+
+    if (!h->loaded) {
+        pthread_mutex_unlock(&mod->hint_lock);
+        return;
+    }
+
+    if (start) {
+        changed = (h->refcount++ == 0);
+        /* Timeouts need the worker; without one they are not enforced. */
+        if (h->timeout_ms)
+            h->expires_us = now_us() + (uint64_t) h->timeout_ms * 1000;
+    } else if (h->refcount > 0) {
+        changed = (--h->refcount == 0);
     } else {
-        res->tv_nsec = 1000000000 - b->tv_nsec + a->tv_nsec;
-        res->tv_sec--;
+        ALOGW("%s profile ended more often than started", h->profile.name);
     }
-}
 
-static inline uint64_t timespec_to_us(struct timespec *t)
-{
-    return t->tv_sec * 1000000 + t->tv_nsec / 1000;
+    ALOGV("%s profile: refcount %d", h->profile.name, h->refcount);
+    pthread_mutex_unlock(&mod->hint_lock);
+
+    if (changed)
+        queue_work(mod, WORK_PROFILE);
 }
 
+/*
+ * Called from whichever thread delivered the hint, typically input dispatch.
+ * The profile hints start with data != NULL and end with data == NULL.
+ */
 static void fugu_power_hint(struct power_module *module, power_hint_t hint, void *data)
 {
     struct intel_power_module *mod = (struct intel_power_module *) module;
-    char sysfs_val[80];
-    struct timespec curr_time;
-    struct timespec diff_time;
-    uint64_t diff;
 
-    (void) data;
-
-    switch (hint) {
+    /* Some of the hints we take are not in power_hint_t yet. */
+    switch ((int) hint) {
         case POWER_HINT_INTERACTION:
-            clock_gettime(CLOCK_MONOTONIC, &curr_time);
-            timespec_sub(&diff_time, &curr_time, &mod->last_boost_time);
-            diff = timespec_to_us(&diff_time);
-
-            ALOGV("POWER_HINT_INTERACTION: diff=%llu", diff);
+            /* Still inside the last pulse; another would change nothing. */
+            if (now_us() <= atomic_load_explicit(&mod->boost_until_us,
+                                                 memory_order_acquire))
+                break;
 
-            if (diff > mod->pulse_duration) {
-                sysfs_write(BOOST_PULSE_SYSFS, "1");
-                mod->last_boost_time = curr_time;
-            }
+            ALOGV("POWER_HINT_INTERACTION: boost");
+            queue_work(mod, WORK_BOOST);
+            break;
+        case POWER_HINT_VIDEO_DECODE:
+            update_hint_profile(mod, HINT_PROFILE_VIDEO_DECODE, data != NULL);
+            break;
+        case FUGU_POWER_HINT_LAUNCH:
+            update_hint_profile(mod, HINT_PROFILE_LAUNCH, data != NULL);
+            break;
+        case FUGU_POWER_HINT_SUSTAINED_PERFORMANCE:
+            update_hint_profile(mod, HINT_PROFILE_SUSTAINED, data != NULL);
             break;
         case POWER_HINT_VSYNC:
             break;